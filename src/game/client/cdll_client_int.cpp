@@ -1907,6 +1907,7 @@ void CHLClient::ResetStringTablePointers()
 
 // @Deferred - Biohazard
 	g_pStringTable_LightCookies = NULL;
+	g_pStringTable_WorldLights = NULL;
 }
 
 //-----------------------------------------------------------------------------
@@ -2184,6 +2185,12 @@ void CHLClient::InstallStringTableCallback( const char *tableName )
 
 		g_pStringTable_LightCookies->SetStringChangedCallback( NULL, OnCookieTableChanged );
 	}
+	else if ( !Q_strcasecmp( tableName, WORLDLIGHTS_STRINGTBL_NAME ) )
+	{
+		g_pStringTable_WorldLights = networkstringtable->FindTable( tableName );
+
+		g_pStringTable_WorldLights->SetStringChangedCallback( NULL, OnWorldLightTableChanged );
+	}
 	else
 	{
 		// Pass tablename to gamerules last if all other checks fail
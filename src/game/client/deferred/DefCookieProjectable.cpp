@@ -1,25 +1,128 @@
-
 #include "cbase.h"
 #include "deferred/deferred_shared_common.h"
 
+CProjectableTargetCache::CProjectableTargetCache()
+{
+	Reset();
+}
+
+void CProjectableTargetCache::Reset()
+{
+	for ( int i = 0; i < NUM_PROJECTABLE_VGUI; i++ )
+	{
+		m_Targets[ i ].pOwner = NULL;
+		m_Targets[ i ].iBatch = -1;
+		m_Targets[ i ].iLastUse = 0;
+	}
+
+	m_iBatch = 0;
+	m_iUseCounter = 0;
+
+	ResetStats();
+}
+
+void CProjectableTargetCache::BeginBatch()
+{
+	m_iBatch++;
+}
+
+int CProjectableTargetCache::Acquire( const void *pOwner, bool &bHasContent )
+{
+	Assert( pOwner != NULL );
+
+	int iTarget = GetTarget( pOwner );
+	bHasContent = iTarget >= 0;
+
+	if ( iTarget < 0 )
+	{
+		// free targets have never been used, so the oldest one wins
+		for ( int i = 0; i < NUM_PROJECTABLE_VGUI; i++ )
+		{
+			if ( m_Targets[ i ].iBatch == m_iBatch )
+				continue;
+
+			if ( iTarget < 0 || m_Targets[ i ].iLastUse < m_Targets[ iTarget ].iLastUse )
+				iTarget = i;
+		}
+
+		if ( iTarget < 0 )
+			return -1;
+
+		m_Targets[ iTarget ].pOwner = pOwner;
+	}
+
+	m_Targets[ iTarget ].iBatch = m_iBatch;
+	m_Targets[ iTarget ].iLastUse = ++m_iUseCounter;
+	return iTarget;
+}
+
+void CProjectableTargetCache::Release( const void *pOwner )
+{
+	const int iTarget = GetTarget( pOwner );
+
+	if ( iTarget < 0 )
+		return;
+
+	m_Targets[ iTarget ].pOwner = NULL;
+	m_Targets[ iTarget ].iLastUse = 0;
+}
+
+int CProjectableTargetCache::GetTarget( const void *pOwner ) const
+{
+	for ( int i = 0; i < NUM_PROJECTABLE_VGUI; i++ )
+	{
+		if ( m_Targets[ i ].pOwner == pOwner )
+			return i;
+	}
+
+	return -1;
+}
+
+static CProjectableTargetCache g_ProjectableTargets;
+
+CProjectableTargetCache &CDefCookieProjectable::GetTargetCache()
+{
+	return g_ProjectableTargets;
+}
+
 CDefCookieProjectable::CDefCookieProjectable( CVGUIProjectable *pProjectable )
 {
 	Assert( pProjectable != NULL );
 
 	m_pProjectable = pProjectable;
+	m_iTarget = -1;
 }
 
 CDefCookieProjectable::~CDefCookieProjectable()
 {
-	delete m_pProjectable;
+	CProjectableFactory::ReleaseProjectable( m_pProjectable );
 }
 
 ITexture *CDefCookieProjectable::GetCookieTarget( const int iTargetIndex )
 {
-	return GetProjectableVguiRT( iTargetIndex );
+	return GetProjectableVguiRT( ( m_iTarget >= 0 ) ? m_iTarget : iTargetIndex );
 }
 
 void CDefCookieProjectable::PreRender( const int iTargetIndex )
 {
-	m_pProjectable->DrawSelfToRT( GetProjectableVguiRT( iTargetIndex ) );
-}
\ No newline at end of file
+	m_pProjectable->MarkUsed();
+
+	bool bHasContent;
+	m_iTarget = g_ProjectableTargets.Acquire( m_pProjectable, bHasContent );
+
+	// a batch never binds more cookies than there are targets
+	Assert( m_iTarget >= 0 );
+
+	if ( m_iTarget < 0 )
+		return;
+
+	// targets that were just assigned have to be painted even over the cap
+	if ( bHasContent && !m_pProjectable->IsRepaintGranted() )
+	{
+		g_ProjectableTargets.CountReuse();
+		return;
+	}
+
+	m_pProjectable->DrawSelfToRT( GetProjectableVguiRT( m_iTarget ) );
+	g_ProjectableTargets.CountRepaint();
+}
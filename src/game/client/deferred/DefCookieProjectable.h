@@ -5,6 +5,56 @@
 
 class CVGUIProjectable;
 
+/*
+ * Maps projectable panels to the projectable render targets. A panel keeps
+ * its target until it's evicted, so lights that project the same panel share
+ * it and a panel that didn't change isn't painted again. Targets bound in the
+ * current batch of lights are pinned, a batch never has more cookies than
+ * there are targets.
+ */
+class CProjectableTargetCache
+{
+public:
+
+	CProjectableTargetCache();
+
+	// drops all content, after a device reset or on level change
+	void Reset();
+
+	// the cookies of one light pass are about to be bound
+	void BeginBatch();
+
+	// pins the owner's target for this batch, bHasContent is false when the
+	// target was (re)assigned and has to be painted; -1 if all are pinned
+	int Acquire( const void *pOwner, bool &bHasContent );
+	void Release( const void *pOwner );
+
+	int GetTarget( const void *pOwner ) const;
+
+	FORCEINLINE void ResetStats() { m_iNumRepaints = m_iNumReused = 0; };
+	FORCEINLINE void CountRepaint() { m_iNumRepaints++; };
+	FORCEINLINE void CountReuse() { m_iNumReused++; };
+	FORCEINLINE int GetNumRepaints() const { return m_iNumRepaints; };
+	FORCEINLINE int GetNumReused() const { return m_iNumReused; };
+
+private:
+
+	struct target_t
+	{
+		const void *pOwner;
+		int iBatch;
+		int iLastUse;
+	};
+
+	target_t m_Targets[ NUM_PROJECTABLE_VGUI ];
+
+	int m_iBatch;
+	int m_iUseCounter;
+
+	int m_iNumRepaints;
+	int m_iNumReused;
+};
+
 class CDefCookieProjectable : public IDefCookie
 {
 public:
@@ -15,10 +65,13 @@ public:
 	virtual ITexture *GetCookieTarget( const int iTargetIndex );
 	virtual void PreRender( const int iTargetIndex );
 
+	static CProjectableTargetCache &GetTargetCache();
+
 private:
 
 	CVGUIProjectable *m_pProjectable;
+	int m_iTarget;
 };
 
 
-#endif
\ No newline at end of file
+#endif
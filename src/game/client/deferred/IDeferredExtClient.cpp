@@ -34,7 +34,8 @@ void ShutdownDeferredExt()
 	if ( !__g_defExt )
 		return;
 
-	delete [] __g_defExt->CommitLightData_Common( NULL, 0, 0, 0, 0, 0 );
+	// the light data itself is owned by the lighting manager
+	__g_defExt->CommitLightData_Common( NULL, 0, 0, 0, 0, 0 );
 
 	__g_defExt = NULL;
 }
\ No newline at end of file
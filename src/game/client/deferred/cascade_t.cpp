@@ -1,7 +1,9 @@
-
 #include "cbase.h"
 #include "deferred/deferred_shared_common.h"
 
+#include "filesystem.h"
+#include "KeyValues.h"
+
 
 static const cascade_t g_CascadeInfo[] = {
 	// res	orthosize	light offset	zFar		slopemin	slopemax	normalmax	renderdelay		rad		radcascade
@@ -18,13 +20,522 @@ static const cascade_t g_CascadeInfo[] = {
 #endif
 	},
 };
-static const int iNumCascades = ARRAYSIZE( g_CascadeInfo );
+static const int iNumDefaultCascades = ARRAYSIZE( g_CascadeInfo );
+
+#if CSM_USE_COMPOSITED_TARGET
+#define CSM_MAX_RESOLUTION MIN( CSM_COMP_RES_X, CSM_COMP_RES_Y )
+#else
+#define CSM_MAX_RESOLUTION 4096
+#endif
+
+static const char *g_pszSplitSchemes[] = {
+	"fixed",
+	"uniform",
+	"log",
+	"practical",
+};
+COMPILE_TIME_ASSERT( ARRAYSIZE( g_pszSplitSchemes ) == CSM_SPLIT_COUNT );
+
+
+CCascadeConfig::CCascadeConfig()
+{
+	SetDefaults();
+}
+
+void CCascadeConfig::SetDefaults()
+{
+	COMPILE_TIME_ASSERT( iNumDefaultCascades == SHADOW_NUM_CASCADES );
+
+	Q_memset( m_Cascades, 0, sizeof( m_Cascades ) );
+
+	for ( int i = 0; i < iNumDefaultCascades; i++ )
+		m_Cascades[ i ] = g_CascadeInfo[ i ];
+
+	m_iNumCascades = iNumDefaultCascades;
+
+	m_iSplitScheme = CSM_SPLIT_FIXED;
+	m_flSplitLambda = 0.75f;
+	m_flSplitNear = 16.0f;
+	m_flShadowDistance = 4096.0f;
+}
+
+bool CCascadeConfig::LoadFromFile( const char *pszFilename )
+{
+	KeyValues *pKV = new KeyValues( "DeferredCascades" );
+	const bool bSuccess = pKV->LoadFromFile( g_pFullFileSystem, pszFilename );
+
+	if ( bSuccess )
+		LoadFromKeyValues( pKV );
+
+	pKV->deleteThis();
+	return bSuccess;
+}
+
+void CCascadeConfig::LoadFromKeyValues( KeyValues *pKV, int iMaxCascades )
+{
+	SetDefaults();
+
+	const char *pszSplit = pKV->GetString( "split", g_pszSplitSchemes[ CSM_SPLIT_FIXED ] );
+	m_iSplitScheme = -1;
+
+	for ( int i = 0; i < CSM_SPLIT_COUNT; i++ )
+	{
+		if ( !Q_stricmp( pszSplit, g_pszSplitSchemes[ i ] ) )
+			m_iSplitScheme = i;
+	}
+
+	if ( m_iSplitScheme < 0 )
+	{
+		Warning( "Unknown cascade split scheme '%s'.\n", pszSplit );
+		m_iSplitScheme = CSM_SPLIT_FIXED;
+	}
+
+	m_flSplitLambda = clamp( pKV->GetFloat( "lambda", m_flSplitLambda ), 0.0f, 1.0f );
+	m_flSplitNear = MAX( 1.0f, pKV->GetFloat( "near", m_flSplitNear ) );
+	m_flShadowDistance = MAX( m_flSplitNear + 1.0f, pKV->GetFloat( "distance", m_flShadowDistance ) );
+
+	int iNumCascades = 0;
+
+	for ( KeyValues *pCascade = pKV->GetFirstTrueSubKey(); pCascade; pCascade = pCascade->GetNextTrueSubKey() )
+	{
+		if ( Q_stricmp( pCascade->GetName(), "cascade" ) )
+			continue;
+
+		if ( iNumCascades >= CSM_MAX_CASCADES )
+		{
+			Warning( "Too many cascades in config, max is %i.\n", CSM_MAX_CASCADES );
+			break;
+		}
+
+		// unset values continue the last cascade
+		cascade_t &c = m_Cascades[ iNumCascades ];
+		c = m_Cascades[ MAX( 0, MIN( iNumCascades, iNumDefaultCascades - 1 ) ) ];
+
+		c.iResolution = SmallestPowerOfTwoGreaterOrEqual( clamp( pCascade->GetInt( "resolution", c.iResolution ),
+			CSM_MIN_RESOLUTION, CSM_MAX_RESOLUTION ) );
+		c.flProjectionSize = pCascade->GetFloat( "size", c.flProjectionSize );
+		c.flOriginOffset = pCascade->GetFloat( "offset", c.flOriginOffset );
+		c.flFarZ = pCascade->GetFloat( "zfar", c.flFarZ );
+		c.flSlopeScaleMin = pCascade->GetFloat( "slope_min", c.flSlopeScaleMin );
+		c.flSlopeScaleMax = pCascade->GetFloat( "slope_max", c.flSlopeScaleMax );
+		c.flNormalScaleMax = pCascade->GetFloat( "normal_max", c.flNormalScaleMax );
+		c.flUpdateDelay = pCascade->GetFloat( "delay", c.flUpdateDelay );
+		c.bOutputRadiosityData = pCascade->GetBool( "radiosity", c.bOutputRadiosityData );
+		c.iRadiosityCascadeTarget = clamp( pCascade->GetInt( "radiosity_target", c.iRadiosityCascadeTarget ), 0, 1 );
+
+		iNumCascades++;
+	}
+
+	if ( iNumCascades < 2 )
+	{
+		Warning( "Cascade config needs at least two cascades, using defaults.\n" );
+		SetDefaults();
+		return;
+	}
+
+	if ( iNumCascades > iMaxCascades )
+	{
+		Warning( "Shaders are built for %i cascades, dropping %i.\n",
+			iMaxCascades, iNumCascades - iMaxCascades );
+		iNumCascades = iMaxCascades;
+	}
+
+	m_iNumCascades = iNumCascades;
+
+#if CSM_USE_COMPOSITED_TARGET
+	PackAtlas( CSM_COMP_RES_X, CSM_COMP_RES_Y );
+#endif
+}
+
+void CCascadeConfig::CalcSplitDistances( int iScheme, float flLambda,
+	float flNear, float flFar, int iNumSplits, float *pflSplits )
+{
+	Assert( flNear > 0.0f && flFar > flNear );
+
+	if ( iScheme == CSM_SPLIT_UNIFORM )
+		flLambda = 0.0f;
+	else if ( iScheme == CSM_SPLIT_LOG )
+		flLambda = 1.0f;
+
+	pflSplits[ 0 ] = flNear;
+
+	for ( int i = 1; i < iNumSplits; i++ )
+	{
+		const float flFraction = i / (float)iNumSplits;
+		const float flLog = flNear * pow( flFar / flNear, flFraction );
+		const float flUniform = flNear + ( flFar - flNear ) * flFraction;
+
+		pflSplits[ i ] = Lerp( flLambda, flUniform, flLog );
+	}
+
+	pflSplits[ iNumSplits ] = flFar;
+}
+
+void CCascadeConfig::CalcSplits( float flViewZNear, float *pflSplits ) const
+{
+	const float flNear = MAX( flViewZNear, m_flSplitNear );
+
+	CalcSplitDistances( m_iSplitScheme, m_flSplitLambda, flNear,
+		MAX( flNear + 1.0f, m_flShadowDistance ), m_iNumCascades, pflSplits );
+}
+
+void CCascadeConfig::CalcSliceBoundingSphere( float flTanX, float flTanY,
+	float flSliceNear, float flSliceFar, float &flCenterDist, float &flRadius )
+{
+	// squared distance of the slice corners from the view axis per unit depth
+	const float flCornerSqr = flTanX * flTanX + flTanY * flTanY;
+
+	// equidistant to the near and far corners, can't be past the far plane
+	flCenterDist = MIN( flSliceFar, ( flSliceNear + flSliceFar ) * ( 1.0f + flCornerSqr ) * 0.5f );
+
+	const float flNearSqr = Square( flCenterDist - flSliceNear ) + Square( flSliceNear ) * flCornerSqr;
+	const float flFarSqr = Square( flSliceFar - flCenterDist ) + Square( flSliceFar ) * flCornerSqr;
+
+	flRadius = FastSqrt( MAX( flNearSqr, flFarSqr ) );
+}
+
+void CCascadeConfig::CalcFit( const cascade_t &cascade,
+	const Vector &vecViewOrigin, const QAngle &angView, float flFovX, float flAspectRatio,
+	float flSliceNear, float flSliceFar, const QAngle &angLight, cascadeFit_t &fit )
+{
+	const float flTanX = tan( DEG2RAD( flFovX * 0.5f ) );
+	const float flTanY = flTanX / MAX( 0.01f, flAspectRatio );
+
+	float flCenterDist;
+	CalcSliceBoundingSphere( flTanX, flTanY, flSliceNear, flSliceFar, flCenterDist, fit.flRadius );
+
+	Vector vecViewFwd;
+	AngleVectors( angView, &vecViewFwd );
+	fit.vecCenter = vecViewOrigin + vecViewFwd * flCenterDist;
+
+	Vector vecFwd, vecRight, vecUp;
+	AngleVectors( angLight, &vecFwd, &vecRight, &vecUp );
+
+	// the sphere doesn't change with the view angles, so snapping
+	// its center to texels is all it takes to keep the shadow still
+	fit.flProjectionSize = fit.flRadius * 2.0f;
+	const float flTexel = fit.flProjectionSize / cascade.iResolution;
+
+	const float flRight = DotProduct( fit.vecCenter, vecRight );
+	const float flUp = DotProduct( fit.vecCenter, vecUp );
+
+	fit.vecCenter += vecRight * ( floor( flRight / flTexel ) * flTexel - flRight );
+	fit.vecCenter += vecUp * ( floor( flUp / flTexel ) * flTexel - flUp );
+
+	// the view origin is the top left corner of the ortho projection
+	const float flOriginOffset = MAX( cascade.flOriginOffset, fit.flRadius );
+	fit.vecOrigin = fit.vecCenter - vecFwd * flOriginOffset
+		+ vecUp * fit.flRadius - vecRight * fit.flRadius;
+
+	fit.flFarZ = MAX( cascade.flFarZ, flOriginOffset + fit.flRadius );
+}
+
+void CCascadeConfig::CalcCascadeBounds( int index, const Vector &vecViewOrigin, const QAngle &angView,
+	float flViewZNear, float flFovX, float flAspectRatio, Vector &vecCenter, float &flProjectionSize ) const
+{
+	const cascade_t &cascade = GetCascade( index );
+
+	Vector vecViewFwd;
+	AngleVectors( angView, &vecViewFwd );
+
+	if ( m_iSplitScheme == CSM_SPLIT_FIXED )
+	{
+		flProjectionSize = cascade.flProjectionSize;
+		vecCenter = vecViewOrigin + vecViewFwd * flProjectionSize * 0.5f;
+		return;
+	}
+
+	float flSplits[ CSM_MAX_CASCADES + 1 ];
+	CalcSplits( flViewZNear, flSplits );
+
+	const float flTanX = tan( DEG2RAD( flFovX * 0.5f ) );
+	const float flTanY = flTanX / MAX( 0.01f, flAspectRatio );
 
+	float flCenterDist, flRadius;
+	CalcSliceBoundingSphere( flTanX, flTanY, flSplits[ index ], flSplits[ index + 1 ], flCenterDist, flRadius );
+
+	flProjectionSize = flRadius * 2.0f;
+	vecCenter = vecViewOrigin + vecViewFwd * flCenterDist;
+}
+
+bool CCascadeConfig::TryPackAtlas( int iAtlasSizeX, int iAtlasSizeY )
+{
+#if CSM_USE_COMPOSITED_TARGET
+	int iOrder[ CSM_MAX_CASCADES ];
+	for ( int i = 0; i < m_iNumCascades; i++ )
+		iOrder[ i ] = i;
+
+	// largest first, stable so the layout is deterministic
+	for ( int i = 1; i < m_iNumCascades; i++ )
+	{
+		for ( int j = i; j > 0 && m_Cascades[ iOrder[ j ] ].iResolution > m_Cascades[ iOrder[ j - 1 ] ].iResolution; j-- )
+			V_swap( iOrder[ j ], iOrder[ j - 1 ] );
+	}
+
+	int x = 0;
+	int y = 0;
+	int iShelfHeight = 0;
+
+	for ( int i = 0; i < m_iNumCascades; i++ )
+	{
+		cascade_t &c = m_Cascades[ iOrder[ i ] ];
+
+		if ( x + c.iResolution > iAtlasSizeX )
+		{
+			x = 0;
+			y += iShelfHeight;
+			iShelfHeight = 0;
+		}
+
+		if ( x + c.iResolution > iAtlasSizeX || y + c.iResolution > iAtlasSizeY )
+			return false;
+
+		c.iViewport_x = x;
+		c.iViewport_y = y;
+
+		x += c.iResolution;
+		iShelfHeight = MAX( iShelfHeight, c.iResolution );
+	}
+#endif
+
+	return true;
+}
+
+bool CCascadeConfig::PackAtlas( int iAtlasSizeX, int iAtlasSizeY )
+{
+	while ( !TryPackAtlas( iAtlasSizeX, iAtlasSizeY ) )
+	{
+		// halve the largest cascade, far ones first
+		int iLargest = -1;
+		for ( int i = m_iNumCascades - 1; i >= 0; i-- )
+		{
+			if ( iLargest < 0 || m_Cascades[ i ].iResolution > m_Cascades[ iLargest ].iResolution )
+				iLargest = i;
+		}
+
+		if ( m_Cascades[ iLargest ].iResolution <= CSM_MIN_RESOLUTION )
+		{
+			Warning( "Can't fit %i cascades into a %ix%i shadow target.\n", m_iNumCascades, iAtlasSizeX, iAtlasSizeY );
+			return false;
+		}
+
+		m_Cascades[ iLargest ].iResolution /= 2;
+		Warning( "Cascade %i doesn't fit into the shadow target, lowered to %i.\n",
+			iLargest, m_Cascades[ iLargest ].iResolution );
+	}
+
+	return true;
+}
+
+void CCascadeConfig::Print() const
+{
+	Msg( "%i cascades, split %s, lambda %.2f, near %.1f, distance %.1f\n", m_iNumCascades,
+		g_pszSplitSchemes[ m_iSplitScheme ], m_flSplitLambda, m_flSplitNear, m_flShadowDistance );
+
+	float flSplits[ CSM_MAX_CASCADES + 1 ];
+	if ( m_iSplitScheme != CSM_SPLIT_FIXED )
+		CalcSplits( 7.0f, flSplits );
+
+	for ( int i = 0; i < m_iNumCascades; i++ )
+	{
+		const cascade_t &c = m_Cascades[ i ];
+
+		Msg( "  %i: res %i", i, c.iResolution );
+#if CSM_USE_COMPOSITED_TARGET
+		Msg( " at %i/%i", c.iViewport_x, c.iViewport_y );
+#endif
+		if ( m_iSplitScheme == CSM_SPLIT_FIXED )
+			Msg( ", size %.1f", c.flProjectionSize );
+		else
+			Msg( ", slice %.1f - %.1f", flSplits[ i ], flSplits[ i + 1 ] );
+		Msg( ", delay %.2f, radiosity %i\n", c.flUpdateDelay, c.bOutputRadiosityData ? 1 : 0 );
+	}
+}
+
+static CCascadeConfig __g_cascadeConfig;
+static bool s_bCascadeConfigLoaded = false;
+
+CCascadeConfig *GetCascadeConfig()
+{
+	if ( !s_bCascadeConfigLoaded )
+	{
+		s_bCascadeConfigLoaded = true;
+		__g_cascadeConfig.LoadFromFile( PATHLOCATION_CASCADE_SCRIPT );
+	}
+
+	return &__g_cascadeConfig;
+}
 
 const cascade_t &GetCascadeInfo( int index )
 {
-	Assert( index >= 0 && index < iNumCascades );
-	COMPILE_TIME_ASSERT( iNumCascades == SHADOW_NUM_CASCADES );
+	return GetCascadeConfig()->GetCascade( index );
+}
+
+CON_COMMAND( deferred_cascades_reload, "Reloads the cascade config script." )
+{
+	if ( !GetCascadeConfig()->LoadFromFile( PATHLOCATION_CASCADE_SCRIPT ) )
+		Warning( "Can't load %s, keeping the current config.\n", PATHLOCATION_CASCADE_SCRIPT );
+
+	GetCascadeConfig()->Print();
+}
 
-	return g_CascadeInfo[ index ];
+CON_COMMAND( deferred_cascades_print, "Prints the cascade config." )
+{
+	GetCascadeConfig()->Print();
+}
+
+CON_COMMAND( deferred_cascades_test, "Validates split, fitting and packing math with synthetic views." )
+{
+	int iSplitFailures = 0;
+
+	// splits are ordered, end at the range and blend as documented
+	for ( int iNumSplits = 2; iNumSplits <= CSM_MAX_CASCADES; iNumSplits++ )
+	{
+		float flUniform[ CSM_MAX_CASCADES + 1 ], flLog[ CSM_MAX_CASCADES + 1 ];
+		float flPractical0[ CSM_MAX_CASCADES + 1 ], flPractical1[ CSM_MAX_CASCADES + 1 ];
+
+		CCascadeConfig::CalcSplitDistances( CSM_SPLIT_UNIFORM, 0.5f, 8.0f, 4096.0f, iNumSplits, flUniform );
+		CCascadeConfig::CalcSplitDistances( CSM_SPLIT_LOG, 0.5f, 8.0f, 4096.0f, iNumSplits, flLog );
+		CCascadeConfig::CalcSplitDistances( CSM_SPLIT_PRACTICAL, 0.0f, 8.0f, 4096.0f, iNumSplits, flPractical0 );
+		CCascadeConfig::CalcSplitDistances( CSM_SPLIT_PRACTICAL, 1.0f, 8.0f, 4096.0f, iNumSplits, flPractical1 );
+
+		for ( int i = 0; i <= iNumSplits; i++ )
+		{
+			if ( i > 0 && ( flUniform[ i ] <= flUniform[ i - 1 ] || flLog[ i ] <= flLog[ i - 1 ] ) )
+				iSplitFailures++;
+
+			if ( fabs( flPractical0[ i ] - flUniform[ i ] ) > 0.01f || fabs( flPractical1[ i ] - flLog[ i ] ) > 0.01f )
+				iSplitFailures++;
+		}
+
+		if ( flLog[ 0 ] != 8.0f || flLog[ iNumSplits ] != 4096.0f )
+			iSplitFailures++;
+	}
+
+	if ( iSplitFailures > 0 )
+		Warning( "split distances: %i bad splits\n", iSplitFailures );
+
+	// every slice corner lands inside the fitted projection
+	CUniformRandomStream rnd;
+	rnd.SetSeed( 1 );
+
+	cascade_t cascade = GetCascadeInfo( 0 );
+	int iFitFailures = 0;
+	int iSwimFailures = 0;
+
+	for ( int iTest = 0; iTest < 1000; iTest++ )
+	{
+		const Vector vecView( rnd.RandomFloat( -8192, 8192 ), rnd.RandomFloat( -8192, 8192 ), rnd.RandomFloat( -2048, 2048 ) );
+		const QAngle angView( rnd.RandomFloat( -89, 89 ), rnd.RandomFloat( 0, 360 ), 0 );
+		const QAngle angLight( rnd.RandomFloat( 20, 89 ), rnd.RandomFloat( 0, 360 ), 0 );
+		const float flFov = rnd.RandomFloat( 60, 110 );
+		const float flAspect = rnd.RandomFloat( 1.25f, 2.4f );
+		const float flNear = rnd.RandomFloat( 8, 512 );
+		const float flFar = flNear + rnd.RandomFloat( 64, 4096 );
+
+		cascade.iResolution = 256 << rnd.RandomInt( 0, 3 );
+
+		cascadeFit_t fit;
+		CCascadeConfig::CalcFit( cascade, vecView, angView, flFov, flAspect, flNear, flFar, angLight, fit );
+
+		Vector vecFwd, vecRight, vecUp;
+		AngleVectors( angLight, &vecFwd, &vecRight, &vecUp );
+
+		Vector vecViewFwd, vecViewRight, vecViewUp;
+		AngleVectors( angView, &vecViewFwd, &vecViewRight, &vecViewUp );
+
+		const float flTanX = tan( DEG2RAD( flFov * 0.5f ) );
+		const float flTanY = flTanX / flAspect;
+
+		for ( int iCorner = 0; iCorner < 8; iCorner++ )
+		{
+			const float flDist = ( iCorner & 4 ) ? flFar : flNear;
+			const Vector vecCorner = vecView + vecViewFwd * flDist
+				+ vecViewRight * flDist * flTanX * ( ( iCorner & 1 ) ? 1 : -1 )
+				+ vecViewUp * flDist * flTanY * ( ( iCorner & 2 ) ? 1 : -1 );
+
+			const Vector vecLocal = vecCorner - fit.vecOrigin;
+			const float x = DotProduct( vecLocal, vecRight );
+			const float y = DotProduct( vecLocal, vecUp );
+			const float z = DotProduct( vecLocal, vecFwd );
+
+			const float flEpsilon = 0.01f * fit.flProjectionSize;
+
+			if ( x < -flEpsilon || x > fit.flProjectionSize + flEpsilon ||
+				y > flEpsilon || y < -fit.flProjectionSize - flEpsilon ||
+				z < 0 || z > fit.flFarZ )
+			{
+				iFitFailures++;
+				break;
+			}
+		}
+
+		// turning the view or moving it by a fraction of a texel moves the
+		// projection by whole texels only
+		cascadeFit_t fitMoved;
+		const QAngle angTurned( angView.x * 0.5f, angView.y + rnd.RandomFloat( -180, 180 ), 0 );
+		const Vector vecMoved = vecView + RandomVector( -1, 1 ) * ( fit.flProjectionSize / cascade.iResolution );
+		CCascadeConfig::CalcFit( cascade, vecMoved, angTurned, flFov, flAspect, flNear, flFar, angLight, fitMoved );
+
+		const float flTexel = fit.flProjectionSize / cascade.iResolution;
+		const float flMovedX = DotProduct( fitMoved.vecOrigin - fit.vecOrigin, vecRight ) / flTexel;
+		const float flMovedY = DotProduct( fitMoved.vecOrigin - fit.vecOrigin, vecUp ) / flTexel;
+
+		if ( fitMoved.flProjectionSize != fit.flProjectionSize ||
+			fabs( flMovedX - RoundFloatToInt( flMovedX ) ) > 0.01f ||
+			fabs( flMovedY - RoundFloatToInt( flMovedY ) ) > 0.01f )
+			iSwimFailures++;
+	}
+
+	if ( iFitFailures > 0 )
+		Warning( "slice fitting: %i of 1000 views not covered\n", iFitFailures );
+	if ( iSwimFailures > 0 )
+		Warning( "texel snapping: %i of 1000 views swim\n", iSwimFailures );
+
+#if CSM_USE_COMPOSITED_TARGET
+	int iPackFailures = 0;
+
+	// packed viewports stay inside the target and don't overlap
+	for ( int iNumCascades = 2; iNumCascades <= CSM_MAX_CASCADES; iNumCascades++ )
+	{
+		KeyValues *pKV = new KeyValues( "DeferredCascades" );
+		pKV->SetString( "split", "practical" );
+
+		for ( int i = 0; i < iNumCascades; i++ )
+		{
+			KeyValues *pCascade = new KeyValues( "cascade" );
+			pCascade->SetInt( "resolution", 2048 >> ( i / 2 ) );
+			pKV->AddSubKey( pCascade );
+		}
+
+		CCascadeConfig config;
+		config.LoadFromKeyValues( pKV, CSM_MAX_CASCADES );
+		pKV->deleteThis();
+
+		if ( !config.PackAtlas( CSM_COMP_RES_X, CSM_COMP_RES_Y ) )
+			iPackFailures++;
+
+		for ( int i = 0; i < config.GetNumCascades(); i++ )
+		{
+			const cascade_t &a = config.GetCascade( i );
+
+			if ( a.iViewport_x < 0 || a.iViewport_y < 0 ||
+				a.iViewport_x + a.iResolution > CSM_COMP_RES_X ||
+				a.iViewport_y + a.iResolution > CSM_COMP_RES_Y )
+				iPackFailures++;
+
+			for ( int j = i + 1; j < config.GetNumCascades(); j++ )
+			{
+				const cascade_t &b = config.GetCascade( j );
+
+				if ( a.iViewport_x < b.iViewport_x + b.iResolution && b.iViewport_x < a.iViewport_x + a.iResolution &&
+					a.iViewport_y < b.iViewport_y + b.iResolution && b.iViewport_y < a.iViewport_y + a.iResolution )
+					iPackFailures++;
+			}
+		}
+	}
+
+	if ( iPackFailures > 0 )
+		Warning( "atlas packing: %i misplaced viewports\n", iPackFailures );
+#endif
 }
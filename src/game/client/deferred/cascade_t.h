@@ -3,6 +3,23 @@
 
 #include "deferred/deferred_shared_common.h"
 
+class KeyValues;
+
+#define CSM_MAX_CASCADES 6
+#define CSM_MIN_RESOLUTION 256
+
+#define PATHLOCATION_CASCADE_SCRIPT "scripts/deferred_cascades.txt"
+
+enum
+{
+	CSM_SPLIT_FIXED = 0,	// projection size and offset from the script
+	CSM_SPLIT_UNIFORM,
+	CSM_SPLIT_LOG,
+	CSM_SPLIT_PRACTICAL,	// blends log and uniform by the split lambda
+
+	CSM_SPLIT_COUNT,
+};
+
 struct cascade_t
 {
 	int iResolution;
@@ -25,7 +42,85 @@ struct cascade_t
 #endif
 };
 
+// ortho light view covering one slice of the view frustum
+struct cascadeFit_t
+{
+	Vector vecOrigin;
+	float flProjectionSize;
+	float flFarZ;
+
+	// bounding sphere of the slice
+	Vector vecCenter;
+	float flRadius;
+};
+
+/*
+ * Cascade layout of the global light shadows, loaded from
+ * PATHLOCATION_CASCADE_SCRIPT. Split schemes other than fixed fit every
+ * cascade to a slice of the view frustum. The fit uses the bounding sphere
+ * of the slice and snaps it to whole texels, so the shadow doesn't swim
+ * while the camera turns or moves.
+ *
+ * The projection shaders sample SHADOW_NUM_CASCADES cascades, configs with
+ * more are clamped to that.
+ */
+class CCascadeConfig
+{
+public:
+
+	CCascadeConfig();
+
+	void SetDefaults();
+	bool LoadFromFile( const char *pszFilename );
+	// the shaders can't sample more than SHADOW_NUM_CASCADES
+	void LoadFromKeyValues( KeyValues *pKV, int iMaxCascades = SHADOW_NUM_CASCADES );
+
+	FORCEINLINE int GetNumCascades() const { return m_iNumCascades; };
+	FORCEINLINE const cascade_t &GetCascade( int index ) const
+	{
+		Assert( index >= 0 && index < m_iNumCascades );
+		return m_Cascades[ index ];
+	};
+
+	FORCEINLINE int GetSplitScheme() const { return m_iSplitScheme; };
+
+	// fills GetNumCascades() + 1 distances along the view
+	void CalcSplits( float flViewZNear, float *pflSplits ) const;
+	static void CalcSplitDistances( int iScheme, float flLambda,
+		float flNear, float flFar, int iNumSplits, float *pflSplits );
+
+	static void CalcFit( const cascade_t &cascade,
+		const Vector &vecViewOrigin, const QAngle &angView, float flFovX, float flAspectRatio,
+		float flSliceNear, float flSliceFar, const QAngle &angLight, cascadeFit_t &fit );
+
+	// unsnapped center and size of the area a cascade covers
+	void CalcCascadeBounds( int index, const Vector &vecViewOrigin, const QAngle &angView,
+		float flViewZNear, float flFovX, float flAspectRatio, Vector &vecCenter, float &flProjectionSize ) const;
+
+	static void CalcSliceBoundingSphere( float flTanX, float flTanY,
+		float flSliceNear, float flSliceFar, float &flCenterDist, float &flRadius );
+
+	// assigns viewports in the composited target, lowers resolutions that don't fit
+	bool PackAtlas( int iAtlasSizeX, int iAtlasSizeY );
+
+	void Print() const;
+
+private:
+
+	bool TryPackAtlas( int iAtlasSizeX, int iAtlasSizeY );
+
+	cascade_t m_Cascades[ CSM_MAX_CASCADES ];
+	int m_iNumCascades;
+
+	int m_iSplitScheme;
+	float m_flSplitLambda;
+	float m_flSplitNear;
+	float m_flShadowDistance;
+};
+
+CCascadeConfig *GetCascadeConfig();
+
 const cascade_t &GetCascadeInfo( int index );
 
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,54 @@
+
+#include "cbase.h"
+#include "deferred/deferred_shared_common.h"
+
+static CDeferredPipelineConfig __g_defPipeline;
+CDeferredPipelineConfig *GetDeferredPipeline()
+{
+	return &__g_defPipeline;
+}
+
+CDeferredPipelineConfig::CDeferredPipelineConfig()
+{
+	m_bExtraSort = DEFCFG_EXTRA_SORT != 0;
+	m_bSIMDCulling = DEFCFG_USE_SSE != 0;
+	m_iVolumetricLOD = DEFPIPE_VOLUMLOD_PER_LIGHT;
+}
+
+void CDeferredPipelineConfig::Update()
+{
+	m_bExtraSort = deferred_pipeline_extrasort.GetBool();
+
+#if DEFCFG_USE_SSE
+	m_bSIMDCulling = deferred_pipeline_simd.GetBool() && GetCPUInformation().m_bSSE2;
+#else
+	m_bSIMDCulling = false;
+#endif
+
+#if DEFCFG_CONFIGURABLE_VOLUMETRIC_LOD
+	m_iVolumetricLOD = clamp( deferred_pipeline_volumetric_lod.GetInt(), 0, DEFPIPE_VOLUMLOD_COUNT - 1 );
+#else
+	m_iVolumetricLOD = DEFPIPE_VOLUMLOD_PER_LIGHT;
+#endif
+}
+
+void CDeferredPipelineConfig::Print() const
+{
+	static const char *pszVolumetricLOD[] = {
+		"per light",
+		"distance",
+	};
+	COMPILE_TIME_ASSERT( ARRAYSIZE( pszVolumetricLOD ) == DEFPIPE_VOLUMLOD_COUNT );
+
+	Msg( "extra sort: %s\n", m_bExtraSort ? "on" : "off" );
+	Msg( "simd culling: %s%s\n", m_bSIMDCulling ? "on" : "off", DEFCFG_USE_SSE ? "" : " (not compiled)" );
+	Msg( "volumetric lod: %s%s\n", pszVolumetricLOD[ m_iVolumetricLOD ],
+		DEFCFG_CONFIGURABLE_VOLUMETRIC_LOD ? "" : " (not compiled)" );
+	Msg( "light accum compressed: %i, shadow mapping method: %i (compile time)\n",
+		DEFCFG_LIGHTACCUM_COMPRESSED, SHADOWMAPPING_METHOD );
+}
+
+CON_COMMAND( deferred_pipeline_print, "Prints the light pipeline variant in use." )
+{
+	GetDeferredPipeline()->Print();
+}
@@ -0,0 +1,45 @@
+#ifndef C_DEFERRED_PIPELINE_H
+#define C_DEFERRED_PIPELINE_H
+
+#include "cbase.h"
+
+enum
+{
+	DEFPIPE_VOLUMLOD_PER_LIGHT = 0,	// samples as set on the light
+	DEFPIPE_VOLUMLOD_DISTANCE,		// samples halve with every distance band
+
+	DEFPIPE_VOLUMLOD_COUNT,
+};
+
+/*
+ * CPU side variants of the light pipeline that used to be DEFCFG
+ * switches. The DEFCFG values are the defaults, the convars are latched
+ * when the lights are set up so the lists of a frame are always built and
+ * drawn by the same variant. Switches that change shaders or render target
+ * formats stay compile time.
+ */
+class CDeferredPipelineConfig
+{
+public:
+
+	CDeferredPipelineConfig();
+
+	void Update();
+	void Print() const;
+
+	// split simple and advanced lights while sorting, simple world lights share render state
+	FORCEINLINE bool UseExtraSort() const { return m_bExtraSort; };
+	// cull four lights at once from the light store
+	FORCEINLINE bool UseSIMDCulling() const { return m_bSIMDCulling; };
+	FORCEINLINE int GetVolumetricLOD() const { return m_iVolumetricLOD; };
+
+private:
+
+	bool m_bExtraSort;
+	bool m_bSIMDCulling;
+	int m_iVolumetricLOD;
+};
+
+extern CDeferredPipelineConfig *GetDeferredPipeline();
+
+#endif
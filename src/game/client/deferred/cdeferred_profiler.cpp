@@ -0,0 +1,235 @@
+
+#include "cbase.h"
+#include "deferred/deferred_shared_common.h"
+
+#include "filesystem.h"
+
+static CDeferredProfiler __g_defProfiler;
+CDeferredProfiler *GetDeferredProfiler()
+{
+	return &__g_defProfiler;
+}
+
+static const char *s_pszPassNames[] =
+{
+	"gbuffer",
+	"lighting",
+	"cascades",
+	"shadowviews",
+	"radiosity_begin",
+	"radiosity_propagate",
+	"radiosity_end",
+	"volumetrics",
+	"composite",
+};
+COMPILE_TIME_ASSERT( ARRAYSIZE( s_pszPassNames ) == DEFPROF_COUNT );
+
+CDeferredProfiler::CDeferredProfiler()
+{
+	Reset();
+}
+
+void CDeferredProfiler::Reset()
+{
+	Q_memset( m_Frames, 0, sizeof( m_Frames ) );
+	Q_memset( m_iPassDepth, 0, sizeof( m_iPassDepth ) );
+	Q_memset( m_flRenderStart, 0, sizeof( m_flRenderStart ) );
+
+	m_iNumFrames = 0;
+	m_iCurrentFrame = -1;
+}
+
+const char *CDeferredProfiler::GetPassName( int iPass )
+{
+	Assert( iPass >= 0 && iPass < DEFPROF_COUNT );
+	return s_pszPassNames[ iPass ];
+}
+
+void CDeferredProfiler::BeginFrame( int iFrame )
+{
+	// the render thread closes the previous frame after its last pass
+	if ( m_iNumFrames > 0 )
+		QueueStamp( -1, true );
+
+	m_iCurrentFrame = iFrame;
+	m_iNumFrames++;
+
+	defProfFrame_t &frame = m_Frames[ ( m_iNumFrames - 1 ) % DEFPROF_HISTORY ];
+	Q_memset( &frame, 0, sizeof( frame ) );
+	frame.iFrame = iFrame;
+	frame.flFrameTime = gpGlobals->absoluteframetime * 1000.0f;
+}
+
+void CDeferredProfiler::QueueStamp( int iPass, bool bEnd )
+{
+	renderStamp_t data;
+	data.iSlot = ( m_iNumFrames - 1 ) % DEFPROF_HISTORY;
+	data.iPass = iPass;
+	data.bEnd = bEnd;
+	QUEUE_FIRE( renderStamp_t, Fire, data );
+}
+
+void CDeferredProfiler::renderStamp_t::Fire( renderStamp_t d )
+{
+	GetDeferredProfiler()->OnRenderStamp( d );
+}
+
+void CDeferredProfiler::OnRenderStamp( const renderStamp_t &d )
+{
+	defProfFrame_t &frame = m_Frames[ d.iSlot ];
+
+	if ( d.iPass < 0 )
+	{
+		frame.bComplete = true;
+		return;
+	}
+
+	const double flTime = Plat_FloatTime();
+
+	if ( d.bEnd )
+		frame.flRenderThread[ d.iPass ] += ( flTime - m_flRenderStart[ d.iPass ] ) * 1000.0;
+	else
+		m_flRenderStart[ d.iPass ] = flTime;
+}
+
+void CDeferredProfiler::BeginPass( int iPass )
+{
+	if ( !deferred_profile.GetBool() )
+		return;
+
+	if ( m_iCurrentFrame != gpGlobals->framecount )
+		BeginFrame( gpGlobals->framecount );
+
+	m_Frames[ ( m_iNumFrames - 1 ) % DEFPROF_HISTORY ].iCalls[ iPass ]++;
+
+	// recursion is timed by the outermost scope
+	if ( m_iPassDepth[ iPass ]++ > 0 )
+		return;
+
+	m_PassTimer[ iPass ].Start();
+	QueueStamp( iPass, false );
+}
+
+void CDeferredProfiler::EndPass( int iPass )
+{
+	// profiling was toggled inside the pass
+	if ( m_iPassDepth[ iPass ] == 0 )
+		return;
+
+	if ( --m_iPassDepth[ iPass ] > 0 )
+		return;
+
+	m_PassTimer[ iPass ].End();
+	m_Frames[ ( m_iNumFrames - 1 ) % DEFPROF_HISTORY ].flCPU[ iPass ] +=
+		m_PassTimer[ iPass ].GetDuration().GetMillisecondsF();
+	QueueStamp( iPass, true );
+}
+
+int CDeferredProfiler::GetNumPendingFrames() const
+{
+	const int iNumFrames = MIN( m_iNumFrames, DEFPROF_HISTORY );
+	int iPending = 0;
+
+	// the render thread lags behind by a frame or two
+	while ( iPending < iNumFrames && !m_Frames[ ( m_iNumFrames - 1 - iPending ) % DEFPROF_HISTORY ].bComplete )
+		iPending++;
+
+	return iPending;
+}
+
+int CDeferredProfiler::GetNumFrames() const
+{
+	return MIN( m_iNumFrames, DEFPROF_HISTORY ) - GetNumPendingFrames();
+}
+
+const defProfFrame_t &CDeferredProfiler::GetFrame( int iAge ) const
+{
+	Assert( iAge >= 0 && iAge < GetNumFrames() );
+
+	return m_Frames[ ( m_iNumFrames - 1 - GetNumPendingFrames() - iAge ) % DEFPROF_HISTORY ];
+}
+
+bool CDeferredProfiler::DumpCSV( const char *pszFilename ) const
+{
+	FileHandle_t hFile = g_pFullFileSystem->Open( pszFilename, "w", "GAME" );
+
+	if ( hFile == FILESYSTEM_INVALID_HANDLE )
+		return false;
+
+	g_pFullFileSystem->FPrintf( hFile, "frame,frametime_ms" );
+	for ( int i = 0; i < DEFPROF_COUNT; i++ )
+		g_pFullFileSystem->FPrintf( hFile, ",%s_cpu_ms,%s_rt_ms,%s_calls",
+			GetPassName( i ), GetPassName( i ), GetPassName( i ) );
+	g_pFullFileSystem->FPrintf( hFile, "\n" );
+
+	for ( int iAge = GetNumFrames() - 1; iAge >= 0; iAge-- )
+	{
+		const defProfFrame_t &frame = GetFrame( iAge );
+
+		g_pFullFileSystem->FPrintf( hFile, "%i,%.4f", frame.iFrame, frame.flFrameTime );
+		for ( int i = 0; i < DEFPROF_COUNT; i++ )
+			g_pFullFileSystem->FPrintf( hFile, ",%.4f,%.4f,%i",
+				frame.flCPU[ i ], frame.flRenderThread[ i ], frame.iCalls[ i ] );
+		g_pFullFileSystem->FPrintf( hFile, "\n" );
+	}
+
+	g_pFullFileSystem->Close( hFile );
+	return true;
+}
+
+void CDeferredProfiler::PrintAverages() const
+{
+	const int iNumFrames = GetNumFrames();
+
+	if ( iNumFrames < 1 )
+	{
+		Msg( "No profiled frames, set deferred_profile 1.\n" );
+		return;
+	}
+
+	float flFrameTime = 0;
+	float flCPU[ DEFPROF_COUNT ] = { 0 };
+	float flRenderThread[ DEFPROF_COUNT ] = { 0 };
+	float flCalls[ DEFPROF_COUNT ] = { 0 };
+
+	for ( int iAge = 0; iAge < iNumFrames; iAge++ )
+	{
+		const defProfFrame_t &frame = GetFrame( iAge );
+
+		flFrameTime += frame.flFrameTime;
+		for ( int i = 0; i < DEFPROF_COUNT; i++ )
+		{
+			flCPU[ i ] += frame.flCPU[ i ];
+			flRenderThread[ i ] += frame.flRenderThread[ i ];
+			flCalls[ i ] += frame.iCalls[ i ];
+		}
+	}
+
+	Msg( "Averages over %i frames, frame time %.3f ms\n", iNumFrames, flFrameTime / iNumFrames );
+	Msg( "%-20s %10s %10s %8s\n", "pass", "cpu ms", "rt ms", "calls" );
+	for ( int i = 0; i < DEFPROF_COUNT; i++ )
+	{
+		Msg( "%-20s %10.3f %10.3f %8.1f\n", GetPassName( i ),
+			flCPU[ i ] / iNumFrames, flRenderThread[ i ] / iNumFrames, flCalls[ i ] / iNumFrames );
+	}
+}
+
+CON_COMMAND( deferred_profile_dump, "Writes the profiled frames of the deferred pipeline to a csv file. Args: [filename]" )
+{
+	const char *pszFilename = args.ArgC() > 1 ? args[1] : "deferred_profile.csv";
+
+	if ( GetDeferredProfiler()->DumpCSV( pszFilename ) )
+		Msg( "Wrote %i frames to %s.\n", GetDeferredProfiler()->GetNumFrames(), pszFilename );
+	else
+		Warning( "Can't write %s.\n", pszFilename );
+}
+
+CON_COMMAND( deferred_profile_print, "Prints the average pass times of the profiled frames." )
+{
+	GetDeferredProfiler()->PrintAverages();
+}
+
+CON_COMMAND( deferred_profile_reset, "Drops all profiled frames." )
+{
+	GetDeferredProfiler()->Reset();
+}
@@ -0,0 +1,115 @@
+#ifndef C_DEFERRED_PROFILER_H
+#define C_DEFERRED_PROFILER_H
+
+#include "cbase.h"
+#include "tier0/fasttimer.h"
+
+enum
+{
+	DEFPROF_GBUFFER = 0,
+	DEFPROF_LIGHTING,
+	DEFPROF_CASCADES,
+	DEFPROF_SHADOWVIEWS,
+	DEFPROF_RADIOSITY_BEGIN,
+	DEFPROF_RADIOSITY_PROPAGATE,
+	DEFPROF_RADIOSITY_END,
+	DEFPROF_VOLUMETRICS,
+	DEFPROF_COMPOSITE,
+
+	DEFPROF_COUNT,
+};
+
+#define DEFPROF_HISTORY 512
+
+struct defProfFrame_t
+{
+	int iFrame;
+	float flFrameTime;
+
+	// milliseconds, passes include the passes nested in them
+	float flCPU[ DEFPROF_COUNT ];
+	float flRenderThread[ DEFPROF_COUNT ];
+	int iCalls[ DEFPROF_COUNT ];
+
+	volatile bool bComplete;
+};
+
+/*
+ * Times the passes of the deferred pipeline on the main thread and again on
+ * the render thread, by queueing time stamps around the pass. Frames are
+ * kept in a ring, a frame is complete once the render thread got to its end.
+ *
+ * The material system doesn't expose timestamp queries to the client, so
+ * the render thread time is submission cost and not GPU time.
+ */
+class CDeferredProfiler
+{
+public:
+
+	CDeferredProfiler();
+
+	void Reset();
+
+	void BeginPass( int iPass );
+	void EndPass( int iPass );
+
+	// complete frames, 0 is the latest
+	int GetNumFrames() const;
+	const defProfFrame_t &GetFrame( int iAge ) const;
+
+	bool DumpCSV( const char *pszFilename ) const;
+	void PrintAverages() const;
+
+	static const char *GetPassName( int iPass );
+
+private:
+
+	struct renderStamp_t
+	{
+		int iSlot;
+		int iPass;
+		bool bEnd;
+
+		static void Fire( renderStamp_t d );
+	};
+
+	void BeginFrame( int iFrame );
+	int GetNumPendingFrames() const;
+	void QueueStamp( int iPass, bool bEnd );
+	void OnRenderStamp( const renderStamp_t &d );
+
+	defProfFrame_t m_Frames[ DEFPROF_HISTORY ];
+
+	// frames started since the last reset
+	int m_iNumFrames;
+	int m_iCurrentFrame;
+
+	CFastTimer m_PassTimer[ DEFPROF_COUNT ];
+	int m_iPassDepth[ DEFPROF_COUNT ];
+
+	// render thread only
+	double m_flRenderStart[ DEFPROF_COUNT ];
+};
+
+extern CDeferredProfiler *GetDeferredProfiler();
+
+class CDeferredProfileScope
+{
+public:
+	CDeferredProfileScope( int iPass )
+	{
+		m_iPass = iPass;
+		GetDeferredProfiler()->BeginPass( iPass );
+	};
+	~CDeferredProfileScope()
+	{
+		GetDeferredProfiler()->EndPass( m_iPass );
+	};
+
+private:
+	int m_iPass;
+};
+
+#define DEFPROF_SCOPE( pass ) CDeferredProfileScope __defProfScope( pass )
+
+#endif
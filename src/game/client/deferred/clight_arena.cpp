@@ -0,0 +1,283 @@
+
+#include "cbase.h"
+#include "deferred/deferred_shared_common.h"
+
+#include "tier0/fasttimer.h"
+
+CLightDataArena::CLightDataArena()
+{
+	m_iCurrentBuffer = 0;
+	m_iCurrentFrame = -1;
+
+	m_iFrameFloats = 0;
+	m_iLastFrameFloats = 0;
+	m_iHighWaterFloats = 0;
+	m_iNumStalls = 0;
+	m_iNumDropped = 0;
+
+	for ( int i = 0; i < ARENA_BUFFERS; i++ )
+	{
+		m_Buffers[ i ].iUsed = 0;
+		m_Buffers[ i ].pPendingFences = new CInterlockedInt;
+	}
+}
+
+CLightDataArena::~CLightDataArena()
+{
+	Purge();
+
+	for ( int i = 0; i < ARENA_BUFFERS; i++ )
+		delete m_Buffers[ i ].pPendingFences;
+
+	// whatever is still pending here may yet be read, so it is leaked
+}
+
+void CLightDataArena::Purge()
+{
+	for ( int i = 0; i < ARENA_BUFFERS; i++ )
+	{
+		// at shutdown the queue may have been thrown away with its fences
+		if ( WaitForBuffer( m_Buffers[ i ] ) )
+			FreeChunks( m_Buffers[ i ] );
+		else
+			DropBuffer( m_Buffers[ i ] );
+
+		m_Buffers[ i ].iUsed = 0;
+	}
+
+	FreeDroppedChunks();
+
+	m_iCurrentBuffer = 0;
+	m_iCurrentFrame = -1;
+	m_iFrameFloats = 0;
+}
+
+void CLightDataArena::FreeChunks( buffer_t &buffer )
+{
+	for ( int i = 0; i < buffer.hChunks.Count(); i++ )
+		MemAlloc_FreeAligned( buffer.hChunks[ i ].pData );
+
+	buffer.hChunks.Purge();
+}
+
+void CLightDataArena::FreeDroppedChunks()
+{
+	for ( int f = m_hDroppedFences.Count() - 1; f >= 0; f-- )
+	{
+		CInterlockedInt *pPendingFences = m_hDroppedFences[ f ];
+
+		if ( *pPendingFences > 0 )
+			continue;
+
+		for ( int i = m_hDroppedChunks.Count() - 1; i >= 0; i-- )
+		{
+			if ( m_hDroppedChunks[ i ].pPendingFences != pPendingFences )
+				continue;
+
+			MemAlloc_FreeAligned( m_hDroppedChunks[ i ].pData );
+			m_hDroppedChunks.FastRemove( i );
+		}
+
+		delete pPendingFences;
+		m_hDroppedFences.FastRemove( f );
+	}
+}
+
+bool CLightDataArena::WaitForBuffer( buffer_t &buffer )
+{
+	if ( *buffer.pPendingFences <= 0 )
+		return true;
+
+	m_iNumStalls++;
+
+	const double flGiveUpTime = Plat_FloatTime() + ARENA_MAX_WAIT_MS * 0.001;
+
+	while ( *buffer.pPendingFences > 0 )
+	{
+		if ( Plat_FloatTime() > flGiveUpTime )
+			return false;
+
+		ThreadSleep( 0 );
+	}
+
+	return true;
+}
+
+void CLightDataArena::DropBuffer( buffer_t &buffer )
+{
+	Warning( "Light data arena gave up on a buffer after %i ms, holding %i chunks until its calls ran.\n",
+		(int)ARENA_MAX_WAIT_MS, buffer.hChunks.Count() );
+
+	m_iNumDropped++;
+
+	// the pending calls may still run, so their blocks and the counter their
+	// fences decrement must stay valid until the counter hits zero
+	for ( int i = 0; i < buffer.hChunks.Count(); i++ )
+	{
+		droppedChunk_t &dropped = m_hDroppedChunks[ m_hDroppedChunks.AddToTail() ];
+		dropped.pData = buffer.hChunks[ i ].pData;
+		dropped.pPendingFences = buffer.pPendingFences;
+	}
+	m_hDroppedFences.AddToTail( buffer.pPendingFences );
+
+	buffer.hChunks.Purge();
+	buffer.iUsed = 0;
+	buffer.pPendingFences = new CInterlockedInt;
+}
+
+void CLightDataArena::ResetBuffer( buffer_t &buffer )
+{
+	buffer.iUsed = 0;
+
+	if ( buffer.hChunks.Count() <= 1 )
+		return;
+
+	// last frame didn't fit, make one chunk large enough for all of it
+	int iSize = 0;
+	for ( int i = 0; i < buffer.hChunks.Count(); i++ )
+		iSize += buffer.hChunks[ i ].iSize;
+
+	FreeChunks( buffer );
+
+	chunk_t &chunk = buffer.hChunks[ buffer.hChunks.AddToTail() ];
+	chunk.pData = (float*)MemAlloc_AllocAligned( iSize * sizeof( float ), 16 );
+	chunk.iSize = iSize;
+}
+
+void CLightDataArena::BeginFrame( int iFrame )
+{
+	if ( iFrame == m_iCurrentFrame )
+		return;
+
+	m_iCurrentFrame = iFrame;
+
+	m_iLastFrameFloats = m_iFrameFloats;
+	m_iFrameFloats = 0;
+
+	m_iCurrentBuffer = ( m_iCurrentBuffer + 1 ) % ARENA_BUFFERS;
+
+	if ( m_hDroppedFences.Count() > 0 )
+		FreeDroppedChunks();
+
+	buffer_t &buffer = m_Buffers[ m_iCurrentBuffer ];
+	if ( !WaitForBuffer( buffer ) )
+		DropBuffer( buffer );
+	ResetBuffer( buffer );
+}
+
+float *CLightDataArena::Alloc( int iNumFloats )
+{
+	Assert( iNumFloats > 0 );
+
+	// keep every block on a float4 boundary
+	iNumFloats = ( iNumFloats + 3 ) & ~3;
+
+	buffer_t &buffer = m_Buffers[ m_iCurrentBuffer ];
+
+	if ( buffer.hChunks.Count() == 0 ||
+		buffer.iUsed + iNumFloats > buffer.hChunks.Tail().iSize )
+	{
+		int iSize = ARENA_MIN_CHUNK;
+		if ( buffer.hChunks.Count() > 0 )
+			iSize = buffer.hChunks.Tail().iSize * 2;
+		iSize = MAX( iSize, iNumFloats );
+
+		chunk_t &chunk = buffer.hChunks[ buffer.hChunks.AddToTail() ];
+		chunk.pData = (float*)MemAlloc_AllocAligned( iSize * sizeof( float ), 16 );
+		chunk.iSize = iSize;
+
+		buffer.iUsed = 0;
+	}
+
+	float *pData = buffer.hChunks.Tail().pData + buffer.iUsed;
+	buffer.iUsed += iNumFloats;
+
+	m_iFrameFloats += iNumFloats;
+	m_iHighWaterFloats = MAX( m_iHighWaterFloats, m_iFrameFloats );
+
+	return pData;
+}
+
+void CLightDataArena::Fence()
+{
+	buffer_t &buffer = m_Buffers[ m_iCurrentBuffer ];
+
+	++( *buffer.pPendingFences );
+
+	fenceData_t data;
+	data.pPendingFences = buffer.pPendingFences;
+	QUEUE_FIRE( fenceData_t, Fire, data );
+}
+
+int CLightDataArena::GetCapacityBytes() const
+{
+	int iSize = 0;
+
+	for ( int b = 0; b < ARENA_BUFFERS; b++ )
+	{
+		for ( int i = 0; i < m_Buffers[ b ].hChunks.Count(); i++ )
+			iSize += m_Buffers[ b ].hChunks[ i ].iSize;
+	}
+
+	return iSize * sizeof( float );
+}
+
+CON_COMMAND( deferred_lightarena_bench, "Compares new/delete of light constant blocks with the light data arena. Args: [frames]" )
+{
+	const int iFrames = args.ArgC() > 1 ? MAX( 1, atoi( args[1] ) ) : 1000;
+	const int iBlocksPerFrame[] = { 4, 16, 64, 256 };
+
+	for ( int iTest = 0; iTest < ARRAYSIZE( iBlocksPerFrame ); iTest++ )
+	{
+		const int iNumBlocks = iBlocksPerFrame[ iTest ];
+
+		// sizes of a batch of simple lights down to a single advanced one
+		CUtlVector< int > sizes;
+		for ( int i = 0; i < iNumBlocks; i++ )
+			sizes.AddToTail( 4 * ( ( i % 3 == 0 ) ? NUM_CONSTS_POINT_SIMPLE * MAX_LIGHTS_SIMPLE : NUM_CONSTS_SPOT_ADVANCED ) );
+
+		// freed one frame late like the call queue does
+		CUtlVector< float* > pending;
+
+		CFastTimer timerHeap;
+		timerHeap.Start();
+		for ( int f = 0; f < iFrames; f++ )
+		{
+			for ( int i = 0; i < pending.Count(); i++ )
+				delete [] pending[ i ];
+			pending.RemoveAll();
+
+			for ( int i = 0; i < iNumBlocks; i++ )
+			{
+				float *pData = new float[ sizes[ i ] ];
+				pData[ 0 ] = 0.0f;
+				pending.AddToTail( pData );
+			}
+		}
+		timerHeap.End();
+
+		for ( int i = 0; i < pending.Count(); i++ )
+			delete [] pending[ i ];
+
+		CLightDataArena arena;
+
+		CFastTimer timerArena;
+		timerArena.Start();
+		for ( int f = 0; f < iFrames; f++ )
+		{
+			arena.BeginFrame( f );
+
+			for ( int i = 0; i < iNumBlocks; i++ )
+			{
+				float *pData = arena.Alloc( sizes[ i ] );
+				pData[ 0 ] = 0.0f;
+			}
+		}
+		timerArena.End();
+
+		Msg( "%4i blocks: new/delete %.4f ms, arena %.4f ms, high water %i bytes, capacity %i bytes\n", iNumBlocks,
+			timerHeap.GetDuration().GetMillisecondsF() / iFrames,
+			timerArena.GetDuration().GetMillisecondsF() / iFrames,
+			arena.GetHighWaterBytes(), arena.GetCapacityBytes() );
+	}
+}
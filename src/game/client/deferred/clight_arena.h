@@ -0,0 +1,100 @@
+#ifndef C_LIGHT_ARENA_H
+#define C_LIGHT_ARENA_H
+
+#include "cbase.h"
+
+/*
+ * Linear allocator for the light constant blocks that are handed to the
+ * render thread. Every frame bumps through its own buffer, a buffer is only
+ * rewound once the render thread went past all calls that read from it.
+ * Overflowing a buffer chains another chunk, the chunks are merged into
+ * one when the buffer comes around again. Waits are bounded, a buffer whose
+ * calls don't run in time is given up rather than reused, its chunks are
+ * freed once those calls did run.
+ */
+class CLightDataArena
+{
+public:
+
+	CLightDataArena();
+	~CLightDataArena();
+
+	// waits a bounded time for the render thread, buffers it still reads are dropped
+	void Purge();
+
+	// switches buffers when the frame changed
+	void BeginFrame( int iFrame );
+	// 16 byte aligned, valid until the buffer comes around again
+	float *Alloc( int iNumFloats );
+	// must be called after queueing the last call that reads this frames data
+	void Fence();
+
+	FORCEINLINE int GetFrameBytes() const { return m_iFrameFloats * sizeof( float ); };
+	FORCEINLINE int GetLastFrameBytes() const { return m_iLastFrameFloats * sizeof( float ); };
+	FORCEINLINE int GetHighWaterBytes() const { return m_iHighWaterFloats * sizeof( float ); };
+	int GetCapacityBytes() const;
+	FORCEINLINE int GetNumStalls() const { return m_iNumStalls; };
+	FORCEINLINE int GetNumDropped() const { return m_iNumDropped; };
+	FORCEINLINE int GetNumDroppedChunks() const { return m_hDroppedChunks.Count(); };
+
+	enum
+	{
+		ARENA_BUFFERS = 3,
+		ARENA_MIN_CHUNK = 4096,
+		ARENA_MAX_WAIT_MS = 250,
+	};
+
+private:
+
+	struct chunk_t
+	{
+		float *pData;
+		int iSize;
+	};
+
+	struct buffer_t
+	{
+		CUtlVector< chunk_t > hChunks;
+		int iUsed;
+		// on the heap so a dropped buffer can leave it to late fences
+		CInterlockedInt *pPendingFences;
+	};
+
+	// chunk of a dropped buffer, freed when its fences fired
+	struct droppedChunk_t
+	{
+		float *pData;
+		CInterlockedInt *pPendingFences;
+	};
+
+	struct fenceData_t
+	{
+		CInterlockedInt *pPendingFences;
+
+		static void Fire( fenceData_t d )
+		{
+			--( *d.pPendingFences );
+		};
+	};
+
+	// false if the render thread didn't get past the buffer in time
+	bool WaitForBuffer( buffer_t &buffer );
+	void DropBuffer( buffer_t &buffer );
+	void ResetBuffer( buffer_t &buffer );
+	void FreeChunks( buffer_t &buffer );
+	void FreeDroppedChunks();
+
+	buffer_t m_Buffers[ ARENA_BUFFERS ];
+	CUtlVector< droppedChunk_t > m_hDroppedChunks;
+	CUtlVector< CInterlockedInt* > m_hDroppedFences;
+	int m_iCurrentBuffer;
+	int m_iCurrentFrame;
+
+	int m_iFrameFloats;
+	int m_iLastFrameFloats;
+	int m_iHighWaterFloats;
+	int m_iNumStalls;
+	int m_iNumDropped;
+};
+
+#endif
@@ -0,0 +1,228 @@
+#include "cbase.h"
+#include "deferred/deferred_shared_common.h"
+
+#include "bspfile.h"
+#include "filesystem.h"
+#include "tier1/utlbuffer.h"
+
+CLightBakeCache::CLightBakeCache()
+{
+}
+
+void CLightBakeCache::Purge()
+{
+	m_Bakes.Purge();
+	m_Leaves.Purge();
+}
+
+CRC32_t CLightBakeCache::GetLightKey( const def_light_t *l )
+{
+	CRC32_t iKey;
+	CRC32_Init( &iKey );
+
+	CRC32_ProcessBuffer( &iKey, &l->iLighttype, sizeof( l->iLighttype ) );
+	CRC32_ProcessBuffer( &iKey, l->pos.Base(), sizeof( Vector ) );
+	CRC32_ProcessBuffer( &iKey, &l->flRadius, sizeof( l->flRadius ) );
+
+	// point bounds don't depend on the angles
+	if ( l->iLighttype == DEFLIGHTTYPE_SPOT )
+	{
+		QAngle ang = l->ang;
+		normalizeAngles( ang );
+
+		CRC32_ProcessBuffer( &iKey, ang.Base(), sizeof( QAngle ) );
+		CRC32_ProcessBuffer( &iKey, &l->flSpotCone_Outer, sizeof( l->flSpotCone_Outer ) );
+	}
+
+	CRC32_Final( &iKey );
+	return iKey;
+}
+
+bool CLightBakeCache::CalcMapCRC( const char *pszMapName, CRC32_t &iCRC )
+{
+	FileHandle_t hFile = g_pFullFileSystem->Open( pszMapName, "rb", "GAME" );
+
+	if ( hFile == FILESYSTEM_INVALID_HANDLE )
+		return false;
+
+	const int iFileSize = g_pFullFileSystem->Size( hFile );
+	CUtlMemory< unsigned char > buffer( 0, 64 * 1024 );
+
+	CRC32_Init( &iCRC );
+
+	int iRead = 0;
+	while ( iRead < iFileSize )
+	{
+		const int iChunk = g_pFullFileSystem->Read( buffer.Base(), MIN( buffer.Count(), iFileSize - iRead ), hFile );
+
+		if ( iChunk <= 0 )
+			break;
+
+		CRC32_ProcessBuffer( &iCRC, buffer.Base(), iChunk );
+		iRead += iChunk;
+	}
+
+	CRC32_Final( &iCRC );
+	g_pFullFileSystem->Close( hFile );
+
+	return iFileSize > (int)sizeof( BSPHeader_t ) && iRead == iFileSize;
+}
+
+void CLightBakeCache::GetFileName( const char *pszMapName, char *pszOut, int iMaxLen )
+{
+	Q_StripExtension( pszMapName, pszOut, iMaxLen );
+	Q_strncat( pszOut, LIGHTBAKE_EXTENSION, iMaxLen, COPY_ALL_CHARACTERS );
+}
+
+int CLightBakeCache::LowerBound( CRC32_t iKey ) const
+{
+	int iLow = 0;
+	int iHigh = m_Bakes.Count();
+
+	while ( iLow < iHigh )
+	{
+		const int iMid = ( iLow + iHigh ) / 2;
+
+		if ( m_Bakes[ iMid ].iKey < iKey )
+			iLow = iMid + 1;
+		else
+			iHigh = iMid;
+	}
+
+	return iLow;
+}
+
+void CLightBakeCache::Add( const lightBake_t &bake, const int *pLeaves )
+{
+	Assert( bake.iNumLeaves >= 0 && bake.iNumLeaves <= DEFLIGHT_MAX_LEAVES );
+
+	const int iIndex = LowerBound( bake.iKey );
+
+	if ( iIndex < m_Bakes.Count() && m_Bakes[ iIndex ].iKey == bake.iKey )
+		return;
+
+	lightBake_t &added = m_Bakes[ m_Bakes.InsertBefore( iIndex, bake ) ];
+	added.iFirstLeaf = m_Leaves.AddMultipleToTail( bake.iNumLeaves, pLeaves );
+}
+
+const lightBake_t *CLightBakeCache::Find( CRC32_t iKey ) const
+{
+	const int iIndex = LowerBound( iKey );
+
+	if ( iIndex < m_Bakes.Count() && m_Bakes[ iIndex ].iKey == iKey )
+		return &m_Bakes[ iIndex ];
+
+	return NULL;
+}
+
+static void PutVector( CUtlBuffer &buf, const Vector &v )
+{
+	buf.PutFloat( v.x );
+	buf.PutFloat( v.y );
+	buf.PutFloat( v.z );
+}
+
+static void GetVector( CUtlBuffer &buf, Vector &v )
+{
+	v.x = buf.GetFloat();
+	v.y = buf.GetFloat();
+	v.z = buf.GetFloat();
+}
+
+void CLightBakeCache::Write( CUtlBuffer &buf, CRC32_t iMapCRC ) const
+{
+	buf.PutInt( LIGHTBAKE_VERSION );
+	buf.PutUnsignedInt( iMapCRC );
+	buf.PutInt( m_Bakes.Count() );
+	buf.PutInt( m_Leaves.Count() );
+
+	for ( int i = 0; i < m_Bakes.Count(); i++ )
+	{
+		const lightBake_t &bake = m_Bakes[ i ];
+
+		buf.PutUnsignedInt( bake.iKey );
+		PutVector( buf, bake.bounds_min );
+		PutVector( buf, bake.bounds_max );
+
+		for ( int j = 0; j < 4; j++ )
+			PutVector( buf, bake.vecSpotCorners[ j ] );
+
+		buf.PutInt( bake.iFirstLeaf );
+		buf.PutInt( bake.iNumLeaves );
+	}
+
+	for ( int i = 0; i < m_Leaves.Count(); i++ )
+		buf.PutInt( m_Leaves[ i ] );
+}
+
+bool CLightBakeCache::Read( CUtlBuffer &buf, CRC32_t iMapCRC )
+{
+	Purge();
+
+	if ( buf.GetInt() != LIGHTBAKE_VERSION || buf.GetUnsignedInt() != iMapCRC )
+		return false;
+
+	const int iNumBakes = buf.GetInt();
+	const int iNumLeaves = buf.GetInt();
+
+	if ( !buf.IsValid() || iNumBakes < 0 || iNumLeaves < 0 )
+		return false;
+
+	m_Bakes.EnsureCapacity( iNumBakes );
+
+	for ( int i = 0; i < iNumBakes && buf.IsValid(); i++ )
+	{
+		lightBake_t &bake = m_Bakes[ m_Bakes.AddToTail() ];
+
+		bake.iKey = buf.GetUnsignedInt();
+		GetVector( buf, bake.bounds_min );
+		GetVector( buf, bake.bounds_max );
+
+		for ( int j = 0; j < 4; j++ )
+			GetVector( buf, bake.vecSpotCorners[ j ] );
+
+		bake.iFirstLeaf = buf.GetInt();
+		bake.iNumLeaves = buf.GetInt();
+
+		if ( bake.iNumLeaves < 0 || bake.iNumLeaves > DEFLIGHT_MAX_LEAVES ||
+			bake.iFirstLeaf < 0 || bake.iFirstLeaf > iNumLeaves - bake.iNumLeaves ||
+			( i > 0 && m_Bakes[ i - 1 ].iKey >= bake.iKey ) )
+		{
+			Purge();
+			return false;
+		}
+	}
+
+	m_Leaves.EnsureCapacity( iNumLeaves );
+
+	for ( int i = 0; i < iNumLeaves && buf.IsValid(); i++ )
+		m_Leaves.AddToTail( buf.GetInt() );
+
+	if ( !buf.IsValid() )
+	{
+		Purge();
+		return false;
+	}
+
+	return true;
+}
+
+bool CLightBakeCache::Save( const char *pszFileName, CRC32_t iMapCRC ) const
+{
+	CUtlBuffer buf;
+	Write( buf, iMapCRC );
+
+	return g_pFullFileSystem->WriteFile( pszFileName, "MOD", buf );
+}
+
+bool CLightBakeCache::Load( const char *pszFileName, CRC32_t iMapCRC )
+{
+	Purge();
+
+	CUtlBuffer buf;
+
+	if ( !g_pFullFileSystem->ReadFile( pszFileName, "GAME", buf ) )
+		return false;
+
+	return Read( buf, iMapCRC );
+}
@@ -0,0 +1,73 @@
+#ifndef C_LIGHT_BAKE_H
+#define C_LIGHT_BAKE_H
+
+#include "cbase.h"
+
+#include "checksum_crc.h"
+
+class CUtlBuffer;
+struct def_light_t;
+
+#define LIGHTBAKE_VERSION 1
+#define LIGHTBAKE_EXTENSION ".deferred_lights"
+
+// traced bounds and leaves of one world light
+struct lightBake_t
+{
+	// crc of the parameters the bake was made from
+	CRC32_t iKey;
+
+	Vector bounds_min;
+	Vector bounds_max;
+
+	// far corners of spots, unused for point lights
+	Vector vecSpotCorners[ 4 ];
+
+	int iFirstLeaf;
+	int iNumLeaves;
+};
+
+/*
+ * Bounds, leaves and spot corners of world lights saved next to the map, so
+ * loading a level doesn't trace every light again. Files are only used for the
+ * map they were made for and a light only uses a bake made from the same
+ * position, angles, radius and cone, lights that were moved are traced.
+ */
+class CLightBakeCache
+{
+public:
+
+	CLightBakeCache();
+
+	void Purge();
+
+	static CRC32_t GetLightKey( const def_light_t *l );
+	// crc of the whole bsp, changes whenever the map is compiled
+	static bool CalcMapCRC( const char *pszMapName, CRC32_t &iCRC );
+	static void GetFileName( const char *pszMapName, char *pszOut, int iMaxLen );
+
+	// ignored if the key is already baked
+	void Add( const lightBake_t &bake, const int *pLeaves );
+	const lightBake_t *Find( CRC32_t iKey ) const;
+
+	FORCEINLINE const int *GetLeaves( const lightBake_t &bake ) const { return m_Leaves.Base() + bake.iFirstLeaf; };
+	FORCEINLINE int GetNumBakes() const { return m_Bakes.Count(); };
+
+	void Write( CUtlBuffer &buf, CRC32_t iMapCRC ) const;
+	// false and empty if the data is from another map or malformed
+	bool Read( CUtlBuffer &buf, CRC32_t iMapCRC );
+
+	bool Save( const char *pszFileName, CRC32_t iMapCRC ) const;
+	bool Load( const char *pszFileName, CRC32_t iMapCRC );
+
+private:
+
+	// index of the first bake with a key >= iKey
+	int LowerBound( CRC32_t iKey ) const;
+
+	// sorted by key
+	CUtlVector< lightBake_t > m_Bakes;
+	CUtlVector< int > m_Leaves;
+};
+
+#endif
@@ -0,0 +1,295 @@
+
+#include "cbase.h"
+#include "deferred/deferred_shared_common.h"
+
+#include "tier0/fasttimer.h"
+#include "vstdlib/random.h"
+
+static unsigned int SpreadBits( unsigned int v )
+{
+	v &= 0xFFFF;
+	v = ( v | ( v << 8 ) ) & 0x00FF00FF;
+	v = ( v | ( v << 4 ) ) & 0x0F0F0F0F;
+	v = ( v | ( v << 2 ) ) & 0x33333333;
+	v = ( v | ( v << 1 ) ) & 0x55555555;
+	return v;
+}
+
+CLightBatchBuilder::CLightBatchBuilder()
+{
+}
+
+int64 CLightBatchBuilder::CalcBatchCost( int64 iUnionArea, int iNumLights, int iDrawCost )
+{
+	return iUnionArea * ( PASS_PIXEL_COST + iNumLights ) + iDrawCost;
+}
+
+int64 CLightBatchBuilder::CalcSeparateCost( int64 iSumArea, int iNumLights, int iDrawCost )
+{
+	return iSumArea * ( PASS_PIXEL_COST + 1 ) + (int64)iNumLights * iDrawCost;
+}
+
+int CLightBatchBuilder::SortByKey( const sortEntry_t *a, const sortEntry_t *b )
+{
+	if ( a->iKey != b->iKey )
+		return ( a->iKey < b->iKey ) ? -1 : 1;
+
+	return a->iIndex - b->iIndex;
+}
+
+void CLightBatchBuilder::UnionRect( const lightBatchRect_t &a, const lightBatchRect_t &b, lightBatchRect_t &out )
+{
+	out.x0 = MIN( a.x0, b.x0 );
+	out.y0 = MIN( a.y0, b.y0 );
+	out.x1 = MAX( a.x1, b.x1 );
+	out.y1 = MAX( a.y1, b.y1 );
+}
+
+int CLightBatchBuilder::Build( const lightBatchRect_t *pRects, int iNumRects, int iMaxPerBatch, int iDrawCost )
+{
+	Assert( iMaxPerBatch > 0 );
+
+	m_Order.RemoveAll();
+	m_Batches.RemoveAll();
+	m_Indices.RemoveAll();
+
+	m_Assigned.SetCount( iNumRects );
+
+	// walk the rects along a z-curve so neighbours on screen are close in the list
+	for ( int i = 0; i < iNumRects; i++ )
+	{
+		const lightBatchRect_t &r = pRects[ i ];
+		const unsigned int cx = clamp( ( r.x0 + r.x1 ) >> 4, 0, 0xFFFF );
+		const unsigned int cy = clamp( ( r.y0 + r.y1 ) >> 4, 0, 0xFFFF );
+
+		sortEntry_t &entry = m_Order[ m_Order.AddToTail() ];
+		entry.iKey = SpreadBits( cx ) | ( SpreadBits( cy ) << 1 );
+		entry.iIndex = i;
+
+		m_Assigned[ i ] = false;
+	}
+
+	m_Order.Sort( SortByKey );
+
+	for ( int o = 0; o < iNumRects; o++ )
+	{
+		const int iSeed = m_Order[ o ].iIndex;
+
+		if ( m_Assigned[ iSeed ] )
+			continue;
+
+		batch_t &batch = m_Batches[ m_Batches.AddToTail() ];
+		batch.rect = pRects[ iSeed ];
+		batch.iFirst = m_Indices.Count();
+		batch.iCount = 1;
+
+		m_Indices.AddToTail( iSeed );
+		m_Assigned[ iSeed ] = true;
+
+		int64 iSumArea = batch.rect.GetArea();
+
+		while ( batch.iCount < iMaxPerBatch )
+		{
+			int iBest = -1;
+			int64 iBestArea = 0;
+			lightBatchRect_t bestUnion;
+
+			int iScanned = 0;
+
+			for ( int p = o + 1; p < iNumRects && iScanned < SEARCH_WINDOW; p++ )
+			{
+				const int iCandidate = m_Order[ p ].iIndex;
+
+				if ( m_Assigned[ iCandidate ] )
+					continue;
+
+				iScanned++;
+
+				lightBatchRect_t merged;
+				UnionRect( batch.rect, pRects[ iCandidate ], merged );
+
+				const int64 iArea = merged.GetArea();
+
+				if ( iBest < 0 || iArea < iBestArea )
+				{
+					iBest = iCandidate;
+					iBestArea = iArea;
+					bestUnion = merged;
+				}
+			}
+
+			if ( iBest < 0 )
+				break;
+
+			const int64 iNewSumArea = iSumArea + pRects[ iBest ].GetArea();
+			const int iNewCount = batch.iCount + 1;
+
+			if ( CalcBatchCost( iBestArea, iNewCount, iDrawCost ) >
+				CalcSeparateCost( iNewSumArea, iNewCount, iDrawCost ) )
+				break;
+
+			batch.rect = bestUnion;
+			batch.iCount = iNewCount;
+			iSumArea = iNewSumArea;
+
+			m_Indices.AddToTail( iBest );
+			m_Assigned[ iBest ] = true;
+		}
+	}
+
+	return m_Batches.Count();
+}
+
+bool CLightBatchBuilder::CalcScreenRect( const VMatrix &matWorldToScreen, const Vector &vecMins, const Vector &vecMaxs,
+	int iScreenWidth, int iScreenHeight, lightBatchRect_t &rect )
+{
+	float flMinX = FLT_MAX;
+	float flMinY = FLT_MAX;
+	float flMaxX = -FLT_MAX;
+	float flMaxY = -FLT_MAX;
+
+	for ( int i = 0; i < 8; i++ )
+	{
+		const Vector vecCorner( ( i & 1 ) ? vecMaxs.x : vecMins.x,
+			( i & 2 ) ? vecMaxs.y : vecMins.y,
+			( i & 4 ) ? vecMaxs.z : vecMins.z );
+
+		const float w = matWorldToScreen.m[3][0] * vecCorner.x + matWorldToScreen.m[3][1] * vecCorner.y +
+			matWorldToScreen.m[3][2] * vecCorner.z + matWorldToScreen.m[3][3];
+
+		if ( w < 0.001f )
+			return false;
+
+		const float x = ( matWorldToScreen.m[0][0] * vecCorner.x + matWorldToScreen.m[0][1] * vecCorner.y +
+			matWorldToScreen.m[0][2] * vecCorner.z + matWorldToScreen.m[0][3] ) / w;
+		const float y = ( matWorldToScreen.m[1][0] * vecCorner.x + matWorldToScreen.m[1][1] * vecCorner.y +
+			matWorldToScreen.m[1][2] * vecCorner.z + matWorldToScreen.m[1][3] ) / w;
+
+		flMinX = MIN( flMinX, x );
+		flMinY = MIN( flMinY, y );
+		flMaxX = MAX( flMaxX, x );
+		flMaxY = MAX( flMaxY, y );
+	}
+
+	// device y points up
+	rect.x0 = clamp( (int)floor( ( flMinX * 0.5f + 0.5f ) * iScreenWidth ), 0, iScreenWidth );
+	rect.x1 = clamp( (int)ceil( ( flMaxX * 0.5f + 0.5f ) * iScreenWidth ), 0, iScreenWidth );
+	rect.y0 = clamp( (int)floor( ( 0.5f - flMaxY * 0.5f ) * iScreenHeight ), 0, iScreenHeight );
+	rect.y1 = clamp( (int)ceil( ( 0.5f - flMinY * 0.5f ) * iScreenHeight ), 0, iScreenHeight );
+
+	return !rect.IsEmpty();
+}
+
+static bool ValidateLightBatches( const CLightBatchBuilder &builder, const lightBatchRect_t *pRects, int iNumRects, int iMaxPerBatch )
+{
+	CUtlVector< int > seen;
+	seen.SetCount( iNumRects );
+	for ( int i = 0; i < iNumRects; i++ )
+		seen[ i ] = 0;
+
+	for ( int b = 0; b < builder.GetNumBatches(); b++ )
+	{
+		const lightBatchRect_t &batchRect = builder.GetBatchRect( b );
+
+		if ( builder.GetBatchSize( b ) < 1 || builder.GetBatchSize( b ) > iMaxPerBatch )
+			return false;
+
+		for ( int i = 0; i < builder.GetBatchSize( b ); i++ )
+		{
+			const int iIndex = builder.GetBatchIndices( b )[ i ];
+			const lightBatchRect_t &r = pRects[ iIndex ];
+
+			seen[ iIndex ]++;
+
+			if ( r.x0 < batchRect.x0 || r.y0 < batchRect.y0 ||
+				r.x1 > batchRect.x1 || r.y1 > batchRect.y1 )
+				return false;
+		}
+	}
+
+	for ( int i = 0; i < iNumRects; i++ )
+	{
+		if ( seen[ i ] != 1 )
+			return false;
+	}
+
+	return true;
+}
+
+CON_COMMAND( deferred_lightbatch_bench, "Batches clustered and scattered synthetic light rects and counts the draws. Args: [lights]" )
+{
+	const int iNumLights = args.ArgC() > 1 ? MAX( 1, atoi( args[1] ) ) : 512;
+	const int iWidth = 1920;
+	const int iHeight = 1080;
+	const int iDrawCost = deferred_lightmanager_batch_drawcost.GetInt();
+
+	CUniformRandomStream rnd;
+	rnd.SetSeed( iNumLights );
+
+	CUtlVector< lightBatchRect_t > rects;
+	rects.SetCount( iNumLights );
+
+	CLightBatchBuilder builder;
+
+	// small lights gathered around a few fixtures, this is what batching is for
+	for ( int i = 0; i < iNumLights; i++ )
+	{
+		const int iCluster = rnd.RandomInt( 0, 15 );
+		const int cx = 120 + ( iCluster % 4 ) * 560 + rnd.RandomInt( -60, 60 );
+		const int cy = 100 + ( iCluster / 4 ) * 280 + rnd.RandomInt( -40, 40 );
+		const int iExtent = rnd.RandomInt( 8, 48 );
+
+		rects[ i ].x0 = clamp( cx - iExtent, 0, iWidth );
+		rects[ i ].y0 = clamp( cy - iExtent, 0, iHeight );
+		rects[ i ].x1 = clamp( cx + iExtent, 0, iWidth );
+		rects[ i ].y1 = clamp( cy + iExtent, 0, iHeight );
+	}
+
+	CFastTimer timer;
+	timer.Start();
+	const int iClusteredDraws = builder.Build( rects.Base(), iNumLights, MAX_LIGHTS_SIMPLE, iDrawCost );
+	timer.End();
+
+	Msg( "clustered: %i lights, %i draws, %.4f ms\n", iNumLights, iClusteredDraws, timer.GetDuration().GetMillisecondsF() );
+
+	if ( !ValidateLightBatches( builder, rects.Base(), iNumLights, MAX_LIGHTS_SIMPLE ) )
+		Warning( "clustered: lights were lost, repeated or overflowed a batch\n" );
+
+	// clustered lights have to collapse into far fewer passes
+	if ( iNumLights >= MAX_LIGHTS_SIMPLE * 4 && iClusteredDraws * 2 > iNumLights )
+		Warning( "clustered: lights weren't batched\n" );
+
+	// large lights far apart, batching them would only add fill
+	for ( int i = 0; i < iNumLights; i++ )
+	{
+		const int cx = rnd.RandomInt( 0, iWidth );
+		const int cy = rnd.RandomInt( 0, iHeight );
+		const int iExtent = rnd.RandomInt( 200, 400 );
+
+		rects[ i ].x0 = clamp( cx - iExtent, 0, iWidth );
+		rects[ i ].y0 = clamp( cy - iExtent, 0, iHeight );
+		rects[ i ].x1 = clamp( cx + iExtent, 0, iWidth );
+		rects[ i ].y1 = clamp( cy + iExtent, 0, iHeight );
+	}
+
+	timer.Start();
+	const int iScatteredDraws = builder.Build( rects.Base(), iNumLights, MAX_LIGHTS_SIMPLE, iDrawCost );
+	timer.End();
+
+	Msg( "scattered: %i lights, %i draws, %.4f ms\n", iNumLights, iScatteredDraws, timer.GetDuration().GetMillisecondsF() );
+
+	if ( !ValidateLightBatches( builder, rects.Base(), iNumLights, MAX_LIGHTS_SIMPLE ) )
+		Warning( "scattered: lights were lost, repeated or overflowed a batch\n" );
+
+	// no batch may cost more than drawing its lights separately
+	for ( int b = 0; b < builder.GetNumBatches(); b++ )
+	{
+		int64 iSumArea = 0;
+		for ( int i = 0; i < builder.GetBatchSize( b ); i++ )
+			iSumArea += rects[ builder.GetBatchIndices( b )[ i ] ].GetArea();
+
+		if ( CLightBatchBuilder::CalcBatchCost( builder.GetBatchRect( b ).GetArea(), builder.GetBatchSize( b ), iDrawCost ) >
+			CLightBatchBuilder::CalcSeparateCost( iSumArea, builder.GetBatchSize( b ), iDrawCost ) )
+			Warning( "scattered: batch %i costs more than its lights drawn one by one\n", b );
+	}
+}
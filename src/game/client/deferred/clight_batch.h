@@ -0,0 +1,85 @@
+#ifndef C_LIGHT_BATCH_H
+#define C_LIGHT_BATCH_H
+
+#include "cbase.h"
+
+class VMatrix;
+
+struct lightBatchRect_t
+{
+	int x0;
+	int y0;
+	int x1;
+	int y1;
+
+	FORCEINLINE bool IsEmpty() const { return x1 <= x0 || y1 <= y0; };
+	FORCEINLINE int64 GetArea() const { return IsEmpty() ? 0 : (int64)( x1 - x0 ) * ( y1 - y0 ); };
+};
+
+/*
+ * Groups the screen rects of simple lights so that lights sharing screen
+ * space are shaded by one fullscreen pass clipped to their union. A group
+ * is only grown while shading the union for every light in it is cheaper
+ * than drawing the lights one by one, a draw call is weighed as a number
+ * of per pixel light evaluations.
+ */
+class CLightBatchBuilder
+{
+public:
+
+	CLightBatchBuilder();
+
+	// returns the number of batches, every rect ends up in exactly one
+	int Build( const lightBatchRect_t *pRects, int iNumRects, int iMaxPerBatch, int iDrawCost );
+
+	FORCEINLINE int GetNumBatches() const { return m_Batches.Count(); };
+	FORCEINLINE const lightBatchRect_t &GetBatchRect( int iBatch ) const { return m_Batches[ iBatch ].rect; };
+	FORCEINLINE int GetBatchSize( int iBatch ) const { return m_Batches[ iBatch ].iCount; };
+	// indices into the rects passed to Build
+	FORCEINLINE const int *GetBatchIndices( int iBatch ) const { return &m_Indices[ m_Batches[ iBatch ].iFirst ]; };
+
+	// bounds of a world space box on a screen of the given size, false if
+	// the box crosses the near plane or is off screen
+	static bool CalcScreenRect( const VMatrix &matWorldToScreen, const Vector &vecMins, const Vector &vecMaxs,
+		int iScreenWidth, int iScreenHeight, lightBatchRect_t &rect );
+
+	// in light evaluations, a pass pays PASS_PIXEL_COST per pixel to fetch the
+	// gbuffer and blend plus one per light it evaluates
+	static int64 CalcBatchCost( int64 iUnionArea, int iNumLights, int iDrawCost );
+	static int64 CalcSeparateCost( int64 iSumArea, int iNumLights, int iDrawCost );
+
+	enum
+	{
+		PASS_PIXEL_COST = 4,
+	};
+
+private:
+
+	enum
+	{
+		SEARCH_WINDOW = 32,
+	};
+
+	struct sortEntry_t
+	{
+		unsigned int iKey;
+		int iIndex;
+	};
+
+	struct batch_t
+	{
+		lightBatchRect_t rect;
+		int iFirst;
+		int iCount;
+	};
+
+	static int SortByKey( const sortEntry_t *a, const sortEntry_t *b );
+	static void UnionRect( const lightBatchRect_t &a, const lightBatchRect_t &b, lightBatchRect_t &out );
+
+	CUtlVector< sortEntry_t > m_Order;
+	CUtlVector< bool > m_Assigned;
+	CUtlVector< batch_t > m_Batches;
+	CUtlVector< int > m_Indices;
+};
+
+#endif
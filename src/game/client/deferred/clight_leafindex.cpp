@@ -0,0 +1,254 @@
+
+#include "cbase.h"
+#include "deferred/deferred_shared_common.h"
+
+#include "tier0/fasttimer.h"
+
+CLightLeafIndex::CLightLeafIndex()
+{
+	m_bValid = false;
+	m_iNumLights = 0;
+	m_iNumVisibleLeaves = 0;
+	m_iNumBuilds = 0;
+}
+
+void CLightLeafIndex::Purge()
+{
+	m_Leaves.Purge();
+	m_LeafOffsets.Purge();
+	m_LeafLights.Purge();
+	m_LeafRemap.Purge();
+	m_VisibleBits.Purge();
+	m_BuildLeaves.Purge();
+	m_BuildNumLeaves.Purge();
+
+	m_bValid = false;
+	m_iNumLights = 0;
+	m_iNumVisibleLeaves = 0;
+}
+
+void CLightLeafIndex::Build( def_light_t * const *pLights, int iNumLights )
+{
+	m_BuildLeaves.SetCount( iNumLights );
+	m_BuildNumLeaves.SetCount( iNumLights );
+
+	for ( int i = 0; i < iNumLights; i++ )
+	{
+		m_BuildLeaves[ i ] = pLights[ i ]->GetLeaves();
+		m_BuildNumLeaves[ i ] = pLights[ i ]->GetNumLeaves();
+	}
+
+	Build( m_BuildLeaves.Base(), m_BuildNumLeaves.Base(), iNumLights );
+}
+
+void CLightLeafIndex::Build( const int * const *ppLeaves, const int *pNumLeaves, int iNumLights )
+{
+	Assert( iNumLights <= 0xFFFF );
+
+	m_iNumLights = iNumLights;
+	m_iNumBuilds++;
+
+	m_Leaves.RemoveAll();
+	m_LeafOffsets.RemoveAll();
+
+	int iMaxLeaf = -1;
+	int iNumReferences = 0;
+
+	for ( int i = 0; i < iNumLights; i++ )
+	{
+		for ( int iLeaf = 0; iLeaf < pNumLeaves[ i ]; iLeaf++ )
+			iMaxLeaf = MAX( iMaxLeaf, ppLeaves[ i ][ iLeaf ] );
+
+		iNumReferences += pNumLeaves[ i ];
+	}
+
+	m_LeafRemap.SetCount( iMaxLeaf + 1 );
+	for ( int i = 0; i < m_LeafRemap.Count(); i++ )
+		m_LeafRemap[ i ] = -1;
+
+	// count the lights of every leaf, then lay them out contiguously
+	for ( int i = 0; i < iNumLights; i++ )
+	{
+		const int *pLeaves = ppLeaves[ i ];
+
+		for ( int iLeaf = 0; iLeaf < pNumLeaves[ i ]; iLeaf++ )
+		{
+			int &iUnique = m_LeafRemap[ pLeaves[ iLeaf ] ];
+
+			if ( iUnique < 0 )
+			{
+				iUnique = m_Leaves.AddToTail( pLeaves[ iLeaf ] );
+				m_LeafOffsets.AddToTail( 0 );
+			}
+
+			m_LeafOffsets[ iUnique ]++;
+		}
+	}
+
+	int iOffset = 0;
+	for ( int u = 0; u < m_LeafOffsets.Count(); u++ )
+	{
+		const int iCount = m_LeafOffsets[ u ];
+		m_LeafOffsets[ u ] = iOffset;
+		iOffset += iCount;
+	}
+	m_LeafOffsets.AddToTail( iOffset );
+
+	Assert( iOffset == iNumReferences );
+
+	// offsets are used as write cursors and shifted back afterwards
+	m_LeafLights.SetCount( iNumReferences );
+
+	for ( int i = 0; i < iNumLights; i++ )
+	{
+		const int *pLeaves = ppLeaves[ i ];
+
+		for ( int iLeaf = 0; iLeaf < pNumLeaves[ i ]; iLeaf++ )
+		{
+			const int iUnique = m_LeafRemap[ pLeaves[ iLeaf ] ];
+			m_LeafLights[ m_LeafOffsets[ iUnique ]++ ] = i;
+		}
+	}
+
+	for ( int u = m_Leaves.Count() - 1; u > 0; u-- )
+		m_LeafOffsets[ u ] = m_LeafOffsets[ u - 1 ];
+	if ( m_Leaves.Count() > 0 )
+		m_LeafOffsets[ 0 ] = 0;
+
+	m_VisibleBits.SetCount( ( iNumLights + 31 ) / 32 );
+	m_iNumVisibleLeaves = 0;
+	m_bValid = true;
+}
+
+struct benchLeafVisibility_t
+{
+	const CUtlVector< bool > *pVisible;
+	int iNumQueries;
+
+	FORCEINLINE bool operator()( int iLeaf )
+	{
+		iNumQueries++;
+		return pVisible->Element( iLeaf );
+	};
+};
+
+CON_COMMAND( deferred_leafindex_bench, "Compares per light leaf visibility queries with the leaf index. Args: [iterations]" )
+{
+	const int iIterations = args.ArgC() > 1 ? MAX( 1, atoi( args[1] ) ) : 100;
+	const int iLightCounts[] = { 100, 500, 1000, 2500, 5000 };
+
+	// leaves of a large map laid out on a grid, a tenth of them visible
+	const int iLeavesX = 96;
+	const int iNumLeaves = iLeavesX * iLeavesX;
+
+	CUtlVector< bool > visible;
+	visible.SetCount( iNumLeaves );
+
+	CUniformRandomStream rndVis;
+	rndVis.SetSeed( 1 );
+	for ( int i = 0; i < iNumLeaves; i++ )
+		visible[ i ] = rndVis.RandomInt( 0, 9 ) == 0;
+
+	Msg( "%i leaves, %i iterations\n", iNumLeaves, iIterations );
+
+	for ( int iTest = 0; iTest < ARRAYSIZE( iLightCounts ); iTest++ )
+	{
+		const int iNumLights = iLightCounts[ iTest ];
+
+		CUniformRandomStream rnd;
+		rnd.SetSeed( iNumLights );
+
+		CUtlVector< int > leaves;
+		leaves.SetCount( iNumLights * DEFLIGHT_MAX_LEAVES );
+
+		CUtlVector< const int* > lightLeaves;
+		CUtlVector< int > lightNumLeaves;
+		lightLeaves.SetCount( iNumLights );
+		lightNumLeaves.SetCount( iNumLights );
+
+		// every light touches a block of neighbouring leaves
+		for ( int i = 0; i < iNumLights; i++ )
+		{
+			int *pLeaves = leaves.Base() + i * DEFLIGHT_MAX_LEAVES;
+			int iNumLightLeaves = 0;
+
+			const int x0 = rnd.RandomInt( 0, iLeavesX - 1 );
+			const int y0 = rnd.RandomInt( 0, iLeavesX - 1 );
+			const int iExtent = rnd.RandomInt( 1, 8 );
+
+			for ( int y = y0; y < MIN( iLeavesX, y0 + iExtent ); y++ )
+			{
+				for ( int x = x0; x < MIN( iLeavesX, x0 + iExtent ) && iNumLightLeaves < DEFLIGHT_MAX_LEAVES; x++ )
+					pLeaves[ iNumLightLeaves++ ] = y * iLeavesX + x;
+			}
+
+			lightLeaves[ i ] = pLeaves;
+			lightNumLeaves[ i ] = iNumLightLeaves;
+		}
+
+		CUtlVector< bool > resultBrute;
+		resultBrute.SetCount( iNumLights );
+		int iBruteQueries = 0;
+
+		CFastTimer timerBrute;
+		timerBrute.Start();
+
+		for ( int iter = 0; iter < iIterations; iter++ )
+		{
+			iBruteQueries = 0;
+
+			for ( int i = 0; i < iNumLights; i++ )
+			{
+				bool bVisible = false;
+
+				for ( int iLeaf = 0; iLeaf < lightNumLeaves[ i ] && !bVisible; iLeaf++ )
+				{
+					iBruteQueries++;
+					bVisible = visible[ lightLeaves[ i ][ iLeaf ] ];
+				}
+
+				resultBrute[ i ] = bVisible;
+			}
+		}
+
+		timerBrute.End();
+
+		CLightLeafIndex index;
+
+		CFastTimer timerBuild;
+		timerBuild.Start();
+		index.Build( lightLeaves.Base(), lightNumLeaves.Base(), iNumLights );
+		timerBuild.End();
+
+		benchLeafVisibility_t isLeafVisible;
+		isLeafVisible.pVisible = &visible;
+
+		CFastTimer timerIndex;
+		timerIndex.Start();
+
+		for ( int iter = 0; iter < iIterations; iter++ )
+		{
+			isLeafVisible.iNumQueries = 0;
+			index.FindVisibleLights( isLeafVisible );
+		}
+
+		timerIndex.End();
+
+		int iVisible = 0;
+		int iMismatches = 0;
+		for ( int i = 0; i < iNumLights; i++ )
+		{
+			iVisible += resultBrute[ i ] ? 1 : 0;
+			iMismatches += ( resultBrute[ i ] != index.IsLightVisible( i ) ) ? 1 : 0;
+		}
+
+		Msg( "%5i lights, %4i visible: per light %.4f ms (%i queries), index %.4f ms (%i queries), build %.4f ms\n",
+			iNumLights, iVisible,
+			timerBrute.GetDuration().GetMillisecondsF() / iIterations, iBruteQueries,
+			timerIndex.GetDuration().GetMillisecondsF() / iIterations, isLeafVisible.iNumQueries,
+			timerBuild.GetDuration().GetMillisecondsF() );
+
+		if ( iMismatches > 0 )
+			Warning( "leaf index disagrees with per light queries on %i lights!\n", iMismatches );
+	}
+}
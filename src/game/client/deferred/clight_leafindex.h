@@ -0,0 +1,91 @@
+#ifndef C_LIGHT_LEAFINDEX_H
+#define C_LIGHT_LEAFINDEX_H
+
+#include "cbase.h"
+
+struct def_light_t;
+
+/*
+ * Inverted index from BSP leaves to the lights touching them. Culling asks
+ * the engine once per referenced leaf instead of once per light and leaf,
+ * the lights of every visible leaf are or'ed into a bitset that is indexed
+ * like the light list the index was built from.
+ *
+ * Only needs to be rebuilt when lights are added, removed or moved.
+ */
+class CLightLeafIndex
+{
+public:
+
+	CLightLeafIndex();
+
+	void Purge();
+
+	FORCEINLINE void Invalidate() { m_bValid = false; };
+	FORCEINLINE bool IsValid() const { return m_bValid; };
+
+	void Build( def_light_t * const *pLights, int iNumLights );
+	void Build( const int * const *ppLeaves, const int *pNumLeaves, int iNumLights );
+
+	// functor takes a leaf index and returns whether it's visible
+	template< class T >
+	void FindVisibleLights( T &isLeafVisible );
+
+	FORCEINLINE bool IsLightVisible( int iLight ) const
+	{
+		Assert( iLight >= 0 && iLight < m_iNumLights );
+		return ( m_VisibleBits[ iLight >> 5 ] & ( 1U << ( iLight & 31 ) ) ) != 0;
+	};
+
+	FORCEINLINE int GetNumLights() const { return m_iNumLights; };
+	FORCEINLINE int GetNumLeaves() const { return m_Leaves.Count(); };
+	FORCEINLINE int GetNumReferences() const { return m_LeafLights.Count(); };
+	FORCEINLINE int GetNumVisibleLeaves() const { return m_iNumVisibleLeaves; };
+	FORCEINLINE int GetNumBuilds() const { return m_iNumBuilds; };
+
+private:
+
+	bool m_bValid;
+	int m_iNumLights;
+
+	// leaf u owns light indices [ offsets[u], offsets[u+1] )
+	CUtlVector< int > m_Leaves;
+	CUtlVector< int > m_LeafOffsets;
+	CUtlVector< unsigned short > m_LeafLights;
+
+	// maps bsp leaves to m_Leaves while building
+	CUtlVector< int > m_LeafRemap;
+
+	CUtlVector< unsigned int > m_VisibleBits;
+
+	CUtlVector< const int* > m_BuildLeaves;
+	CUtlVector< int > m_BuildNumLeaves;
+
+	int m_iNumVisibleLeaves;
+	int m_iNumBuilds;
+};
+
+template< class T >
+void CLightLeafIndex::FindVisibleLights( T &isLeafVisible )
+{
+	Assert( m_bValid );
+
+	Q_memset( m_VisibleBits.Base(), 0, m_VisibleBits.Count() * sizeof( unsigned int ) );
+	m_iNumVisibleLeaves = 0;
+
+	const unsigned short *pLights = m_LeafLights.Base();
+	unsigned int *pBits = m_VisibleBits.Base();
+
+	for ( int u = 0; u < m_Leaves.Count(); u++ )
+	{
+		if ( !isLeafVisible( m_Leaves[ u ] ) )
+			continue;
+
+		m_iNumVisibleLeaves++;
+
+		for ( int i = m_LeafOffsets[ u ]; i < m_LeafOffsets[ u + 1 ]; i++ )
+			pBits[ pLights[ i ] >> 5 ] |= 1U << ( pLights[ i ] & 31 );
+	}
+}
+
+#endif
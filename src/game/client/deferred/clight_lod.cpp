@@ -0,0 +1,404 @@
+#include "cbase.h"
+#include "deferred/deferred_shared_common.h"
+
+#include "vstdlib/random.h"
+
+// diameter in pixels below which a level is picked
+static const float s_flSizeThreshold[ LIGHTLOD_COUNT ] = { 0.0f, 48.0f, 32.0f, 16.0f, 6.0f };
+
+// per pixel cost of a feature relative to a simple light
+static const float s_flCookieCost = 0.5f;
+static const float s_flVolumetricsCost = 1.0f;
+static const float s_flShadowCost = 1.0f;
+
+// a shadow view draws the scene again, in draws
+static const float s_flShadowViewDraws = 16.0f;
+
+// share of a proxy paid by each merged light
+static const float s_flMergeShare = 0.25f;
+
+CLightLODPolicy::CLightLODPolicy()
+{
+	m_flFullCost = 0.0f;
+	m_flCost = 0.0f;
+	m_iNumBudgetDemoted = 0;
+
+	Q_memset( m_iNumLights, 0, sizeof( m_iNumLights ) );
+}
+
+float CLightLODPolicy::GetSizeThreshold( int iLod )
+{
+	Assert( iLod >= 0 && iLod < LIGHTLOD_COUNT );
+
+	return s_flSizeThreshold[ iLod ];
+}
+
+int CLightLODPolicy::GetMaxLevel( const lightLodInput_t &input )
+{
+	return ( input.iFeatures & LIGHTLOD_FEATURE_MERGEABLE ) ? LIGHTLOD_MERGED : LIGHTLOD_NO_SHADOW;
+}
+
+float CLightLODPolicy::GetLevelCost( const lightLodInput_t &input, int iLod, float flDrawCost )
+{
+	if ( iLod >= LIGHTLOD_MERGED )
+		return ( input.flCoverage + flDrawCost ) * s_flMergeShare;
+
+	float flCost = flDrawCost + input.flCoverage;
+
+	const bool bShadow = ( input.iFeatures & LIGHTLOD_FEATURE_SHADOW ) != 0;
+
+	if ( iLod < LIGHTLOD_NO_COOKIE && ( input.iFeatures & LIGHTLOD_FEATURE_COOKIE ) )
+		flCost += input.flCoverage * s_flCookieCost;
+
+	// volumetrics march through the shadow map
+	if ( iLod < LIGHTLOD_NO_VOLUMETRICS && bShadow && ( input.iFeatures & LIGHTLOD_FEATURE_VOLUMETRICS ) )
+		flCost += input.flCoverage * s_flVolumetricsCost;
+
+	if ( iLod < LIGHTLOD_NO_SHADOW && bShadow )
+		flCost += input.flCoverage * s_flShadowCost + flDrawCost * s_flShadowViewDraws;
+
+	return flCost;
+}
+
+int CLightLODPolicy::SortBySize( const candidate_t *a, const candidate_t *b )
+{
+	if ( a->flScreenSize != b->flScreenSize )
+		return ( a->flScreenSize < b->flScreenSize ) ? -1 : 1;
+
+	return a->iIndex - b->iIndex;
+}
+
+float CLightLODPolicy::Evaluate( const lightLodInput_t *pInputs, int iNumLights, float flSizeScale,
+	float flBudget, float flDrawCost, int *pLodsOut )
+{
+	m_flFullCost = 0.0f;
+	m_flCost = 0.0f;
+	m_iNumBudgetDemoted = 0;
+
+	for ( int i = 0; i < iNumLights; i++ )
+	{
+		const lightLodInput_t &input = pInputs[ i ];
+		const int iMaxLevel = GetMaxLevel( input );
+
+		int iLod = LIGHTLOD_FULL;
+
+		for ( int iLevel = LIGHTLOD_FULL + 1; iLevel <= iMaxLevel; iLevel++ )
+		{
+			float flThreshold = s_flSizeThreshold[ iLevel ] * flSizeScale;
+
+			if ( input.iPrevLod >= iLevel )
+				flThreshold *= 1.0f + LIGHTLOD_HYSTERESIS;
+
+			if ( input.flScreenSize < flThreshold )
+				iLod = iLevel;
+		}
+
+		pLodsOut[ i ] = iLod;
+
+		m_flFullCost += GetLevelCost( input, LIGHTLOD_FULL, flDrawCost );
+		m_flCost += GetLevelCost( input, iLod, flDrawCost );
+	}
+
+	if ( flBudget > 0.0f )
+	{
+		// lights that were demoted keep their level until there's headroom
+		for ( int iLevel = LIGHTLOD_FULL + 1; iLevel < LIGHTLOD_COUNT; iLevel++ )
+		{
+			DemoteToFit( pInputs, iNumLights, iLevel, true,
+				flBudget * ( 1.0f - LIGHTLOD_HYSTERESIS ), flDrawCost, pLodsOut );
+			DemoteToFit( pInputs, iNumLights, iLevel, false,
+				flBudget, flDrawCost, pLodsOut );
+		}
+	}
+
+	// summed again so the demotions don't accumulate float error
+	m_flCost = 0.0f;
+	Q_memset( m_iNumLights, 0, sizeof( m_iNumLights ) );
+
+	for ( int i = 0; i < iNumLights; i++ )
+	{
+		m_flCost += GetLevelCost( pInputs[ i ], pLodsOut[ i ], flDrawCost );
+		m_iNumLights[ pLodsOut[ i ] ]++;
+	}
+
+	return m_flCost;
+}
+
+void CLightLODPolicy::DemoteToFit( const lightLodInput_t *pInputs, int iNumLights, int iLod, bool bDemotedBefore,
+	float flTarget, float flDrawCost, int *pLods )
+{
+	if ( m_flCost <= flTarget )
+		return;
+
+	m_Candidates.RemoveAll();
+
+	for ( int i = 0; i < iNumLights; i++ )
+	{
+		const lightLodInput_t &input = pInputs[ i ];
+
+		if ( pLods[ i ] >= iLod || iLod > GetMaxLevel( input ) )
+			continue;
+
+		if ( bDemotedBefore && input.iPrevLod < iLod )
+			continue;
+
+		if ( GetLevelCost( input, iLod, flDrawCost ) >= GetLevelCost( input, pLods[ i ], flDrawCost ) )
+			continue;
+
+		candidate_t &c = m_Candidates[ m_Candidates.AddToTail() ];
+		c.iIndex = i;
+		c.flScreenSize = input.flScreenSize;
+	}
+
+	m_Candidates.Sort( SortBySize );
+
+	for ( int i = 0; i < m_Candidates.Count() && m_flCost > flTarget; i++ )
+	{
+		const int iIndex = m_Candidates[ i ].iIndex;
+
+		m_flCost -= GetLevelCost( pInputs[ iIndex ], pLods[ iIndex ], flDrawCost )
+			- GetLevelCost( pInputs[ iIndex ], iLod, flDrawCost );
+
+		pLods[ iIndex ] = iLod;
+		m_iNumBudgetDemoted++;
+	}
+}
+
+struct mergeCell_t
+{
+	int iCell[ 3 ];
+	int iIndex;
+};
+
+static int SortByCell( const mergeCell_t *a, const mergeCell_t *b )
+{
+	for ( int i = 0; i < 3; i++ )
+	{
+		if ( a->iCell[ i ] != b->iCell[ i ] )
+			return ( a->iCell[ i ] < b->iCell[ i ] ) ? -1 : 1;
+	}
+
+	return a->iIndex - b->iIndex;
+}
+
+int CLightLODPolicy::BuildMergeClusters( const Vector *pPositions, int iNumPositions, float flCellSize,
+	int *pClustersOut )
+{
+	Assert( flCellSize > 0.0f );
+
+	CUtlVector< mergeCell_t > hCells;
+	hCells.SetCount( iNumPositions );
+
+	for ( int i = 0; i < iNumPositions; i++ )
+	{
+		for ( int j = 0; j < 3; j++ )
+			hCells[ i ].iCell[ j ] = (int)floor( pPositions[ i ][ j ] / flCellSize );
+
+		hCells[ i ].iIndex = i;
+	}
+
+	hCells.Sort( SortByCell );
+
+	int iNumClusters = 0;
+
+	for ( int i = 0; i < iNumPositions; i++ )
+	{
+		if ( i > 0 && Q_memcmp( hCells[ i - 1 ].iCell, hCells[ i ].iCell, sizeof( hCells[ i ].iCell ) ) != 0 )
+			iNumClusters++;
+
+		pClustersOut[ hCells[ i ].iIndex ] = iNumClusters;
+	}
+
+	return ( iNumPositions > 0 ) ? iNumClusters + 1 : 0;
+}
+
+CON_COMMAND( deferred_light_lod_test, "Runs the light LOD policy over random light sets and warns about levels that break the size thresholds, budget or hysteresis." )
+{
+	CLightLODPolicy policy;
+
+	const int iMaxLights = 256;
+	lightLodInput_t inputs[ iMaxLights ];
+	int iLods[ iMaxLights ];
+	int iLodsAgain[ iMaxLights ];
+	const float flDrawCost = 16384.0f;
+
+	CUniformRandomStream rnd;
+	rnd.SetSeed( 1 );
+
+	int iSizeFailures = 0;
+	int iBudgetFailures = 0;
+	int iHysteresisFailures = 0;
+	int iMergeFailures = 0;
+
+	for ( int iTest = 0; iTest < 100; iTest++ )
+	{
+		const int iNumLights = rnd.RandomInt( 1, iMaxLights );
+		const bool bLarge = ( iTest & 1 ) != 0;
+
+		for ( int i = 0; i < iNumLights; i++ )
+		{
+			// large lights only move by budget
+			inputs[ i ].flScreenSize = bLarge ? rnd.RandomFloat( 64.0f, 1024.0f ) : rnd.RandomFloat( 1.0f, 128.0f );
+			inputs[ i ].flCoverage = inputs[ i ].flScreenSize * inputs[ i ].flScreenSize * 0.785f;
+			inputs[ i ].iFeatures = rnd.RandomInt( 0, 15 );
+			inputs[ i ].iPrevLod = -1;
+		}
+
+		// without a budget only the size counts
+		policy.Evaluate( inputs, iNumLights, 1.0f, 0.0f, flDrawCost, iLods );
+
+		for ( int i = 0; i < iNumLights; i++ )
+		{
+			int iExpected = LIGHTLOD_FULL;
+			for ( int iLevel = LIGHTLOD_FULL + 1; iLevel <= CLightLODPolicy::GetMaxLevel( inputs[ i ] ); iLevel++ )
+			{
+				if ( inputs[ i ].flScreenSize < CLightLODPolicy::GetSizeThreshold( iLevel ) )
+					iExpected = iLevel;
+			}
+
+			if ( iLods[ i ] != iExpected )
+				iSizeFailures++;
+		}
+
+		const float flBudget = policy.GetFullCost() * rnd.RandomFloat( 0.05f, 1.0f );
+		const float flCost = policy.Evaluate( inputs, iNumLights, 1.0f, flBudget, flDrawCost, iLods );
+
+		float flSum = 0.0f;
+		int iMaxUsed = LIGHTLOD_FULL;
+		bool bCanDemote = false;
+
+		for ( int i = 0; i < iNumLights; i++ )
+		{
+			flSum += CLightLODPolicy::GetLevelCost( inputs[ i ], iLods[ i ], flDrawCost );
+			iMaxUsed = MAX( iMaxUsed, iLods[ i ] );
+
+			for ( int iLevel = iLods[ i ] + 1; iLevel <= CLightLODPolicy::GetMaxLevel( inputs[ i ] ); iLevel++ )
+			{
+				if ( CLightLODPolicy::GetLevelCost( inputs[ i ], iLevel, flDrawCost ) <
+					CLightLODPolicy::GetLevelCost( inputs[ i ], iLods[ i ], flDrawCost ) )
+					bCanDemote = true;
+			}
+		}
+
+		if ( fabs( flSum - flCost ) > flSum * 0.0001f )
+			iBudgetFailures++;
+
+		// over budget only when nothing is left to drop
+		if ( flCost > flBudget * 1.0001f && bCanDemote )
+			iBudgetFailures++;
+
+		if ( !bLarge )
+			continue;
+
+		// cheaper levels are used up before the next one starts, smallest first
+		for ( int i = 0; i < iNumLights; i++ )
+		{
+			for ( int iLevel = iLods[ i ] + 1; iLevel <= MIN( iMaxUsed, CLightLODPolicy::GetMaxLevel( inputs[ i ] ) ); iLevel++ )
+			{
+				if ( CLightLODPolicy::GetLevelCost( inputs[ i ], iLevel, flDrawCost ) >=
+					CLightLODPolicy::GetLevelCost( inputs[ i ], iLods[ i ], flDrawCost ) )
+					continue;
+
+				if ( iLevel < iMaxUsed )
+					iBudgetFailures++;
+
+				for ( int j = 0; j < iNumLights; j++ )
+				{
+					if ( iLods[ j ] == iMaxUsed && iLevel == iMaxUsed &&
+						inputs[ j ].flScreenSize > inputs[ i ].flScreenSize )
+						iBudgetFailures++;
+				}
+			}
+		}
+
+		// with history a slightly larger budget only promotes with headroom left
+		for ( int i = 0; i < iNumLights; i++ )
+			inputs[ i ].iPrevLod = iLods[ i ];
+
+		const float flBudgetAgain = flBudget * 1.1f;
+		const float flCostAgain = policy.Evaluate( inputs, iNumLights, 1.0f, flBudgetAgain, flDrawCost, iLodsAgain );
+
+		bool bPromoted = false;
+		for ( int i = 0; i < iNumLights; i++ )
+			bPromoted = bPromoted || iLodsAgain[ i ] < iLods[ i ];
+
+		if ( bPromoted && flCostAgain > flBudgetAgain * ( 1.0f - LIGHTLOD_HYSTERESIS ) * 1.0001f )
+			iHysteresisFailures++;
+
+		// and nothing moves when the last frame's cost used most of the budget
+		if ( flCost > flBudgetAgain * ( 1.0f - LIGHTLOD_HYSTERESIS ) &&
+			Q_memcmp( iLods, iLodsAgain, sizeof( int ) * iNumLights ) != 0 )
+			iHysteresisFailures++;
+	}
+
+	// size hysteresis
+	lightLodInput_t light;
+	light.iFeatures = LIGHTLOD_FEATURE_COOKIE | LIGHTLOD_FEATURE_VOLUMETRICS |
+		LIGHTLOD_FEATURE_SHADOW | LIGHTLOD_FEATURE_MERGEABLE;
+	light.flScreenSize = CLightLODPolicy::GetSizeThreshold( LIGHTLOD_NO_SHADOW ) * ( 1.0f + LIGHTLOD_HYSTERESIS * 0.5f );
+	light.flCoverage = light.flScreenSize * light.flScreenSize;
+
+	int iLod;
+	light.iPrevLod = -1;
+	policy.Evaluate( &light, 1, 1.0f, 0.0f, flDrawCost, &iLod );
+	if ( iLod != LIGHTLOD_NO_VOLUMETRICS )
+		iHysteresisFailures++;
+
+	light.iPrevLod = LIGHTLOD_NO_SHADOW;
+	policy.Evaluate( &light, 1, 1.0f, 0.0f, flDrawCost, &iLod );
+	if ( iLod != LIGHTLOD_NO_SHADOW )
+		iHysteresisFailures++;
+
+	light.flScreenSize = CLightLODPolicy::GetSizeThreshold( LIGHTLOD_NO_SHADOW ) * ( 1.0f + LIGHTLOD_HYSTERESIS * 1.5f );
+	policy.Evaluate( &light, 1, 1.0f, 0.0f, flDrawCost, &iLod );
+	if ( iLod != LIGHTLOD_NO_VOLUMETRICS )
+		iHysteresisFailures++;
+
+	// merge clusters are grid cells
+	Vector positions[ iMaxLights ];
+	int iClusters[ iMaxLights ];
+
+	for ( int i = 0; i < iMaxLights; i++ )
+		positions[ i ].Init( rnd.RandomFloat( -1024, 1024 ), rnd.RandomFloat( -1024, 1024 ), rnd.RandomFloat( -256, 256 ) );
+
+	const float flCellSize = 256.0f;
+	const int iNumClusters = CLightLODPolicy::BuildMergeClusters( positions, iMaxLights, flCellSize, iClusters );
+
+	int iDistinctCells = 0;
+
+	for ( int i = 0; i < iMaxLights; i++ )
+	{
+		if ( iClusters[ i ] < 0 || iClusters[ i ] >= iNumClusters )
+			iMergeFailures++;
+
+		bool bFirstInCell = true;
+
+		for ( int j = 0; j < iMaxLights; j++ )
+		{
+			bool bSameCell = true;
+			for ( int k = 0; k < 3; k++ )
+				bSameCell = bSameCell && floor( positions[ i ][ k ] / flCellSize ) == floor( positions[ j ][ k ] / flCellSize );
+
+			if ( bSameCell != ( iClusters[ i ] == iClusters[ j ] ) )
+				iMergeFailures++;
+
+			if ( bSameCell && j < i )
+				bFirstInCell = false;
+		}
+
+		if ( bFirstInCell )
+			iDistinctCells++;
+	}
+
+	if ( iDistinctCells != iNumClusters )
+		iMergeFailures++;
+
+	if ( iSizeFailures > 0 )
+		Warning( "size levels: %i lights off their threshold\n", iSizeFailures );
+	if ( iBudgetFailures > 0 )
+		Warning( "budget: %i frames miscounted, over budget or demoted out of order\n", iBudgetFailures );
+	if ( iHysteresisFailures > 0 )
+		Warning( "hysteresis: %i lights changed level inside the margin\n", iHysteresisFailures );
+	if ( iMergeFailures > 0 )
+		Warning( "merge clusters: %i lights in the wrong cluster\n", iMergeFailures );
+}
@@ -0,0 +1,95 @@
+#ifndef C_LIGHT_LOD_H
+#define C_LIGHT_LOD_H
+
+#include "cbase.h"
+
+// every level drops the feature of its own and all lower levels
+enum
+{
+	LIGHTLOD_FULL = 0,
+	LIGHTLOD_NO_COOKIE,
+	LIGHTLOD_NO_VOLUMETRICS,
+	LIGHTLOD_NO_SHADOW,
+	LIGHTLOD_MERGED,
+
+	LIGHTLOD_COUNT,
+};
+
+#define LIGHTLOD_FEATURE_COOKIE			( 1 << 0 )
+#define LIGHTLOD_FEATURE_VOLUMETRICS	( 1 << 1 )
+#define LIGHTLOD_FEATURE_SHADOW			( 1 << 2 )
+// point light without lightstyle that doesn't contain the view
+#define LIGHTLOD_FEATURE_MERGEABLE		( 1 << 3 )
+
+// size thresholds and the budget both need this much headroom to promote again
+#define LIGHTLOD_HYSTERESIS 0.2f
+
+struct lightLodInput_t
+{
+	// diameter on screen in pixels
+	float flScreenSize;
+	// pixels covered, clamped to the screen
+	float flCoverage;
+	int iFeatures;
+	// level of the last frame, -1 without history
+	int iPrevLod;
+};
+
+/*
+ * Picks a LOD level per light. Lights first drop features by their size on
+ * screen, then, if the frame is over its cost budget, cookies are dropped
+ * from the smallest lights up, then volumetrics, shadows and finally tiny
+ * point lights are merged into proxies. Both steps have hysteresis so lights
+ * near a threshold don't flicker between levels.
+ *
+ * Costs are rough per pixel light evaluations plus a fixed cost per draw.
+ */
+class CLightLODPolicy
+{
+public:
+
+	CLightLODPolicy();
+
+	// thresholds are scaled by flSizeScale, a budget of 0 is unlimited;
+	// returns the cost of the frame at the picked levels
+	float Evaluate( const lightLodInput_t *pInputs, int iNumLights, float flSizeScale,
+		float flBudget, float flDrawCost, int *pLodsOut );
+
+	static float GetLevelCost( const lightLodInput_t &input, int iLod, float flDrawCost );
+	static int GetMaxLevel( const lightLodInput_t &input );
+	static float GetSizeThreshold( int iLod );
+
+	// groups positions by grid cell, writes a cluster per position and
+	// returns the number of clusters; clusters are numbered in cell order
+	static int BuildMergeClusters( const Vector *pPositions, int iNumPositions, float flCellSize,
+		int *pClustersOut );
+
+	FORCEINLINE float GetFullCost() const { return m_flFullCost; };
+	FORCEINLINE float GetCost() const { return m_flCost; };
+	FORCEINLINE int GetNumLights( int iLod ) const { return m_iNumLights[ iLod ]; };
+	FORCEINLINE int GetNumBudgetDemoted() const { return m_iNumBudgetDemoted; };
+
+private:
+
+	struct candidate_t
+	{
+		int iIndex;
+		float flScreenSize;
+	};
+
+	static int SortBySize( const candidate_t *a, const candidate_t *b );
+
+	// demotes the smallest candidates to iLod until the cost fits flTarget,
+	// bDemotedBefore limits it to lights that were at iLod or worse last frame
+	void DemoteToFit( const lightLodInput_t *pInputs, int iNumLights, int iLod, bool bDemotedBefore,
+		float flTarget, float flDrawCost, int *pLods );
+
+	CUtlVector< candidate_t > m_Candidates;
+
+	float m_flFullCost;
+	float m_flCost;
+	int m_iNumLights[ LIGHTLOD_COUNT ];
+	int m_iNumBudgetDemoted;
+};
+
+#endif
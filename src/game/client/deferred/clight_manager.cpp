@@ -6,8 +6,10 @@
 #include "viewrender.h"
 #include "view_shared.h"
 #include "engine/IVDebugOverlay.h"
+#include "filesystem.h"
 #include "tier0/fasttimer.h"
 #include "tier1/callqueue.h"
+#include "vstdlib/jobthread.h"
 
 static CLightingManager __g_lightingMan;
 CLightingManager *GetLightingManager()
@@ -29,14 +31,37 @@ CLightingManager::CLightingManager() : BaseClass( "LightingManagerSystem" )
 	m_bDrawWorldLights = true;
 
 	MatrixSetIdentity( m_matScreenToWorld );
+	MatrixSetIdentity( m_matWorldToScreen );
 
 	m_vecViewOrigin.Init();
 	m_vecForward.Init();
 	m_flzNear = 0;
 	m_bDrawVolumetrics = false;
-#if DEFCFG_USE_SSE
-	m_pSortDataX4 = NULL;
-	m_uiSortDataCount = 0;
+
+	m_bUseLeafIndex = false;
+
+	m_iNumLightJobs = 0;
+	m_iNumLightProxies = 0;
+	m_bOcclusionQueries = false;
+	m_bOcclusionSoftware = false;
+	m_vecOcclusionOrigin.Init();
+	m_iNumOccludedLights = 0;
+	m_iNumOcclusionQueries = 0;
+	m_iNumLightBatches = 0;
+	m_iNumBatchedLights = 0;
+	m_flPrepareLightsTime = 0;
+	m_flCullLightsTime = 0;
+
+	m_bLightBake = false;
+	m_bLightBakeSave = false;
+	m_bHasMapCRC = false;
+	m_iMapCRC = 0;
+	m_szLightBakeFile[ 0 ] = '\0';
+	m_iNumBakedLights = 0;
+	m_iNumTracedLights = 0;
+
+#if DEFCFG_CONFIGURABLE_VOLUMETRIC_LOD
+	m_iVolumetricSamplesFrame = 0;
 #endif
 }
 
@@ -56,21 +81,81 @@ void CLightingManager::Shutdown()
 	materials->RemoveReleaseFunc( LightingResourceRelease );
 
 #if DEFCFG_USE_SSE
-	if( m_pSortDataX4 != NULL )
-	{
-		MemAlloc_FreeAligned( m_pSortDataX4 );
-		m_pSortDataX4 = NULL;
-	}
+	m_LightStore.Purge();
 #endif
+
+	m_LightDataArena.Purge();
+
+	m_hLightProxies.PurgeAndDeleteElements();
 }
 
 void CLightingManager::LevelInitPostEntity()
 {
+	m_OcclusionProxyMaterial.Init( "engine/occlusionproxy", TEXTURE_GROUP_CLIENT_EFFECTS );
+
+	CMatRenderContextPtr pRenderContext( materials );
+	OcclusionQueryObjectHandle_t hQuery = pRenderContext->CreateOcclusionQueryObject();
+
+	m_bOcclusionQueries = hQuery != INVALID_OCCLUSION_QUERY_OBJECT_HANDLE;
+
+	if ( m_bOcclusionQueries )
+		pRenderContext->DestroyOcclusionQueryObject( hQuery );
+
+	m_LightBake.Purge();
+	m_bLightBakeSave = false;
+	m_iNumBakedLights = 0;
+	m_iNumTracedLights = 0;
+
+	CLightBakeCache::GetFileName( engine->GetLevelName(), m_szLightBakeFile, sizeof( m_szLightBakeFile ) );
+
+	// hashing the whole bsp is only worth it with a file to check it against
+	m_bHasMapCRC = deferred_light_bake.GetBool() &&
+		g_pFullFileSystem->FileExists( m_szLightBakeFile, "GAME" ) &&
+		CLightBakeCache::CalcMapCRC( engine->GetLevelName(), m_iMapCRC );
+
+	if ( m_bHasMapCRC &&
+		m_LightBake.Load( m_szLightBakeFile, m_iMapCRC ) )
+		DevMsg( "Loaded %i light bakes from %s.\n", m_LightBake.GetNumBakes(), m_szLightBakeFile );
 }
 
 void CLightingManager::LevelShutdownPostEntity()
 {
+	m_LightBake.Purge();
+	m_bHasMapCRC = false;
+	m_szLightBakeFile[ 0 ] = '\0';
+
 	m_hRenderLights.Purge();
+	m_hRenderLightsFullscreen.Purge();
+	m_hDirtyXFormLights.Purge();
+
+	m_LeafIndex.Purge();
+
+#if DEFCFG_SHADOW_CACHE
+	m_ShadowCache.Purge();
+#endif
+
+	m_ShadowScheduler.Reset();
+	m_hShadowScheduleLights.Purge();
+
+#if DEFCFG_CONFIGURABLE_VOLUMETRIC_LOD
+	m_hVolumetricLights.Purge();
+	m_VolumetricBaseSamples.Purge();
+	m_VolumetricCoverage.Purge();
+	m_VolumetricSamples.Purge();
+#endif
+
+	m_iNumLightProxies = 0;
+	m_hLightProxies.PurgeAndDeleteElements();
+
+	m_hOcclusionQueryLights.Purge();
+	m_OcclusionProxyMaterial.Shutdown();
+
+	for ( int i = 0; i < LIGHTJOB_MAX; i++ )
+	{
+		m_LightJobs[ i ].hLights.Purge();
+		m_LightJobs[ i ].hFullscreen.Purge();
+		m_LightJobs[ i ].hIndices.Purge();
+	}
 
 	for ( int i = 0; i < LSORT_COUNT; i++ )
 		m_hPreSortedLights[ i ].Purge();
@@ -89,6 +174,7 @@ void CLightingManager::SetRenderConstants( const VMatrix &ScreenToWorld,
 		const CViewSetup &setup )
 {
 	m_matScreenToWorld = ScreenToWorld;
+	MatrixInverseGeneral( m_matScreenToWorld, m_matWorldToScreen );
 
 	m_vecViewOrigin = setup.origin;
 	AngleVectors( setup.angles, &m_vecForward );
@@ -98,16 +184,41 @@ void CLightingManager::SetRenderConstants( const VMatrix &ScreenToWorld,
 
 void CLightingManager::LightSetup( const CViewSetup &setup )
 {
+	GetDeferredPipeline()->Update();
+
+	CFastTimer timer;
+	timer.Start();
+
 	PrepareLights();
 
+	timer.End();
+	m_flPrepareLightsTime = timer.GetDuration().GetMillisecondsF();
+
+#if DEFCFG_SHADOW_CACHE
+	m_ShadowCache.InvalidateLights( m_hDirtyXFormLights.Base(), m_hDirtyXFormLights.Count() );
+
+	if ( deferred_shadow_cache.GetBool() )
+		m_ShadowCache.UpdateMovers();
+#endif
+
 #if DEBUG
 	m_bVolatileLists = true;
 #endif
 
+	timer.Start();
+
 	CullLights();
+	CullOccludedLights();
 
-#if DEFCFG_USE_SSE
-	BuildLightSortDataBuffer();
+	timer.End();
+	m_flCullLightsTime = timer.GetDuration().GetMillisecondsF();
+
+	ApplyLightLOD( setup );
+
+	ScheduleShadowViews();
+
+#if DEFCFG_CONFIGURABLE_VOLUMETRIC_LOD
+	BudgetVolumetrics( setup );
 #endif
 
 	SortLights();
@@ -118,349 +229,926 @@ void CLightingManager::LightSetup( const CViewSetup &setup )
 	}
 }
 
+int CLightingManager::SortByViewDistance( def_light_t * const *a, def_light_t * const *b )
+{
+	if ( (*a)->flDistance_ViewOrigin != (*b)->flDistance_ViewOrigin )
+		return ( (*a)->flDistance_ViewOrigin < (*b)->flDistance_ViewOrigin ) ? -1 : 1;
+
+	return 0;
+}
+
+void CLightingManager::ScheduleShadowViews()
+{
+	m_hShadowScheduleLights.RemoveAll();
+
+	FOR_EACH_VEC_FAST( def_light_t*, m_hRenderLights, l )
+	{
+		if ( l->ShouldRenderShadow() )
+			m_hShadowScheduleLights.AddToTail( l );
+	}
+	FOR_EACH_VEC_FAST_END
+
+	m_hShadowScheduleLights.Sort( SortByViewDistance );
+
+	FOR_EACH_VEC_FAST( def_light_t*, m_hShadowScheduleLights, l )
+	{
+#if DEFCFG_SHADOW_CACHE
+		const bool bCacheable = m_ShadowCache.IsCacheable( l );
+		const int iShadowRes = l->IsPoint() ? GetShadowResolution_Point() : GetShadowResolution_Spot();
+
+		// copies of cached maps are free
+		if ( bCacheable && m_ShadowCache.HasEntry( l, iShadowRes, false ) )
+			continue;
+#endif
+
+		if ( m_ShadowScheduler.RequestViews( l->IsPoint() ? 2 : 1 ) )
+			continue;
+
+#if DEFCFG_SHADOW_CACHE
+		if ( bCacheable && m_ShadowCache.HasEntry( l, iShadowRes, true ) )
+		{
+			l->bShadowStale = true;
+			m_ShadowScheduler.OnShadowStale();
+			continue;
+		}
+#endif
+
+		// fades the shadow out for this frame, the farthest lights go first
+		l->flShadowFade = 1.0f;
+		m_ShadowScheduler.OnShadowDropped();
+	}
+	FOR_EACH_VEC_FAST_END
+}
+
+void CLightingManager::CullOccludedLights()
+{
+	m_hOcclusionQueryLights.RemoveAll();
+	m_iNumOccludedLights = 0;
+
+	const int iMode = deferred_light_occlusion.GetInt();
+
+	if ( iMode <= 0 )
+		return;
+
+	m_bOcclusionSoftware = iMode >= 2 || !m_bOcclusionQueries;
+
+	if ( m_bOcclusionSoftware )
+		UpdateOcclusionBuffer();
+
+	// last frame's results don't hold after a teleport
+	const bool bViewMoved = m_vecOcclusionOrigin.DistToSqr( m_vecViewOrigin ) > Square( LIGHTOCCLUSION_MAX_MOVE );
+	m_vecOcclusionOrigin = m_vecViewOrigin;
+
+	const int iFrame = gpGlobals->framecount;
+	CMatRenderContextPtr pRenderContext( materials );
+
+	int iWrite = 0;
+	for ( int i = 0; i < m_hRenderLights.Count(); i++ )
+	{
+		def_light_t *l = m_hRenderLights[ i ];
+		const bool bFullscreen = m_hRenderLightsFullscreen[ i ];
+
+		bool bOccluded = false;
+
+		// the volume of a light around the view can't be hidden
+		if ( bFullscreen )
+			CLightOcclusion::Invalidate( l->occlusion );
+		else if ( m_bOcclusionSoftware )
+			bOccluded = m_OcclusionBuffer.IsBoxOccluded( l->bounds_min_naive, l->bounds_max_naive );
+		else
+		{
+			if ( l->occlusion.iIssueFrame >= 0 )
+				CLightOcclusion::OnResult( l->occlusion,
+					pRenderContext->OcclusionQuery_GetNumPixelsRendered( l->occlusion.hQuery ) );
+
+			bOccluded = !bViewMoved && CLightOcclusion::IsOccluded( l->occlusion, iFrame );
+
+			// hidden lights are queried too, to find out when they show up again
+			m_hOcclusionQueryLights.AddToTail( l );
+		}
+
+		if ( bOccluded )
+		{
+			m_iNumOccludedLights++;
+			continue;
+		}
+
+		m_hRenderLights[ iWrite ] = l;
+		m_hRenderLightsFullscreen[ iWrite ] = bFullscreen;
+		iWrite++;
+	}
+
+	m_hRenderLights.SetCountNonDestructively( iWrite );
+	m_hRenderLightsFullscreen.SetCountNonDestructively( iWrite );
+}
+
+void CLightingManager::UpdateOcclusionBuffer()
+{
+	if ( m_OcclusionBuffer.GetWidth() == 0 )
+		m_OcclusionBuffer.Init( LIGHTOCCLUSION_SW_WIDTH, LIGHTOCCLUSION_SW_HEIGHT );
+
+	m_OcclusionBuffer.SetView( m_matWorldToScreen );
+
+	CTraceFilterWorldOnly filter;
+	trace_t tr;
+
+	// brushes and displacements only, props never hide a light
+	for ( int i = 0; i < m_OcclusionBuffer.GetNumCorners(); i++ )
+	{
+		float x, y;
+		m_OcclusionBuffer.GetCornerDeviceCoords( i, x, y );
+
+		Vector vecEnd;
+		Vector3DMultiplyPositionProjective( m_matScreenToWorld, Vector( x, y, 1 ), vecEnd );
+
+		UTIL_TraceLine( m_vecViewOrigin, vecEnd, MASK_OPAQUE, &filter, &tr );
+
+		m_OcclusionBuffer.SetCornerDepth( i, ( tr.fraction < 1.0f && !tr.startsolid ) ?
+			m_OcclusionBuffer.GetDepth( tr.endpos ) : FLT_MAX );
+	}
+
+	m_OcclusionBuffer.Resolve();
+}
+
+void CLightingManager::IssueOcclusionQueries()
+{
+	m_iNumOcclusionQueries = 0;
+
+	if ( m_hOcclusionQueryLights.Count() == 0 || !m_OcclusionProxyMaterial.IsValid() )
+		return;
+
+	const int iFrame = gpGlobals->framecount;
+
+	// the light accumulation target still has the scene depth bound
+	CMatRenderContextPtr pRenderContext( materials );
+	pRenderContext->MatrixMode( MATERIAL_MODEL );
+	pRenderContext->PushMatrix();
+	pRenderContext->LoadIdentity();
+	pRenderContext->CullMode( MATERIAL_CULLMODE_NONE );
+
+	FOR_EACH_VEC_FAST( def_light_t*, m_hOcclusionQueryLights, l )
+	{
+		lightOcclusion_t &occlusion = l->occlusion;
+
+		if ( !CLightOcclusion::ShouldIssue( occlusion, iFrame ) )
+			continue;
+
+		if ( occlusion.hQuery == INVALID_OCCLUSION_QUERY_OBJECT_HANDLE )
+			occlusion.hQuery = pRenderContext->CreateOcclusionQueryObject();
+
+		if ( occlusion.hQuery == INVALID_OCCLUSION_QUERY_OBJECT_HANDLE )
+			continue;
+
+		const Vector &vecMins = l->bounds_min_naive;
+		const Vector &vecMaxs = l->bounds_max_naive;
+
+		pRenderContext->BeginOcclusionQueryDrawing( occlusion.hQuery );
+
+		CMeshBuilder meshBuilder;
+		IMesh *pMesh = pRenderContext->GetDynamicMesh( true, NULL, NULL, m_OcclusionProxyMaterial );
+		meshBuilder.Begin( pMesh, MATERIAL_QUADS, 6 );
+
+		// two faces per axis, corners walk around the face
+		for ( int iAxis = 0; iAxis < 3; iAxis++ )
+		{
+			const int iU = ( iAxis + 1 ) % 3;
+			const int iV = ( iAxis + 2 ) % 3;
+
+			for ( int iSide = 0; iSide < 2; iSide++ )
+			{
+				for ( int iCorner = 0; iCorner < 4; iCorner++ )
+				{
+					Vector vecPos;
+					vecPos[ iAxis ] = iSide ? vecMaxs[ iAxis ] : vecMins[ iAxis ];
+					vecPos[ iU ] = ( iCorner == 1 || iCorner == 2 ) ? vecMaxs[ iU ] : vecMins[ iU ];
+					vecPos[ iV ] = ( iCorner >= 2 ) ? vecMaxs[ iV ] : vecMins[ iV ];
+
+					meshBuilder.Position3fv( vecPos.Base() );
+					meshBuilder.AdvanceVertex();
+				}
+			}
+		}
+
+		meshBuilder.End();
+		pMesh->Draw();
+
+		pRenderContext->EndOcclusionQueryDrawing( occlusion.hQuery );
+
+		CLightOcclusion::OnIssued( occlusion, iFrame );
+		m_iNumOcclusionQueries++;
+	}
+	FOR_EACH_VEC_FAST_END
+
+	pRenderContext->CullMode( MATERIAL_CULLMODE_CCW );
+	pRenderContext->MatrixMode( MATERIAL_MODEL );
+	pRenderContext->PopMatrix();
+}
+
+void CLightingManager::ReleaseOcclusionQuery( def_light_t *l )
+{
+	if ( l->occlusion.hQuery != INVALID_OCCLUSION_QUERY_OBJECT_HANDLE )
+	{
+		CMatRenderContextPtr pRenderContext( materials );
+		pRenderContext->DestroyOcclusionQueryObject( l->occlusion.hQuery );
+	}
+
+	CLightOcclusion::Init( l->occlusion );
+}
+
+void CLightingManager::ApplyLightLOD( const CViewSetup &setup )
+{
+	m_iNumLightProxies = 0;
+
+	if ( !deferred_light_lod.GetBool() )
+		return;
+
+	const int iNumLights = m_hRenderLights.Count();
+	m_LightLODInputs.SetCount( iNumLights );
+	m_LightLODs.SetCount( iNumLights );
+
+	const float flProjScale = setup.width * 0.5f / tan( DEG2RAD( setup.fov * 0.5f ) );
+	const float flScreenArea = setup.width * setup.height;
+
+	for ( int i = 0; i < iNumLights; i++ )
+	{
+		def_light_t *l = m_hRenderLights[ i ];
+		lightLodInput_t &input = m_LightLODInputs[ i ];
+
+		// inside the radius the light covers the screen
+		const float flDistance = MAX( 1.0f, MAX( l->flDistance_ViewOrigin, l->flRadius ) );
+		input.flScreenSize = 2.0f * flProjScale * l->flRadius / flDistance;
+		input.flCoverage = MIN( flScreenArea, Square( input.flScreenSize ) * ( M_PI_F * 0.25f ) );
+
+		input.iFeatures = 0;
+
+		if ( l->HasCookie() && l->IsCookieReady() )
+			input.iFeatures |= LIGHTLOD_FEATURE_COOKIE;
+		if ( l->HasVolumetrics() )
+			input.iFeatures |= LIGHTLOD_FEATURE_VOLUMETRICS;
+		if ( l->ShouldRenderShadow() )
+			input.iFeatures |= LIGHTLOD_FEATURE_SHADOW;
+		if ( l->IsPoint() && !l->HasLightstyle() && !m_hRenderLightsFullscreen[ i ] )
+			input.iFeatures |= LIGHTLOD_FEATURE_MERGEABLE;
+
+		input.iPrevLod = ( l->iLodFrame >= gpGlobals->framecount - 1 ) ? l->iLodHistory : -1;
+	}
+
+	m_LightLOD.Evaluate( m_LightLODInputs.Base(), iNumLights, deferred_light_lod_size_scale.GetFloat(),
+		deferred_light_lod_budget.GetFloat(), deferred_lightmanager_batch_drawcost.GetFloat(), m_LightLODs.Base() );
+
+	for ( int i = 0; i < iNumLights; i++ )
+	{
+		def_light_t *l = m_hRenderLights[ i ];
+
+		l->iLod = m_LightLODs[ i ];
+		l->iLodHistory = l->iLod;
+		l->iLodFrame = gpGlobals->framecount;
+
+		// keeps the light away from the shadow scheduler and atlas
+		if ( l->iLod >= LIGHTLOD_NO_SHADOW )
+			l->flShadowFade = 1.0f;
+	}
+
+	if ( m_LightLOD.GetNumLights( LIGHTLOD_MERGED ) > 0 )
+		MergeLights();
+}
+
+def_light_t *CLightingManager::AllocateLightProxy()
+{
+	if ( m_iNumLightProxies == m_hLightProxies.Count() )
+		m_hLightProxies.AddToTail( new def_light_t() );
+
+	def_light_t *pProxy = m_hLightProxies[ m_iNumLightProxies++ ];
+
+	pProxy->iLighttype = DEFLIGHTTYPE_POINT;
+	pProxy->iFlags = 0;
+	pProxy->pos.Init();
+	pProxy->col_diffuse.Init();
+	pProxy->col_ambient.Init();
+	pProxy->flRadius = 0;
+	pProxy->flFalloffPower = 0;
+
+	// the members are faded already
+	pProxy->iVisible_Dist = 0xFFFF;
+	pProxy->iVisible_Range = 1;
+
+	return pProxy;
+}
+
+void CLightingManager::MergeLights()
+{
+	m_hMergedLights.RemoveAll();
+	m_MergePositions.RemoveAll();
+
+	FOR_EACH_VEC_FAST( def_light_t*, m_hRenderLights, l )
+	{
+		if ( l->iLod == LIGHTLOD_MERGED )
+		{
+			m_hMergedLights.AddToTail( l );
+			m_MergePositions.AddToTail( l->pos );
+		}
+	}
+	FOR_EACH_VEC_FAST_END
+
+	const int iNumMerged = m_hMergedLights.Count();
+	m_MergeClusters.SetCount( iNumMerged );
+
+	const int iNumClusters = CLightLODPolicy::BuildMergeClusters( m_MergePositions.Base(), iNumMerged,
+		MAX( 1.0f, deferred_light_lod_merge_size.GetFloat() ), m_MergeClusters.Base() );
+
+	m_MergeClusterProxies.SetCount( iNumClusters );
+	m_MergeWeights.SetCount( iNumClusters );
+
+	for ( int i = 0; i < iNumClusters; i++ )
+		m_MergeClusterProxies[ i ] = 0;
+
+	for ( int i = 0; i < iNumMerged; i++ )
+		m_MergeClusterProxies[ m_MergeClusters[ i ] ]++;
+
+	// lone lights keep their own draw
+	for ( int i = 0; i < iNumClusters; i++ )
+	{
+		m_MergeWeights[ i ] = 0;
+
+		if ( m_MergeClusterProxies[ i ] > 1 )
+		{
+			m_MergeClusterProxies[ i ] = m_iNumLightProxies;
+			AllocateLightProxy();
+		}
+		else
+			m_MergeClusterProxies[ i ] = -1;
+	}
+
+	// centroid and falloff weighted by the energy of the members
+	for ( int i = 0; i < iNumMerged; i++ )
+	{
+		def_light_t *l = m_hMergedLights[ i ];
+		const int iCluster = m_MergeClusters[ i ];
+
+		if ( m_MergeClusterProxies[ iCluster ] < 0 )
+		{
+			l->iLod = l->iLodHistory = LIGHTLOD_NO_SHADOW;
+			continue;
+		}
+
+		def_light_t *pProxy = m_hLightProxies[ m_MergeClusterProxies[ iCluster ] ];
+		const float flWeight = ( l->col_diffuse.Length() + 0.001f ) * Square( l->flRadius );
+
+		pProxy->pos += l->pos * flWeight;
+		pProxy->flFalloffPower += l->flFalloffPower * flWeight;
+		m_MergeWeights[ iCluster ] += flWeight;
+	}
+
+	for ( int i = 0; i < iNumClusters; i++ )
+	{
+		if ( m_MergeClusterProxies[ i ] < 0 )
+			continue;
+
+		def_light_t *pProxy = m_hLightProxies[ m_MergeClusterProxies[ i ] ];
+		pProxy->pos /= m_MergeWeights[ i ];
+		pProxy->flFalloffPower /= m_MergeWeights[ i ];
+	}
+
+	// the proxy covers all members
+	for ( int i = 0; i < iNumMerged; i++ )
+	{
+		const int iProxy = m_MergeClusterProxies[ m_MergeClusters[ i ] ];
+
+		if ( iProxy < 0 )
+			continue;
+
+		def_light_t *l = m_hMergedLights[ i ];
+		def_light_t *pProxy = m_hLightProxies[ iProxy ];
+		pProxy->flRadius = MAX( pProxy->flRadius, pProxy->pos.DistTo( l->pos ) + l->flRadius );
+	}
+
+	// colors are spread over the larger volume, faded members contribute less
+	for ( int i = 0; i < iNumMerged; i++ )
+	{
+		const int iProxy = m_MergeClusterProxies[ m_MergeClusters[ i ] ];
+
+		if ( iProxy < 0 )
+			continue;
+
+		def_light_t *l = m_hMergedLights[ i ];
+		def_light_t *pProxy = m_hLightProxies[ iProxy ];
+
+		const float flFade = 1.0f - SATURATE( ( l->flDistance_ViewOrigin - l->iVisible_Dist ) / l->iVisible_Range );
+		const float flScale = flFade * Square( l->flRadius / pProxy->flRadius );
+
+		pProxy->col_diffuse += l->col_diffuse * flScale;
+		pProxy->col_ambient += l->col_ambient * flScale;
+	}
+
+	// swap the members for their proxies
+	int iWrite = 0;
+	for ( int i = 0; i < m_hRenderLights.Count(); i++ )
+	{
+		def_light_t *l = m_hRenderLights[ i ];
+
+		if ( l->iLod == LIGHTLOD_MERGED )
+			continue;
+
+		m_hRenderLights[ iWrite ] = l;
+		m_hRenderLightsFullscreen[ iWrite ] = m_hRenderLightsFullscreen[ i ];
+		iWrite++;
+	}
+
+	m_hRenderLights.SetCountNonDestructively( iWrite );
+	m_hRenderLightsFullscreen.SetCountNonDestructively( iWrite );
+
+	const float zNear = m_flzNear + 2;
+	const Vector vecBloat( zNear, zNear, zNear );
+
+	for ( int i = 0; i < m_iNumLightProxies; i++ )
+	{
+		def_light_t *pProxy = m_hLightProxies[ i ];
+
+		pProxy->UpdateProxyXForms();
+		pProxy->UpdateViewDistance( m_vecViewOrigin );
+
+		m_hRenderLights.AddToTail( pProxy );
+		m_hRenderLightsFullscreen.AddToTail( IsPointInBounds( m_vecViewOrigin,
+			pProxy->bounds_min_naive - vecBloat,
+			pProxy->bounds_max_naive + vecBloat ) );
+	}
+}
+
+#if DEFCFG_CONFIGURABLE_VOLUMETRIC_LOD
+void CLightingManager::BudgetVolumetrics( const CViewSetup &setup )
+{
+	m_iVolumetricSamplesFrame = 0;
+
+	// lights budgeted last frame fall back to their own samples
+	FOR_EACH_VEC_FAST( def_light_t*, m_hVolumetricLights, l )
+	{
+		l->iVolumeSamplesFrame = 0;
+	}
+	FOR_EACH_VEC_FAST_END
+
+	m_hVolumetricLights.RemoveAll();
+
+	const float flBudget = deferred_volumetrics_sample_budget.GetFloat();
+
+	if ( flBudget <= 0.0f )
+		return;
+
+	m_VolumetricBaseSamples.RemoveAll();
+	m_VolumetricCoverage.RemoveAll();
+
+	const float flScreenArea = MAX( 1, setup.width * setup.height );
+
+	FOR_EACH_VEC_FAST( def_light_t*, m_hRenderLights, l )
+	{
+		if ( !l->ShouldRenderVolumetrics() )
+			continue;
+
+		// inside the bounds the volume covers the whole screen
+		lightBatchRect_t rect;
+		float flCoverage = 1.0f;
+		if ( CLightBatchBuilder::CalcScreenRect( m_matWorldToScreen, l->GetBoundsMinNaive(), l->GetBoundsMaxNaive(),
+			setup.width, setup.height, rect ) )
+			flCoverage = ( rect.x1 - rect.x0 ) * ( rect.y1 - rect.y0 ) / flScreenArea;
+
+		m_hVolumetricLights.AddToTail( l );
+		m_VolumetricBaseSamples.AddToTail( GetVolumetricSamples( setup.origin, l ) );
+		m_VolumetricCoverage.AddToTail( flCoverage );
+	}
+	FOR_EACH_VEC_FAST_END
+
+	const int iNumLights = m_hVolumetricLights.Count();
+	m_VolumetricSamples.SetCount( iNumLights );
+
+	CVolumetricBudget::BudgetSamples( m_VolumetricBaseSamples.Base(), m_VolumetricCoverage.Base(), iNumLights,
+		flBudget, m_VolumetricSamples.Base() );
+
+	for ( int i = 0; i < iNumLights; i++ )
+	{
+		m_hVolumetricLights[ i ]->iVolumeSamplesFrame = m_VolumetricSamples[ i ];
+		m_iVolumetricSamplesFrame += m_VolumetricSamples[ i ];
+	}
+}
+
+int CLightingManager::GetVolumetricSamples( const Vector &vecViewOrigin, def_light_t *l ) const
+{
+	if ( GetDeferredPipeline()->GetVolumetricLOD() != DEFPIPE_VOLUMLOD_DISTANCE )
+		return l->iVolumeSamples;
+
+	// full quality up to twice the radius, half for every doubling after that
+	const float flBands = vecViewOrigin.DistTo( l->pos ) / MAX( 1.0f, l->flRadius * 2.0f );
+
+	int iBand = 0;
+	for ( float flEdge = 1.0f; flBands > flEdge && iBand < 4; flEdge *= 2.0f )
+		iBand++;
+
+	return MAX( VOLUMETRIC_MIN_SAMPLES, l->iVolumeSamples >> iBand );
+}
+#endif
+
 void CLightingManager::LightTearDown()
 {
 	DoSceneDebug();
 
-	ClearTmpLists();
+	ClearTmpLists();
+
+#if DEBUG
+	m_bVolatileLists = false;
+#endif
+}
+
+void CLightingManager::OnCookieStringReceived( const char *pszString, const int &index )
+{
+	ITexture *pTexCookie = materials->FindTexture( pszString, TEXTURE_GROUP_OTHER );
+
+	if ( IsErrorTexture( pTexCookie ) )
+		return;
+}
+
+void CLightingManager::OnMaterialReload()
+{
+	FOR_EACH_VEC_FAST( def_light_t*, m_hDeferredLights, l )
+	{
+		l->ClearCookie();
+
+		l->MakeDirtyAll();
+	}
+	FOR_EACH_VEC_FAST_END
+}
+
+void CLightingManager::AddLight( def_light_t *l )
+{
+	Assert( !m_hDeferredLights.HasElement( l ) );
+
+	m_hDeferredLights.AddToTail( l );
+	m_LeafIndex.Invalidate();
+
+#if DEFCFG_USE_SSE
+	m_LightStore.AddLight( l );
+	Assert( m_LightStore.Count() == m_hDeferredLights.Count() );
+#endif
+}
+
+bool CLightingManager::RemoveLight( def_light_t *l )
+{
+#if DEBUG
+	AssertMsg( m_bVolatileLists == false, "You MUST NOT remove lights while rendering." );
+#endif 
+
+#if DEFCFG_SHADOW_CACHE
+	m_ShadowCache.OnLightRemoved( l );
+#endif
+
+	m_LeafIndex.Invalidate();
+
+	ReleaseOcclusionQuery( l );
+
+#if DEFCFG_CONFIGURABLE_VOLUMETRIC_LOD
+	m_hVolumetricLights.FindAndRemove( l );
+#endif
+
+#if DEFCFG_USE_SSE
+	const int iSlot = m_hDeferredLights.Find( l );
+
+	if ( !m_hDeferredLights.IsValidIndex( iSlot ) )
+		return false;
+
+	// the store moves its last slot, keep the list in sync
+	m_hDeferredLights.FastRemove( iSlot );
+	m_LightStore.RemoveLight( iSlot );
+	return true;
+#else
+	return m_hDeferredLights.FindAndRemove( l );
+#endif
+}
+
+bool CLightingManager::IsLightRendered( def_light_t *l )
+{
+#if DEBUG
+	AssertMsg( m_bVolatileLists, "Only works correctly during rendering." );
+#endif
+
+	return m_hRenderLights.HasElement( l );
+}
+
+void CLightingManager::ClearTmpLists()
+{
+	m_hRenderLights.RemoveAll();
+	m_hRenderLightsFullscreen.RemoveAll();
+
+	for ( int i = 0; i < LSORT_COUNT; i++ )
+		m_hPreSortedLights[ i ].RemoveAll();
+}
+
+void CLightingManager::RunLightJobs( int iNumItems, int iMinItemsPerJob, void (CLightingManager::*pfnJob)( lightJob_t & ) )
+{
+	int iNumJobs = 1;
+
+	if ( deferred_lightmanager_threaded.GetBool() && g_pThreadPool != NULL )
+		iNumJobs = clamp( iNumItems / iMinItemsPerJob, 1, MIN( (int)LIGHTJOB_MAX, g_pThreadPool->NumThreads() + 1 ) );
+
+	const int iItemsPerJob = iNumItems / iNumJobs;
+
+	for ( int i = 0; i < iNumJobs; i++ )
+	{
+		lightJob_t &job = m_LightJobs[ i ];
+
+		job.iFirst = i * iItemsPerJob;
+		job.iCount = ( i == iNumJobs - 1 ) ? iNumItems - job.iFirst : iItemsPerJob;
+		job.hLights.RemoveAll();
+		job.hFullscreen.RemoveAll();
+		job.hIndices.RemoveAll();
+	}
+
+	m_iNumLightJobs = iNumJobs;
+
+	if ( iNumJobs > 1 )
+		ParallelProcess( m_LightJobs, iNumJobs, this, pfnJob );
+	else
+		( this->*pfnJob )( m_LightJobs[ 0 ] );
+}
+
+void CLightingManager::PrepareLights()
+{
+	const bool bStress = deferred_lightmanager_stress.GetBool();
+
+	m_hDirtyXFormLights.RemoveAll();
+
+	FOR_EACH_VEC_FAST( def_light_t*, m_hDeferredLights, l )
+	{
+		l->UpdateCookieTexture();
+
+		if ( bStress )
+			l->MakeDirtyXForms();
+
+		if ( l->IsDirtyXForms() )
+			m_hDirtyXFormLights.AddToTail( l );
+	}
+	FOR_EACH_VEC_FAST_END
+
+	m_bLightBake = deferred_light_bake.GetBool();
+
+	// bounds are traced with a world only filter and leaves come from the bsp tree,
+	// neither touches client entities, so xforms update in jobs
+	RunLightJobs( m_hDirtyXFormLights.Count(), LIGHTJOB_MIN_XFORMS, &CLightingManager::UpdateXFormsJob );
+
+	if ( m_bLightBake || m_bLightBakeSave )
+		UpdateLightBake();
+
+	// meshes have to be built on this thread
+	for ( int i = 0; i < m_hDeferredLights.Count(); i++ )
+	{
+		def_light_t *l = m_hDeferredLights[ i ];
+
+		if ( !l->IsDirty() )
+		{
+			continue;
+		}
+
+		if ( l->IsDirtyRenderMesh() )
+		{
+			l->UpdateRenderMesh();
+			l->UpdateVolumetrics();
+		}
+
+		l->UnDirtyAll();
 
-#if DEBUG
-	m_bVolatileLists = false;
+#if DEFCFG_USE_SSE
+		m_LightStore.UpdateLight( i );
 #endif
+	}
 }
 
-void CLightingManager::OnCookieStringReceived( const char *pszString, const int &index )
+void CLightingManager::UpdateXFormsJob( lightJob_t &job )
 {
-	ITexture *pTexCookie = materials->FindTexture( pszString, TEXTURE_GROUP_OTHER );
+	for ( int i = job.iFirst; i < job.iFirst + job.iCount; i++ )
+	{
+		def_light_t *l = m_hDirtyXFormLights[ i ];
 
-	if ( IsErrorTexture( pTexCookie ) )
-		return;
-}
+		if ( l->IsSpot() )
+			l->UpdateMatrix();
 
-void CLightingManager::OnMaterialReload()
-{
-	FOR_EACH_VEC_FAST( def_light_t*, m_hDeferredLights, l )
-	{
-		l->ClearCookie();
+		// dynamic and moved lights are traced
+		const lightBake_t *pBake = ( m_bLightBake && l->IsWorldLight() ) ?
+			m_LightBake.Find( CLightBakeCache::GetLightKey( l ) ) : NULL;
 
-		l->MakeDirtyAll();
+		l->UpdateXForms( pBake, pBake != NULL ? m_LightBake.GetLeaves( *pBake ) : NULL );
 	}
-	FOR_EACH_VEC_FAST_END
 }
 
-void CLightingManager::AddLight( def_light_t *l )
+void CLightingManager::UpdateLightBake()
 {
-	Assert( !m_hDeferredLights.HasElement( l ) );
+	FOR_EACH_VEC_FAST( def_light_t*, m_hDirtyXFormLights, l )
+	{
+		if ( !l->IsWorldLight() )
+			continue;
 
-	m_hDeferredLights.AddToTail( l );
+		if ( m_LightBake.Find( CLightBakeCache::GetLightKey( l ) ) != NULL )
+		{
+			m_iNumBakedLights++;
+			continue;
+		}
 
-#if DEFCFG_USE_SSE
-	AllocateSortDataBuffer();
-#endif
-}
+		lightBake_t bake;
+		l->FillBake( bake );
 
-bool CLightingManager::RemoveLight( def_light_t *l )
-{
-#if DEBUG
-	AssertMsg( m_bVolatileLists == false, "You MUST NOT remove lights while rendering." );
-#endif 
+		m_LightBake.Add( bake, l->iLeaveIDs );
+		m_iNumTracedLights++;
+	}
+	FOR_EACH_VEC_FAST_END
 
-#if DEFCFG_USE_SSE
-	bool bSuccess = m_hDeferredLights.FindAndRemove( l );
-	AllocateSortDataBuffer();
-	return bSuccess;
-#else
-	return m_hDeferredLights.FindAndRemove( l );
-#endif
+	if ( m_bLightBakeSave )
+		SaveLightBake();
 }
 
-bool CLightingManager::IsLightRendered( def_light_t *l )
+void CLightingManager::SaveLightBake()
 {
-#if DEBUG
-	AssertMsg( m_bVolatileLists, "Only works correctly during rendering." );
-#endif
+	m_bLightBakeSave = false;
 
-	return m_hRenderLights.HasElement( l );
+	if ( !m_bHasMapCRC )
+		return;
+
+	if ( m_LightBake.Save( m_szLightBakeFile, m_iMapCRC ) )
+		DevMsg( "Saved %i light bakes to %s.\n", m_LightBake.GetNumBakes(), m_szLightBakeFile );
+	else
+		Warning( "Can't write %s.\n", m_szLightBakeFile );
 }
 
-#if DEFCFG_USE_SSE
-void CLightingManager::AllocateSortDataBuffer()
+void CLightingManager::BakeWorldLights()
 {
-	if( m_pSortDataX4 != NULL )
+	if ( !m_szLightBakeFile[ 0 ] )
 	{
-		MemAlloc_FreeAligned( m_pSortDataX4 );
-		m_pSortDataX4 = NULL;
+		Warning( "No map loaded.\n" );
+		return;
 	}
 
-	if( m_hDeferredLights.Count() == 0 )
+	m_bHasMapCRC = CLightBakeCache::CalcMapCRC( engine->GetLevelName(), m_iMapCRC );
+
+	if ( !m_bHasMapCRC )
+	{
+		Warning( "Can't read %s.\n", engine->GetLevelName() );
 		return;
+	}
+
+	m_LightBake.Purge();
+	m_bLightBakeSave = true;
 
-	const int iSortBufferDataSize = m_hDeferredLights.Count() % 4 == 0
-			? m_hDeferredLights.Count() / 4 
-			: ((m_hDeferredLights.Count() - (m_hDeferredLights.Count() % 4)) / 4) + 1;
+	FOR_EACH_VEC_FAST( def_light_t*, m_hDeferredLights, l )
+	{
+		if ( l->IsWorldLight() )
+			l->MakeDirtyXForms();
+	}
+	FOR_EACH_VEC_FAST_END
+}
 
-	m_pSortDataX4 = reinterpret_cast<def_light_presortdatax4_t*>(
-		MemAlloc_AllocAligned( iSortBufferDataSize * sizeof(def_light_presortdatax4_t),
-		sizeof(fltx4) ));
+CON_COMMAND( deferred_light_bake_world, "Traces all world lights again and saves their bounds and leaves next to the map." )
+{
+	GetLightingManager()->BakeWorldLights();
 }
 
-void CLightingManager::BuildLightSortDataBuffer()
-{	
-	const int iPartiallyFullSortDataElementCount = m_hRenderLights.Count() % 4;
-	m_uiSortDataCount = ( m_hRenderLights.Count() - iPartiallyFullSortDataElementCount ) / 4;
+#if DEFCFG_USE_SSE
+template<>
+void CLightingManager::CullLightsJob< true >( lightJob_t &job )
+{
+	const fltx4 viewOrigin[3] = { ReplicateX4( m_vecViewOrigin.x ),
+		ReplicateX4( m_vecViewOrigin.y ),
+		ReplicateX4( m_vecViewOrigin.z ) };
+	const fltx4 bloat = ReplicateX4( m_flzNear + 2 );
 
-	for( int i = 0, baseLightIdx = 0; i < m_uiSortDataCount; i++, baseLightIdx += 4 )
+	for ( int iBlock = job.iFirst; iBlock < job.iFirst + job.iCount; iBlock++ )
 	{
-		def_light_presortdatax4_t& sortData = m_pSortDataX4[i];
+		const def_light_datax4_t &b = m_LightStore.GetBlock( iBlock );
 
-		sortData.count = 4;
+		int iInRange, iContainsView;
+		CalcViewMasksX4( b, viewOrigin, bloat, iInRange, iContainsView );
 
-		def_light_t* lights[4] = 
+		if ( !m_bDrawWorldLights )
+			iInRange &= ~TestSignSIMD( b.isWorldLight );
+
+		for ( int lane = 0; iInRange != 0; lane++, iInRange >>= 1 )
 		{
-			m_hRenderLights[baseLightIdx],
-			m_hRenderLights[baseLightIdx+1],
-			m_hRenderLights[baseLightIdx+2],
-			m_hRenderLights[baseLightIdx+3]
-		};
+			if ( ( iInRange & 1 ) == 0 )
+				continue;
 
-		sortData.lights[0] = lights[0];
-		sortData.lights[1] = lights[1];
-		sortData.lights[2] = lights[2];
-		sortData.lights[3] = lights[3];
+			const int iSlot = iBlock * 4 + lane;
+			def_light_t *l = m_LightStore.GetLight( iSlot );
 
-		float boundsMinX[4] = 
-			{
-				lights[0]->bounds_min_naive.x,
-				lights[1]->bounds_min_naive.x,
-				lights[2]->bounds_min_naive.x,
-				lights[3]->bounds_min_naive.x
-			};
-		sortData.bounds_min_naive[0] = LoadUnalignedSIMD( boundsMinX );
-
-		float boundsMinY[4] = 
-			{
-				lights[0]->bounds_min_naive.y,
-				lights[1]->bounds_min_naive.y,
-				lights[2]->bounds_min_naive.y,
-				lights[3]->bounds_min_naive.y
-			};
-		sortData.bounds_min_naive[1] = LoadUnalignedSIMD( boundsMinY );
-
-		float boundsMinZ[4] = 
-			{
-				lights[0]->bounds_min_naive.z,
-				lights[1]->bounds_min_naive.z,
-				lights[2]->bounds_min_naive.z,
-				lights[3]->bounds_min_naive.z
-			};
-		sortData.bounds_min_naive[2] = LoadUnalignedSIMD( boundsMinZ );
-
-		float boundsMaxX[4] = 
+			if ( l->IsSpot() && l->HasShadow() )
 			{
-				lights[0]->bounds_max_naive.x,
-				lights[1]->bounds_max_naive.x,
-				lights[2]->bounds_max_naive.x,
-				lights[3]->bounds_max_naive.x
-			};
-		sortData.bounds_max_naive[0] = LoadUnalignedSIMD( boundsMaxX );
-
-		float boundsMaxY[4] = 
-			{
-				lights[0]->bounds_max_naive.y,
-				lights[1]->bounds_max_naive.y,
-				lights[2]->bounds_max_naive.y,
-				lights[3]->bounds_max_naive.y
-			};
-		sortData.bounds_max_naive[1] = LoadUnalignedSIMD( boundsMaxY );
-
-		float boundsMaxZ[4] = 
-			{
-				lights[0]->bounds_max_naive.z,
-				lights[1]->bounds_max_naive.z,
-				lights[2]->bounds_max_naive.z,
-				lights[3]->bounds_max_naive.z
-			};
-		sortData.bounds_max_naive[2] = LoadUnalignedSIMD( boundsMaxZ );
-
-		int hasShadowX4[4] = 
-			{ 
-				lights[0]->HasShadow() ? 1 : 0,
-				lights[1]->HasShadow() ? 1 : 0,
-				lights[2]->HasShadow() ? 1 : 0,
-				lights[3]->HasShadow() ? 1 : 0
-			};
-		sortData.hasShadow = LoadUnalignedIntSIMD( hasShadowX4 );
-			
-		int hasVolumetricsX4[4] = 
-			{ 
-				lights[0]->HasVolumetrics() ? 1 : 0,
-				lights[1]->HasVolumetrics() ? 1 : 0,
-				lights[2]->HasVolumetrics() ? 1 : 0,
-				lights[3]->HasVolumetrics() ? 1 : 0
-			};
-		sortData.hasVolumetrics = LoadUnalignedIntSIMD( hasVolumetricsX4 );
-	}
-
-	if( iPartiallyFullSortDataElementCount != 0 )
-	{
-		def_light_presortdatax4_t& sortData = m_pSortDataX4[m_uiSortDataCount];
-
-		sortData.count = iPartiallyFullSortDataElementCount;
-
-		float boundsMinX[4] = {0};
-		float boundsMinY[4] = {0};
-		float boundsMinZ[4] = {0};
-		float boundsMaxX[4] = {0};
-		float boundsMaxY[4] = {0};
-		float boundsMaxZ[4] = {0};
-		int hasShadowX4[4] = {0};		
-		int hasVolumetricsX4[4] = {0};
-
-		int iBaseLightIndex = m_uiSortDataCount * 4;
-
-		for( int i = 0; i < iPartiallyFullSortDataElementCount; i++ )
-		{
-			def_light_t* l = m_hRenderLights[iBaseLightIndex + i];
+				if ( IntersectFrustumWithFrustum( m_matScreenToWorld, l->spotMVPInv ) )
+					continue;
+			}
 
-			sortData.lights[i] = l;
+			l->UpdateViewDistance( m_vecViewOrigin );
 
-			boundsMinX[i] = l->bounds_min_naive.x;
-			boundsMinY[i] = l->bounds_min_naive.y;
-			boundsMinZ[i] = l->bounds_min_naive.z;
+			job.hLights.AddToTail( l );
+			job.hFullscreen.AddToTail( ( iContainsView & ( 1 << lane ) ) != 0 );
+			job.hIndices.AddToTail( iSlot );
+		}
+	}
+}
+#endif
 
-			boundsMaxX[i] = l->bounds_max_naive.x;
-			boundsMaxY[i] = l->bounds_max_naive.y;
-			boundsMaxZ[i] = l->bounds_max_naive.z;
+template<>
+void CLightingManager::CullLightsJob< false >( lightJob_t &job )
+{
+	const float zNear = m_flzNear + 2;
+	const Vector vecBloat( zNear, zNear, zNear );
 
-			hasShadowX4[i] = l->HasShadow() ? 1 : 0;
+	for ( int i = job.iFirst; i < job.iFirst + job.iCount; i++ )
+	{
+		def_light_t *l = m_hDeferredLights[ i ];
 
-			hasVolumetricsX4[i] =l->HasVolumetrics() ? 1 : 0;
-		}
+		if ( !m_bDrawWorldLights && l->bWorldLight )
+			continue;
 
-		sortData.bounds_min_naive[0] = LoadUnalignedSIMD( boundsMinX );
-		sortData.bounds_min_naive[1] = LoadUnalignedSIMD( boundsMinY );
-		sortData.bounds_min_naive[2] = LoadUnalignedSIMD( boundsMinZ );
+		if ( l->IsSpot() && l->HasShadow() )
+		{
+			if ( IntersectFrustumWithFrustum( m_matScreenToWorld, l->spotMVPInv ) )
+				continue;
+		}
 
-		sortData.bounds_max_naive[0] = LoadUnalignedSIMD( boundsMaxX );
-		sortData.bounds_max_naive[1] = LoadUnalignedSIMD( boundsMaxY );
-		sortData.bounds_max_naive[2] = LoadUnalignedSIMD( boundsMaxZ );
+		Vector veclightDelta = l->boundsCenter - m_vecViewOrigin;
 
-		sortData.hasShadow = LoadUnalignedIntSIMD( hasShadowX4 );
+		if ( veclightDelta.LengthSqr() > l->flMaxDistSqr )
+			continue;
 
-		sortData.hasVolumetrics = LoadUnalignedIntSIMD( hasVolumetricsX4 );
+		l->UpdateViewDistance( m_vecViewOrigin );
 
-		m_uiSortDataCount++;
+		job.hLights.AddToTail( l );
+		job.hFullscreen.AddToTail( IsPointInBounds( m_vecViewOrigin,
+			l->bounds_min_naive - vecBloat,
+			l->bounds_max_naive + vecBloat ) );
+		job.hIndices.AddToTail( i );
 	}
 }
-#endif
-
-void CLightingManager::ClearTmpLists()
-{
-	m_hRenderLights.RemoveAll();
-
-	for ( int i = 0; i < LSORT_COUNT; i++ )
-		m_hPreSortedLights[ i ].RemoveAll();
-}
 
-void CLightingManager::PrepareLights()
+struct engineLeafVisibility_t
 {
-	FOR_EACH_VEC_FAST( def_light_t*, m_hDeferredLights, l )
+	FORCEINLINE bool operator()( int iLeaf )
 	{
-		l->UpdateCookieTexture();
-
-		if ( !l->IsDirty() )
-		{
-			continue;
-		}
+		return render->AreAnyLeavesVisible( &iLeaf, 1 );
+	};
+};
 
-		if ( l->IsDirtyXForms() )
-		{
-			if ( l->IsSpot() )
-				l->UpdateMatrix();
+void CLightingManager::UpdateLeafIndex()
+{
+	m_bUseLeafIndex = deferred_lightmanager_leafindex.GetBool() && m_hDeferredLights.Count() <= 0xFFFF;
 
-			l->UpdateXForms();
-		}
+	if ( !m_bUseLeafIndex )
+	{
+		m_LeafIndex.Invalidate();
+		return;
+	}
 
-		if ( l->IsDirtyRenderMesh() )
-		{
-			l->UpdateRenderMesh();
-			l->UpdateVolumetrics();
-		}
+	// leaves only change with the xforms
+	if ( !m_LeafIndex.IsValid() || m_hDirtyXFormLights.Count() > 0 )
+		m_LeafIndex.Build( m_hDeferredLights.Base(), m_hDeferredLights.Count() );
 
-		l->UnDirtyAll();
-	}
-	FOR_EACH_VEC_FAST_END
+	engineLeafVisibility_t isLeafVisible;
+	m_LeafIndex.FindVisibleLights( isLeafVisible );
 }
 
 void CLightingManager::CullLights()
 {
 	Assert( m_hRenderLights.Count() == 0 );
 
-	FOR_EACH_VEC_FAST( def_light_t*, m_hDeferredLights, l )
-	{
-		if ( !m_bDrawWorldLights && l->bWorldLight )
-			continue;
+	UpdateLeafIndex();
 
-		if ( !render->AreAnyLeavesVisible( l->iLeaveIDs, l->iNumLeaves ) )
-			continue;
+#if DEFCFG_USE_SSE
+	Assert( m_LightStore.Count() == m_hDeferredLights.Count() );
 
-		// if the optimized bounds cause popping for you, use the naive ones or
-		// ...improve the optimization code
-		//if( !engine->IsBoxInViewCluster( l->bounds_min_naive, l->bounds_max_naive ) )
-		//	continue;
+	if ( GetDeferredPipeline()->UseSIMDCulling() )
+		RunLightJobs( m_LightStore.GetNumBlocks(), LIGHTJOB_MIN_CULL / 4, &CLightingManager::CullLightsJob< true > );
+	else
+#endif
+		RunLightJobs( m_hDeferredLights.Count(), LIGHTJOB_MIN_CULL, &CLightingManager::CullLightsJob< false > );
 
-		if ( engine->CullBox( l->bounds_min_naive, l->bounds_max_naive ) )
-		//if ( engine->CullBox( l->bounds_min, l->bounds_max ) )
-			continue;
+	// the engine's visibility and frustum queries aren't thread safe, so they run here on
+	// what the jobs kept. job order matches the light order, so this equals a serial cull
+	for ( int i = 0; i < m_iNumLightJobs; i++ )
+	{
+		const lightJob_t &job = m_LightJobs[ i ];
 
-		if ( l->IsSpot() && l->HasShadow() )
+		for ( int j = 0; j < job.hLights.Count(); j++ )
 		{
-			if ( IntersectFrustumWithFrustum( m_matScreenToWorld, l->spotMVPInv ) )
-				continue;
-		}
+			def_light_t *l = job.hLights[ j ];
 
-		Vector veclightDelta = l->boundsCenter - m_vecViewOrigin;
+			if ( !AreLightLeavesVisible( job.hIndices[ j ], l ) )
+				continue;
 
-		if ( veclightDelta.LengthSqr() > l->flMaxDistSqr )
-			continue;
+			// if the optimized bounds cause popping for you, use the naive ones or
+			// ...improve the optimization code
+			//if( !engine->IsBoxInViewCluster( l->bounds_min_naive, l->bounds_max_naive ) )
+			//	continue;
 
-		l->flDistance_ViewOrigin = veclightDelta.Length();
-		l->flShadowFade = l->HasShadow() ?
-			( SATURATE( ( l->flDistance_ViewOrigin - l->iShadow_Dist ) / l->iShadow_Range ) )
-			: 1.0f;
+			if ( engine->CullBox( l->bounds_min_naive, l->bounds_max_naive ) )
+			//if ( engine->CullBox( l->bounds_min, l->bounds_max ) )
+				continue;
 
-		m_hRenderLights.AddToTail( l );
+			m_hRenderLights.AddToTail( l );
+			m_hRenderLightsFullscreen.AddToTail( job.hFullscreen[ j ] );
+		}
 	}
-	FOR_EACH_VEC_FAST_END
-}
-
-inline fltx4 IsPointInBoundsX4( const Vector point, fltx4 boundsMin[3], fltx4 boundsMax[3] )
-{
-	fltx4 pointX = ReplicateX4( point.x );
-	fltx4 pointY = ReplicateX4( point.y );
-	fltx4 pointZ = ReplicateX4( point.z );
-
-	return	AndSIMD
-			(
-				AndSIMD
-				(
-					AndSIMD
-					(
-						CmpGeSIMD( pointX, boundsMin[0] ),
-						CmpLeSIMD( pointX, boundsMax[0] )
-					),
-					AndSIMD
-					(
-						CmpGeSIMD( pointY, boundsMin[1] ),
-						CmpLeSIMD( pointY, boundsMax[1] )
-					)
-				),
-				AndSIMD
-				(
-					CmpGeSIMD( pointZ, boundsMin[2] ),
-					CmpLeSIMD( pointZ, boundsMax[2] )
-				)
-			);
 }
 
 void CLightingManager::SortLights()
@@ -470,6 +1158,15 @@ void CLightingManager::SortLights()
 		Assert( m_hPreSortedLights[ i ].Count() == 0 );
 #endif
 
+	if ( GetDeferredPipeline()->UseExtraSort() )
+		SortLightsInBuckets< true >();
+	else
+		SortLightsInBuckets< false >();
+}
+
+template< bool bExtraSort >
+void CLightingManager::SortLightsInBuckets()
+{
 	m_bDrawVolumetrics = false;
 
 	float zNear = m_flzNear + 2;
@@ -479,121 +1176,76 @@ void CLightingManager::SortLights()
 	Vector camMins( m_vecViewOrigin - vecBloat );
 	Vector camMaxs( m_vecViewOrigin + vecBloat );
 
-#if DEFCFG_USE_SSE
-	fltx4 zNearX4 = ReplicateX4( zNear );
-
-	for( int i = 0; i < m_uiSortDataCount; i++ )
+	for ( int i = 0; i < m_hRenderLights.Count(); i++ )
 	{
-		def_light_presortdatax4_t& s = m_pSortDataX4[i];
-
-		fltx4 adjustedMins[3] = { SubSIMD( s.bounds_min_naive[0], zNearX4 ),
-			SubSIMD( s.bounds_min_naive[1], zNearX4 ),
-			SubSIMD( s.bounds_min_naive[2], zNearX4 ) };
-
-		fltx4 adjustedMaxs[3] = { AddSIMD( s.bounds_max_naive[0], zNearX4 ),
-			AddSIMD( s.bounds_max_naive[1], zNearX4 ),
-			AddSIMD( s.bounds_max_naive[2], zNearX4 ) };
-
-		fltx4 needsFullscreen = IsPointInBoundsX4( m_vecViewOrigin,
-			adjustedMins, adjustedMaxs );
-
-		//Jack: this is terrible I know
-		for( int i = 0; i < s.count; i++ )
-		{
-			if( s.lights[i]->IsSpot() )
-			{
-				if( _isnan( SubFloat( needsFullscreen, i ) ) )
-				{
-					if( !s.lights[i]->spotFrustum.CullBox( camMins, camMaxs ) )
-					{
-						m_hPreSortedLights[LSORT_SPOT_FULLSCREEN].AddToTail( s.lights[i] );
-					}
-					else
-					{
-						m_hPreSortedLights[LSORT_SPOT_WORLD].AddToTail( s.lights[i] );
-					}
-				}
-				else
-				{
-					m_hPreSortedLights[LSORT_SPOT_WORLD].AddToTail( s.lights[i] );
-				}
-			}
-			else
-			{
-				if( _isnan( SubFloat( needsFullscreen, i ) ) )
-				{
-					m_hPreSortedLights[LSORT_POINT_FULLSCREEN].AddToTail( s.lights[i] );
-				}
-				else
-				{
-					m_hPreSortedLights[LSORT_POINT_WORLD].AddToTail( s.lights[i] );
-				}
-			}
-		}
-
-		fltx4 volume = AndSIMD( s.hasVolumetrics, s.hasVolumetrics );
+		def_light_t *l = m_hRenderLights[ i ];
 
-		m_bDrawVolumetrics = m_bDrawVolumetrics || !IsAllZeros( volume );
-	}
-#else
-	FOR_EACH_VEC_FAST( def_light_t*, m_hRenderLights, l )
-	{
-		bool bNeedsFullscreen = IsPointInBounds( m_vecViewOrigin,
-			l->bounds_min_naive - vecBloat,
-			l->bounds_max_naive + vecBloat );
+		// tested against the bloated bounds while culling
+		bool bNeedsFullscreen = m_hRenderLightsFullscreen[ i ];
 
 		if ( bNeedsFullscreen && l->IsSpot() )
 		{
 			bNeedsFullscreen = !l->spotFrustum.CullBox( camMins, camMaxs );
 		}
 
-		const bool bVolume = ( l->HasShadow() && l->HasVolumetrics() );
+		const bool bVolume = l->ShouldRenderVolumetrics();
 
 		m_bDrawVolumetrics = m_bDrawVolumetrics || bVolume;
 
-		Assert( l->iLighttype * 2 + 1 < LSORT_COUNT );
-		m_hPreSortedLights[ l->iLighttype * 2 + (int)bNeedsFullscreen ].AddToTail( l );
+		const bool bAdvanced = bExtraSort &&
+			( l->ShouldRenderShadow() || l->ShouldRenderCookie() );
+
+		const int iBucket = GetSortBucket( l->iLighttype, bNeedsFullscreen, bAdvanced );
+
+		Assert( iBucket < LSORT_COUNT );
+		m_hPreSortedLights[ iBucket ].AddToTail( l );
 	}
-	FOR_EACH_VEC_FAST_END
-#endif
 
 	static CUtlVector< def_light_t* > hBatchFullscreen;
 
-	for ( int i = 0; i < 2; i++ )
+	// LSORT_* holds four buckets per light type
+	for ( int iType = 0; iType < LSORT_COUNT / 4; iType++ )
 	{
-		FOR_EACH_VEC_FAST( def_light_t*, m_hPreSortedLights[ i * 2 ], l )
+		for ( int iAdvanced = 0; iAdvanced < ( bExtraSort ? 2 : 1 ); iAdvanced++ )
 		{
-			if ( l->HasVolumetrics() )
-				continue;
+			const bool bAdvanced = iAdvanced != 0;
+			CUtlVector< def_light_t* > &hWorld = m_hPreSortedLights[ GetSortBucket( iType, false, bAdvanced ) ];
+			CUtlVector< def_light_t* > &hFullscreen = m_hPreSortedLights[ GetSortBucket( iType, true, bAdvanced ) ];
 
-			const bool bSpot = l->IsSpot();
-			const float flSizeFactor = bSpot ? 1.5f : 2.25f;
+			FOR_EACH_VEC_FAST( def_light_t*, hWorld, l )
+			{
+				if ( l->ShouldRenderVolumetrics() )
+					continue;
 
-			Vector viewVec = l->boundsCenter - m_vecViewOrigin;
-			const float flDot = DotProduct( m_vecForward, viewVec.Normalized() );
+				const bool bSpot = l->IsSpot();
+				const float flSizeFactor = bSpot ? 1.5f : 2.25f;
 
-			const float flCoverageFactor = flSizeFactor * l->flRadius / l->flDistance_ViewOrigin * flDot;
+				Vector viewVec = l->boundsCenter - m_vecViewOrigin;
+				const float flDot = DotProduct( m_vecForward, viewVec.Normalized() );
 
-			if ( flCoverageFactor > 1 )
-				hBatchFullscreen.AddToTail( l );
-		}
-		FOR_EACH_VEC_FAST_END
+				const float flCoverageFactor = flSizeFactor * l->flRadius / l->flDistance_ViewOrigin * flDot;
 
-		if ( hBatchFullscreen.Count() > 1 )
-		{
-			FOR_EACH_VEC_FAST( def_light_t*, hBatchFullscreen, l )
+				if ( flCoverageFactor > 1 )
+					hBatchFullscreen.AddToTail( l );
+			}
+			FOR_EACH_VEC_FAST_END
+
+			if ( hBatchFullscreen.Count() > 1 )
 			{
+				FOR_EACH_VEC_FAST( def_light_t*, hBatchFullscreen, l )
+				{
 #if DEBUG
-				Assert( m_hPreSortedLights[ i * 2 ].FindAndRemove( l ) );
+					Assert( hWorld.FindAndRemove( l ) );
 #else
-				m_hPreSortedLights[ i * 2 ].FindAndRemove( l );
+					hWorld.FindAndRemove( l );
 #endif
-				m_hPreSortedLights[ i * 2 + 1 ].AddToTail( l );
+					hFullscreen.AddToTail( l );
+				}
+				FOR_EACH_VEC_FAST_END
 			}
-			FOR_EACH_VEC_FAST_END
-		}
 
-		hBatchFullscreen.RemoveAll();
+			hBatchFullscreen.RemoveAll();
+		}
 	}
 }
 
@@ -663,7 +1315,7 @@ FORCEINLINE float CLightingManager::DoLightStyle( def_light_t *l )
 FORCEINLINE int CLightingManager::WriteLight( def_light_t *l, float *pfl4 )
 {
 	const bool bShadow = l->ShouldRenderShadow();
-	const bool bCookie = l->HasCookie();
+	const bool bCookie = l->ShouldRenderCookie();
 
 	const bool bAdvanced = bShadow || bCookie;
 
@@ -770,7 +1422,7 @@ FORCEINLINE bool SortLightsByComboType( CUtlVector<def_light_t*> &hLights,
 	FOR_EACH_VEC_FAST( def_light_t*, hLights, l )
 	{
 		const bool bShadowed = l->ShouldRenderShadow();
-		const bool bCookie = l->HasCookie() && l->IsCookieReady();
+		const bool bCookie = l->ShouldRenderCookie();
 
 		if ( bShadowed && bCookie )
 			hLightsShadowedCookie.AddToTail( l );
@@ -790,6 +1442,25 @@ FORCEINLINE bool SortLightsByComboType( CUtlVector<def_light_t*> &hLights,
 	return hLights.Count() > 0;
 }
 
+// with extra sorting the simple lights are already in their own bucket
+bool CLightingManager::GatherFullscreenLights( const lightPass_t &pass, bool bExtraSort,
+	CUtlVector<def_light_t*> &hLightsShadowedCookie, CUtlVector<def_light_t*> &hLightsShadowed,
+	CUtlVector<def_light_t*> &hLightsCookied, CUtlVector<def_light_t*> &hLightsSimple )
+{
+	if ( !bExtraSort )
+	{
+		return SortLightsByComboType( *pass.lightVecFullscreen,
+			hLightsShadowedCookie, hLightsShadowed, hLightsCookied, hLightsSimple );
+	}
+
+	SortLightsByComboType( *pass.lightVecFullscreenAdvanced,
+		hLightsShadowedCookie, hLightsShadowed, hLightsCookied, hLightsSimple );
+
+	hLightsSimple.AddVectorToTail( *pass.lightVecFullscreen );
+
+	return pass.lightVecFullscreenAdvanced->Count() > 0 || hLightsSimple.Count() > 0;
+}
+
 FORCEINLINE void CLightingManager::DrawVolumePrepass( bool bDoModelTransform, const CViewSetup &view, def_light_t *l )
 {
 	if ( !l->IsSpot() )
@@ -821,6 +1492,44 @@ FORCEINLINE void CLightingManager::DrawVolumePrepass( bool bDoModelTransform, co
 	pRenderContext->PopRenderTargetAndViewport();
 }
 
+struct defData_commitData
+{
+public:
+	float *pData;
+	int a,b,c,d,rows;
+
+	static void Fire( defData_commitData d )
+	{
+		// the previous block belongs to the light data arena
+		GetDeferredExt()->CommitLightData_Common(
+			d.pData,
+			d.rows,
+			d.a, d.b,
+			d.c, d.d );
+	};
+};
+
+struct defData_Cookie
+{
+public:
+	ITexture *pCookie;
+	int index;
+	static void Fire( defData_Cookie d )
+	{
+		GetDeferredExt()->CommitTexture_Cookie( d.index, d.pCookie );
+	}
+};
+
+struct defData_Volume
+{
+public:
+	volumeData_t mData;
+	static void Fire( defData_Volume d )
+	{
+		GetDeferredExt()->CommitVolumeData( d.mData );
+	}
+};
+
 void CLightingManager::RenderLights( const CViewSetup &view, CDeferredViewRender *pCaller )
 {
 	static CUtlVector<def_light_t*> lightsShadowedCookied;
@@ -828,125 +1537,47 @@ void CLightingManager::RenderLights( const CViewSetup &view, CDeferredViewRender
 	static CUtlVector<def_light_t*> lightsCookied;
 	static CUtlVector<def_light_t*> lightsSimple;
 
-#if DEFCFG_EXTRA_SORT
-	struct Lightpass_t
-	{
-		CUtlVector<def_light_t*> *lightVecFullscreenSimple;
-		CUtlVector<def_light_t*> *lightVecFullscreenAdvanced;
-		CUtlVector<def_light_t*> *lightVecWorldSimple;
-		CUtlVector<def_light_t*> *lightVecWorldAdvanced;
-		IMaterial *pMatPassFullscreen;
-		IMaterial *pMatPassWorld;
-		IMaterial *pMatVolumeFullscreen;
-		IMaterial *pMatVolumeWorld;
-		int constCount_simple;
-		int constCount_advanced;
-	};
+	const bool bExtraSort = GetDeferredPipeline()->UseExtraSort();
 
-	Lightpass_t lightTypes[] =
+	lightPass_t lightTypes[] =
 	{
-		{ &m_hPreSortedLights[ LSORT_POINT_FULLSCREEN_SIMPLE ], &m_hPreSortedLights[ LSORT_POINT_FULLSCREEN_ADVANCED ],
-		 &m_hPreSortedLights[ LSORT_POINT_WORLD_SIMPLE ], &m_hPreSortedLights[ LSORT_POINT_WORLD_ADVANCED ],//JACK: Here we could be sorting into
-		GetDeferredManager()->GetDeferredMaterial( DEF_MAT_LIGHT_POINT_FULLSCREEN ),						//		simple and advanced lights as
-		GetDeferredManager()->GetDeferredMaterial( DEF_MAT_LIGHT_POINT_WORLD ),								//		simple lights only need  a single
-		GetDeferredManager()->GetDeferredMaterial( DEF_MAT_LIGHT_VOLUME_POINT_FULLSCREEN ),					//		state change (model proj) to render
+		{ &m_hPreSortedLights[ LSORT_POINT_FULLSCREEN ], &m_hPreSortedLights[ LSORT_POINT_FULLSCREEN_ADVANCED ],
+		&m_hPreSortedLights[ LSORT_POINT_WORLD ], &m_hPreSortedLights[ LSORT_POINT_WORLD_ADVANCED ],
+		GetDeferredManager()->GetDeferredMaterial( DEF_MAT_LIGHT_POINT_FULLSCREEN ),
+		GetDeferredManager()->GetDeferredMaterial( DEF_MAT_LIGHT_POINT_WORLD ),
+		GetDeferredManager()->GetDeferredMaterial( DEF_MAT_LIGHT_VOLUME_POINT_FULLSCREEN ),
 		GetDeferredManager()->GetDeferredMaterial( DEF_MAT_LIGHT_VOLUME_POINT_WORLD ),
 		NUM_CONSTS_POINT_SIMPLE, NUM_CONSTS_POINT_ADVANCED },
 
-		{ &m_hPreSortedLights[ LSORT_SPOT_FULLSCREEN_SIMPLE ], &m_hPreSortedLights[ LSORT_SPOT_FULLSCREEN_ADVANCED ],
-		&m_hPreSortedLights[ LSORT_SPOT_WORLD_SIMPLE ], &m_hPreSortedLights[ LSORT_SPOT_WORLD_ADVANCED ],
+		{ &m_hPreSortedLights[ LSORT_SPOT_FULLSCREEN ], &m_hPreSortedLights[ LSORT_SPOT_FULLSCREEN_ADVANCED ],
+		&m_hPreSortedLights[ LSORT_SPOT_WORLD ], &m_hPreSortedLights[ LSORT_SPOT_WORLD_ADVANCED ],
 		GetDeferredManager()->GetDeferredMaterial( DEF_MAT_LIGHT_SPOT_FULLSCREEN ),
 		GetDeferredManager()->GetDeferredMaterial( DEF_MAT_LIGHT_SPOT_WORLD ),
 		GetDeferredManager()->GetDeferredMaterial( DEF_MAT_LIGHT_VOLUME_SPOT_FULLSCREEN ),
 		GetDeferredManager()->GetDeferredMaterial( DEF_MAT_LIGHT_VOLUME_SPOT_WORLD ),
 		NUM_CONSTS_SPOT_SIMPLE, NUM_CONSTS_SPOT_ADVANCED },
 	};
-#else
-	struct Lightpass_t
-	{
-		CUtlVector<def_light_t*> *lightVecFullscreen;
-		CUtlVector<def_light_t*> *lightVecWorld;
-		IMaterial *pMatPassFullscreen;
-		IMaterial *pMatPassWorld;
-		IMaterial *pMatVolumeFullscreen;
-		IMaterial *pMatVolumeWorld;
-		int constCount_simple;
-		int constCount_advanced;
-	};
+	const int iNumLightTypes = ARRAYSIZE( lightTypes );
 
-	Lightpass_t lightTypes[] =
-	{
-		{ &m_hPreSortedLights[ LSORT_POINT_FULLSCREEN ], &m_hPreSortedLights[ LSORT_POINT_WORLD ],	//JACK: Here we could be sorting into
-		GetDeferredManager()->GetDeferredMaterial( DEF_MAT_LIGHT_POINT_FULLSCREEN ),				//		simple and advanced lights as
-		GetDeferredManager()->GetDeferredMaterial( DEF_MAT_LIGHT_POINT_WORLD ),						//		simple lights only need  a single
-		GetDeferredManager()->GetDeferredMaterial( DEF_MAT_LIGHT_VOLUME_POINT_FULLSCREEN ),			//		state change (model proj) to render
-		GetDeferredManager()->GetDeferredMaterial( DEF_MAT_LIGHT_VOLUME_POINT_WORLD ),
-		NUM_CONSTS_POINT_SIMPLE, NUM_CONSTS_POINT_ADVANCED },
+	COMPILE_TIME_ASSERT( iNumLightTypes == ARRAYSIZE( m_RenderStats.iPassesDrawnFullscreen ) );
 
-		{ &m_hPreSortedLights[ LSORT_SPOT_FULLSCREEN ], &m_hPreSortedLights[ LSORT_SPOT_WORLD ],
-		GetDeferredManager()->GetDeferredMaterial( DEF_MAT_LIGHT_SPOT_FULLSCREEN ),
-		GetDeferredManager()->GetDeferredMaterial( DEF_MAT_LIGHT_SPOT_WORLD ),
-		GetDeferredManager()->GetDeferredMaterial( DEF_MAT_LIGHT_VOLUME_SPOT_FULLSCREEN ),
-		GetDeferredManager()->GetDeferredMaterial( DEF_MAT_LIGHT_VOLUME_SPOT_WORLD ),
-		NUM_CONSTS_SPOT_SIMPLE, NUM_CONSTS_SPOT_ADVANCED },
-	};
-#endif
-	const int iNumLightTypes = ARRAYSIZE( lightTypes );
+	Q_memset( &m_RenderStats, 0, sizeof( m_RenderStats ) );
 
-	int iPassesDrawnFullscreen[iNumLightTypes] = { 0 };
-	int iPassesVolumetrics[2] = { 0 };
-	int iDrawnShadowed = 0;
-	int iDrawnCookied = 0;
-	int iDrawnSimple = 0;
+	m_LightDataArena.BeginFrame( gpGlobals->framecount );
+
+	m_iNumLightBatches = 0;
+	m_iNumBatchedLights = 0;
 
 	ITexture *pVolumBuffer0 = GetDefRT_VolumetricsBuffer( 0 );
 
 	if ( m_bDrawVolumetrics )
 	{
 		CMatRenderContextPtr pRenderContext( materials );
-		pRenderContext->PushRenderTargetAndViewport( pVolumBuffer0 );
-		pRenderContext->ClearColor3ub( 0, 0, 0 );
-		pRenderContext->ClearBuffers( true, false );
-		pRenderContext->PopRenderTargetAndViewport();
-	}
-
-	struct defData_commitData
-	{
-	public:
-		float *pData;
-		int a,b,c,d,rows;
-
-		static void Fire( defData_commitData d )
-		{
-			float *pflTrash = GetDeferredExt()->CommitLightData_Common(
-				d.pData,
-				d.rows,
-				d.a, d.b,
-				d.c, d.d );
-			delete [] pflTrash;
-		};
-	};
-
-	struct defData_Cookie
-	{
-	public:
-		ITexture *pCookie;
-		int index;
-		static void Fire( defData_Cookie d )
-		{
-			GetDeferredExt()->CommitTexture_Cookie( d.index, d.pCookie );
-		}
-	};
-
-	struct defData_Volume
-	{
-	public:
-		volumeData_t mData;
-		static void Fire( defData_Volume d )
-		{
-			GetDeferredExt()->CommitVolumeData( d.mData );
-		}
-	};
+		pRenderContext->PushRenderTargetAndViewport( pVolumBuffer0 );
+		pRenderContext->ClearColor3ub( 0, 0, 0 );
+		pRenderContext->ClearBuffers( true, false );
+		pRenderContext->PopRenderTargetAndViewport();
+	}
 
 	struct queueVolume
 	{
@@ -964,7 +1595,7 @@ void CLightingManager::RenderLights( const CViewSetup &view, CDeferredViewRender
 
 	for ( int i = 0; i < iNumLightTypes; i++ )
 	{
-		if ( SortLightsByComboType( *(lightTypes[i].lightVecFullscreen),
+		if ( GatherFullscreenLights( lightTypes[i], bExtraSort,
 			lightsShadowedCookied, lightsShadowed, lightsCookied, lightsSimple ) )
 		{
 			while ( lightsShadowedCookied.Count() > 0 || lightsShadowed.Count() > 0 ||
@@ -984,7 +1615,7 @@ void CLightingManager::RenderLights( const CViewSetup &view, CDeferredViewRender
 
 				Assert( memToAlloc > 0 );
 
-				float *pFlLightDataBlock = new float[ memToAlloc ];
+				float *pFlLightDataBlock = m_LightDataArena.Alloc( memToAlloc );
 
 				Assert( pFlLightDataBlock != NULL );
 
@@ -1008,7 +1639,7 @@ void CLightingManager::RenderLights( const CViewSetup &view, CDeferredViewRender
 
 					Assert( pFlWriter - pFlLightDataBlock == memToAlloc );
 
-					iPassesDrawnFullscreen[i]++;
+					m_RenderStats.iPassesDrawnFullscreen[i]++;
 
 					//JACK: Here we can use the MAX_LIGHTS_X macros to mean the max light textures to use
 					//		and render multiple lower LOD lights to the same texture, will need to commit the 
@@ -1018,7 +1649,7 @@ void CLightingManager::RenderLights( const CViewSetup &view, CDeferredViewRender
 					{
 						pCaller->DrawLightShadowView( view, iShadowed, commitableLights[ iShadowed ] );
 
-						if ( commitableLights[ iShadowed ]->HasVolumetrics() )
+						if ( commitableLights[ iShadowed ]->ShouldRenderVolumetrics() )
 						{
 							int iDataOffset = iShadowed * lightTypes[i].constCount_advanced * 4;
 							int iSamplerOffset = iShadowed;
@@ -1038,14 +1669,16 @@ void CLightingManager::RenderLights( const CViewSetup &view, CDeferredViewRender
 					data.d = drawSimple;
 					QUEUE_FIRE( defData_commitData, Fire, data );
 
-					iDrawnShadowed += drawShadowedCookied + drawShadowed;
-					iDrawnCookied += drawShadowedCookied + drawCookied;
-					iDrawnSimple += drawSimple;
+					m_RenderStats.iDrawnShadowed += drawShadowedCookied + drawShadowed;
+					m_RenderStats.iDrawnCookied += drawShadowedCookied + drawCookied;
+					m_RenderStats.iDrawnSimple += drawSimple;
 
 					static CUtlVector< def_light_t* > cookiedLights;
 					cookiedLights.AddVectorToTail( lightsShadowedCookied );
 					cookiedLights.AddVectorToTail( lightsCookied );
 
+					CDefCookieProjectable::GetTargetCache().BeginBatch();
+
 					for ( int iCookied = 0; iCookied < (drawShadowedCookied+drawCookied); iCookied++ )
 					{
 						defData_Cookie data;
@@ -1063,38 +1696,12 @@ void CLightingManager::RenderLights( const CViewSetup &view, CDeferredViewRender
 
 					FOR_EACH_VEC_FAST( queueVolume, volumeLights, entry )
 					{
-#if DEFCFG_ADAPTIVE_VOLUMETRIC_LOD
-						const float flCameraLightDelta = (view.origin).DistTo(entry.pLight->pos);
-						int iVolumeLOD = 4;
-						if( flCameraLightDelta < entry.pLight->flVolumeLOD0Dist )
-						{ 
-							iVolumeLOD = 0;
-						}
-						else if( flCameraLightDelta < entry.pLight->flVolumeLOD1Dist )
-						{
-							iVolumeLOD = 1;
-						}
-						else if( flCameraLightDelta < entry.pLight->flVolumeLOD2Dist )
-						{
-							iVolumeLOD = 2;
-						}
-						else if( flCameraLightDelta < entry.pLight->flVolumeLOD3Dist )
-						{
-							iVolumeLOD = 3;
-						}
-#endif
-
 						defData_Volume data;
 						data.mData.iDataOffset = entry.dataoffset;
 						data.mData.iSamplerOffset = entry.sampleroffset;
 						data.mData.iNumRows = lightTypes[i].constCount_advanced;
-						data.mData.bHasCookie = entry.pLight->HasCookie();
-#if DEFCFG_ADAPTIVE_VOLUMETRIC_LOD
-						data.mData.iLOD = iVolumeLOD;
-#endif
-#if DEFCFG_CONFIGURABLE_VOLUMETRIC_LOD
-						data.mData.iSamples = entry.pLight->iVolumeSamples;
-#endif
+						data.mData.bHasCookie = entry.pLight->ShouldRenderCookie();
+						SetVolumetricLOD( view, entry.pLight, data.mData );
 						QUEUE_FIRE( defData_Volume, Fire, data );
 
 						DrawVolumePrepass( true, view, entry.pLight );
@@ -1107,7 +1714,7 @@ void CLightingManager::RenderLights( const CViewSetup &view, CDeferredViewRender
 
 						pRenderContext->PopRenderTargetAndViewport();
 
-						iPassesVolumetrics[1]++;
+						m_RenderStats.iPassesVolumetrics[1]++;
 					}
 					FOR_EACH_VEC_FAST_END
 
@@ -1124,349 +1731,342 @@ void CLightingManager::RenderLights( const CViewSetup &view, CDeferredViewRender
 
 	for ( int i = 0; i < iNumLightTypes; i++ )
 	{
-#if DEFCFG_EXTRA_SORT
-		CMatRenderContextPtr pRenderContext( materials );
-		pRenderContext->Bind( lightTypes[i].pMatPassWorld );
-		pRenderContext->MatrixMode( MATERIAL_MODEL );
+		if ( bExtraSort )
+			RenderWorldLights< true >( view, pCaller, lightTypes[i], pVolumBuffer0 );
+		else
+			RenderWorldLights< false >( view, pCaller, lightTypes[i], pVolumBuffer0 );
+	}
+
+	IssueOcclusionQueries();
+
+	m_LightDataArena.Fence();
+
+	if ( deferred_lightmanager_debug.GetBool() )
+	{
+		Assert( iNumLightTypes == 2 );
+
+		const char *pszFilterName = "UNKNOWN FILTER";
+		const char *pszProfile = "HARDWARE";
+
+#if SHADOWMAPPING_USE_COLOR
+		pszProfile = "SOFTWARE";
+#endif
 
-		FOR_EACH_VEC_FAST( def_light_t*, (*(lightTypes[i].lightVecWorldSimple)), l )
+		switch ( SHADOWMAPPING_METHOD )
 		{
-			if ( l->pMesh_World == NULL )
-				continue;
+		case SHADOWMAPPING_DEPTH_COLOR__RAW:
+		case SHADOWMAPPING_DEPTH_STENCIL__RAW:
+			pszFilterName = "RAW";
+			break;
+		case SHADOWMAPPING_DEPTH_STENCIL__3X3_GAUSSIAN:
+			pszFilterName = "3x3 GAUSS";
+			break;
+		case SHADOWMAPPING_DEPTH_COLOR__4X4_SOFTWARE_BILINEAR_BOX:
+			pszFilterName = "4x4 BOX";
+			break;
+		case SHADOWMAPPING_DEPTH_COLOR__4X4_SOFTWARE_BILINEAR_GAUSSIAN:
+			pszFilterName = "4x4 GAUSS";
+			break;
+		case SHADOWMAPPING_DEPTH_COLOR__5X5_SOFTWARE_BILINEAR_GAUSSIAN:
+		case SHADOWMAPPING_DEPTH_STENCIL__5X5_GAUSSIAN:
+			pszFilterName = "5x5 GAUSS";
+			break;
+		default:
+			Assert(0); // add filter name to this switch case
+		}
 
-			const bool bCookie = l->HasCookie() && l->IsCookieReady();
+		engine->Con_NPrintf( 17, "STATS - RENDERING" );
+		engine->Con_NPrintf( 18, "Fullscreen passes - point: %i, spot: %i, total: %i",
+			m_RenderStats.iPassesDrawnFullscreen[0], m_RenderStats.iPassesDrawnFullscreen[1],
+			m_RenderStats.iPassesDrawnFullscreen[0] + m_RenderStats.iPassesDrawnFullscreen[1] );
+		engine->Con_NPrintf( 19, "Volumetric passes - world: %i, fullscreen: %i",
+			m_RenderStats.iPassesVolumetrics[0], m_RenderStats.iPassesVolumetrics[1] );
+		engine->Con_NPrintf( 20, "Stats drawn - simple: %i, shadows: %i, cookies: %i", m_RenderStats.iDrawnSimple, m_RenderStats.iDrawnShadowed, m_RenderStats.iDrawnCookied );
+		engine->Con_NPrintf( 21, "World light batches: %i, lights batched: %i, draws saved: %i",
+			m_iNumLightBatches, m_iNumBatchedLights, m_iNumBatchedLights - m_iNumLightBatches );
+		engine->Con_NPrintf( 22, "Shadow mapping filter profile: %s - %s", pszProfile, pszFilterName );
+	}
+}
 
-			int numRows = bCookie ? lightTypes[i].constCount_advanced : lightTypes[i].constCount_simple;
+template< bool bExtraSort >
+void CLightingManager::RenderWorldLights( const CViewSetup &view, CDeferredViewRender *pCaller,
+	const lightPass_t &pass, ITexture *pVolumBuffer )
+{
+	static CUtlVector< def_light_t* > lightsWorld;
+	m_RenderStats.iDrawnSimple += DrawWorldLightBatches( view, *pass.lightVecWorld,
+		pass.pMatPassFullscreen, pass.constCount_simple, lightsWorld );
 
-			int memToAlloc = 4 * numRows;
+	if ( bExtraSort )
+	{
+		// everything left in this bucket uses the same material and constant layout
+		CMatRenderContextPtr pRenderContext( materials );
+		pRenderContext->Bind( pass.pMatPassWorld );
+		pRenderContext->MatrixMode( MATERIAL_MODEL );
 
-			Assert( memToAlloc > 0 );
+		FOR_EACH_VEC_FAST( def_light_t*, lightsWorld, l )
+		{
+			if ( l->pMesh_World == NULL )
+				continue;
 
-			float *pFlLightDataBlock = new float[ memToAlloc ];
+			const int memToAlloc = 4 * pass.constCount_simple;
+			float *pFlLightDataBlock = m_LightDataArena.Alloc( memToAlloc );
 
 			WriteLight( l, pFlLightDataBlock );
 
 			defData_commitData data;
 			data.pData = pFlLightDataBlock;
-			data.rows = lightTypes[i].constCount_simple;
+			data.rows = pass.constCount_simple;
 			data.a = 0;
 			data.b = 0;
-			data.c = bCookie ? 1 : 0;
-			data.d = 0;
+			data.c = 0;
+			data.d = 1;
 			QUEUE_FIRE( defData_commitData, Fire, data );
 
-			if ( !bCookie )
-				iDrawnSimple++;
+			m_RenderStats.iDrawnSimple++;
 
 			pRenderContext->PushMatrix();
 			pRenderContext->LoadMatrix( l->worldTransform );
 			l->pMesh_World->Draw();
 			pRenderContext->PopMatrix();
-
-			//ShaderStencilState_t stencilLightVolume;
-			//set to reference 1 where draw succeeds 
-			//pRenderContext->Bind( lightTypes[i].pMatPassWorldStencilStage );
-			//pMatPassWorldStencilStage only draws the backface where depth test fails
-			//pRenderContext->SetStencilState( stencilLightVolume );
-			//l->pMesh_World->Draw();
-			//set to only draw where stencil is reference 1, set depth test to nearer
-			//pRenderContext->SetStencilState( stencilLightVolume );			
 		}
 		FOR_EACH_VEC_FAST_END
 
-		FOR_EACH_VEC_FAST( def_light_t*, (*(lightTypes[i].lightVecWorldAdvanced)), l )
-		{
-			if ( l->pMesh_World == NULL )
-				continue;
-
-			const bool bShadow = l->ShouldRenderShadow();
-			const bool bCookie = l->HasCookie() && l->IsCookieReady();
-			const bool bVolumetrics = l->HasVolumetrics() && bShadow;
-
-			const bool bAdvanced = ( bShadow || bCookie );
+		pRenderContext.SafeRelease();
 
-			int numRows = bAdvanced ? lightTypes[i].constCount_advanced : lightTypes[i].constCount_simple;
-			int memToAlloc = 4 * numRows;
+		FOR_EACH_VEC_FAST( def_light_t*, (*pass.lightVecWorldAdvanced), l )
+		{
+			DrawWorldLight( view, pCaller, pass, l, pVolumBuffer );
+		}
+		FOR_EACH_VEC_FAST_END
+	}
+	else
+	{
+		FOR_EACH_VEC_FAST( def_light_t*, lightsWorld, l )
+		{
+			DrawWorldLight( view, pCaller, pass, l, pVolumBuffer );
+		}
+		FOR_EACH_VEC_FAST_END
+	}
+}
 
-			Assert( memToAlloc > 0 );
+void CLightingManager::DrawWorldLight( const CViewSetup &view, CDeferredViewRender *pCaller,
+	const lightPass_t &pass, def_light_t *l, ITexture *pVolumBuffer )
+{
+	if ( l->pMesh_World == NULL )
+		return;
 
-			float *pFlLightDataBlock = new float[ memToAlloc ];
+	const bool bShadow = l->ShouldRenderShadow();
+	const bool bCookie = l->ShouldRenderCookie();
+	const bool bVolumetrics = l->ShouldRenderVolumetrics();
 
-			WriteLight( l, pFlLightDataBlock );
+	const bool bAdvanced = ( bShadow || bCookie );
 
-			if ( bShadow )
-			{
-				pCaller->DrawLightShadowView( view, 0, l );
+	int numRows = bAdvanced ? pass.constCount_advanced : pass.constCount_simple;
+	int memToAlloc = 4 * numRows;
 
-				iDrawnShadowed++;
-			}
+	Assert( memToAlloc > 0 );
 
-			defData_commitData data;
-			data.pData = pFlLightDataBlock;
-			data.rows = numRows;
-			data.a = ( bShadow && bCookie ) ? 1 : 0;
-			data.b = ( bShadow && !bCookie ) ? 1 : 0;
-			data.c = ( !bShadow && bCookie ) ? 1 : 0;
-			data.d = bAdvanced ? 0 : 1;
-			QUEUE_FIRE( defData_commitData, Fire, data );
+	float *pFlLightDataBlock = m_LightDataArena.Alloc( memToAlloc );
 
-			if ( bCookie )
-			{
-				defData_Cookie data;
-				data.index = 0;
-				data.pCookie = l->GetCookieForDraw();
-				Assert( data.pCookie != NULL );
-				QUEUE_FIRE( defData_Cookie, Fire, data );
+	WriteLight( l, pFlLightDataBlock );
 
-				iDrawnCookied++;
-			}
+	if ( bShadow )
+	{
+		pCaller->DrawLightShadowView( view, 0, l );
 
-			if ( !bShadow && !bCookie )
-				iDrawnSimple++;
+		m_RenderStats.iDrawnShadowed++;
+	}
 
-			pRenderContext->MatrixMode( MATERIAL_MODEL );
-			pRenderContext->PushMatrix();
-			pRenderContext->LoadMatrix( l->worldTransform );
-			pRenderContext->Bind( lightTypes[i].pMatPassWorld );
+	defData_commitData data;
+	data.pData = pFlLightDataBlock;
+	data.rows = numRows;
+	data.a = ( bShadow && bCookie ) ? 1 : 0;
+	data.b = ( bShadow && !bCookie ) ? 1 : 0;
+	data.c = ( !bShadow && bCookie ) ? 1 : 0;
+	data.d = bAdvanced ? 0 : 1;
+	QUEUE_FIRE( defData_commitData, Fire, data );
 
-			//ShaderStencilState_t stencilLightVolume;
-			//set to reference 1 where draw succeeds 
-			//pRenderContext->Bind( lightTypes[i].pMatPassWorldStencilStage );
-			//pMatPassWorldStencilStage only draws the backface where depth test fails
-			//pRenderContext->SetStencilState( stencilLightVolume );
-			//l->pMesh_World->Draw();
-			//set to only draw where stencil is reference 1, set depth test to nearer
-			//pRenderContext->SetStencilState( stencilLightVolume );
+	if ( bCookie )
+	{
+		CDefCookieProjectable::GetTargetCache().BeginBatch();
 
-			l->pMesh_World->Draw();
+		defData_Cookie data;
+		data.index = 0;
+		data.pCookie = l->GetCookieForDraw();
+		Assert( data.pCookie != NULL );
+		QUEUE_FIRE( defData_Cookie, Fire, data );
 
-			if ( bVolumetrics )
-			{
-				Assert( m_bDrawVolumetrics );
-				Assert( l->pMesh_Volumetrics != NULL );
+		m_RenderStats.iDrawnCookied++;
+	}
 
-#if DEFCFG_ADAPTIVE_VOLUMETRIC_LOD
-				const float flCameraLightDelta = (view.origin).DistTo(l->pos);
-				int iVolumeLOD = 4;
-				if( flCameraLightDelta < l->flVolumeLOD0Dist )
-				{ 
-					iVolumeLOD = 0;
-				}
-				else if( flCameraLightDelta < l->flVolumeLOD1Dist )
-				{
-					iVolumeLOD = 1;
-				}
-				else if( flCameraLightDelta < l->flVolumeLOD2Dist )
-				{
-					iVolumeLOD = 2;
-				}
-				else if( flCameraLightDelta < l->flVolumeLOD3Dist )
-				{
-					iVolumeLOD = 3;
-				}
-#endif
+	if ( !bShadow && !bCookie )
+		m_RenderStats.iDrawnSimple++;
 
-				defData_Volume data;
-				data.mData.iDataOffset = 0;
-				data.mData.iSamplerOffset = 0;
-				data.mData.iNumRows = lightTypes[i].constCount_advanced;
-				data.mData.bHasCookie = bCookie;
-#if DEFCFG_ADAPTIVE_VOLUMETRIC_LOD
-				data.mData.iLOD = iVolumeLOD;
-#endif
-#if DEFCFG_CONFIGURABLE_VOLUMETRIC_LOD
-				data.mData.iSamples = l->iVolumeSamples;
-#endif
-				QUEUE_FIRE( defData_Volume, Fire, data );
+	CMatRenderContextPtr pRenderContext( materials );
+	pRenderContext->MatrixMode( MATERIAL_MODEL );
+	pRenderContext->PushMatrix();
+	pRenderContext->LoadMatrix( l->worldTransform );
+	pRenderContext->Bind( pass.pMatPassWorld );
 
-				DrawVolumePrepass( false, view, l );
+	//ShaderStencilState_t stencilLightVolume;
+	//set to reference 1 where draw succeeds 
+	//pRenderContext->Bind( pass.pMatPassWorldStencilStage );
+	//pMatPassWorldStencilStage only draws the backface where depth test fails
+	//pRenderContext->SetStencilState( stencilLightVolume );
+	//l->pMesh_World->Draw();
+	//set to only draw where stencil is reference 1, set depth test to nearer
+	//pRenderContext->SetStencilState( stencilLightVolume );
 
-				pRenderContext->PushRenderTargetAndViewport( pVolumBuffer0 );
+	l->pMesh_World->Draw();
 
-				pRenderContext->Bind( lightTypes[i].pMatVolumeWorld );
-				l->pMesh_Volumetrics->Draw();
+	if ( bVolumetrics )
+	{
+		Assert( m_bDrawVolumetrics );
+		Assert( l->pMesh_Volumetrics != NULL );
 
-				pRenderContext->PopRenderTargetAndViewport();
+		defData_Volume data;
+		data.mData.iDataOffset = 0;
+		data.mData.iSamplerOffset = 0;
+		data.mData.iNumRows = pass.constCount_advanced;
+		data.mData.bHasCookie = bCookie;
+		SetVolumetricLOD( view, l, data.mData );
+		QUEUE_FIRE( defData_Volume, Fire, data );
 
-				iPassesVolumetrics[0]++;
-			}
+		DrawVolumePrepass( false, view, l );
 
-			pRenderContext->MatrixMode( MATERIAL_MODEL );
-			pRenderContext->PopMatrix();
-		}
-		FOR_EACH_VEC_FAST_END
+		pRenderContext->PushRenderTargetAndViewport( pVolumBuffer );
 
-		pRenderContext.SafeRelease();
-#else
-		FOR_EACH_VEC_FAST( def_light_t*, (*(lightTypes[i].lightVecWorld)), l )
-		{
-			if ( l->pMesh_World == NULL )
-				continue;
+		pRenderContext->Bind( pass.pMatVolumeWorld );
+		l->pMesh_Volumetrics->Draw();
 
-			const bool bShadow = l->ShouldRenderShadow();
-			const bool bCookie = l->HasCookie() && l->IsCookieReady();
-			const bool bVolumetrics = l->HasVolumetrics() && bShadow;
+		pRenderContext->PopRenderTargetAndViewport();
 
-			const bool bAdvanced = ( bShadow || bCookie );
+		m_RenderStats.iPassesVolumetrics[0]++;
+	}
 
-			int numRows = bAdvanced ? lightTypes[i].constCount_advanced : lightTypes[i].constCount_simple;
-			int memToAlloc = 4 * numRows;
+	pRenderContext->MatrixMode( MATERIAL_MODEL );
+	pRenderContext->PopMatrix();
+	pRenderContext.SafeRelease();
+}
 
-			Assert( memToAlloc > 0 );
+void CLightingManager::SetVolumetricLOD( const CViewSetup &view, def_light_t *l, volumeData_t &data ) const
+{
+#if DEFCFG_ADAPTIVE_VOLUMETRIC_LOD
+	const float flCameraLightDelta = (view.origin).DistTo(l->pos);
+	int iVolumeLOD = 4;
+	if( flCameraLightDelta < l->flVolumeLOD0Dist )
+	{ 
+		iVolumeLOD = 0;
+	}
+	else if( flCameraLightDelta < l->flVolumeLOD1Dist )
+	{
+		iVolumeLOD = 1;
+	}
+	else if( flCameraLightDelta < l->flVolumeLOD2Dist )
+	{
+		iVolumeLOD = 2;
+	}
+	else if( flCameraLightDelta < l->flVolumeLOD3Dist )
+	{
+		iVolumeLOD = 3;
+	}
 
-			float *pFlLightDataBlock = new float[ memToAlloc ];
+	data.iLOD = iVolumeLOD;
+#endif
 
-			WriteLight( l, pFlLightDataBlock );
+#if DEFCFG_CONFIGURABLE_VOLUMETRIC_LOD
+	data.iSamples = ( l->iVolumeSamplesFrame > 0 ) ? l->iVolumeSamplesFrame :
+		GetVolumetricSamples( view.origin, l );
+#endif
+}
 
-			if ( bShadow )
-			{
-				pCaller->DrawLightShadowView( view, 0, l );
+int CLightingManager::DrawWorldLightBatches( const CViewSetup &view, const CUtlVector< def_light_t* > &hLights,
+	IMaterial *pMatPassFullscreen, int iConstCount, CUtlVector< def_light_t* > &hUnbatched )
+{
+	static CUtlVector< def_light_t* > batchable;
+	static CUtlVector< lightBatchRect_t > rects;
 
-				iDrawnShadowed++;
-			}
+	hUnbatched.RemoveAll();
 
-			defData_commitData data;
-			data.pData = pFlLightDataBlock;
-			data.rows = numRows;
-			data.a = ( bShadow && bCookie ) ? 1 : 0;
-			data.b = ( bShadow && !bCookie ) ? 1 : 0;
-			data.c = ( !bShadow && bCookie ) ? 1 : 0;
-			data.d = bAdvanced ? 0 : 1;
-			QUEUE_FIRE( defData_commitData, Fire, data );
+	FOR_EACH_VEC_FAST( def_light_t*, hLights, l )
+	{
+		// shadows and cookies need their own samplers
+		const bool bSimple = !l->ShouldRenderShadow() && !l->ShouldRenderCookie();
 
-			if ( bCookie )
-			{
-				defData_Cookie data;
-				data.index = 0;
-				data.pCookie = l->GetCookieForDraw();
-				Assert( data.pCookie != NULL );
-				QUEUE_FIRE( defData_Cookie, Fire, data );
+		lightBatchRect_t rect;
 
-				iDrawnCookied++;
-			}
+		if ( !deferred_lightmanager_batch.GetBool() || !bSimple || l->pMesh_World == NULL ||
+			!CLightBatchBuilder::CalcScreenRect( m_matWorldToScreen, l->GetBoundsMinNaive(), l->GetBoundsMaxNaive(),
+				view.width, view.height, rect ) )
+		{
+			hUnbatched.AddToTail( l );
+			continue;
+		}
 
-			if ( !bShadow && !bCookie )
-				iDrawnSimple++;
+		batchable.AddToTail( l );
+		rects.AddToTail( rect );
+	}
+	FOR_EACH_VEC_FAST_END
 
-			CMatRenderContextPtr pRenderContext( materials );
-			pRenderContext->MatrixMode( MATERIAL_MODEL );
-			pRenderContext->PushMatrix();
-			pRenderContext->LoadMatrix( l->worldTransform );
-			pRenderContext->Bind( lightTypes[i].pMatPassWorld );
+	int iDrawn = 0;
 
-			//ShaderStencilState_t stencilLightVolume;
-			//set to reference 1 where draw succeeds 
-			//pRenderContext->Bind( lightTypes[i].pMatPassWorldStencilStage );
-			//pMatPassWorldStencilStage only draws the backface where depth test fails
-			//pRenderContext->SetStencilState( stencilLightVolume );
-			//l->pMesh_World->Draw();
-			//set to only draw where stencil is reference 1, set depth test to nearer
-			//pRenderContext->SetStencilState( stencilLightVolume );
+	if ( batchable.Count() > 1 )
+	{
+		m_LightBatcher.Build( rects.Base(), rects.Count(), MAX_LIGHTS_SIMPLE,
+			deferred_lightmanager_batch_drawcost.GetInt() );
 
-			l->pMesh_World->Draw();
+		for ( int b = 0; b < m_LightBatcher.GetNumBatches(); b++ )
+		{
+			const int iCount = m_LightBatcher.GetBatchSize( b );
+			const int *pIndices = m_LightBatcher.GetBatchIndices( b );
 
-			if ( bVolumetrics )
+			// the world mesh is tighter than a rect of its own
+			if ( iCount == 1 )
 			{
-				Assert( m_bDrawVolumetrics );
-				Assert( l->pMesh_Volumetrics != NULL );
-
-#if DEFCFG_ADAPTIVE_VOLUMETRIC_LOD
-				const float flCameraLightDelta = (view.origin).DistTo(l->pos);
-				int iVolumeLOD = 4;
-				if( flCameraLightDelta < l->flVolumeLOD0Dist )
-				{ 
-					iVolumeLOD = 0;
-				}
-				else if( flCameraLightDelta < l->flVolumeLOD1Dist )
-				{
-					iVolumeLOD = 1;
-				}
-				else if( flCameraLightDelta < l->flVolumeLOD2Dist )
-				{
-					iVolumeLOD = 2;
-				}
-				else if( flCameraLightDelta < l->flVolumeLOD3Dist )
-				{
-					iVolumeLOD = 3;
-				}
-#endif
-
-				defData_Volume data;
-				data.mData.iDataOffset = 0;
-				data.mData.iSamplerOffset = 0;
-				data.mData.iNumRows = lightTypes[i].constCount_advanced;
-				data.mData.bHasCookie = bCookie;
-#if DEFCFG_ADAPTIVE_VOLUMETRIC_LOD
-				data.mData.iLOD = iVolumeLOD;
-#endif
-#if DEFCFG_CONFIGURABLE_VOLUMETRIC_LOD
-				data.mData.iSamples = l->iVolumeSamples;
-#endif
-				QUEUE_FIRE( defData_Volume, Fire, data );
+				hUnbatched.AddToTail( batchable[ pIndices[ 0 ] ] );
+				continue;
+			}
 
-				DrawVolumePrepass( false, view, l );
+			const int numRows = iCount * iConstCount;
+			float *pFlLightDataBlock = m_LightDataArena.Alloc( 4 * numRows );
+			float *pFlWriter = pFlLightDataBlock;
 
-				pRenderContext->PushRenderTargetAndViewport( pVolumBuffer0 );
+			for ( int i = 0; i < iCount; i++ )
+				pFlWriter += WriteLight( batchable[ pIndices[ i ] ], pFlWriter ) * 4;
 
-				pRenderContext->Bind( lightTypes[i].pMatVolumeWorld );
-				l->pMesh_Volumetrics->Draw();
+			Assert( pFlWriter - pFlLightDataBlock == 4 * numRows );
 
-				pRenderContext->PopRenderTargetAndViewport();
+			defData_commitData data;
+			data.pData = pFlLightDataBlock;
+			data.rows = numRows;
+			data.a = 0;
+			data.b = 0;
+			data.c = 0;
+			data.d = iCount;
+			QUEUE_FIRE( defData_commitData, Fire, data );
 
-				iPassesVolumetrics[0]++;
-			}
+			const lightBatchRect_t &rect = m_LightBatcher.GetBatchRect( b );
 
-			pRenderContext->MatrixMode( MATERIAL_MODEL );
-			pRenderContext->PopMatrix();
-			pRenderContext.SafeRelease();
+			CMatRenderContextPtr pRenderContext( materials );
+			pRenderContext->DrawScreenSpaceRectangle( pMatPassFullscreen,
+				rect.x0, rect.y0, rect.x1 - rect.x0, rect.y1 - rect.y0,
+				rect.x0, rect.y0, rect.x1 - 1.0f, rect.y1 - 1.0f,
+				view.width, view.height );
+
+			m_iNumLightBatches++;
+			m_iNumBatchedLights += iCount;
+			iDrawn += iCount;
 		}
-		FOR_EACH_VEC_FAST_END
-#endif
 	}
-
-	if ( deferred_lightmanager_debug.GetBool() )
+	else
 	{
-		Assert( iNumLightTypes == 2 );
-
-		const char *pszFilterName = "UNKNOWN FILTER";
-		const char *pszProfile = "HARDWARE";
-
-#if SHADOWMAPPING_USE_COLOR
-		pszProfile = "SOFTWARE";
-#endif
+		hUnbatched.AddVectorToTail( batchable );
+	}
 
-		switch ( SHADOWMAPPING_METHOD )
-		{
-		case SHADOWMAPPING_DEPTH_COLOR__RAW:
-		case SHADOWMAPPING_DEPTH_STENCIL__RAW:
-			pszFilterName = "RAW";
-			break;
-		case SHADOWMAPPING_DEPTH_STENCIL__3X3_GAUSSIAN:
-			pszFilterName = "3x3 GAUSS";
-			break;
-		case SHADOWMAPPING_DEPTH_COLOR__4X4_SOFTWARE_BILINEAR_BOX:
-			pszFilterName = "4x4 BOX";
-			break;
-		case SHADOWMAPPING_DEPTH_COLOR__4X4_SOFTWARE_BILINEAR_GAUSSIAN:
-			pszFilterName = "4x4 GAUSS";
-			break;
-		case SHADOWMAPPING_DEPTH_COLOR__5X5_SOFTWARE_BILINEAR_GAUSSIAN:
-		case SHADOWMAPPING_DEPTH_STENCIL__5X5_GAUSSIAN:
-			pszFilterName = "5x5 GAUSS";
-			break;
-		default:
-			Assert(0); // add filter name to this switch case
-		}
+	batchable.RemoveAll();
+	rects.RemoveAll();
 
-		engine->Con_NPrintf( 17, "STATS - RENDERING" );
-		engine->Con_NPrintf( 18, "Fullscreen passes - point: %i, spot: %i, total: %i",
-			iPassesDrawnFullscreen[0], iPassesDrawnFullscreen[1],
-			iPassesDrawnFullscreen[0] + iPassesDrawnFullscreen[1] );
-		engine->Con_NPrintf( 19, "Volumetric passes - world: %i, fullscreen: %i",
-			iPassesVolumetrics[0], iPassesVolumetrics[1] );
-		engine->Con_NPrintf( 20, "Stats drawn - simple: %i, shadows: %i, cookies: %i", iDrawnSimple, iDrawnShadowed, iDrawnCookied );
-		engine->Con_NPrintf( 22, "Shadow mapping filter profile: %s - %s", pszProfile, pszFilterName );
-	}
+	return iDrawn;
 }
 
 void CLightingManager::RenderVolumetrics( const CViewSetup &view )
@@ -1474,6 +2074,8 @@ void CLightingManager::RenderVolumetrics( const CViewSetup &view )
 	if ( !m_bDrawVolumetrics )
 		return;
 
+	DEFPROF_SCOPE( DEFPROF_VOLUMETRICS );
+
 	ITexture *pVolumBuffer0 = GetDefRT_VolumetricsBuffer( 0 );
 	ITexture *pVolumBuffer1 = GetDefRT_VolumetricsBuffer( 1 );
 
@@ -1518,11 +2120,68 @@ void CLightingManager::DoSceneDebug()
 
 	engine->Con_NPrintf( 10, "Total deferred lights: %i", m_hDeferredLights.Count() );
 	engine->Con_NPrintf( 11, "lights rendered: %i", m_hRenderLights.Count() );
+	engine->Con_NPrintf( 12, "light setup - prepare: %.3f ms, cull: %.3f ms, jobs: %i",
+		m_flPrepareLightsTime, m_flCullLightsTime, m_iNumLightJobs );
 	engine->Con_NPrintf( 13, "STATS - SORTING" );
-	engine->Con_NPrintf( 14, "lights point - world: %i, fullscreen: %i",
-		m_hPreSortedLights[ LSORT_POINT_WORLD ].Count(), m_hPreSortedLights[ LSORT_POINT_FULLSCREEN ].Count() );
-	engine->Con_NPrintf( 15, "lights spot - world: %i, fullscreen: %i",
-		m_hPreSortedLights[ LSORT_SPOT_WORLD ].Count(), m_hPreSortedLights[ LSORT_SPOT_FULLSCREEN ].Count() );
+	if ( m_bUseLeafIndex )
+	{
+		engine->Con_NPrintf( 23, "leaf index - leaves: %i, references: %i, visible leaves: %i, builds: %i",
+			m_LeafIndex.GetNumLeaves(), m_LeafIndex.GetNumReferences(),
+			m_LeafIndex.GetNumVisibleLeaves(), m_LeafIndex.GetNumBuilds() );
+	}
+	engine->Con_NPrintf( 14, "lights point - world: %i (%i adv), fullscreen: %i (%i adv)",
+		m_hPreSortedLights[ LSORT_POINT_WORLD ].Count(), m_hPreSortedLights[ LSORT_POINT_WORLD_ADVANCED ].Count(),
+		m_hPreSortedLights[ LSORT_POINT_FULLSCREEN ].Count(), m_hPreSortedLights[ LSORT_POINT_FULLSCREEN_ADVANCED ].Count() );
+	engine->Con_NPrintf( 15, "lights spot - world: %i (%i adv), fullscreen: %i (%i adv)",
+		m_hPreSortedLights[ LSORT_SPOT_WORLD ].Count(), m_hPreSortedLights[ LSORT_SPOT_WORLD_ADVANCED ].Count(),
+		m_hPreSortedLights[ LSORT_SPOT_FULLSCREEN ].Count(), m_hPreSortedLights[ LSORT_SPOT_FULLSCREEN_ADVANCED ].Count() );
+
+#if DEFCFG_SHADOW_CACHE
+	if ( deferred_shadow_cache.GetBool() )
+	{
+		engine->Con_NPrintf( 28, "STATS - SHADOW CACHE" );
+		engine->Con_NPrintf( 29, "valid: %i, hits: %i, stores: %i, invalidated: %i, movers: %i",
+			m_ShadowCache.GetNumValidEntries(), m_ShadowCache.GetNumHits(), m_ShadowCache.GetNumStores(),
+			m_ShadowCache.GetNumInvalidated(), m_ShadowCache.GetNumMovers() );
+	}
+#endif
+
+	engine->Con_NPrintf( 32, "shadow views: %i / %i, cascades: %i (%i forced), stale: %i, dropped: %i",
+		m_ShadowScheduler.GetNumViews(), deferred_shadow_view_budget.GetInt(),
+		m_ShadowScheduler.GetNumCascadeUpdates(), m_ShadowScheduler.GetNumForced(),
+		m_ShadowScheduler.GetNumStale(), m_ShadowScheduler.GetNumDropped() );
+
+#if DEFCFG_CONFIGURABLE_VOLUMETRIC_LOD
+	if ( deferred_volumetrics_sample_budget.GetFloat() > 0.0f )
+	{
+		engine->Con_NPrintf( 33, "volumetrics: %i lights, %i samples",
+			m_hVolumetricLights.Count(), m_iVolumetricSamplesFrame );
+	}
+#endif
+
+	engine->Con_NPrintf( 30, "STATS - LIGHT DATA ARENA" );
+	engine->Con_NPrintf( 31, "frame: %i bytes, high water: %i bytes, capacity: %i bytes, stalls: %i, dropped: %i (%i chunks pending)",
+		m_LightDataArena.GetLastFrameBytes(), m_LightDataArena.GetHighWaterBytes(),
+		m_LightDataArena.GetCapacityBytes(), m_LightDataArena.GetNumStalls(), m_LightDataArena.GetNumDropped(),
+		m_LightDataArena.GetNumDroppedChunks() );
+
+	const CProjectableTargetCache &projectables = CDefCookieProjectable::GetTargetCache();
+	engine->Con_NPrintf( 35, "projectables: %i repaints, %i reused, budget: %i",
+		projectables.GetNumRepaints(), projectables.GetNumReused(),
+		deferred_projectable_repaint_budget.GetInt() );
+
+	engine->Con_NPrintf( 36, "light lod: %i full, %i no cookie, %i no volumetrics, %i no shadow, %i merged into %i proxies, cost: %.0fk / %.0fk",
+		m_LightLOD.GetNumLights( LIGHTLOD_FULL ), m_LightLOD.GetNumLights( LIGHTLOD_NO_COOKIE ),
+		m_LightLOD.GetNumLights( LIGHTLOD_NO_VOLUMETRICS ), m_LightLOD.GetNumLights( LIGHTLOD_NO_SHADOW ),
+		m_LightLOD.GetNumLights( LIGHTLOD_MERGED ), m_iNumLightProxies,
+		m_LightLOD.GetCost() * 0.001f, m_LightLOD.GetFullCost() * 0.001f );
+
+	engine->Con_NPrintf( 37, "light occlusion: %i occluded, %i queries, %s",
+		m_iNumOccludedLights, m_iNumOcclusionQueries,
+		!deferred_light_occlusion.GetBool() ? "off" : ( m_bOcclusionSoftware ? "software" : "hardware" ) );
+
+	engine->Con_NPrintf( 38, "light bake: %i from the bake, %i traced, %i in the file",
+		m_iNumBakedLights, m_iNumTracedLights, m_LightBake.GetNumBakes() );
 }
 
 void CLightingManager::DebugLights_Draw_Boundingboxes()
@@ -5,9 +5,6 @@
 
 class CViewSetup;
 class CDeferredViewRender;
-#if DEFCFG_USE_SSE
-struct def_light_presortdatax4_t;
-#endif
 
 class CLightingManager : public CAutoGameSystemPerFrame
 {
@@ -33,17 +30,15 @@ public:
 		const CViewSetup &setup );
 
 	void OnCookieStringReceived( const char *pszString, const int &index );
+
+	// traces all world lights again and saves them next to the map
+	void BakeWorldLights();
 	void OnMaterialReload();
 
 	void AddLight( def_light_t *l );
 	bool RemoveLight( def_light_t *l );
 	bool IsLightRendered( def_light_t *l );
 
-#if DEFCFG_USE_SSE
-	void AllocateSortDataBuffer();
-	void BuildLightSortDataBuffer();
-#endif
-
 	void ClearTmpLists();
 
 	// update volatile data - internal xforms, final light col bleh
@@ -61,6 +56,14 @@ public:
 	// add volumes to scene after composition
 	void RenderVolumetrics( const CViewSetup &view );
 
+#if DEFCFG_SHADOW_CACHE
+	// shadow maps of world lights kept between frames
+	FORCEINLINE CShadowCache &GetShadowCache() { return m_ShadowCache; };
+#endif
+
+	// per frame budget of shadow views, shared with the cascades
+	FORCEINLINE CShadowScheduler &GetShadowScheduler() { return m_ShadowScheduler; };
+
 	// debugging crap
 	void DoSceneDebug();
 	void DebugLights_Draw_Boundingboxes();
@@ -72,43 +75,211 @@ private:
 
 	bool m_bDrawWorldLights;
 
+	// the advanced buckets are only used when the pipeline sorts by combo
 	enum
 	{
-#if DEFCFG_EXTRA_SORT
-		LSORT_POINT_WORLD_SIMPLE = 0,
-		LSORT_POINT_WORLD_ADVANCED,
-		LSORT_POINT_FULLSCREEN_SIMPLE,
-		LSORT_POINT_FULLSCREEN_ADVANCED,
-		LSORT_SPOT_WORLD_SIMPLE,
-		LSORT_SPOT_WORLD_ADVANCED,
-		LSORT_SPOT_FULLSCREEN_SIMPLE,
-		LSORT_SPOT_FULLSCREEN_ADVANCED,
-#else
 		LSORT_POINT_WORLD = 0,
+		LSORT_POINT_WORLD_ADVANCED,
 		LSORT_POINT_FULLSCREEN,
+		LSORT_POINT_FULLSCREEN_ADVANCED,
 		LSORT_SPOT_WORLD,
+		LSORT_SPOT_WORLD_ADVANCED,
 		LSORT_SPOT_FULLSCREEN,
-#endif
+		LSORT_SPOT_FULLSCREEN_ADVANCED,
 
 		LSORT_COUNT,
 	};
 
+	FORCEINLINE static int GetSortBucket( int iLightType, bool bFullscreen, bool bAdvanced )
+	{
+		return iLightType * 4 + ( bFullscreen ? 2 : 0 ) + ( bAdvanced ? 1 : 0 );
+	};
+
+	CUtlVector< def_light_t* > m_hDeferredLights;
+
 #if DEFCFG_USE_SSE
-	def_light_presortdatax4_t* m_pSortDataX4;
-	unsigned int m_uiSortDataCount;			
+	// slots match m_hDeferredLights
+	CDeferredLightStore m_LightStore;
 #endif
 
-	CUtlVector< def_light_t* > m_hDeferredLights;
+	// leaves to lights, indexed like m_hDeferredLights
+	CLightLeafIndex m_LeafIndex;
+	bool m_bUseLeafIndex;
+
+	FORCEINLINE bool AreLightLeavesVisible( int iLight, def_light_t *l ) const
+	{
+		if ( m_bUseLeafIndex )
+			return m_LeafIndex.IsLightVisible( iLight );
+
+		return render->AreAnyLeavesVisible( l->iLeaveIDs, l->iNumLeaves );
+	};
+
+	void UpdateLeafIndex();
 
 	CUtlVector< def_light_t* > m_hRenderLights;
+	CUtlVector< bool > m_hRenderLightsFullscreen;
 	CUtlVector< def_light_t* > m_hPreSortedLights[ LSORT_COUNT ];
 
+#if DEFCFG_SHADOW_CACHE
+	CShadowCache m_ShadowCache;
+#endif
+
+	CShadowScheduler m_ShadowScheduler;
+	CUtlVector< def_light_t* > m_hShadowScheduleLights;
+
+	// hands out shadow views nearest first, drops or reuses old maps past the budget
+	void ScheduleShadowViews();
+	static int SortByViewDistance( def_light_t * const *a, def_light_t * const *b );
+
+	// visibility of light volumes, queries are issued after the lights are drawn
+	// and read back while culling the next frame
+	bool m_bOcclusionQueries;
+	bool m_bOcclusionSoftware;
+	Vector m_vecOcclusionOrigin;
+	CMaterialReference m_OcclusionProxyMaterial;
+	CLightOcclusionBuffer m_OcclusionBuffer;
+	CUtlVector< def_light_t* > m_hOcclusionQueryLights;
+	int m_iNumOccludedLights;
+	int m_iNumOcclusionQueries;
+
+	void CullOccludedLights();
+	void UpdateOcclusionBuffer();
+	void IssueOcclusionQueries();
+	void ReleaseOcclusionQuery( def_light_t *l );
+
+	CLightLODPolicy m_LightLOD;
+	CUtlVector< lightLodInput_t > m_LightLODInputs;
+	CUtlVector< int > m_LightLODs;
+
+	// merged point lights, owned by the manager and reused between frames
+	CUtlVector< def_light_t* > m_hLightProxies;
+	int m_iNumLightProxies;
+	CUtlVector< def_light_t* > m_hMergedLights;
+	CUtlVector< Vector > m_MergePositions;
+	CUtlVector< int > m_MergeClusters;
+	CUtlVector< int > m_MergeClusterProxies;
+	CUtlVector< float > m_MergeWeights;
+
+	// picks the LOD of the render lights, drops features and merges tiny point lights
+	void ApplyLightLOD( const CViewSetup &setup );
+	void MergeLights();
+	def_light_t *AllocateLightProxy();
+
+#if DEFCFG_CONFIGURABLE_VOLUMETRIC_LOD
+	CUtlVector< def_light_t* > m_hVolumetricLights;
+	CUtlVector< int > m_VolumetricBaseSamples;
+	CUtlVector< float > m_VolumetricCoverage;
+	CUtlVector< int > m_VolumetricSamples;
+	int m_iVolumetricSamplesFrame;
+
+	// splits the ray march samples of the frame between the volumetric lights
+	void BudgetVolumetrics( const CViewSetup &setup );
+	int GetVolumetricSamples( const Vector &vecViewOrigin, def_light_t *l ) const;
+#endif
+
+	// constant blocks read by the render thread
+	CLightDataArena m_LightDataArena;
+
 	VMatrix m_matScreenToWorld;
+	VMatrix m_matWorldToScreen;
 	Vector m_vecViewOrigin;
 	Vector m_vecForward;
 	float m_flzNear;
 	bool m_bDrawVolumetrics;
 
+	// a range of lights processed by one job, results are merged in job order.
+	// jobs must not call into the engine's renderer, that's left to the merge
+	struct lightJob_t
+	{
+		int iFirst;
+		int iCount;
+		CUtlVector< def_light_t* > hLights;
+		CUtlVector< bool > hFullscreen;
+		CUtlVector< int > hIndices;
+	};
+
+	enum
+	{
+		LIGHTJOB_MAX = 8,
+		LIGHTJOB_MIN_XFORMS = 4,
+		LIGHTJOB_MIN_CULL = 64,
+	};
+
+	lightJob_t m_LightJobs[ LIGHTJOB_MAX ];
+	int m_iNumLightJobs;
+
+	void RunLightJobs( int iNumItems, int iMinItemsPerJob, void (CLightingManager::*pfnJob)( lightJob_t & ) );
+	void UpdateXFormsJob( lightJob_t &job );
+	template< bool bSIMD >
+	void CullLightsJob( lightJob_t &job );
+
+	template< bool bExtraSort >
+	void SortLightsInBuckets();
+
+	// one light type as drawn by RenderLights
+	struct lightPass_t
+	{
+		CUtlVector< def_light_t* > *lightVecFullscreen;
+		CUtlVector< def_light_t* > *lightVecFullscreenAdvanced;
+		CUtlVector< def_light_t* > *lightVecWorld;
+		CUtlVector< def_light_t* > *lightVecWorldAdvanced;
+		IMaterial *pMatPassFullscreen;
+		IMaterial *pMatPassWorld;
+		IMaterial *pMatVolumeFullscreen;
+		IMaterial *pMatVolumeWorld;
+		int constCount_simple;
+		int constCount_advanced;
+	};
+
+	struct renderStats_t
+	{
+		int iPassesDrawnFullscreen[ 2 ];
+		int iPassesVolumetrics[ 2 ];
+		int iDrawnShadowed;
+		int iDrawnCookied;
+		int iDrawnSimple;
+	};
+
+	renderStats_t m_RenderStats;
+
+	static bool GatherFullscreenLights( const lightPass_t &pass, bool bExtraSort,
+		CUtlVector< def_light_t* > &hLightsShadowedCookie, CUtlVector< def_light_t* > &hLightsShadowed,
+		CUtlVector< def_light_t* > &hLightsCookied, CUtlVector< def_light_t* > &hLightsSimple );
+
+	template< bool bExtraSort >
+	void RenderWorldLights( const CViewSetup &view, CDeferredViewRender *pCaller,
+		const lightPass_t &pass, ITexture *pVolumBuffer );
+	void DrawWorldLight( const CViewSetup &view, CDeferredViewRender *pCaller,
+		const lightPass_t &pass, def_light_t *l, ITexture *pVolumBuffer );
+	void SetVolumetricLOD( const CViewSetup &view, def_light_t *l, volumeData_t &data ) const;
+
+	// draws simple lights that share screen space as clipped fullscreen passes,
+	// returns the number of lights drawn and the ones left for the world pass
+	int DrawWorldLightBatches( const CViewSetup &view, const CUtlVector< def_light_t* > &hLights,
+		IMaterial *pMatPassFullscreen, int iConstCount, CUtlVector< def_light_t* > &hUnbatched );
+
+	CLightBatchBuilder m_LightBatcher;
+	int m_iNumLightBatches;
+	int m_iNumBatchedLights;
+
+	CUtlVector< def_light_t* > m_hDirtyXFormLights;
+
+	// traced bounds of world lights, loaded with the level and only saved by deferred_light_bake_world
+	CLightBakeCache m_LightBake;
+	bool m_bLightBake;
+	bool m_bLightBakeSave;
+	bool m_bHasMapCRC;
+	CRC32_t m_iMapCRC;
+	char m_szLightBakeFile[ MAX_PATH ];
+	int m_iNumBakedLights;
+	int m_iNumTracedLights;
+
+	void UpdateLightBake();
+	void SaveLightBake();
+
+	float m_flPrepareLightsTime;
+	float m_flCullLightsTime;
+
 	FORCEINLINE float DoLightStyle( def_light_t *l );
 	FORCEINLINE int WriteLight( def_light_t *l, float *pfl4 );
 	FORCEINLINE void DrawVolumePrepass( bool bDoModelTransform, const CViewSetup &view, def_light_t *l );
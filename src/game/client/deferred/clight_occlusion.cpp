@@ -0,0 +1,290 @@
+#include "cbase.h"
+#include "deferred/deferred_shared_common.h"
+
+#include "vstdlib/random.h"
+
+void CLightOcclusion::Init( lightOcclusion_t &occlusion )
+{
+	occlusion.hQuery = INVALID_OCCLUSION_QUERY_OBJECT_HANDLE;
+	Invalidate( occlusion );
+}
+
+void CLightOcclusion::Invalidate( lightOcclusion_t &occlusion )
+{
+	occlusion.iIssueFrame = -1;
+	occlusion.iResultFrame = -1;
+	occlusion.bHidden = false;
+}
+
+bool CLightOcclusion::ShouldIssue( const lightOcclusion_t &occlusion, int iFrame )
+{
+	return occlusion.iIssueFrame < 0 || iFrame - occlusion.iIssueFrame > LIGHTOCCLUSION_MAX_AGE;
+}
+
+void CLightOcclusion::OnIssued( lightOcclusion_t &occlusion, int iFrame )
+{
+	occlusion.iIssueFrame = iFrame;
+}
+
+void CLightOcclusion::OnResult( lightOcclusion_t &occlusion, int iPixels )
+{
+	if ( occlusion.iIssueFrame < 0 || iPixels < 0 )
+		return;
+
+	occlusion.iResultFrame = occlusion.iIssueFrame;
+	occlusion.iIssueFrame = -1;
+	occlusion.bHidden = iPixels == 0;
+}
+
+bool CLightOcclusion::IsOccluded( const lightOcclusion_t &occlusion, int iFrame )
+{
+	return occlusion.bHidden && occlusion.iResultFrame >= 0 &&
+		iFrame - occlusion.iResultFrame <= LIGHTOCCLUSION_MAX_AGE;
+}
+
+CLightOcclusionBuffer::CLightOcclusionBuffer()
+{
+	m_iWidth = 0;
+	m_iHeight = 0;
+	m_matWorldToScreen.Identity();
+}
+
+void CLightOcclusionBuffer::Init( int iWidth, int iHeight )
+{
+	Assert( iWidth > 0 && iHeight > 0 );
+
+	m_iWidth = iWidth;
+	m_iHeight = iHeight;
+
+	m_CornerDepth.SetCount( GetNumCorners() );
+	m_CellDepth.SetCount( m_iWidth * m_iHeight );
+
+	for ( int i = 0; i < m_CornerDepth.Count(); i++ )
+		m_CornerDepth[ i ] = FLT_MAX;
+
+	Resolve();
+}
+
+void CLightOcclusionBuffer::SetView( const VMatrix &matWorldToScreen )
+{
+	m_matWorldToScreen = matWorldToScreen;
+}
+
+void CLightOcclusionBuffer::GetCornerDeviceCoords( int iCorner, float &x, float &y ) const
+{
+	const int iStride = m_iWidth + 1;
+
+	x = ( iCorner % iStride ) / (float)m_iWidth * 2.0f - 1.0f;
+	y = 1.0f - ( iCorner / iStride ) / (float)m_iHeight * 2.0f;
+}
+
+void CLightOcclusionBuffer::SetCornerDepth( int iCorner, float flDepth )
+{
+	m_CornerDepth[ iCorner ] = flDepth;
+}
+
+void CLightOcclusionBuffer::Resolve()
+{
+	const int iStride = m_iWidth + 1;
+
+	for ( int y = 0; y < m_iHeight; y++ )
+	{
+		for ( int x = 0; x < m_iWidth; x++ )
+		{
+			const float *pTop = &m_CornerDepth[ y * iStride + x ];
+			const float *pBottom = pTop + iStride;
+
+			m_CellDepth[ y * m_iWidth + x ] = MAX( MAX( pTop[ 0 ], pTop[ 1 ] ), MAX( pBottom[ 0 ], pBottom[ 1 ] ) );
+		}
+	}
+}
+
+float CLightOcclusionBuffer::GetDepth( const Vector &vecPos ) const
+{
+	return m_matWorldToScreen.m[3][0] * vecPos.x + m_matWorldToScreen.m[3][1] * vecPos.y +
+		m_matWorldToScreen.m[3][2] * vecPos.z + m_matWorldToScreen.m[3][3];
+}
+
+bool CLightOcclusionBuffer::IsBoxOccluded( const Vector &vecMins, const Vector &vecMaxs ) const
+{
+	// boxes through the near plane or off screen are left to the other tests
+	lightBatchRect_t rect;
+	if ( !CLightBatchBuilder::CalcScreenRect( m_matWorldToScreen, vecMins, vecMaxs, m_iWidth, m_iHeight, rect ) )
+		return false;
+
+	float flMinDepth = FLT_MAX;
+
+	for ( int i = 0; i < 8; i++ )
+	{
+		const Vector vecCorner( ( i & 1 ) ? vecMaxs.x : vecMins.x,
+			( i & 2 ) ? vecMaxs.y : vecMins.y,
+			( i & 4 ) ? vecMaxs.z : vecMins.z );
+
+		flMinDepth = MIN( flMinDepth, GetDepth( vecCorner ) );
+	}
+
+	for ( int y = rect.y0; y < rect.y1; y++ )
+	{
+		for ( int x = rect.x0; x < rect.x1; x++ )
+		{
+			if ( GetCellDepth( x, y ) >= flMinDepth )
+				return false;
+		}
+	}
+
+	return true;
+}
+
+CON_COMMAND( deferred_light_occlusion_test, "Runs light occlusion query tracking and the software depth buffer through known cases and warns about wrong results." )
+{
+	// results arrive late and expire
+	lightOcclusion_t occlusion;
+	CLightOcclusion::Init( occlusion );
+
+	if ( CLightOcclusion::IsOccluded( occlusion, 10 ) || !CLightOcclusion::ShouldIssue( occlusion, 10 ) )
+		Warning( "query: a new light isn't queried\n" );
+
+	CLightOcclusion::OnIssued( occlusion, 10 );
+	CLightOcclusion::OnResult( occlusion, -1 );
+
+	if ( CLightOcclusion::ShouldIssue( occlusion, 11 ) || CLightOcclusion::IsOccluded( occlusion, 11 ) )
+		Warning( "query: a pending result was used\n" );
+
+	CLightOcclusion::OnResult( occlusion, 0 );
+
+	if ( !CLightOcclusion::IsOccluded( occlusion, 11 ) ||
+		!CLightOcclusion::IsOccluded( occlusion, 10 + LIGHTOCCLUSION_MAX_AGE ) ||
+		CLightOcclusion::IsOccluded( occlusion, 11 + LIGHTOCCLUSION_MAX_AGE ) ||
+		!CLightOcclusion::ShouldIssue( occlusion, 11 ) )
+		Warning( "query: an occluded result didn't last LIGHTOCCLUSION_MAX_AGE frames\n" );
+
+	CLightOcclusion::OnIssued( occlusion, 11 );
+	CLightOcclusion::OnResult( occlusion, 5 );
+
+	if ( CLightOcclusion::IsOccluded( occlusion, 12 ) )
+		Warning( "query: visible pixels didn't clear the occlusion\n" );
+
+	// without a query in flight results are ignored
+	CLightOcclusion::OnResult( occlusion, 0 );
+
+	if ( CLightOcclusion::IsOccluded( occlusion, 12 ) )
+		Warning( "query: a result arrived without a query in flight\n" );
+
+	// stuck queries are issued again
+	CLightOcclusion::OnIssued( occlusion, 20 );
+
+	if ( CLightOcclusion::ShouldIssue( occlusion, 20 + LIGHTOCCLUSION_MAX_AGE ) ||
+		!CLightOcclusion::ShouldIssue( occlusion, 21 + LIGHTOCCLUSION_MAX_AGE ) )
+		Warning( "query: a stuck query wasn't issued again\n" );
+
+	CLightOcclusion::OnResult( occlusion, 0 );
+	CLightOcclusion::Invalidate( occlusion );
+
+	if ( CLightOcclusion::IsOccluded( occlusion, 21 ) )
+		Warning( "query: invalidating kept the occlusion\n" );
+
+	// view from the origin down +x with a 90 degree fov, screen x is -y
+	VMatrix matWorldToScreen;
+	matWorldToScreen.Init( 0, -1, 0, 0,
+		0, 0, 1, 0,
+		1, 0, 0, -1,
+		1, 0, 0, 0 );
+
+	CLightOcclusionBuffer buffer;
+	buffer.Init( LIGHTOCCLUSION_SW_WIDTH, LIGHTOCCLUSION_SW_HEIGHT );
+	buffer.SetView( matWorldToScreen );
+
+	// a wall at depth 100 over the left half of the screen
+	for ( int i = 0; i < buffer.GetNumCorners(); i++ )
+	{
+		float x, y;
+		buffer.GetCornerDeviceCoords( i, x, y );
+		buffer.SetCornerDepth( i, ( x <= 0.0f ) ? 100.0f : FLT_MAX );
+	}
+
+	buffer.Resolve();
+
+	const Vector vecExtent( 20, 20, 20 );
+
+	// behind the wall
+	if ( !buffer.IsBoxOccluded( Vector( 300, 150, 0 ) - vecExtent, Vector( 300, 150, 0 ) + vecExtent ) )
+		Warning( "depth buffer: a box behind the wall is visible\n" );
+
+	// beside it, in front of it, across its edge, through the near plane and off screen
+	if ( buffer.IsBoxOccluded( Vector( 300, -150, 0 ) - vecExtent, Vector( 300, -150, 0 ) + vecExtent ) ||
+		buffer.IsBoxOccluded( Vector( 50, 25, 0 ) - vecExtent, Vector( 50, 25, 0 ) + vecExtent ) ||
+		buffer.IsBoxOccluded( Vector( 300, 0, 0 ) - vecExtent, Vector( 300, 0, 0 ) + vecExtent ) ||
+		buffer.IsBoxOccluded( -vecExtent, vecExtent ) ||
+		buffer.IsBoxOccluded( Vector( 300, 1000, 0 ) - vecExtent, Vector( 300, 1000, 0 ) + vecExtent ) )
+		Warning( "depth buffer: a box that isn't behind the wall is occluded\n" );
+
+	// random depths: cells take the farthest corner and every point of an
+	// occluded box lies behind the cell it projects to
+	CUniformRandomStream rnd;
+	rnd.SetSeed( 1 );
+
+	int iCellFailures = 0;
+	int iBoxFailures = 0;
+
+	for ( int iTest = 0; iTest < 20; iTest++ )
+	{
+		CUtlVector< float > corners;
+		corners.SetCount( buffer.GetNumCorners() );
+
+		for ( int i = 0; i < corners.Count(); i++ )
+		{
+			corners[ i ] = ( rnd.RandomInt( 0, 9 ) == 0 ) ? FLT_MAX : rnd.RandomFloat( 50, 500 );
+			buffer.SetCornerDepth( i, corners[ i ] );
+		}
+
+		buffer.Resolve();
+
+		const int iStride = buffer.GetWidth() + 1;
+
+		for ( int y = 0; y < buffer.GetHeight(); y++ )
+		{
+			for ( int x = 0; x < buffer.GetWidth(); x++ )
+			{
+				const int i = y * iStride + x;
+				const float flMax = MAX( MAX( corners[ i ], corners[ i + 1 ] ),
+					MAX( corners[ i + iStride ], corners[ i + iStride + 1 ] ) );
+
+				if ( buffer.GetCellDepth( x, y ) != flMax )
+					iCellFailures++;
+			}
+		}
+
+		for ( int iBox = 0; iBox < 200; iBox++ )
+		{
+			const Vector vecCenter( rnd.RandomFloat( 20, 1000 ), rnd.RandomFloat( -500, 500 ), rnd.RandomFloat( -500, 500 ) );
+			const Vector vecSize( rnd.RandomFloat( 1, 100 ), rnd.RandomFloat( 1, 100 ), rnd.RandomFloat( 1, 100 ) );
+			const Vector vecMins = vecCenter - vecSize;
+			const Vector vecMaxs = vecCenter + vecSize;
+
+			if ( !buffer.IsBoxOccluded( vecMins, vecMaxs ) )
+				continue;
+
+			for ( int iPoint = 0; iPoint < 32; iPoint++ )
+			{
+				const Vector vecPoint( rnd.RandomFloat( vecMins.x, vecMaxs.x ),
+					rnd.RandomFloat( vecMins.y, vecMaxs.y ),
+					rnd.RandomFloat( vecMins.z, vecMaxs.z ) );
+
+				const float flDepth = buffer.GetDepth( vecPoint );
+				const int x = (int)floor( ( -vecPoint.y / flDepth * 0.5f + 0.5f ) * buffer.GetWidth() );
+				const int y = (int)floor( ( 0.5f - vecPoint.z / flDepth * 0.5f ) * buffer.GetHeight() );
+
+				if ( x < 0 || y < 0 || x >= buffer.GetWidth() || y >= buffer.GetHeight() )
+					continue;
+
+				if ( buffer.GetCellDepth( x, y ) >= flDepth )
+					iBoxFailures++;
+			}
+		}
+	}
+
+	if ( iCellFailures > 0 )
+		Warning( "depth buffer: %i cells not as deep as their farthest corner\n", iCellFailures );
+	if ( iBoxFailures > 0 )
+		Warning( "depth buffer: %i points of occluded boxes in front of their cell\n", iBoxFailures );
+}
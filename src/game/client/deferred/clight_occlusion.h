@@ -0,0 +1,93 @@
+#ifndef C_LIGHT_OCCLUSION_H
+#define C_LIGHT_OCCLUSION_H
+
+#include "cbase.h"
+
+// results older than this many frames are ignored, the light is drawn
+#define LIGHTOCCLUSION_MAX_AGE 2
+// results are ignored for a frame after the view moved this far
+#define LIGHTOCCLUSION_MAX_MOVE 64.0f
+
+// cells of the software depth buffer
+#define LIGHTOCCLUSION_SW_WIDTH 32
+#define LIGHTOCCLUSION_SW_HEIGHT 18
+
+// occlusion query of one light, results arrive a frame late
+struct lightOcclusion_t
+{
+	OcclusionQueryObjectHandle_t hQuery;
+	// frame of the query in flight, -1 if none
+	int iIssueFrame;
+	// frame the last result was issued in, -1 if none
+	int iResultFrame;
+	// no pixel passed the depth test in the last result
+	bool bHidden;
+};
+
+/*
+ * Tracks the occlusion queries of light volumes. A light is only skipped
+ * while its last result is recent and hidden, lights without a result or
+ * with a query that takes too long are drawn.
+ */
+class CLightOcclusion
+{
+public:
+
+	static void Init( lightOcclusion_t &occlusion );
+	// forgets the result, the query object is kept
+	static void Invalidate( lightOcclusion_t &occlusion );
+
+	// a query in flight is only issued again once it's too old
+	static bool ShouldIssue( const lightOcclusion_t &occlusion, int iFrame );
+	static void OnIssued( lightOcclusion_t &occlusion, int iFrame );
+	// iPixels is negative while the result is pending
+	static void OnResult( lightOcclusion_t &occlusion, int iPixels );
+
+	static bool IsOccluded( const lightOcclusion_t &occlusion, int iFrame );
+};
+
+/*
+ * Coarse depth buffer for when occlusion queries are unavailable. Depths are
+ * sampled at the cell corners, a cell is as deep as its farthest corner and a
+ * box is occluded when every cell it covers is closer than its nearest point.
+ * Occluders thinner than a cell can slip between the corners.
+ */
+class CLightOcclusionBuffer
+{
+public:
+
+	CLightOcclusionBuffer();
+
+	void Init( int iWidth, int iHeight );
+	void SetView( const VMatrix &matWorldToScreen );
+
+	FORCEINLINE int GetWidth() const { return m_iWidth; };
+	FORCEINLINE int GetHeight() const { return m_iHeight; };
+	FORCEINLINE int GetNumCorners() const { return ( m_iWidth + 1 ) * ( m_iHeight + 1 ); };
+
+	// device coords of a corner, y points up
+	void GetCornerDeviceCoords( int iCorner, float &x, float &y ) const;
+	// FLT_MAX if nothing was hit through the corner
+	void SetCornerDepth( int iCorner, float flDepth );
+	// updates the cells once all corners are set
+	void Resolve();
+
+	FORCEINLINE float GetCellDepth( int x, int y ) const { return m_CellDepth[ y * m_iWidth + x ]; };
+
+	// depth along the view direction
+	float GetDepth( const Vector &vecPos ) const;
+
+	bool IsBoxOccluded( const Vector &vecMins, const Vector &vecMaxs ) const;
+
+private:
+
+	int m_iWidth;
+	int m_iHeight;
+
+	VMatrix m_matWorldToScreen;
+
+	CUtlVector< float > m_CornerDepth;
+	CUtlVector< float > m_CellDepth;
+};
+
+#endif
@@ -0,0 +1,277 @@
+
+#include "cbase.h"
+#include "deferred/deferred_shared_common.h"
+
+#include "tier0/fasttimer.h"
+#include "vstdlib/random.h"
+
+#if DEFCFG_USE_SSE
+
+CDeferredLightStore::CDeferredLightStore()
+{
+	m_pBlocks = NULL;
+	m_iBlockCapacity = 0;
+}
+
+CDeferredLightStore::~CDeferredLightStore()
+{
+	Purge();
+}
+
+void CDeferredLightStore::Purge()
+{
+	if ( m_pBlocks != NULL )
+	{
+		MemAlloc_FreeAligned( m_pBlocks );
+		m_pBlocks = NULL;
+	}
+
+	m_iBlockCapacity = 0;
+
+	m_hLights.Purge();
+	m_hLeaves.Purge();
+	m_hNumLeaves.Purge();
+}
+
+void CDeferredLightStore::EnsureCapacity( int iNumLights )
+{
+	const int iNumBlocks = ( iNumLights + 3 ) / 4;
+
+	if ( iNumBlocks <= m_iBlockCapacity )
+		return;
+
+	const int iNewCapacity = MAX( iNumBlocks, MAX( 16, m_iBlockCapacity * 2 ) );
+
+	def_light_datax4_t *pNewBlocks = reinterpret_cast< def_light_datax4_t* >(
+		MemAlloc_AllocAligned( iNewCapacity * sizeof( def_light_datax4_t ), sizeof( fltx4 ) ) );
+
+	if ( m_pBlocks != NULL )
+	{
+		Q_memcpy( pNewBlocks, m_pBlocks, m_iBlockCapacity * sizeof( def_light_datax4_t ) );
+		MemAlloc_FreeAligned( m_pBlocks );
+	}
+
+	m_pBlocks = pNewBlocks;
+
+	for ( int i = m_iBlockCapacity * 4; i < iNewCapacity * 4; i++ )
+		ClearLane( i );
+
+	m_iBlockCapacity = iNewCapacity;
+
+	m_hLeaves.SetCount( iNewCapacity * 4 * DEFLIGHT_MAX_LEAVES );
+	m_hNumLeaves.SetCount( iNewCapacity * 4 );
+}
+
+int CDeferredLightStore::AddLight( def_light_t *l )
+{
+	EnsureCapacity( Count() + 1 );
+
+	const int iSlot = m_hLights.AddToTail( l );
+
+	// dirty lights are written once their xforms are valid
+	if ( l->IsDirtyXForms() )
+	{
+		ClearLane( iSlot );
+		m_hNumLeaves[ iSlot ] = 0;
+	}
+	else
+		UpdateLight( iSlot );
+
+	return iSlot;
+}
+
+void CDeferredLightStore::RemoveLight( int iSlot )
+{
+	Assert( iSlot >= 0 && iSlot < Count() );
+
+	const int iLast = Count() - 1;
+
+	if ( iSlot != iLast )
+		CopyLane( iSlot, iLast );
+
+	ClearLane( iLast );
+
+	m_hLights.FastRemove( iSlot );
+}
+
+void CDeferredLightStore::UpdateLight( int iSlot )
+{
+	def_light_t *l = m_hLights[ iSlot ];
+
+	WriteLane( m_pBlocks[ iSlot / 4 ], iSlot % 4, l );
+
+	m_hNumLeaves[ iSlot ] = l->iNumLeaves;
+	Q_memcpy( m_hLeaves.Base() + iSlot * DEFLIGHT_MAX_LEAVES, l->iLeaveIDs, sizeof( int ) * l->iNumLeaves );
+}
+
+void CDeferredLightStore::WriteLane( def_light_datax4_t &b, int lane, def_light_t *l )
+{
+	for ( int i = 0; i < 3; i++ )
+	{
+		SubFloat( b.bounds_min_naive[i], lane ) = l->bounds_min_naive[i];
+		SubFloat( b.bounds_max_naive[i], lane ) = l->bounds_max_naive[i];
+		SubFloat( b.bounds_center[i], lane ) = l->boundsCenter[i];
+	}
+
+	SubFloat( b.maxDistSqr, lane ) = l->flMaxDistSqr;
+
+	SubInt( b.isSpot, lane ) = l->IsSpot() ? ~0 : 0;
+	SubInt( b.isWorldLight, lane ) = l->IsWorldLight() ? ~0 : 0;
+	SubInt( b.hasShadow, lane ) = l->HasShadow() ? ~0 : 0;
+	SubInt( b.hasVolumetrics, lane ) = l->HasVolumetrics() ? ~0 : 0;
+}
+
+void CDeferredLightStore::ClearLane( int iSlot )
+{
+	def_light_datax4_t &b = m_pBlocks[ iSlot / 4 ];
+	const int lane = iSlot % 4;
+
+	for ( int i = 0; i < 3; i++ )
+	{
+		SubFloat( b.bounds_min_naive[i], lane ) = 0;
+		SubFloat( b.bounds_max_naive[i], lane ) = 0;
+		SubFloat( b.bounds_center[i], lane ) = 0;
+	}
+
+	// never in range
+	SubFloat( b.maxDistSqr, lane ) = -1.0f;
+
+	SubInt( b.isSpot, lane ) = 0;
+	SubInt( b.isWorldLight, lane ) = 0;
+	SubInt( b.hasShadow, lane ) = 0;
+	SubInt( b.hasVolumetrics, lane ) = 0;
+}
+
+void CDeferredLightStore::CopyLane( int iSlotDst, int iSlotSrc )
+{
+	def_light_datax4_t &d = m_pBlocks[ iSlotDst / 4 ];
+	const def_light_datax4_t &s = m_pBlocks[ iSlotSrc / 4 ];
+	const int ld = iSlotDst % 4;
+	const int ls = iSlotSrc % 4;
+
+	for ( int i = 0; i < 3; i++ )
+	{
+		SubFloat( d.bounds_min_naive[i], ld ) = SubFloat( s.bounds_min_naive[i], ls );
+		SubFloat( d.bounds_max_naive[i], ld ) = SubFloat( s.bounds_max_naive[i], ls );
+		SubFloat( d.bounds_center[i], ld ) = SubFloat( s.bounds_center[i], ls );
+	}
+
+	SubFloat( d.maxDistSqr, ld ) = SubFloat( s.maxDistSqr, ls );
+
+	SubInt( d.isSpot, ld ) = SubInt( s.isSpot, ls );
+	SubInt( d.isWorldLight, ld ) = SubInt( s.isWorldLight, ls );
+	SubInt( d.hasShadow, ld ) = SubInt( s.hasShadow, ls );
+	SubInt( d.hasVolumetrics, ld ) = SubInt( s.hasVolumetrics, ls );
+
+	m_hNumLeaves[ iSlotDst ] = m_hNumLeaves[ iSlotSrc ];
+	Q_memcpy( m_hLeaves.Base() + iSlotDst * DEFLIGHT_MAX_LEAVES,
+		m_hLeaves.Base() + iSlotSrc * DEFLIGHT_MAX_LEAVES,
+		sizeof( int ) * m_hNumLeaves[ iSlotSrc ] );
+}
+
+
+// the old path, gathering from the light objects every frame
+static void GatherLightDataX4( def_light_t * const *pLights, int iNumLights, def_light_datax4_t *pBlocks )
+{
+	for ( int i = 0; i < iNumLights; i++ )
+		CDeferredLightStore::WriteLane( pBlocks[ i / 4 ], i % 4, pLights[i] );
+
+	for ( int i = iNumLights; i < ( ( iNumLights + 3 ) / 4 ) * 4; i++ )
+		SubFloat( pBlocks[ i / 4 ].maxDistSqr, i % 4 ) = -1.0f;
+}
+
+static int CountVisibleX4( const def_light_datax4_t *pBlocks, int iNumBlocks, const Vector &vecOrigin )
+{
+	const fltx4 viewOrigin[3] = { ReplicateX4( vecOrigin.x ), ReplicateX4( vecOrigin.y ), ReplicateX4( vecOrigin.z ) };
+	const fltx4 bloat = ReplicateX4( 9.0f );
+
+	int iVisible = 0;
+
+	for ( int i = 0; i < iNumBlocks; i++ )
+	{
+		int iInRange, iContainsView;
+		CalcViewMasksX4( pBlocks[i], viewOrigin, bloat, iInRange, iContainsView );
+
+		for ( int lane = 0; lane < 4; lane++ )
+			iVisible += ( iInRange >> lane ) & 1;
+	}
+
+	return iVisible;
+}
+
+CON_COMMAND( deferred_lightstore_bench, "Compares gathering light data per frame with the persistent light store. Args: [iterations]" )
+{
+	const int iIterations = args.ArgC() > 1 ? MAX( 1, atoi( args[1] ) ) : 200;
+	const int iLightCounts[] = { 128, 256, 512, 1024, 4096 };
+
+	for ( int iTest = 0; iTest < ARRAYSIZE( iLightCounts ); iTest++ )
+	{
+		const int iNumLights = iLightCounts[ iTest ];
+
+		CUniformRandomStream rnd;
+		rnd.SetSeed( iNumLights );
+
+		// interleave allocations so the lights end up scattered like
+		// entity created ones
+		CUtlVector< def_light_t* > lights;
+		CUtlVector< char* > padding;
+
+		for ( int i = 0; i < iNumLights; i++ )
+		{
+			padding.AddToTail( new char[ rnd.RandomInt( 64, 2048 ) ] );
+
+			def_light_t *l = new def_light_t();
+			l->pos.Init( rnd.RandomFloat( -4096, 4096 ),
+				rnd.RandomFloat( -4096, 4096 ),
+				rnd.RandomFloat( -1024, 1024 ) );
+			l->flRadius = rnd.RandomFloat( 64, 512 );
+			l->UpdateNaiveBounds();
+			l->UnDirtyAll();
+
+			lights.AddToTail( l );
+		}
+
+		CDeferredLightStore store;
+		FOR_EACH_VEC_FAST( def_light_t*, lights, l )
+		{
+			store.AddLight( l );
+		}
+		FOR_EACH_VEC_FAST_END
+
+		def_light_datax4_t *pGathered = reinterpret_cast< def_light_datax4_t* >(
+			MemAlloc_AllocAligned( store.GetNumBlocks() * sizeof( def_light_datax4_t ), sizeof( fltx4 ) ) );
+
+		int iVisibleGather = 0;
+		int iVisibleStore = 0;
+
+		CFastTimer timerGather;
+		timerGather.Start();
+		for ( int i = 0; i < iIterations; i++ )
+		{
+			GatherLightDataX4( lights.Base(), lights.Count(), pGathered );
+			iVisibleGather += CountVisibleX4( pGathered, store.GetNumBlocks(), vec3_origin );
+		}
+		timerGather.End();
+
+		CFastTimer timerStore;
+		timerStore.Start();
+		for ( int i = 0; i < iIterations; i++ )
+			iVisibleStore += CountVisibleX4( &store.GetBlock( 0 ), store.GetNumBlocks(), vec3_origin );
+		timerStore.End();
+
+		Msg( "%5i lights: gather %.4f ms, store %.4f ms, visible %i / %i\n", iNumLights,
+			timerGather.GetDuration().GetMillisecondsF() / iIterations,
+			timerStore.GetDuration().GetMillisecondsF() / iIterations,
+			iVisibleGather / iIterations, iVisibleStore / iIterations );
+
+		MemAlloc_FreeAligned( pGathered );
+
+		store.Purge();
+		lights.PurgeAndDeleteElements();
+
+		for ( int i = 0; i < padding.Count(); i++ )
+			delete [] padding[i];
+	}
+}
+
+#endif
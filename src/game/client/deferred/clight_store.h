@@ -0,0 +1,97 @@
+#ifndef C_LIGHT_STORE_H
+#define C_LIGHT_STORE_H
+
+#include "cbase.h"
+
+struct def_light_t;
+
+#if DEFCFG_USE_SSE
+// four lights per block, flags are lane masks
+struct def_light_datax4_t
+{
+	fltx4		bounds_min_naive[3];
+	fltx4		bounds_max_naive[3];
+	fltx4		bounds_center[3];
+	fltx4		maxDistSqr;
+	fltx4		isSpot;
+	fltx4		isWorldLight;
+	fltx4		hasShadow;
+	fltx4		hasVolumetrics;
+};
+
+/*
+ * Persistent SoA copy of the data culling and sorting need. A light owns
+ * one lane for its whole lifetime, the lane is only rewritten when the
+ * lights xforms change. Unused lanes can never pass the distance test.
+ */
+class CDeferredLightStore
+{
+public:
+
+	CDeferredLightStore();
+	~CDeferredLightStore();
+
+	// returns the slot of the new light, slots match the manager list
+	int AddLight( def_light_t *l );
+	// the last slot moves into the removed one
+	void RemoveLight( int iSlot );
+	void Purge();
+
+	// copy xform dependant data
+	void UpdateLight( int iSlot );
+	static void WriteLane( def_light_datax4_t &b, int lane, def_light_t *l );
+
+	FORCEINLINE int Count() const { return m_hLights.Count(); };
+	FORCEINLINE int GetNumBlocks() const { return ( Count() + 3 ) / 4; };
+
+	FORCEINLINE def_light_t *GetLight( int iSlot ) const { return m_hLights[ iSlot ]; };
+	FORCEINLINE const def_light_datax4_t &GetBlock( int iBlock ) const
+	{
+		Assert( iBlock >= 0 && iBlock < GetNumBlocks() );
+		return m_pBlocks[ iBlock ];
+	};
+
+	FORCEINLINE int *GetLeaves( int iSlot ) { return m_hLeaves.Base() + iSlot * DEFLIGHT_MAX_LEAVES; };
+	FORCEINLINE int GetNumLeaves( int iSlot ) const { return m_hNumLeaves[ iSlot ]; };
+
+private:
+
+	void EnsureCapacity( int iNumLights );
+	void ClearLane( int iSlot );
+	void CopyLane( int iSlotDst, int iSlotSrc );
+
+	def_light_datax4_t *m_pBlocks;
+	int m_iBlockCapacity;
+
+	CUtlVector< def_light_t* > m_hLights;
+	CUtlVector< int > m_hLeaves;
+	CUtlVector< int > m_hNumLeaves;
+};
+
+// lane bits of lights within visible distance and of lights
+// whose bloated bounds contain the view origin
+FORCEINLINE void CalcViewMasksX4( const def_light_datax4_t &b, const fltx4 *viewOrigin,
+	const fltx4 &bloat, int &iInRange, int &iContainsView )
+{
+	const fltx4 dx = SubSIMD( b.bounds_center[0], viewOrigin[0] );
+	const fltx4 dy = SubSIMD( b.bounds_center[1], viewOrigin[1] );
+	const fltx4 dz = SubSIMD( b.bounds_center[2], viewOrigin[2] );
+
+	fltx4 distSqr = MulSIMD( dx, dx );
+	distSqr = MaddSIMD( dy, dy, distSqr );
+	distSqr = MaddSIMD( dz, dz, distSqr );
+
+	iInRange = TestSignSIMD( CmpLeSIMD( distSqr, b.maxDistSqr ) );
+
+	fltx4 inside = AndSIMD( CmpGeSIMD( viewOrigin[0], SubSIMD( b.bounds_min_naive[0], bloat ) ),
+		CmpLeSIMD( viewOrigin[0], AddSIMD( b.bounds_max_naive[0], bloat ) ) );
+	inside = AndSIMD( inside, AndSIMD( CmpGeSIMD( viewOrigin[1], SubSIMD( b.bounds_min_naive[1], bloat ) ),
+		CmpLeSIMD( viewOrigin[1], AddSIMD( b.bounds_max_naive[1], bloat ) ) ) );
+	inside = AndSIMD( inside, AndSIMD( CmpGeSIMD( viewOrigin[2], SubSIMD( b.bounds_min_naive[2], bloat ) ),
+		CmpLeSIMD( viewOrigin[2], AddSIMD( b.bounds_max_naive[2], bloat ) ) ) );
+
+	iContainsView = TestSignSIMD( inside );
+}
+#endif
+
+#endif
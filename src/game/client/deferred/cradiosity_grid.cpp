@@ -0,0 +1,405 @@
+#include "cbase.h"
+#include "deferred/deferred_shared_common.h"
+
+static const int s_iGridSize[ 3 ] = { RADIOSITY_BUFFER_SAMPLES_XY, RADIOSITY_BUFFER_SAMPLES_XY, RADIOSITY_BUFFER_SAMPLES_Z };
+
+CRadiosityGrid::CRadiosityGrid()
+{
+	Reset();
+}
+
+void CRadiosityGrid::Reset()
+{
+	m_iCell[ 0 ] = m_iCell[ 1 ] = m_iCell[ 2 ] = 0;
+	m_bValid = false;
+	m_flUpdateTime = 0.0f;
+
+	m_iNumCopies = 0;
+	m_iNumExposed = 0;
+}
+
+int CRadiosityGrid::GetUpdateType( const int *pCell, float flTime, float flRefreshInterval ) const
+{
+	if ( !m_bValid )
+		return UPDATE_FULL;
+
+	bool bMoved = false;
+
+	for ( int i = 0; i < 3; i++ )
+	{
+		const int iDelta = pCell[ i ] - m_iCell[ i ];
+
+		if ( abs( iDelta ) >= s_iGridSize[ i ] )
+			return UPDATE_FULL;
+
+		bMoved = bMoved || iDelta != 0;
+	}
+
+	// a refresh redraws every cell at the new origin, so it also covers a move.
+	// scrolling first would keep postponing it while the camera moves.
+	// time restarts on level changes
+	if ( flTime - m_flUpdateTime >= flRefreshInterval || flTime < m_flUpdateTime )
+		return UPDATE_REFRESH;
+
+	if ( bMoved )
+		return UPDATE_SCROLL;
+
+	return UPDATE_NONE;
+}
+
+void CRadiosityGrid::ApplyUpdate( int iUpdateType, const int *pCell, float flTime )
+{
+	m_iNumCopies = 0;
+	m_iNumExposed = 0;
+
+	if ( iUpdateType == UPDATE_NONE )
+		return;
+
+	if ( iUpdateType == UPDATE_SCROLL )
+	{
+		Assert( m_bValid );
+
+		const int iDelta[ 3 ] = { pCell[ 0 ] - m_iCell[ 0 ], pCell[ 1 ] - m_iCell[ 1 ], pCell[ 2 ] - m_iCell[ 2 ] };
+		BuildScrollRects( iDelta );
+	}
+	else
+	{
+		// scrolls only draw the new cells, the old ones still wait for their refresh
+		m_flUpdateTime = flTime;
+	}
+
+	m_iCell[ 0 ] = pCell[ 0 ];
+	m_iCell[ 1 ] = pCell[ 1 ];
+	m_iCell[ 2 ] = pCell[ 2 ];
+	m_bValid = true;
+}
+
+void CRadiosityGrid::AddCopy( int iDstX, int iDstY, int iSrcX, int iSrcY, int iWidth, int iHeight )
+{
+	// texels shifted past a slice's edge land in the exposed strip of its neighbour
+	if ( iSrcX < 0 )
+	{
+		iDstX -= iSrcX;
+		iWidth += iSrcX;
+		iSrcX = 0;
+	}
+
+	if ( iSrcY < 0 )
+	{
+		iDstY -= iSrcY;
+		iHeight += iSrcY;
+		iSrcY = 0;
+	}
+
+	iWidth = MIN( iWidth, RADIOSITY_GRID_VIEWPORT_SIZE - iSrcX );
+	iHeight = MIN( iHeight, RADIOSITY_GRID_VIEWPORT_SIZE - iSrcY );
+
+	if ( iWidth <= 0 || iHeight <= 0 )
+		return;
+
+	Assert( m_iNumCopies < RADIOSITY_GRID_MAX_COPIES );
+
+	radiosityRect_t &src = m_CopySrc[ m_iNumCopies ];
+	radiosityRect_t &dst = m_CopyDst[ m_iNumCopies ];
+	m_iNumCopies++;
+
+	src.x0 = iSrcX;
+	src.y0 = iSrcY;
+	src.x1 = iSrcX + iWidth;
+	src.y1 = iSrcY + iHeight;
+
+	dst.x0 = iDstX;
+	dst.y0 = iDstY;
+	dst.x1 = iDstX + iWidth;
+	dst.y1 = iDstY + iHeight;
+}
+
+void CRadiosityGrid::AddExposed( int x0, int y0, int x1, int y1 )
+{
+	Assert( m_iNumExposed < RADIOSITY_GRID_MAX_EXPOSED );
+
+	radiosityRect_t &rect = m_Exposed[ m_iNumExposed ];
+	m_iNumExposed++;
+
+	rect.x0 = x0;
+	rect.y0 = y0;
+	rect.x1 = x1;
+	rect.y1 = y1;
+}
+
+void CRadiosityGrid::BuildScrollRects( const int *pDelta )
+{
+	const int iTiles = RADIOSITY_BUFFER_GRIDS_PER_AXIS;
+	const int iTileSize = RADIOSITY_BUFFER_SAMPLES_XY;
+
+	// slice z now shows what slice z + delta showed, runs of slices that
+	// stay in one row move with one copy
+	for ( int iRow = 0; iRow < iTiles; iRow++ )
+	{
+		int iRunStart = -1;
+		int iExposedMin = iTiles;
+		int iExposedMax = -1;
+
+		for ( int iColumn = 0; iColumn <= iTiles; iColumn++ )
+		{
+			const int iSrcSlice = iRow * iTiles + iColumn + pDelta[ 2 ];
+			const bool bKept = iColumn < iTiles && iSrcSlice >= 0 && iSrcSlice < RADIOSITY_BUFFER_SAMPLES_Z;
+
+			if ( iRunStart >= 0 && ( !bKept || iSrcSlice % iTiles == 0 ) )
+			{
+				const int iRunSrcSlice = iRow * iTiles + iRunStart + pDelta[ 2 ];
+
+				AddCopy( iRunStart * iTileSize, iRow * iTileSize,
+					( iRunSrcSlice % iTiles ) * iTileSize + pDelta[ 0 ],
+					( iRunSrcSlice / iTiles ) * iTileSize + pDelta[ 1 ],
+					( iColumn - iRunStart ) * iTileSize, iTileSize );
+
+				iRunStart = -1;
+			}
+
+			if ( bKept && iRunStart < 0 )
+				iRunStart = iColumn;
+
+			if ( !bKept && iColumn < iTiles )
+			{
+				iExposedMin = MIN( iExposedMin, iColumn );
+				iExposedMax = MAX( iExposedMax, iColumn );
+			}
+		}
+
+		if ( iExposedMax >= 0 )
+			AddExposed( iExposedMin * iTileSize, iRow * iTileSize, ( iExposedMax + 1 ) * iTileSize, ( iRow + 1 ) * iTileSize );
+	}
+
+	// new cells at the side the grid moved to, in every slice
+	if ( pDelta[ 0 ] != 0 )
+	{
+		const int iMin = ( pDelta[ 0 ] > 0 ) ? iTileSize - pDelta[ 0 ] : 0;
+		const int iMax = ( pDelta[ 0 ] > 0 ) ? iTileSize : -pDelta[ 0 ];
+
+		for ( int iColumn = 0; iColumn < iTiles; iColumn++ )
+			AddExposed( iColumn * iTileSize + iMin, 0, iColumn * iTileSize + iMax, RADIOSITY_GRID_VIEWPORT_SIZE );
+	}
+
+	if ( pDelta[ 1 ] != 0 )
+	{
+		const int iMin = ( pDelta[ 1 ] > 0 ) ? iTileSize - pDelta[ 1 ] : 0;
+		const int iMax = ( pDelta[ 1 ] > 0 ) ? iTileSize : -pDelta[ 1 ];
+
+		for ( int iRow = 0; iRow < iTiles; iRow++ )
+			AddExposed( 0, iRow * iTileSize + iMin, RADIOSITY_GRID_VIEWPORT_SIZE, iRow * iTileSize + iMax );
+	}
+}
+
+void CRadiosityGrid::ScheduleUpdates( const int *pUpdateType, const float *pflUpdateTime, const int *pCost,
+	int iNumGrids, int iBudget, bool *pScheduled )
+{
+	for ( int i = 0; i < iNumGrids; i++ )
+		pScheduled[ i ] = false;
+
+	int iSpent = 0;
+
+	for ( ;; )
+	{
+		int iBest = -1;
+
+		for ( int i = 0; i < iNumGrids; i++ )
+		{
+			if ( pScheduled[ i ] || pUpdateType[ i ] == UPDATE_NONE )
+				continue;
+
+			if ( iBest < 0 || pUpdateType[ i ] > pUpdateType[ iBest ] ||
+				( pUpdateType[ i ] == pUpdateType[ iBest ] && pflUpdateTime[ i ] < pflUpdateTime[ iBest ] ) )
+				iBest = i;
+		}
+
+		if ( iBest < 0 )
+			break;
+
+		if ( iBudget > 0 && iSpent > 0 && iSpent + pCost[ iBest ] > iBudget )
+			break;
+
+		pScheduled[ iBest ] = true;
+		iSpent += pCost[ iBest ];
+	}
+}
+
+static int RadiosityTestCellID( const int *pCell, int x, int y, int z )
+{
+	return (int)( ( (uint)( pCell[ 0 ] + x ) * 73856093u ) ^ ( (uint)( pCell[ 1 ] + y ) * 19349663u ) ^ ( (uint)( pCell[ 2 ] + z ) * 83492791u ) );
+}
+
+static int RadiosityTestTexel( int x, int y, int z )
+{
+	const int iTileX = z % RADIOSITY_BUFFER_GRIDS_PER_AXIS;
+	const int iTileY = z / RADIOSITY_BUFFER_GRIDS_PER_AXIS;
+
+	return ( iTileY * RADIOSITY_BUFFER_SAMPLES_XY + y ) * RADIOSITY_GRID_VIEWPORT_SIZE
+		+ iTileX * RADIOSITY_BUFFER_SAMPLES_XY + x;
+}
+
+CON_COMMAND( deferred_radiosity_test, "Validates scrolling and update scheduling of the radiosity grid." )
+{
+	const int iNumTexels = RADIOSITY_GRID_VIEWPORT_SIZE * RADIOSITY_GRID_VIEWPORT_SIZE;
+
+	CUtlVector< int > hSrc;
+	CUtlVector< int > hDst;
+	CUtlVector< bool > hExposed;
+	hSrc.SetCount( iNumTexels );
+	hDst.SetCount( iNumTexels );
+	hExposed.SetCount( iNumTexels );
+
+	CUniformRandomStream rnd;
+	rnd.SetSeed( 1 );
+
+	int iScrollFailures = 0;
+
+	// after a scroll every cell either holds what it held at the old origin
+	// or gets drawn again, and only new cells are drawn
+	for ( int iTest = 0; iTest < 200; iTest++ )
+	{
+		CRadiosityGrid grid;
+
+		int iCell0[ 3 ];
+		int iCell1[ 3 ];
+		int iDelta[ 3 ];
+
+		for ( int i = 0; i < 3; i++ )
+		{
+			iCell0[ i ] = rnd.RandomInt( -1000, 1000 );
+
+			// every other test moves along one axis only
+			const bool bAxis = ( iTest % 2 ) == 0 || i == ( iTest / 2 ) % 3;
+			iDelta[ i ] = bAxis ? rnd.RandomInt( -s_iGridSize[ i ] + 1, s_iGridSize[ i ] - 1 ) : 0;
+		}
+
+		if ( iDelta[ 0 ] == 0 && iDelta[ 1 ] == 0 && iDelta[ 2 ] == 0 )
+			iDelta[ iTest % 3 ] = 1;
+
+		for ( int i = 0; i < 3; i++ )
+			iCell1[ i ] = iCell0[ i ] + iDelta[ i ];
+
+		if ( grid.GetUpdateType( iCell0, 0.0f, 1.0f ) != CRadiosityGrid::UPDATE_FULL )
+			iScrollFailures++;
+
+		grid.ApplyUpdate( CRadiosityGrid::UPDATE_FULL, iCell0, 0.0f );
+
+		if ( grid.GetUpdateType( iCell0, 0.5f, 1.0f ) != CRadiosityGrid::UPDATE_NONE ||
+			grid.GetUpdateType( iCell0, 1.0f, 1.0f ) != CRadiosityGrid::UPDATE_REFRESH ||
+			grid.GetUpdateType( iCell1, 0.5f, 1.0f ) != CRadiosityGrid::UPDATE_SCROLL ||
+			grid.GetUpdateType( iCell1, 1.0f, 1.0f ) != CRadiosityGrid::UPDATE_REFRESH )
+			iScrollFailures++;
+
+		for ( int i = 0; i < iNumTexels; i++ )
+		{
+			hSrc[ i ] = 0;
+			hDst[ i ] = 0;
+			hExposed[ i ] = false;
+		}
+
+		for ( int z = 0; z < RADIOSITY_BUFFER_SAMPLES_Z; z++ )
+			for ( int y = 0; y < RADIOSITY_BUFFER_SAMPLES_XY; y++ )
+				for ( int x = 0; x < RADIOSITY_BUFFER_SAMPLES_XY; x++ )
+					hSrc[ RadiosityTestTexel( x, y, z ) ] = RadiosityTestCellID( iCell0, x, y, z );
+
+		grid.ApplyUpdate( CRadiosityGrid::UPDATE_SCROLL, iCell1, 0.5f );
+
+		if ( grid.GetUpdateTime() != 0.0f )
+			iScrollFailures++;
+
+		for ( int iCopy = 0; iCopy < grid.GetNumCopies(); iCopy++ )
+		{
+			const radiosityRect_t &src = grid.GetCopySrc( iCopy );
+			const radiosityRect_t &dst = grid.GetCopyDst( iCopy );
+
+			for ( int y = dst.y0; y < dst.y1; y++ )
+				for ( int x = dst.x0; x < dst.x1; x++ )
+					hDst[ y * RADIOSITY_GRID_VIEWPORT_SIZE + x ] =
+						hSrc[ ( src.y0 + y - dst.y0 ) * RADIOSITY_GRID_VIEWPORT_SIZE + src.x0 + x - dst.x0 ];
+		}
+
+		int iNumExposed = 0;
+
+		for ( int iRect = 0; iRect < grid.GetNumExposedRects(); iRect++ )
+		{
+			const radiosityRect_t &rect = grid.GetExposedRect( iRect );
+
+			for ( int y = rect.y0; y < rect.y1; y++ )
+			{
+				for ( int x = rect.x0; x < rect.x1; x++ )
+				{
+					if ( !hExposed[ y * RADIOSITY_GRID_VIEWPORT_SIZE + x ] )
+						iNumExposed++;
+
+					hExposed[ y * RADIOSITY_GRID_VIEWPORT_SIZE + x ] = true;
+				}
+			}
+		}
+
+		int iNumNewCells = 0;
+
+		for ( int z = 0; z < RADIOSITY_BUFFER_SAMPLES_Z; z++ )
+		{
+			for ( int y = 0; y < RADIOSITY_BUFFER_SAMPLES_XY; y++ )
+			{
+				for ( int x = 0; x < RADIOSITY_BUFFER_SAMPLES_XY; x++ )
+				{
+					const int iTexel = RadiosityTestTexel( x, y, z );
+					const bool bKept = x + iDelta[ 0 ] >= 0 && x + iDelta[ 0 ] < s_iGridSize[ 0 ] &&
+						y + iDelta[ 1 ] >= 0 && y + iDelta[ 1 ] < s_iGridSize[ 1 ] &&
+						z + iDelta[ 2 ] >= 0 && z + iDelta[ 2 ] < s_iGridSize[ 2 ];
+
+					if ( !bKept )
+						iNumNewCells++;
+
+					if ( hExposed[ iTexel ] )
+						continue;
+
+					if ( !bKept || hDst[ iTexel ] != RadiosityTestCellID( iCell1, x, y, z ) )
+						iScrollFailures++;
+				}
+			}
+		}
+
+		if ( iNumExposed != iNumNewCells )
+			iScrollFailures++;
+
+		// a full grid away nothing is left to keep
+		const int iFar[ 3 ] = { iCell1[ 0 ], iCell1[ 1 ], iCell1[ 2 ] + RADIOSITY_BUFFER_SAMPLES_Z };
+		if ( grid.GetUpdateType( iFar, 0.5f, 1.0f ) != CRadiosityGrid::UPDATE_FULL )
+			iScrollFailures++;
+	}
+
+	if ( iScrollFailures > 0 )
+		Warning( "scroll: %i of 200 moves lost or redrew cells\n", iScrollFailures );
+
+	int iScheduleFailures = 0;
+
+	const int iCost[] = { 4, 4 };
+	bool bScheduled[ 2 ];
+
+	// moves go first, then the oldest, the budget leaves the rest for later
+	const int iTypesMoved[] = { CRadiosityGrid::UPDATE_REFRESH, CRadiosityGrid::UPDATE_SCROLL };
+	const int iTypesRefresh[] = { CRadiosityGrid::UPDATE_REFRESH, CRadiosityGrid::UPDATE_REFRESH };
+	const int iTypesNone[] = { CRadiosityGrid::UPDATE_NONE, CRadiosityGrid::UPDATE_NONE };
+	const float flTimes[] = { 1.0f, 5.0f };
+
+	CRadiosityGrid::ScheduleUpdates( iTypesMoved, flTimes, iCost, 2, 4, bScheduled );
+	if ( bScheduled[ 0 ] || !bScheduled[ 1 ] )
+		iScheduleFailures++;
+
+	CRadiosityGrid::ScheduleUpdates( iTypesMoved, flTimes, iCost, 2, 0, bScheduled );
+	if ( !bScheduled[ 0 ] || !bScheduled[ 1 ] )
+		iScheduleFailures++;
+
+	CRadiosityGrid::ScheduleUpdates( iTypesRefresh, flTimes, iCost, 2, 2, bScheduled );
+	if ( !bScheduled[ 0 ] || bScheduled[ 1 ] )
+		iScheduleFailures++;
+
+	CRadiosityGrid::ScheduleUpdates( iTypesNone, flTimes, iCost, 2, 0, bScheduled );
+	if ( bScheduled[ 0 ] || bScheduled[ 1 ] )
+		iScheduleFailures++;
+
+	if ( iScheduleFailures > 0 )
+		Warning( "schedule: %i of 4 budgets picked the wrong grids\n", iScheduleFailures );
+}
@@ -0,0 +1,83 @@
+#ifndef C_RADIOSITY_GRID_H
+#define C_RADIOSITY_GRID_H
+
+#include "cbase.h"
+
+// slices of the grid are tiled into the cascade's viewport
+#define RADIOSITY_GRID_VIEWPORT_SIZE ( RADIOSITY_BUFFER_SAMPLES_XY * RADIOSITY_BUFFER_GRIDS_PER_AXIS )
+
+#define RADIOSITY_GRID_MAX_COPIES ( RADIOSITY_BUFFER_GRIDS_PER_AXIS * 2 )
+#define RADIOSITY_GRID_MAX_EXPOSED ( RADIOSITY_BUFFER_GRIDS_PER_AXIS * 3 )
+
+// texels of the cascade's viewport, max is exclusive
+struct radiosityRect_t
+{
+	int x0;
+	int y0;
+	int x1;
+	int y1;
+};
+
+/*
+ * Tracks which cells of a radiosity cascade are still valid. Small moves
+ * scroll the grid: the kept cells are copied to where they land at the new
+ * origin and only the slices that came into view are injected and propagated
+ * again. The whole grid is still redrawn every refresh interval, moving or not.
+ */
+class CRadiosityGrid
+{
+public:
+
+	enum
+	{
+		UPDATE_NONE = 0,
+		UPDATE_REFRESH,
+		UPDATE_SCROLL,
+		UPDATE_FULL,
+	};
+
+	CRadiosityGrid();
+
+	void Reset();
+
+	// update it takes to show the grid at the given cell
+	int GetUpdateType( const int *pCell, float flTime, float flRefreshInterval ) const;
+
+	// moves the grid, scrolls build the copy and exposed rects
+	void ApplyUpdate( int iUpdateType, const int *pCell, float flTime );
+
+	FORCEINLINE bool IsValid() const { return m_bValid; };
+	FORCEINLINE const int *GetCell() const { return m_iCell; };
+	FORCEINLINE float GetUpdateTime() const { return m_flUpdateTime; };
+
+	FORCEINLINE int GetNumCopies() const { return m_iNumCopies; };
+	FORCEINLINE const radiosityRect_t &GetCopySrc( int i ) const { return m_CopySrc[ i ]; };
+	FORCEINLINE const radiosityRect_t &GetCopyDst( int i ) const { return m_CopyDst[ i ]; };
+
+	FORCEINLINE int GetNumExposedRects() const { return m_iNumExposed; };
+	FORCEINLINE const radiosityRect_t &GetExposedRect( int i ) const { return m_Exposed[ i ]; };
+
+	// moves first, then the grids that waited longest; the first grid always
+	// fits so a small budget can't starve it, 0 is unlimited
+	static void ScheduleUpdates( const int *pUpdateType, const float *pflUpdateTime, const int *pCost,
+		int iNumGrids, int iBudget, bool *pScheduled );
+
+private:
+
+	void BuildScrollRects( const int *pDelta );
+	void AddCopy( int iDstX, int iDstY, int iSrcX, int iSrcY, int iWidth, int iHeight );
+	void AddExposed( int x0, int y0, int x1, int y1 );
+
+	int m_iCell[ 3 ];
+	bool m_bValid;
+	float m_flUpdateTime;
+
+	radiosityRect_t m_CopySrc[ RADIOSITY_GRID_MAX_COPIES ];
+	radiosityRect_t m_CopyDst[ RADIOSITY_GRID_MAX_COPIES ];
+	int m_iNumCopies;
+
+	radiosityRect_t m_Exposed[ RADIOSITY_GRID_MAX_EXPOSED ];
+	int m_iNumExposed;
+};
+
+#endif
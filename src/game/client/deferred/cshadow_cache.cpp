@@ -0,0 +1,354 @@
+
+#include "cbase.h"
+#include "deferred/deferred_shared_common.h"
+
+#include "c_baseanimating.h"
+#include "cliententitylist.h"
+#include "CollisionUtils.h"
+
+#if DEFCFG_SHADOW_CACHE
+
+CShadowCache::CShadowCache()
+	: m_Movers( DefLessFunc( int ) )
+{
+	m_iLastMoverFrame = -1;
+
+	m_iNumHits = 0;
+	m_iNumStores = 0;
+	m_iNumInvalidated = 0;
+
+	Purge();
+}
+
+void CShadowCache::Purge()
+{
+	for ( int i = 0; i < SHADOWCACHE_MAX_PROJ; i++ )
+	{
+		m_EntriesProj[ i ].pLight = NULL;
+		m_EntriesProj[ i ].iResolution = 0;
+		m_EntriesProj[ i ].iLastUsedFrame = -1;
+		m_EntriesProj[ i ].bValid = false;
+	}
+
+	for ( int i = 0; i < SHADOWCACHE_MAX_DP; i++ )
+	{
+		m_EntriesDP[ i ].pLight = NULL;
+		m_EntriesDP[ i ].iResolution = 0;
+		m_EntriesDP[ i ].iLastUsedFrame = -1;
+		m_EntriesDP[ i ].bValid = false;
+	}
+
+	m_Movers.Purge();
+	m_hMoverMins.Purge();
+	m_hMoverMaxs.Purge();
+
+	m_iLastMoverFrame = -1;
+}
+
+FORCEINLINE CShadowCache::entry_t *CShadowCache::GetPool( def_light_t *l, int &iPoolSize )
+{
+	if ( l->IsPoint() )
+	{
+		iPoolSize = SHADOWCACHE_MAX_DP;
+		return m_EntriesDP;
+	}
+
+	iPoolSize = SHADOWCACHE_MAX_PROJ;
+	return m_EntriesProj;
+}
+
+bool CShadowCache::IsCacheable( def_light_t *l ) const
+{
+	// entity lights move with their owner all the time
+	return deferred_shadow_cache.GetBool() && l->IsWorldLight();
+}
+
+void CShadowCache::InvalidateEntry( entry_t &e )
+{
+	if ( !e.bValid )
+		return;
+
+	e.bValid = false;
+	m_iNumInvalidated++;
+}
+
+void CShadowCache::InvalidateLights( def_light_t * const *pLights, int iNumLights )
+{
+	for ( int i = 0; i < iNumLights; i++ )
+	{
+		int iPoolSize;
+		entry_t *pPool = GetPool( pLights[ i ], iPoolSize );
+
+		for ( int e = 0; e < iPoolSize; e++ )
+		{
+			if ( pPool[ e ].pLight == pLights[ i ] )
+				InvalidateEntry( pPool[ e ] );
+		}
+	}
+}
+
+void CShadowCache::OnLightRemoved( def_light_t *l )
+{
+	int iPoolSize;
+	entry_t *pPool = GetPool( l, iPoolSize );
+
+	for ( int e = 0; e < iPoolSize; e++ )
+	{
+		if ( pPool[ e ].pLight != l )
+			continue;
+
+		pPool[ e ].pLight = NULL;
+		pPool[ e ].bValid = false;
+	}
+}
+
+bool CShadowCache::HasMoverChanged( const mover_t &a, const mover_t &b )
+{
+	return a.bDrawn != b.bDrawn ||
+		a.pModel != b.pModel ||
+		a.vecOrigin != b.vecOrigin ||
+		a.angRender != b.angRender ||
+		a.iSequence != b.iSequence ||
+		a.flCycle != b.flCycle;
+}
+
+void CShadowCache::AddMoverBounds( const mover_t &m )
+{
+	if ( !m.bDrawn )
+		return;
+
+	m_hMoverMins.AddToTail( m.vecMins );
+	m_hMoverMaxs.AddToTail( m.vecMaxs );
+}
+
+void CShadowCache::UpdateMovers()
+{
+	const int iFrame = gpGlobals->framecount;
+
+	if ( m_iLastMoverFrame == iFrame )
+		return;
+
+	m_iLastMoverFrame = iFrame;
+
+	m_hMoverMins.RemoveAll();
+	m_hMoverMaxs.RemoveAll();
+
+	m_iNumHits = 0;
+	m_iNumStores = 0;
+	m_iNumInvalidated = 0;
+
+	for ( C_BaseEntity *pEnt = ClientEntityList().FirstBaseEntity(); pEnt != NULL;
+		pEnt = ClientEntityList().NextBaseEntity( pEnt ) )
+	{
+		if ( pEnt->GetModel() == NULL )
+			continue;
+
+		mover_t state;
+		state.pModel = pEnt->GetModel();
+		state.bDrawn = !pEnt->IsDormant() && pEnt->ShouldDraw();
+		state.vecOrigin = pEnt->GetRenderOrigin();
+		state.angRender = pEnt->GetRenderAngles();
+		state.iSequence = -1;
+		state.flCycle = 0.0f;
+		state.iLastSeenFrame = iFrame;
+
+		C_BaseAnimating *pAnimating = pEnt->GetBaseAnimating();
+		if ( pAnimating != NULL )
+		{
+			state.iSequence = pAnimating->GetSequence();
+			state.flCycle = pAnimating->GetCycle();
+		}
+
+		if ( state.bDrawn )
+			pEnt->GetRenderBoundsWorldspace( state.vecMins, state.vecMaxs );
+		else
+			state.vecMins = state.vecMaxs = vec3_origin;
+
+		const int iKey = pEnt->GetRefEHandle().ToInt();
+		const unsigned short iIndex = m_Movers.Find( iKey );
+
+		if ( !m_Movers.IsValidIndex( iIndex ) )
+		{
+			m_Movers.Insert( iKey, state );
+			AddMoverBounds( state );
+			continue;
+		}
+
+		mover_t &old = m_Movers[ iIndex ];
+
+		// ragdoll bones move without touching the origin or cycle
+		if ( HasMoverChanged( old, state ) ||
+			( state.bDrawn && pAnimating != NULL && pAnimating->IsRagdoll() ) )
+		{
+			AddMoverBounds( old );
+			AddMoverBounds( state );
+		}
+
+		old = state;
+	}
+
+	// deleted entities take their shadows with them
+	for ( int i = m_Movers.MaxElement() - 1; i >= 0; i-- )
+	{
+		if ( !m_Movers.IsValidIndex( i ) || m_Movers[ i ].iLastSeenFrame == iFrame )
+			continue;
+
+		AddMoverBounds( m_Movers[ i ] );
+		m_Movers.RemoveAt( i );
+	}
+
+	if ( m_hMoverMins.Count() == 0 )
+		return;
+
+	entry_t *pPools[] = { m_EntriesProj, m_EntriesDP };
+	const int iPoolSizes[] = { SHADOWCACHE_MAX_PROJ, SHADOWCACHE_MAX_DP };
+
+	for ( int p = 0; p < ARRAYSIZE( pPools ); p++ )
+	{
+		for ( int e = 0; e < iPoolSizes[ p ]; e++ )
+		{
+			entry_t &entry = pPools[ p ][ e ];
+
+			if ( !entry.bValid )
+				continue;
+
+			const Vector &vecLightMin = entry.pLight->GetBoundsMinNaive();
+			const Vector &vecLightMax = entry.pLight->GetBoundsMaxNaive();
+
+			for ( int m = 0; m < m_hMoverMins.Count(); m++ )
+			{
+				if ( IsBoxIntersectingBox( vecLightMin, vecLightMax, m_hMoverMins[ m ], m_hMoverMaxs[ m ] ) )
+				{
+					InvalidateEntry( entry );
+					break;
+				}
+			}
+		}
+	}
+}
+
+int CShadowCache::FindValidEntry( def_light_t *l, int iResolution )
+{
+	int iPoolSize;
+	entry_t *pPool = GetPool( l, iPoolSize );
+
+	for ( int e = 0; e < iPoolSize; e++ )
+	{
+		entry_t &entry = pPool[ e ];
+
+		if ( entry.pLight != l || !entry.bValid )
+			continue;
+
+		// shadow targets were rebuilt at another resolution
+		if ( entry.iResolution != iResolution )
+		{
+			InvalidateEntry( entry );
+			return -1;
+		}
+
+		entry.iLastUsedFrame = gpGlobals->framecount;
+		m_iNumHits++;
+		return e;
+	}
+
+	return -1;
+}
+
+int CShadowCache::FindStaleEntry( def_light_t *l, int iResolution )
+{
+	int iPoolSize;
+	entry_t *pPool = GetPool( l, iPoolSize );
+
+	for ( int e = 0; e < iPoolSize; e++ )
+	{
+		entry_t &entry = pPool[ e ];
+
+		if ( entry.pLight != l || entry.iResolution != iResolution )
+			continue;
+
+		entry.iLastUsedFrame = gpGlobals->framecount;
+		return e;
+	}
+
+	return -1;
+}
+
+bool CShadowCache::HasEntry( def_light_t *l, int iResolution, bool bAllowStale )
+{
+	int iPoolSize;
+	const entry_t *pPool = GetPool( l, iPoolSize );
+
+	for ( int e = 0; e < iPoolSize; e++ )
+	{
+		if ( pPool[ e ].pLight == l && pPool[ e ].iResolution == iResolution &&
+			( bAllowStale || pPool[ e ].bValid ) )
+			return true;
+	}
+
+	return false;
+}
+
+// empty slots first, then stale maps, then least recently used
+int CShadowCache::GetEvictionOrder( const entry_t &e )
+{
+	if ( e.pLight == NULL )
+		return INT_MIN;
+
+	if ( !e.bValid )
+		return INT_MIN + 1;
+
+	return e.iLastUsedFrame;
+}
+
+int CShadowCache::AcquireEntry( def_light_t *l, int iResolution )
+{
+	int iPoolSize;
+	entry_t *pPool = GetPool( l, iPoolSize );
+
+	int iBest = -1;
+
+	for ( int e = 0; e < iPoolSize; e++ )
+	{
+		entry_t &entry = pPool[ e ];
+
+		// reuse the slot this light had before
+		if ( entry.pLight == l )
+		{
+			iBest = e;
+			break;
+		}
+
+		if ( iBest < 0 || GetEvictionOrder( entry ) < GetEvictionOrder( pPool[ iBest ] ) )
+			iBest = e;
+	}
+
+	entry_t &entry = pPool[ iBest ];
+
+	// don't thrash maps that were already needed this frame
+	if ( entry.pLight != l && entry.bValid &&
+		entry.iLastUsedFrame == gpGlobals->framecount )
+		return -1;
+
+	entry.pLight = l;
+	entry.iResolution = iResolution;
+	entry.iLastUsedFrame = gpGlobals->framecount;
+	entry.bValid = true;
+
+	m_iNumStores++;
+	return iBest;
+}
+
+int CShadowCache::GetNumValidEntries() const
+{
+	int iValid = 0;
+
+	for ( int i = 0; i < SHADOWCACHE_MAX_PROJ; i++ )
+		iValid += m_EntriesProj[ i ].bValid ? 1 : 0;
+
+	for ( int i = 0; i < SHADOWCACHE_MAX_DP; i++ )
+		iValid += m_EntriesDP[ i ].bValid ? 1 : 0;
+
+	return iValid;
+}
+
+#endif
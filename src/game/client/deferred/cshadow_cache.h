@@ -0,0 +1,95 @@
+#ifndef C_SHADOW_CACHE_H
+#define C_SHADOW_CACHE_H
+
+#include "cbase.h"
+#include "utlmap.h"
+
+struct def_light_t;
+
+#if DEFCFG_SHADOW_CACHE
+/*
+ * Keeps rendered shadow maps of world lights between frames. An entry
+ * stays valid until its light is dirtied or a renderable that changed since
+ * the last frame touches the light bounds, then the map is drawn again.
+ * Spot and point lights have separate pools, entries are recycled least
+ * recently used first.
+ */
+class CShadowCache
+{
+public:
+
+	CShadowCache();
+
+	void Purge();
+
+	// drops the entries of lights whose xforms changed
+	void InvalidateLights( def_light_t * const *pLights, int iNumLights );
+	// finds renderables that changed since the last frame and drops the
+	// entries they touch, only does work once per frame
+	void UpdateMovers();
+
+	void OnLightRemoved( def_light_t *l );
+
+	bool IsCacheable( def_light_t *l ) const;
+
+	// entry with a valid map of the light or -1
+	int FindValidEntry( def_light_t *l, int iResolution );
+	// entry to store a freshly drawn map in
+	int AcquireEntry( def_light_t *l, int iResolution );
+	// outdated map of the light, for lights that ran out of shadow views
+	int FindStaleEntry( def_light_t *l, int iResolution );
+
+	bool HasEntry( def_light_t *l, int iResolution, bool bAllowStale );
+
+	FORCEINLINE int GetNumHits() const { return m_iNumHits; };
+	FORCEINLINE int GetNumStores() const { return m_iNumStores; };
+	FORCEINLINE int GetNumInvalidated() const { return m_iNumInvalidated; };
+	FORCEINLINE int GetNumMovers() const { return m_hMoverMins.Count(); };
+	int GetNumValidEntries() const;
+
+private:
+
+	struct entry_t
+	{
+		def_light_t *pLight;
+		int iResolution;
+		int iLastUsedFrame;
+		bool bValid;
+	};
+
+	struct mover_t
+	{
+		Vector vecOrigin;
+		QAngle angRender;
+		const model_t *pModel;
+		int iSequence;
+		float flCycle;
+		bool bDrawn;
+		Vector vecMins;
+		Vector vecMaxs;
+		int iLastSeenFrame;
+	};
+
+	FORCEINLINE entry_t *GetPool( def_light_t *l, int &iPoolSize );
+
+	void InvalidateEntry( entry_t &e );
+	static int GetEvictionOrder( const entry_t &e );
+	void AddMoverBounds( const mover_t &m );
+	static bool HasMoverChanged( const mover_t &a, const mover_t &b );
+
+	entry_t m_EntriesProj[ SHADOWCACHE_MAX_PROJ ];
+	entry_t m_EntriesDP[ SHADOWCACHE_MAX_DP ];
+
+	CUtlMap< int, mover_t > m_Movers;
+	CUtlVector< Vector > m_hMoverMins;
+	CUtlVector< Vector > m_hMoverMaxs;
+
+	int m_iLastMoverFrame;
+
+	int m_iNumHits;
+	int m_iNumStores;
+	int m_iNumInvalidated;
+};
+#endif
+
+#endif
@@ -0,0 +1,155 @@
+#include "cbase.h"
+#include "deferred/deferred_shared_common.h"
+
+CShadowScheduler::CShadowScheduler()
+{
+	Reset();
+}
+
+void CShadowScheduler::Reset()
+{
+	for ( int i = 0; i < CSM_MAX_CASCADES; i++ )
+	{
+		m_Cascades[ i ].bValid = false;
+		m_Cascades[ i ].vecCenter.Init();
+		m_Cascades[ i ].vecLightDir.Init();
+		m_Cascades[ i ].flUpdateTime = 0.0f;
+
+		m_bCascadeScheduled[ i ] = false;
+		m_vecCenter[ i ].Init();
+	}
+
+	m_vecLightDir.Init( 0, 0, 1 );
+
+	m_iBudget = 0;
+	m_iNumViews = 0;
+	m_iNumCascadeUpdates = 0;
+	m_iNumForced = 0;
+	m_iNumDropped = 0;
+	m_iNumStale = 0;
+}
+
+int CShadowScheduler::GetCascadeUrgency( int iCascade, float flTexelSize ) const
+{
+	const cascadeState_t &state = m_Cascades[ iCascade ];
+
+	if ( !state.bValid )
+		return CASCADE_FORCED;
+
+	const float flThreshold = deferred_cascade_texel_threshold.GetFloat() * flTexelSize;
+
+	if ( ( m_vecCenter[ iCascade ] - state.vecCenter ).LengthSqr() > Square( flThreshold ) )
+		return CASCADE_FORCED;
+
+	// turning the sun moves the edges of the map by the angle times
+	// half the projection size
+	const float flCos = clamp( DotProduct( m_vecLightDir, state.vecLightDir ), -1.0f, 1.0f );
+	const float flEdgeDist = flTexelSize * GetCascadeInfo( iCascade ).iResolution * 0.5f;
+
+	if ( acos( flCos ) * flEdgeDist > flThreshold )
+		return CASCADE_FORCED;
+
+	if ( gpGlobals->curtime - state.flUpdateTime >= GetCascadeInfo( iCascade ).flUpdateDelay )
+		return CASCADE_DUE;
+
+	return CASCADE_IDLE;
+}
+
+void CShadowScheduler::BeginFrame( const CViewSetup &view, const Vector &vecLightDir, bool bCascadesEnabled )
+{
+	m_iBudget = MAX( 0, deferred_shadow_view_budget.GetInt() );
+	m_iNumViews = 0;
+	m_iNumCascadeUpdates = 0;
+	m_iNumForced = 0;
+	m_iNumDropped = 0;
+	m_iNumStale = 0;
+
+	Q_memset( m_bCascadeScheduled, 0, sizeof( m_bCascadeScheduled ) );
+
+	if ( !bCascadesEnabled )
+		return;
+
+	const CCascadeConfig *pConfig = GetCascadeConfig();
+	const int iNumCascades = pConfig->GetNumCascades();
+
+	m_vecLightDir = vecLightDir;
+
+	if ( !deferred_cascade_schedule.GetBool() )
+	{
+		for ( int i = 0; i < iNumCascades; i++ )
+			m_bCascadeScheduled[ i ] = true;
+
+		m_iNumViews += iNumCascades;
+		return;
+	}
+
+	const float flAspectRatio = ( view.m_flAspectRatio > 0.0f ) ? view.m_flAspectRatio : view.width / (float)MAX( 1, view.height );
+
+	int iUrgency[ CSM_MAX_CASCADES ];
+
+	for ( int i = 0; i < iNumCascades; i++ )
+	{
+		const cascade_t &cascade = pConfig->GetCascade( i );
+
+		float flProjectionSize;
+		pConfig->CalcCascadeBounds( i, view.origin, view.angles, view.zNear, view.fov, flAspectRatio,
+			m_vecCenter[ i ], flProjectionSize );
+
+		iUrgency[ i ] = GetCascadeUrgency( i, flProjectionSize / cascade.iResolution );
+
+		// the near cascades follow the camera, empty maps can't wait either
+		if ( cascade.flUpdateDelay <= 0.0f || !m_Cascades[ i ].bValid )
+		{
+			m_bCascadeScheduled[ i ] = true;
+			m_iNumViews++;
+		}
+	}
+
+	// the rest take turns, forced ones first, then the oldest
+	for ( int iUpdate = 0; iUpdate < deferred_cascade_updates_per_frame.GetInt(); iUpdate++ )
+	{
+		int iBest = -1;
+
+		for ( int i = 0; i < iNumCascades; i++ )
+		{
+			if ( m_bCascadeScheduled[ i ] || iUrgency[ i ] == CASCADE_IDLE )
+				continue;
+
+			if ( iBest < 0 || iUrgency[ i ] > iUrgency[ iBest ] ||
+				( iUrgency[ i ] == iUrgency[ iBest ] &&
+				m_Cascades[ i ].flUpdateTime < m_Cascades[ iBest ].flUpdateTime ) )
+				iBest = i;
+		}
+
+		if ( iBest < 0 || !RequestViews( 1 ) )
+			break;
+
+		m_bCascadeScheduled[ iBest ] = true;
+
+		if ( iUrgency[ iBest ] == CASCADE_FORCED )
+			m_iNumForced++;
+	}
+}
+
+void CShadowScheduler::OnCascadeUpdated( int iCascade )
+{
+	Assert( m_bCascadeScheduled[ iCascade ] );
+
+	cascadeState_t &state = m_Cascades[ iCascade ];
+
+	state.bValid = true;
+	state.vecCenter = m_vecCenter[ iCascade ];
+	state.vecLightDir = m_vecLightDir;
+	state.flUpdateTime = gpGlobals->curtime;
+
+	m_iNumCascadeUpdates++;
+}
+
+bool CShadowScheduler::RequestViews( int iNumViews )
+{
+	if ( m_iBudget > 0 && m_iNumViews + iNumViews > m_iBudget )
+		return false;
+
+	m_iNumViews += iNumViews;
+	return true;
+}
@@ -0,0 +1,81 @@
+#ifndef C_SHADOW_SCHEDULER_H
+#define C_SHADOW_SCHEDULER_H
+
+#include "cbase.h"
+
+class CViewSetup;
+
+/*
+ * Spreads shadow view draws over frames. Cascades without an update delay
+ * are drawn every frame, the others take turns, oldest first. A cascade
+ * jumps the queue once the camera or the sun moved its projection by more
+ * than a few texels. Local lights get what's left of the per frame view
+ * budget, nearest first.
+ *
+ * Cascades that aren't drawn keep their last map and matrix, so a late
+ * cascade covers an old area instead of showing a wrong one.
+ */
+class CShadowScheduler
+{
+public:
+
+	CShadowScheduler();
+
+	void Reset();
+
+	// picks the cascades to draw this frame and takes their views from the budget
+	void BeginFrame( const CViewSetup &view, const Vector &vecLightDir, bool bCascadesEnabled );
+
+	FORCEINLINE bool ShouldUpdateCascade( int iCascade ) const
+	{
+		Assert( iCascade >= 0 && iCascade < CSM_MAX_CASCADES );
+		return m_bCascadeScheduled[ iCascade ];
+	};
+	void OnCascadeUpdated( int iCascade );
+
+	// takes views from the budget, fails once it's spent
+	bool RequestViews( int iNumViews );
+	FORCEINLINE void OnShadowDropped() { m_iNumDropped++; };
+	FORCEINLINE void OnShadowStale() { m_iNumStale++; };
+
+	FORCEINLINE int GetNumViews() const { return m_iNumViews; };
+	FORCEINLINE int GetNumCascadeUpdates() const { return m_iNumCascadeUpdates; };
+	FORCEINLINE int GetNumForced() const { return m_iNumForced; };
+	FORCEINLINE int GetNumDropped() const { return m_iNumDropped; };
+	FORCEINLINE int GetNumStale() const { return m_iNumStale; };
+
+private:
+
+	struct cascadeState_t
+	{
+		bool bValid;
+		Vector vecCenter;
+		Vector vecLightDir;
+		float flUpdateTime;
+	};
+
+	enum
+	{
+		CASCADE_IDLE = 0,
+		CASCADE_DUE,
+		CASCADE_FORCED,
+	};
+
+	int GetCascadeUrgency( int iCascade, float flTexelSize ) const;
+
+	cascadeState_t m_Cascades[ CSM_MAX_CASCADES ];
+	bool m_bCascadeScheduled[ CSM_MAX_CASCADES ];
+
+	// state of the frame, stored on the cascades that get drawn
+	Vector m_vecCenter[ CSM_MAX_CASCADES ];
+	Vector m_vecLightDir;
+
+	int m_iBudget;
+	int m_iNumViews;
+	int m_iNumCascadeUpdates;
+	int m_iNumForced;
+	int m_iNumDropped;
+	int m_iNumStale;
+};
+
+#endif
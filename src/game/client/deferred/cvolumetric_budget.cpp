@@ -0,0 +1,80 @@
+#include "cbase.h"
+#include "deferred/deferred_shared_common.h"
+
+void CVolumetricBudget::BudgetSamples( const int *pBaseSamples, const float *pflCoverage, int iNumLights,
+	float flBudget, int *pSamplesOut )
+{
+	float flCost = 0.0f;
+
+	for ( int i = 0; i < iNumLights; i++ )
+	{
+		pSamplesOut[ i ] = clamp( pBaseSamples[ i ], VOLUMETRIC_MIN_SAMPLES, VOLUMETRIC_MAX_SAMPLES );
+
+		flCost += pSamplesOut[ i ] * pflCoverage[ i ];
+	}
+
+	if ( flBudget <= 0.0f || flCost <= flBudget )
+		return;
+
+	// largest common scale that fits, lights stuck at the minimum stop
+	// scaling so it's more than budget / cost
+	float flScaleMin = 0.0f;
+	float flScaleMax = 1.0f;
+
+	for ( int iStep = 0; iStep < 20; iStep++ )
+	{
+		const float flScale = ( flScaleMin + flScaleMax ) * 0.5f;
+		float flScaledCost = 0.0f;
+
+		for ( int i = 0; i < iNumLights; i++ )
+			flScaledCost += MAX( VOLUMETRIC_MIN_SAMPLES, (int)( pSamplesOut[ i ] * flScale ) ) * pflCoverage[ i ];
+
+		if ( flScaledCost <= flBudget )
+			flScaleMin = flScale;
+		else
+			flScaleMax = flScale;
+	}
+
+	for ( int i = 0; i < iNumLights; i++ )
+		pSamplesOut[ i ] = MAX( VOLUMETRIC_MIN_SAMPLES, (int)( pSamplesOut[ i ] * flScaleMin ) );
+}
+
+CON_COMMAND( deferred_volumetrics_test, "Prints how a set of volumetric lights is budgeted and warns where the budget is broken." )
+{
+	const int iBase[] = { 50, 100, 24, 8, 64 };
+	const float flCoverage[] = { 1.0f, 0.25f, 0.5f, 0.1f, 0.05f };
+	const int iNumLights = ARRAYSIZE( iBase );
+	int iSamples[ iNumLights ];
+
+	CVolumetricBudget::BudgetSamples( iBase, flCoverage, iNumLights, 0.0f, iSamples );
+	if ( Q_memcmp( iSamples, iBase, sizeof( iSamples ) ) != 0 )
+		Warning( "no budget changed the sample counts\n" );
+
+	for ( float flBudget = 8.0f; flBudget <= 128.0f; flBudget *= 2.0f )
+	{
+		CVolumetricBudget::BudgetSamples( iBase, flCoverage, iNumLights, flBudget, iSamples );
+
+		float flCost = 0.0f;
+		float flMinCost = 0.0f;
+		Msg( "budget %5.1f:", flBudget );
+
+		for ( int i = 0; i < iNumLights; i++ )
+		{
+			flCost += iSamples[ i ] * flCoverage[ i ];
+			flMinCost += VOLUMETRIC_MIN_SAMPLES * flCoverage[ i ];
+			Msg( " %3i", iSamples[ i ] );
+
+			if ( iSamples[ i ] < VOLUMETRIC_MIN_SAMPLES || iSamples[ i ] > iBase[ i ] )
+				Warning( " (out of range)" );
+		}
+
+		Msg( ", cost %.1f\n", flCost );
+
+		if ( flCost > MAX( flBudget, flMinCost ) + 0.001f )
+			Warning( "  over budget\n" );
+
+		// more samples in, at least as many out
+		if ( iSamples[ 1 ] < iSamples[ 0 ] || iSamples[ 0 ] < iSamples[ 2 ] )
+			Warning( "  lights with more base samples got fewer\n" );
+	}
+}
@@ -0,0 +1,24 @@
+#ifndef C_VOLUMETRIC_BUDGET_H
+#define C_VOLUMETRIC_BUDGET_H
+
+#include "cbase.h"
+
+#define VOLUMETRIC_MIN_SAMPLES 4
+#define VOLUMETRIC_MAX_SAMPLES 100
+
+/*
+ * Splits deferred_volumetrics_sample_budget between the volumetric lights of
+ * a frame. A light costs its ray march samples times the share of the screen
+ * its volume covers.
+ */
+class CVolumetricBudget
+{
+public:
+
+	// all lights scale down evenly until the sum of samples times screen
+	// coverage fits flBudget, 0 is unlimited
+	static void BudgetSamples( const int *pBaseSamples, const float *pflCoverage, int iNumLights,
+		float flBudget, int *pSamplesOut );
+};
+
+#endif
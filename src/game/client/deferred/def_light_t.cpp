@@ -97,6 +97,14 @@ def_light_t::def_light_t( bool bWorld )
 	flLastRandomValue = 0;
 
 	iNumLeaves = 0;
+	bShadowStale = false;
+	iLod = LIGHTLOD_FULL;
+	iLodHistory = LIGHTLOD_FULL;
+	iLodFrame = -1;
+	CLightOcclusion::Init( occlusion );
+#if DEFCFG_CONFIGURABLE_VOLUMETRIC_LOD
+	iVolumeSamplesFrame = 0;
+#endif
 
 #if DEFCFG_ADAPTIVE_VOLUMETRIC_LOD
 	flVolumeLOD0Dist = 128;
@@ -376,7 +384,7 @@ void def_light_t::ClearCookie()
 
 IDefCookie *def_light_t::CreateCookieInstance( const char *pszCookieName )
 {
-	CVGUIProjectable *pVProj = CProjectableFactory::AllocateProjectableByScript( pszCookieName );
+	CVGUIProjectable *pVProj = CProjectableFactory::AcquireProjectableByScript( pszCookieName );
 	if ( pVProj != NULL )
 		return new CDefCookieProjectable( pVProj );
 
@@ -427,7 +435,65 @@ void def_light_t::UpdateFrustum()
 	GeneratePerspectiveFrustum( pos, ang, DEFLIGHT_SPOT_ZNEAR, flRadius, flFOV, 1, spotFrustum );
 }
 
-void def_light_t::UpdateXForms()
+void def_light_t::CalcSpotCorners( Vector *points )
+{
+	Assert( iLighttype == DEFLIGHTTYPE_SPOT );
+
+#if DEFCFG_USE_SSE
+	// no lazy init, lights may be updated from jobs
+	static const float _normPos[4][4] = {
+		{ 1, 1, 1, 1 },
+		{ -1, 1, 1, 1 },
+		{ -1, -1, 1, 1 },
+		{ 1, -1, 1, 1 },
+	};
+
+	fltx4 _spotMVPInvSSE[4];
+
+	_spotMVPInvSSE[0] =	_mm_loadu_ps( spotMVPInv[0] );
+	_spotMVPInvSSE[1] =	_mm_loadu_ps( spotMVPInv[1] );
+	_spotMVPInvSSE[2] =	_mm_loadu_ps( spotMVPInv[2] );
+	_spotMVPInvSSE[3] =	_mm_loadu_ps( spotMVPInv[3] );
+
+	TransposeSIMD
+		( 
+			_spotMVPInvSSE[0],
+			_spotMVPInvSSE[1],
+			_spotMVPInvSSE[2],
+			_spotMVPInvSSE[3] 
+		);
+
+	for( int i = 0; i < 4; i++ )
+	{
+		fltx4 pointx4 = FourDotProducts( _spotMVPInvSSE, _mm_loadu_ps( _normPos[i] ) );
+
+		float _w = SubFloat( pointx4, 3 );
+		if( _w != 0 )
+		{
+			_w = 1.0f / _w;
+		}
+
+		pointx4 = MulSIMD( pointx4, ReplicateX4( _w ) );
+
+		Q_memcpy( points[i].Base(), &SubFloat( pointx4, 0 ), 3 * sizeof(float) );
+	}
+#else
+	static const Vector _normPos[4] = {
+		Vector( 1, 1, 1 ),
+		Vector( -1, 1, 1 ),
+		Vector( -1, -1, 1 ),
+		Vector( 1, -1, 1 ),
+	};
+
+	points[4] = pos;
+
+	for ( int i = 0; i < 4; i++ )
+		Vector3DMultiplyPositionProjective( spotMVPInv, _normPos[i], points[i] );
+#endif
+	points[4] = pos;
+}
+
+void def_light_t::UpdateXForms( const lightBake_t *pBake, const int *pBakedLeaves )
 {
 	normalizeAngles( ang );
 
@@ -443,7 +509,9 @@ void def_light_t::UpdateXForms()
 #define __ND0 1.0f
 #define __ND1 0.57735f
 
-	switch ( iLighttype )
+	if ( pBake != NULL )
+		ApplyBakedBounds( *pBake );
+	else switch ( iLighttype )
 	{
 	default:
 		Assert( 0 );
@@ -494,78 +562,18 @@ void def_light_t::UpdateXForms()
 		{
 			Vector points[5];
 			const int numPoints = ARRAYSIZE( points );
-#if DEFCFG_USE_SSE
-			static bool bSIMDDataInitialised = false;
-			static fltx4 _normPos[4];
-			
-			if( !bSIMDDataInitialised )
-			{
-				_normPos[0] = LoadOneSIMD();
-
-				const float pNormPos1[4] = { -1, 1, 1, 1 },
-					pNormPos2[4] = { -1, -1, 1, 1 },
-					pNormPos3[4] = { 1, -1, 1, 1 };
-
-				_normPos[1] = _mm_loadu_ps( pNormPos1 );
-				_normPos[2] = _mm_loadu_ps( pNormPos2 );
-				_normPos[3] = _mm_loadu_ps( pNormPos3 );
-
-				bSIMDDataInitialised = true;
-			}
-
-			fltx4 _spotMVPInvSSE[4];
-
-			_spotMVPInvSSE[0] =	_mm_loadu_ps( spotMVPInv[0] );
-			_spotMVPInvSSE[1] =	_mm_loadu_ps( spotMVPInv[1] );
-			_spotMVPInvSSE[2] =	_mm_loadu_ps( spotMVPInv[2] );
-			_spotMVPInvSSE[3] =	_mm_loadu_ps( spotMVPInv[3] );
-
-			TransposeSIMD
-				( 
-					_spotMVPInvSSE[0],
-					_spotMVPInvSSE[1],
-					_spotMVPInvSSE[2],
-					_spotMVPInvSSE[3] 
-				);
-
-			for( int i = 0; i < 4; i++ )
-			{
-				fltx4 pointx4 = FourDotProducts( _spotMVPInvSSE, _normPos[i] );
-
-				float _w = SubFloat( pointx4, 3 );
-				if( _w != 0 )
-				{
-					_w = 1.0f / _w;
-				}
-
-				pointx4 = MulSIMD( pointx4, ReplicateX4( _w ) );
-
-				Q_memcpy( points[i].Base(), &SubFloat( pointx4, 0 ), 3 * sizeof(float) );
-			}
-#else
-			static const Vector _normPos[4] = {
-				Vector( 1, 1, 1 ),
-				Vector( -1, 1, 1 ),
-				Vector( -1, -1, 1 ),
-				Vector( 1, -1, 1 ),
-			};
-
-			points[4] = pos;
-
-			for ( int i = 0; i < 4; i++ )
-				Vector3DMultiplyPositionProjective( spotMVPInv, _normPos[i], points[i] );
-#endif
-			points[4] = pos;
+			CalcSpotCorners( points );
 
 			Vector list[6];
 			Q_memcpy( list, points, sizeof( Vector ) * 4 );
 			list[4] = pos + fwd * flRadius;
 			list[5] = pos;
 
+			CTraceFilterWorldOnly filter;
 			for ( int i = 0; i < 5; i++ )
 			{
 				RayTracingEnvironment environment;
-				UTIL_TraceLine( pos, list[i], MASK_SOLID, NULL, COLLISION_GROUP_DEBRIS, &tr );
+				UTIL_TraceLine( pos, list[i], MASK_SOLID, &filter, &tr );
 				list[ i ] = tr.endpos;
 			}
 
@@ -603,6 +611,13 @@ void def_light_t::UpdateXForms()
 	else
 		worldTransform.SetupMatrixOrgAngles( pos, worldAng );
 
+	if ( pBake != NULL )
+	{
+		iNumLeaves = pBake->iNumLeaves;
+		Q_memcpy( iLeaveIDs, pBakedLeaves, sizeof(int) * iNumLeaves );
+		return;
+	}
+
 	CLightLeafEnum leaves;
 	ISpatialQuery* pQuery = engine->GetBSPTreeQuery();
 	pQuery->EnumerateLeavesInBox( bounds_min, bounds_max, &leaves, 0 );
@@ -613,6 +628,121 @@ void def_light_t::UpdateXForms()
 	Q_memcpy( iLeaveIDs, leaves.m_LeafList.Base(), sizeof(int) * iNumLeaves );
 }
 
+void def_light_t::ApplyBakedBounds( const lightBake_t &bake )
+{
+	bounds_min = bake.bounds_min;
+	bounds_max = bake.bounds_max;
+
+	if ( iLighttype == DEFLIGHTTYPE_SPOT )
+	{
+		Vector points[5];
+		Q_memcpy( points, bake.vecSpotCorners, sizeof( Vector ) * 4 );
+		points[4] = pos;
+
+		CalcBoundaries( points, 5, bounds_min_naive, bounds_max_naive );
+
+		boundsCenter = bounds_min_naive + ( bounds_max_naive - bounds_min_naive ) * 0.5f;
+	}
+	else
+	{
+		const Vector vecExtent( flRadius, flRadius, flRadius );
+
+		bounds_min_naive = pos - vecExtent;
+		bounds_max_naive = pos + vecExtent;
+
+		boundsCenter = pos;
+	}
+}
+
+void def_light_t::FillBake( lightBake_t &bake )
+{
+	Q_memset( &bake, 0, sizeof( bake ) );
+
+	bake.iKey = CLightBakeCache::GetLightKey( this );
+	bake.bounds_min = bounds_min;
+	bake.bounds_max = bounds_max;
+	bake.iNumLeaves = iNumLeaves;
+
+	if ( iLighttype == DEFLIGHTTYPE_SPOT )
+	{
+		Vector points[5];
+		CalcSpotCorners( points );
+
+		Q_memcpy( bake.vecSpotCorners, points, sizeof( Vector ) * 4 );
+	}
+}
+
+void def_light_t::UpdateNaiveBounds()
+{
+	flMaxDistSqr = iVisible_Dist + iVisible_Range;
+	flMaxDistSqr *= flMaxDistSqr;
+
+	switch ( iLighttype )
+	{
+	default:
+		Assert( 0 );
+	case DEFLIGHTTYPE_POINT:
+		{
+			const Vector vecExtent( flRadius, flRadius, flRadius );
+
+			bounds_min_naive = pos - vecExtent;
+			bounds_max_naive = pos + vecExtent;
+
+			boundsCenter = pos;
+		}
+		break;
+	case DEFLIGHTTYPE_SPOT:
+		{
+			UpdateMatrix();
+
+			Vector points[5];
+			CalcSpotCorners( points );
+			CalcBoundaries( points, ARRAYSIZE( points ), bounds_min_naive, bounds_max_naive );
+
+			boundsCenter = bounds_min_naive + ( bounds_max_naive - bounds_min_naive ) * 0.5f;
+		}
+		break;
+	}
+
+	bounds_min = bounds_min_naive;
+	bounds_max = bounds_max_naive;
+}
+
+void def_light_t::UpdateProxyXForms()
+{
+	Assert( IsPoint() );
+
+	ang.Init();
+	backDir.Init( -1, 0, 0 );
+
+	UpdateNaiveBounds();
+
+	VMatrix scale;
+	MatrixBuildScale( scale, flRadius, flRadius, flRadius );
+	worldTransform = scale;
+	worldTransform.SetTranslation( pos );
+
+	iNumLeaves = 0;
+
+	if ( pMesh_World == NULL )
+		UpdateRenderMesh();
+
+	UnDirtyAll();
+}
+
+void def_light_t::UpdateViewDistance( const Vector &vecViewOrigin )
+{
+	flDistance_ViewOrigin = ( boundsCenter - vecViewOrigin ).Length();
+	flShadowFade = HasShadow() ?
+		( SATURATE( ( flDistance_ViewOrigin - iShadow_Dist ) / iShadow_Range ) )
+		: 1.0f;
+	bShadowStale = false;
+	iLod = LIGHTLOD_FULL;
+#if DEFCFG_CONFIGURABLE_VOLUMETRIC_LOD
+	iVolumeSamplesFrame = 0;
+#endif
+}
+
 void def_light_t::UpdateRenderMesh()
 {
 	if ( iLighttype == DEFLIGHTTYPE_POINT && pMesh_World != NULL )
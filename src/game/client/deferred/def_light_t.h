@@ -5,22 +5,12 @@
 
 class CMeshBuilder;
 class IDefCookie;
-
-#if DEFCFG_USE_SSE
-struct def_light_presortdatax4_t
-{
-	fltx4		bounds_min_naive[3];
-	fltx4		bounds_max_naive[3];
-	i32x4		hasShadow;
-	i32x4		hasVolumetrics;
-	def_light_t* lights[4];
-	uint		count;				//this throws the alignment way out
-};
-#endif
+struct lightBake_t;
 
 struct def_light_t
 {
 	friend class CLightingManager;
+	friend class CDeferredLightStore;
 
 	def_light_t( bool bWorld = false );
 	virtual ~def_light_t();
@@ -144,12 +134,31 @@ struct def_light_t
 	{
 		return HasShadow() && flShadowFade < 1;
 	};
+	// over the shadow view budget, reuses an outdated cached map
+	FORCEINLINE bool IsShadowStale()
+	{
+		return bShadowStale;
+	};
+
+	// level picked by the light LOD for this frame
+	FORCEINLINE int GetLOD()
+	{
+		return iLod;
+	};
+	FORCEINLINE bool ShouldRenderVolumetrics()
+	{
+		return HasVolumetrics() && iLod < LIGHTLOD_NO_VOLUMETRICS && ShouldRenderShadow();
+	};
 
 	bool IsCookieReady();
 	ITexture *GetCookieForDraw( const int iTargetIndex = 0 );
 	void ClearCookie();
 	IDefCookie *CreateCookieInstance( const char *pszCookieName );
 	void SetCookie( IDefCookie *pCookie );
+	FORCEINLINE bool ShouldRenderCookie()
+	{
+		return HasCookie() && iLod < LIGHTLOD_NO_COOKIE && IsCookieReady();
+	};
 
 	FORCEINLINE float GetFOV()
 	{
@@ -166,6 +175,21 @@ struct def_light_t
 		return iNumLeaves;
 	};
 
+	FORCEINLINE const Vector &GetBoundsMinNaive()
+	{
+		return bounds_min_naive;
+	};
+	FORCEINLINE const Vector &GetBoundsMaxNaive()
+	{
+		return bounds_max_naive;
+	};
+
+	// calcs visible distance and naive bounds without tracing the world
+	void UpdateNaiveBounds();
+
+	// distance to the view and shadow fade for lights that passed culling
+	void UpdateViewDistance( const Vector &vecViewOrigin );
+
 private:
 
 	def_light_t( const def_light_t &o );
@@ -191,7 +215,13 @@ private:
 	void UpdateFrustum();
 	Frustum_t spotFrustum;
 	
-	void UpdateXForms();
+	// a bake skips the traces and the leaf query
+	void UpdateXForms( const lightBake_t *pBake = NULL, const int *pBakedLeaves = NULL );
+	void ApplyBakedBounds( const lightBake_t &bake );
+	void FillBake( lightBake_t &bake );
+	// merged point light of the LOD, no traces and no leaves
+	void UpdateProxyXForms();
+	void CalcSpotCorners( Vector *points );
 	Vector bounds_min, bounds_max;
 	Vector bounds_min_naive, bounds_max_naive;
 
@@ -218,6 +248,18 @@ private:
 
 	float flDistance_ViewOrigin;
 	float flShadowFade;
+	bool bShadowStale;
+
+	int iLod;
+	int iLodHistory;
+	int iLodFrame;
+
+	lightOcclusion_t occlusion;
+
+#if DEFCFG_CONFIGURABLE_VOLUMETRIC_LOD
+	// set by the volumetric budget of the frame, 0 if unbudgeted
+	int iVolumeSamplesFrame;
+#endif
 
 	float flLastRandomTime;
 	float flLastRandomValue;
@@ -14,6 +14,41 @@ ConVar deferred_rt_shadowpoint_lod2_res( "deferred_rt_shadowpoint_lod2_res", "25
 #endif
 
 ConVar deferred_lightmanager_debug( "deferred_lightmanager_debug", "0" );
+ConVar deferred_lightmanager_threaded( "deferred_lightmanager_threaded", "1" );
+ConVar deferred_lightmanager_stress( "deferred_lightmanager_stress", "0", 0, "Dirties all lights every frame." );
+ConVar deferred_lightmanager_batch( "deferred_lightmanager_batch", "1", 0, "Draws simple world lights that are close on screen in one pass." );
+ConVar deferred_lightmanager_batch_drawcost( "deferred_lightmanager_batch_drawcost", "16384", 0, "Per pixel light evaluations one draw call is worth when batching lights." );
+ConVar deferred_lightmanager_leafindex( "deferred_lightmanager_leafindex", "1", 0, "Culls lights through an index of the leaves they touch, queries every leaf once." );
+
+ConVar deferred_pipeline_extrasort( "deferred_pipeline_extrasort", DEFCFG_EXTRA_SORT ? "1" : "0", 0, "Sorts simple and advanced lights apart so simple world lights share render state." );
+ConVar deferred_pipeline_simd( "deferred_pipeline_simd", DEFCFG_USE_SSE ? "1" : "0", 0, "Culls lights four at a time from the light store." );
+#if DEFCFG_CONFIGURABLE_VOLUMETRIC_LOD
+ConVar deferred_pipeline_volumetric_lod( "deferred_pipeline_volumetric_lod", "0", 0, "0 - samples set per light, 1 - samples drop with distance." );
+ConVar deferred_volumetrics_sample_budget( "deferred_volumetrics_sample_budget", "100", 0, "Volumetric samples per pixel summed over all lights, scales lights down evenly. 0 is unlimited." );
+#endif
+
+ConVar deferred_profile( "deferred_profile", "0", 0, "Records pass times of the deferred pipeline, see deferred_profile_dump." );
+
+ConVar deferred_shadow_view_budget( "deferred_shadow_view_budget", "16", 0, "Max shadow views drawn per frame, cascades first. Point lights take two, 0 is unlimited." );
+ConVar deferred_cascade_schedule( "deferred_cascade_schedule", "1", 0, "Lets cascades with an update delay take turns instead of drawing all cascades every frame." );
+ConVar deferred_cascade_texel_threshold( "deferred_cascade_texel_threshold", "4", 0, "Texels a late cascade may lag behind the camera or the sun before it's forced to update." );
+ConVar deferred_cascade_updates_per_frame( "deferred_cascade_updates_per_frame", "1", 0, "Cascades with an update delay drawn per frame." );
+
+ConVar deferred_projectable_repaint_budget( "deferred_projectable_repaint_budget", "4", 0, "Max vgui projectables repainted per frame, the ones that waited longest first. 0 is unlimited." );
+ConVar deferred_projectable_refresh_rate( "deferred_projectable_refresh_rate", "30", 0, "Max repaints per second of a vgui projectable whose script doesn't set a refreshrate. 0 is unlimited." );
+
+ConVar deferred_light_lod( "deferred_light_lod", "1", 0, "Drops cookies, volumetrics and shadows of lights that are small on screen and merges tiny point lights." );
+ConVar deferred_light_lod_budget( "deferred_light_lod_budget", "0", 0, "Per pixel light evaluations per frame, demotes the smallest lights first when over it. 0 only demotes by size." );
+ConVar deferred_light_lod_size_scale( "deferred_light_lod_size_scale", "1", 0, "Scales the screen sizes lights are demoted at." );
+ConVar deferred_light_lod_merge_size( "deferred_light_lod_merge_size", "256", 0, "Grid cell size in units tiny point lights are merged by." );
+
+ConVar deferred_light_occlusion( "deferred_light_occlusion", "1", 0, "Skips lights whose volume is hidden by the scene. 0 - off, 1 - occlusion queries, a frame late, software depth without query support, 2 - software depth." );
+
+ConVar deferred_light_bake( "deferred_light_bake", "1", 0, "Reuses the traced bounds and leaves of world lights saved next to the map. Lights that aren't in the file are traced, deferred_light_bake_world writes the file." );
+
+#if DEFCFG_SHADOW_CACHE
+ConVar deferred_shadow_cache( "deferred_shadow_cache", "1", 0, "Reuses shadow maps of world lights until something changes in their bounds." );
+#endif
 
 ConVar deferred_override_globalLight_enable( "deferred_override_globalLight_enable", "0" );
 ConVar deferred_override_globalLight_shadow_enable( "deferred_override_globalLight_shadow_enable", "1" );
@@ -26,6 +61,8 @@ ConVar deferred_radiosity_propagate_count( "deferred_radiosity_propagate_count",
 ConVar deferred_radiosity_propagate_count_far( "deferred_radiosity_propagate_count_far", "0" );
 ConVar deferred_radiosity_blur_count( "deferred_radiosity_blur_count", "2" ); // 2
 ConVar deferred_radiosity_blur_count_far( "deferred_radiosity_blur_count_far", "1" ); // 1
+ConVar deferred_radiosity_refresh_interval( "deferred_radiosity_refresh_interval", "0.25", 0, "Seconds a radiosity grid that didn't move keeps its cells before it's drawn again." );
+ConVar deferred_radiosity_pass_budget( "deferred_radiosity_pass_budget", "0", 0, "Radiosity grid passes per frame, injection plus propagate and blur steps. Grids over the budget wait, 0 is unlimited." );
 ConVar deferred_radiosity_debug( "deferred_radiosity_debug", "0" );
 
 void OnCookieTableChanged( void *object, INetworkStringTable *stringTable, int stringNumber, const char *newString, void const *newData )
@@ -36,6 +73,12 @@ void OnCookieTableChanged( void *object, INetworkStringTable *stringTable, int s
 	GetLightingManager()->OnCookieStringReceived( newString, stringNumber );
 }
 
+void OnWorldLightTableChanged( void *object, INetworkStringTable *stringTable, int stringNumber, const char *newString, void const *newData )
+{
+	for ( int i = 0; i < GetNumLightContainers(); i++ )
+		GetLightContainer( i )->ReadWorldLights();
+}
+
 void CalcBoundaries( Vector *list, const int &num, Vector &min, Vector &max )
 {
 	Assert( num > 0 );
@@ -13,6 +13,41 @@ extern ConVar deferred_rt_shadowspot_res;
 extern ConVar deferred_rt_shadowpoint_res;
 
 extern ConVar deferred_lightmanager_debug;
+extern ConVar deferred_lightmanager_threaded;
+extern ConVar deferred_lightmanager_stress;
+extern ConVar deferred_lightmanager_batch;
+extern ConVar deferred_lightmanager_batch_drawcost;
+extern ConVar deferred_lightmanager_leafindex;
+
+extern ConVar deferred_pipeline_extrasort;
+extern ConVar deferred_pipeline_simd;
+#if DEFCFG_CONFIGURABLE_VOLUMETRIC_LOD
+extern ConVar deferred_pipeline_volumetric_lod;
+extern ConVar deferred_volumetrics_sample_budget;
+#endif
+
+extern ConVar deferred_profile;
+
+extern ConVar deferred_shadow_view_budget;
+extern ConVar deferred_cascade_schedule;
+extern ConVar deferred_cascade_texel_threshold;
+extern ConVar deferred_cascade_updates_per_frame;
+
+extern ConVar deferred_projectable_repaint_budget;
+extern ConVar deferred_projectable_refresh_rate;
+
+extern ConVar deferred_light_lod;
+extern ConVar deferred_light_lod_budget;
+extern ConVar deferred_light_lod_size_scale;
+extern ConVar deferred_light_lod_merge_size;
+
+extern ConVar deferred_light_occlusion;
+
+extern ConVar deferred_light_bake;
+
+#if DEFCFG_SHADOW_CACHE
+extern ConVar deferred_shadow_cache;
+#endif
 
 extern ConVar deferred_override_globalLight_enable;
 extern ConVar deferred_override_globalLight_shadow_enable;
@@ -25,6 +60,8 @@ extern ConVar deferred_radiosity_propagate_count;
 extern ConVar deferred_radiosity_propagate_count_far;
 extern ConVar deferred_radiosity_blur_count;
 extern ConVar deferred_radiosity_blur_count_far;
+extern ConVar deferred_radiosity_refresh_interval;
+extern ConVar deferred_radiosity_pass_budget;
 extern ConVar deferred_radiosity_debug;
 
 
@@ -41,8 +78,21 @@ extern ConVar deferred_radiosity_debug;
 #include "deferred/IDefCookie.h"
 #include "deferred/DefCookieTexture.h"
 #include "deferred/DefCookieProjectable.h"
+#include "deferred/clight_lod.h"
+#include "deferred/clight_occlusion.h"
 #include "deferred/def_light_t.h"
 #include "deferred/cascade_t.h"
+#include "deferred/clight_store.h"
+#include "deferred/clight_leafindex.h"
+#include "deferred/clight_bake.h"
+#include "deferred/cshadow_cache.h"
+#include "deferred/cshadow_scheduler.h"
+#include "deferred/cvolumetric_budget.h"
+#include "deferred/cradiosity_grid.h"
+#include "deferred/clight_arena.h"
+#include "deferred/clight_batch.h"
+#include "deferred/cdeferred_pipeline.h"
+#include "deferred/cdeferred_profiler.h"
 
 #include "deferred/vgui/vgui_deferred.h"
 
@@ -56,6 +106,7 @@ extern ConVar deferred_radiosity_debug;
 #include "deferred/materialsystem_passthru.h"
 
 void OnCookieTableChanged( void *object, INetworkStringTable *stringTable, int stringNumber, const char *newString, void const *newData );
+void OnWorldLightTableChanged( void *object, INetworkStringTable *stringTable, int stringNumber, const char *newString, void const *newData );
 
 
 #define QUEUE_FIRE( helperName, functionName, varName ){\
@@ -31,6 +31,11 @@ static CTextureReference g_tex_ShadowDepth_Proj_LOD2[ MAX_SHADOW_PROJ ];
 static CTextureReference g_tex_ShadowColor_DP[ MAX_SHADOW_DP ];
 static CTextureReference g_tex_ShadowDepth_DP[ MAX_SHADOW_DP ];
 
+#if DEFCFG_SHADOW_CACHE
+static CTextureReference g_tex_ShadowCache_Proj[ SHADOWCACHE_MAX_PROJ ];
+static CTextureReference g_tex_ShadowCache_DP[ SHADOWCACHE_MAX_DP ];
+#endif
+
 static CTextureReference g_tex_RadiosityBuffer[ 2 ];
 static CTextureReference g_tex_RadiosityNormal[ 2 ];
 
@@ -404,7 +409,35 @@ const ImageFormat fmt_gbuffer0 =
 		Assert( res_x == g_tex_ShadowColor_DP[i]->GetActualWidth() );
 	}
 
-	
+#if DEFCFG_SHADOW_CACHE
+	for ( int i = 0; i < SHADOWCACHE_MAX_PROJ; i++ )
+	{
+		int res = GetShadowResolution_Spot();
+
+		g_tex_ShadowCache_Proj[i].Init( materials->CreateNamedRenderTargetTextureEx2(
+			VarArgs( "%s%02i", DEFRTNAME_SHADOWCACHE_PROJ, i ),
+			res, res,
+			RT_SIZE_NO_CHANGE,
+			fmt_depthColor,
+			MATERIAL_RT_DEPTH_NONE,
+			shadowColorFlags, 0 ) );
+	}
+
+	for ( int i = 0; i < SHADOWCACHE_MAX_DP; i++ )
+	{
+		int res_x = GetShadowResolution_Point();
+		int res_y = res_x * 2;
+
+		g_tex_ShadowCache_DP[i].Init( materials->CreateNamedRenderTargetTextureEx2(
+			VarArgs( "%s%02i", DEFRTNAME_SHADOWCACHE_DP, i ),
+			res_x, res_y,
+			RT_SIZE_NO_CHANGE,
+			fmt_depthColor,
+			MATERIAL_RT_DEPTH_NONE,
+			shadowColorFlags, 0 ) );
+	}
+#endif
+
 
 	materials->EndRenderTargetAllocation();
 
@@ -580,6 +613,21 @@ ITexture *GetShadowDepthRT_DP( int index )
 	Assert( g_tex_ShadowDepth_DP[ index ].IsValid() );
 	return g_tex_ShadowDepth_DP[ index ];
 }
+#if DEFCFG_SHADOW_CACHE
+ITexture *GetShadowCacheRT_Proj( int index )
+{
+	Assert( index >= 0 && index < SHADOWCACHE_MAX_PROJ );
+	Assert( g_tex_ShadowCache_Proj[ index ].IsValid() );
+	return g_tex_ShadowCache_Proj[ index ];
+}
+ITexture *GetShadowCacheRT_DP( int index )
+{
+	Assert( index >= 0 && index < SHADOWCACHE_MAX_DP );
+	Assert( g_tex_ShadowCache_DP[ index ].IsValid() );
+	return g_tex_ShadowCache_DP[ index ];
+}
+#endif
+
 ITexture *GetProjectableVguiRT( int index )
 {
 	Assert( index >= 0 && index < NUM_PROJECTABLE_VGUI );
@@ -53,6 +53,11 @@ ITexture *GetShadowDepthRT_Proj( int index );
 ITexture *GetShadowColorRT_DP( int index );
 ITexture *GetShadowDepthRT_DP( int index );
 
+#if DEFCFG_SHADOW_CACHE
+ITexture *GetShadowCacheRT_Proj( int index );
+ITexture *GetShadowCacheRT_DP( int index );
+#endif
+
 ITexture *GetProjectableVguiRT( int index );
 
 ITexture *GetRadiosityAlbedoRT_Ortho( int index );
@@ -87,6 +87,102 @@ CVGUIProjectable *CProjectableFactory::AllocateProjectableByScript( const char *
 	return pPanel;
 }
 
+struct SharedProjectable
+{
+	char szFileName[ MAX_PATH ];
+	CVGUIProjectable *pPanel;
+	int iRefs;
+};
+
+static CUtlVector< SharedProjectable > g_hSharedProjectables;
+
+CVGUIProjectable *CProjectableFactory::AcquireProjectableByScript( const char *pszFileName )
+{
+	FOR_EACH_VEC( g_hSharedProjectables, i )
+	{
+		if ( !Q_stricmp( g_hSharedProjectables[ i ].szFileName, pszFileName ) )
+		{
+			g_hSharedProjectables[ i ].iRefs++;
+			return g_hSharedProjectables[ i ].pPanel;
+		}
+	}
+
+	CVGUIProjectable *pPanel = AllocateProjectableByScript( pszFileName );
+
+	if ( pPanel != NULL )
+	{
+		SharedProjectable entry;
+		Q_snprintf( entry.szFileName, sizeof( entry.szFileName ), "%s", pszFileName );
+		entry.pPanel = pPanel;
+		entry.iRefs = 1;
+
+		g_hSharedProjectables.AddToTail( entry );
+	}
+
+	return pPanel;
+}
+
+void CProjectableFactory::ReleaseProjectable( CVGUIProjectable *pPanel )
+{
+	FOR_EACH_VEC( g_hSharedProjectables, i )
+	{
+		if ( g_hSharedProjectables[ i ].pPanel != pPanel )
+			continue;
+
+		if ( --g_hSharedProjectables[ i ].iRefs <= 0 )
+		{
+			g_hSharedProjectables.Remove( i );
+			delete pPanel;
+		}
+
+		return;
+	}
+
+	delete pPanel;
+}
+
+struct RepaintCandidate
+{
+	int iIndex;
+	float flLastPaintTime;
+};
+
+static int SortByLastPaint( const RepaintCandidate *a, const RepaintCandidate *b )
+{
+	if ( a->flLastPaintTime != b->flLastPaintTime )
+		return ( a->flLastPaintTime < b->flLastPaintTime ) ? -1 : 1;
+
+	return a->iIndex - b->iIndex;
+}
+
+int CProjectableFactory::ScheduleRepaints( const float *pflLastPaintTime, int iNumPanels, int iBudget, bool *pGranted )
+{
+	if ( iBudget <= 0 || iNumPanels <= iBudget )
+	{
+		for ( int i = 0; i < iNumPanels; i++ )
+			pGranted[ i ] = true;
+
+		return iNumPanels;
+	}
+
+	CUtlVector< RepaintCandidate > hCandidates;
+	hCandidates.SetCount( iNumPanels );
+
+	for ( int i = 0; i < iNumPanels; i++ )
+	{
+		hCandidates[ i ].iIndex = i;
+		hCandidates[ i ].flLastPaintTime = pflLastPaintTime[ i ];
+		pGranted[ i ] = false;
+	}
+
+	hCandidates.Sort( SortByLastPaint );
+
+	for ( int i = 0; i < iBudget; i++ )
+		pGranted[ hCandidates[ i ].iIndex ] = true;
+
+	return iBudget;
+}
+
 
 static CProjectableManager g_pProjManager;
 CProjectableManager *CProjectableFactory::GetProjectableManager()
@@ -100,18 +196,68 @@ CProjectableManager::CProjectableManager() : CAutoGameSystemPerFrame( "CProjecta
 
 CProjectableHelper *CProjectableHelper::m_pLastHelper = NULL;
 
+static void ProjectableRestoreFunc( int nChangeFlags )
+{
+	// render targets lost their content
+	CDefCookieProjectable::GetTargetCache().Reset();
+}
+
 bool CProjectableManager::Init()
 {
 	RegisterHelpers();
+
+	materials->AddRestoreFunc( ProjectableRestoreFunc );
 	return true;
 }
 
+void CProjectableManager::Shutdown()
+{
+	if ( materials )
+		materials->RemoveRestoreFunc( ProjectableRestoreFunc );
+}
+
 void CProjectableManager::Update( float frametime )
 {
 	for ( int i = 0; i < m_hInstantiatedPanels.Count(); i++ )
 	{
 		vgui::ipanel()->Think( m_hInstantiatedPanels[i]->GetVPanel() );
 	}
+
+	GrantRepaints();
+
+	CDefCookieProjectable::GetTargetCache().ResetStats();
+}
+
+void CProjectableManager::GrantRepaints()
+{
+	m_hRepaintCandidates.RemoveAll();
+	m_RepaintLastPaintTime.RemoveAll();
+
+	for ( int i = 0; i < m_hInstantiatedPanels.Count(); i++ )
+	{
+		CVGUIProjectable *pPanel = m_hInstantiatedPanels[ i ];
+
+		if ( pPanel->IsAnimated() )
+			pPanel->Repaint();
+
+		pPanel->SetRepaintGranted( false );
+
+		// panels that weren't drawn recently repaint when they come back
+		if ( pPanel->GetLastUseFrame() < gpGlobals->framecount - 1 ||
+			!pPanel->IsRefreshDue( gpGlobals->realtime ) )
+			continue;
+
+		m_hRepaintCandidates.AddToTail( pPanel );
+		m_RepaintLastPaintTime.AddToTail( pPanel->GetLastPaintTime() );
+	}
+
+	m_RepaintGranted.SetCount( m_hRepaintCandidates.Count() );
+
+	ScheduleRepaints( m_RepaintLastPaintTime.Base(), m_hRepaintCandidates.Count(),
+		deferred_projectable_repaint_budget.GetInt(), m_RepaintGranted.Base() );
+
+	for ( int i = 0; i < m_hRepaintCandidates.Count(); i++ )
+		m_hRepaintCandidates[ i ]->SetRepaintGranted( m_RepaintGranted[ i ] );
 }
 
 void CProjectableManager::RegisterHelpers()
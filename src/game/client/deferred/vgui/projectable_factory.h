@@ -12,6 +12,14 @@ namespace CProjectableFactory
 	extern CVGUIProjectable *AllocateProjectableByName( const char *pszName );
 	extern CVGUIProjectable *AllocateProjectableByScript( const char *pszFileName );
 
+	// lights projecting the same script share one panel, released by reference
+	extern CVGUIProjectable *AcquireProjectableByScript( const char *pszFileName );
+	extern void ReleaseProjectable( CVGUIProjectable *pPanel );
+
+	// grants the panels that waited longest since their last paint, 0 is unlimited;
+	// returns the number of grants
+	extern int ScheduleRepaints( const float *pflLastPaintTime, int iNumPanels, int iBudget, bool *pGranted );
+
 	class CProjectableManager : public CAutoGameSystemPerFrame
 	{
 		friend class CVGUIProjectable;
@@ -19,6 +27,7 @@ namespace CProjectableFactory
 		CProjectableManager();
 
 		bool Init();
+		void Shutdown();
 		void Update( float frametime );
 
 	private:
@@ -27,6 +36,12 @@ namespace CProjectableFactory
 		void AddThinkTarget( CVGUIProjectable *panel );
 		void RemoveThinkTarget( CVGUIProjectable *panel );
 		CUtlVector< CVGUIProjectable* > m_hInstantiatedPanels;
+
+		// dirty panels that were drawn last frame compete for the repaint cap
+		void GrantRepaints();
+		CUtlVector< CVGUIProjectable* > m_hRepaintCandidates;
+		CUtlVector< float > m_RepaintLastPaintTime;
+		CUtlVector< bool > m_RepaintGranted;
 	};
 	extern CProjectableManager *GetProjectableManager();
 
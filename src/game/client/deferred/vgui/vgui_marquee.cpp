@@ -107,8 +107,13 @@ void CVGUIMarquee::OnThink()
 	if ( strWidth < 1 )
 		return;
 
+	if ( m_flMoveDir == 0 )
+		return;
+
 	m_flCurOffset += m_flMoveDir * gpGlobals->frametime;
 
 	while ( abs( m_flCurOffset ) > strWidth )
 		m_flCurOffset -= strWidth * Sign( m_flCurOffset );
+
+	Repaint();
 }
\ No newline at end of file
@@ -99,6 +99,8 @@ void CVGUIParticles::OnThink()
 			m_hParticles.Remove( i );
 			i--;
 		}
+
+		Repaint();
 	}
 }
 
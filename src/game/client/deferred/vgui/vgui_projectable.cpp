@@ -16,6 +16,13 @@ CVGUIProjectable::CVGUIProjectable() : BaseClass( NULL, "" )
 	m_pszParentName = NULL;
 	m_pConfig = NULL;
 
+	m_bDirty = true;
+	m_bAnimated = false;
+	m_bRepaintGranted = false;
+	m_flRefreshRate = 0;
+	m_flLastPaintTime = 0;
+	m_iLastUseFrame = -1;
+
 	SetVisible( true );
 
 	CProjectableFactory::GetProjectableManager()->AddThinkTarget( this );
@@ -24,6 +31,7 @@ CVGUIProjectable::CVGUIProjectable() : BaseClass( NULL, "" )
 CVGUIProjectable::~CVGUIProjectable()
 {
 	CProjectableFactory::GetProjectableManager()->RemoveThinkTarget( this );
+	CDefCookieProjectable::GetTargetCache().Release( this );
 
 	delete [] m_pszControllableName;
 	delete [] m_pszParentName;
@@ -59,6 +67,8 @@ void CVGUIProjectable::PerformLayout()
 	BaseClass::PerformLayout();
 
 	SetBounds( 0, 0, PROJECTABLE_VGUI_RES, PROJECTABLE_VGUI_RES );
+
+	m_bDirty = true;
 }
 
 void CVGUIProjectable::LoadProjectableConfig( KeyValues *pKV )
@@ -75,6 +85,27 @@ void CVGUIProjectable::ApplyConfig( KeyValues *pKV )
 {
 	SetFgColor( pKV->GetColor( "fgcolor", Color( 255,255,255,255 ) ) );
 	SetBgColor( pKV->GetColor( "bgcolor", Color( 0,0,0,0 ) ) );
+
+	m_bAnimated = pKV->GetInt( "animated" ) != 0;
+	m_flRefreshRate = pKV->GetFloat( "refreshrate", deferred_projectable_refresh_rate.GetFloat() );
+
+	m_bDirty = true;
+}
+
+void CVGUIProjectable::Repaint()
+{
+	BaseClass::Repaint();
+
+	m_bDirty = true;
+}
+
+bool CVGUIProjectable::IsRefreshDue( float flTime ) const
+{
+	if ( !m_bDirty )
+		return false;
+
+	return m_flRefreshRate <= 0.0f ||
+		flTime - m_flLastPaintTime >= 1.0f / m_flRefreshRate;
 }
 
 void CVGUIProjectable::ApplySchemeSettings( vgui::IScheme *scheme )
@@ -129,4 +160,8 @@ void CVGUIProjectable::DrawSelfToRT( ITexture *pTarget, bool bClear )
 
 	pRenderContext->PopRenderTargetAndViewport();
 	render->PopView( frustum );
+
+	m_bDirty = false;
+	m_bRepaintGranted = false;
+	m_flLastPaintTime = gpGlobals->realtime;
 }
@@ -20,6 +20,23 @@ public:
 
 	virtual void DrawSelfToRT( ITexture *pTarget, bool bClear = true );
 
+	// painted content is outdated, set by Repaint, layout and config changes
+	virtual void Repaint();
+	FORCEINLINE bool IsDirty() const { return m_bDirty; };
+	// scripts built from generic child controls can't tell when they change
+	FORCEINLINE bool IsAnimated() const { return m_bAnimated; };
+
+	// dirty and the max refresh rate allows painting again
+	bool IsRefreshDue( float flTime ) const;
+	FORCEINLINE float GetLastPaintTime() const { return m_flLastPaintTime; };
+
+	// set by the projectable manager when the frame's repaint cap allows it
+	FORCEINLINE void SetRepaintGranted( bool bGranted ) { m_bRepaintGranted = bGranted; };
+	FORCEINLINE bool IsRepaintGranted() const { return m_bRepaintGranted; };
+
+	FORCEINLINE void MarkUsed() { m_iLastUseFrame = gpGlobals->framecount; };
+	FORCEINLINE int GetLastUseFrame() const { return m_iLastUseFrame; };
+
 protected:
 	virtual void PerformLayout();
 	virtual void ApplySchemeSettings( vgui::IScheme *scheme );
@@ -31,6 +48,13 @@ private:
 	char *m_pszParentName;
 
 	KeyValues *m_pConfig;
+
+	bool m_bDirty;
+	bool m_bAnimated;
+	bool m_bRepaintGranted;
+	float m_flRefreshRate;
+	float m_flLastPaintTime;
+	int m_iLastUseFrame;
 };
 
 
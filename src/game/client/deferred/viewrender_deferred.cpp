@@ -528,6 +528,8 @@ public:
 		return DEFERRED_SHADOW_MODE_PROJECTED;
 	};
 
+	static void		QueueShadowData( int index, const Vector &origin, const QAngle &angles );
+
 private:
 	def_light_t *m_pLight;
 	int m_iIndex;
@@ -659,6 +661,11 @@ CDeferredViewRender::CDeferredViewRender()
 {
 	m_pMesh_RadiosityScreenGrid[0] = NULL;
 	m_pMesh_RadiosityScreenGrid[1] = NULL;
+
+	m_vecRadiosityOrigin[0].Init();
+	m_vecRadiosityOrigin[1].Init();
+	m_iRadiosityUpdate[0] = CRadiosityGrid::UPDATE_NONE;
+	m_iRadiosityUpdate[1] = CRadiosityGrid::UPDATE_NONE;
 }
 
 void CDeferredViewRender::Init()
@@ -696,7 +703,7 @@ void CDeferredViewRender::LevelInit()
 {
 	BaseClass::LevelInit();
 
-	ResetCascadeDelay();
+	InvalidateCascades();
 }
 
 void CDeferredViewRender::LevelShutdown()
@@ -704,10 +711,12 @@ void CDeferredViewRender::LevelShutdown()
 	BaseClass::LevelShutdown();
 }
 
-void CDeferredViewRender::ResetCascadeDelay()
+void CDeferredViewRender::InvalidateCascades()
 {
-	for ( int i = 0; i < SHADOW_NUM_CASCADES; i++ )
-		m_flRenderDelay[i] = 0;
+	GetLightingManager()->GetShadowScheduler().Reset();
+
+	m_RadiosityGrid[0].Reset();
+	m_RadiosityGrid[1].Reset();
 }
 
 //-----------------------------------------------------------------------------
@@ -795,6 +804,8 @@ void CDeferredViewRender::ViewDrawSceneDeferred( const CViewSetup &view, int nCl
 void CDeferredViewRender::ViewDrawGBuffer( const CViewSetup &view, bool &bDrew3dSkybox, SkyboxVisibility_t &nSkyboxVisible,
 	bool bDrawViewModel )
 {
+	DEFPROF_SCOPE( DEFPROF_GBUFFER );
+
 	MDLCACHE_CRITICAL_SECTION();
 
 	int oldViewID = g_CurrentViewID;
@@ -822,6 +833,8 @@ void CDeferredViewRender::ViewDrawGBuffer( const CViewSetup &view, bool &bDrew3d
 void CDeferredViewRender::ViewDrawComposite( const CViewSetup &view, bool &bDrew3dSkybox, SkyboxVisibility_t &nSkyboxVisible,
 		int nClearFlags, view_id_t viewID, bool bDrawViewModel )
 {
+	DEFPROF_SCOPE( DEFPROF_COMPOSITE );
+
 	DrawSkyboxComposite( view, bDrew3dSkybox );
 
 	// this allows the refract texture to be updated once per *scene* on 360
@@ -865,6 +878,8 @@ void CDeferredViewRender::ViewCombineDeferredShading( const CViewSetup &view, vi
 {
 #if DEFCFG_DEFERRED_SHADING == 1
 
+	DEFPROF_SCOPE( DEFPROF_COMPOSITE );
+
 	DrawLightPassFullscreen( GetDeferredManager()->GetDeferredMaterial( DEF_MAT_SCREENSPACE_SHADING ),
 		view.width, view.height );
 
@@ -954,6 +969,8 @@ static lightData_Global_t GetActiveGlobalLightState()
 
 void CDeferredViewRender::PerformLighting( const CViewSetup &view )
 {
+	DEFPROF_SCOPE( DEFPROF_LIGHTING );
+
 	bool bResetLightAccum = false;
 	const bool bRadiosityEnabled = DEFCFG_ENABLE_RADIOSITY != 0 && deferred_radiosity_enable.GetBool();
 
@@ -1041,25 +1058,50 @@ static int GetSourceRadBufferIndex( const int index )
 	Assert( index == 0 || index == 1 );
 
 	const bool bFar = index == 1;
-	const int iNumSteps = bFar ? deferred_radiosity_propagate_count_far.GetInt() : deferred_radiosity_propagate_count.GetInt()
-		+ bFar ? deferred_radiosity_blur_count_far.GetInt() : deferred_radiosity_blur_count.GetInt();
+	const int iNumSteps = ( bFar ? deferred_radiosity_propagate_count_far.GetInt() : deferred_radiosity_propagate_count.GetInt() )
+		+ ( bFar ? deferred_radiosity_blur_count_far.GetInt() : deferred_radiosity_blur_count.GetInt() );
+
+	// the last step always lands in buffer 0
 	return ( iNumSteps % 2 == 0 ) ? 0 : 1;
 }
 
+static int GetRadiosityUpdateCost( const int index )
+{
+	const bool bFar = index == 1;
+
+	// injection, then one pass per step
+	return 1 + ( bFar ? deferred_radiosity_propagate_count_far.GetInt() : deferred_radiosity_propagate_count.GetInt() )
+		+ ( bFar ? deferred_radiosity_blur_count_far.GetInt() : deferred_radiosity_blur_count.GetInt() );
+}
+
+static void RadiosityRectToRect( const radiosityRect_t &rect, const int iOffsetY, Rect_t &out )
+{
+	out.x = rect.x0;
+	out.y = rect.y0 + iOffsetY;
+	out.width = rect.x1 - rect.x0;
+	out.height = rect.y1 - rect.y0;
+}
+
 void CDeferredViewRender::BeginRadiosity( const CViewSetup &view )
 {
+	DEFPROF_SCOPE( DEFPROF_RADIOSITY_BEGIN );
+
 	Vector fwd;
 	AngleVectors( view.angles, &fwd );
 
 	float flAmtVertical = abs( DotProduct( fwd, Vector( 0, 0, 1 ) ) );
 	flAmtVertical = RemapValClamped( flAmtVertical, 0, 1, 1, 0.5f );
 
+	static int iLastSourceBuffer[2] = { GetSourceRadBufferIndex( 0 ), GetSourceRadBufferIndex( 1 ) };
+
+	int iCell[2][3];
+	int iUpdateType[2];
+	float flUpdateTime[2];
+	int iUpdateCost[2];
+
 	for ( int iCascade = 0; iCascade < 2; iCascade++ )
 	{
 		const bool bFar = iCascade == 1;
-		const Vector gridSize( RADIOSITY_BUFFER_SAMPLES_XY, RADIOSITY_BUFFER_SAMPLES_XY,
-								RADIOSITY_BUFFER_SAMPLES_Z );
-		const Vector gridSizeHalf = gridSize / 2;
 		const float gridStepSize = bFar ? RADIOSITY_BUFFER_GRID_STEP_SIZE_FAR
 			: RADIOSITY_BUFFER_GRID_STEP_SIZE_CLOSE;
 		const float flGridDistance = bFar ? RADIOSITY_BUFFER_GRID_STEP_DISTANCEMULT_FAR
@@ -1068,16 +1110,56 @@ void CDeferredViewRender::BeginRadiosity( const CViewSetup &view )
 		Vector vecFwd;
 		AngleVectors( view.angles, &vecFwd );
 
-		m_vecRadiosityOrigin[iCascade] = view.origin
+		const Vector vecCenter = view.origin
 			+ vecFwd * gridStepSize * RADIOSITY_BUFFER_SAMPLES_XY * flGridDistance * flAmtVertical;
 
+		// snaps towards zero like fmod did
+		for ( int i = 0; i < 3; i++ )
+			iCell[iCascade][i] = (int)( vecCenter[i] / gridStepSize );
+
+		// steps changed parity, the chain starts from the other buffer
+		if ( iLastSourceBuffer[iCascade] != GetSourceRadBufferIndex( iCascade ) )
+			m_RadiosityGrid[iCascade].Reset();
+
+		iUpdateType[iCascade] = m_RadiosityGrid[iCascade].GetUpdateType( iCell[iCascade], gpGlobals->curtime,
+			deferred_radiosity_refresh_interval.GetFloat() );
+		flUpdateTime[iCascade] = m_RadiosityGrid[iCascade].GetUpdateTime();
+		iUpdateCost[iCascade] = GetRadiosityUpdateCost( iCascade );
+	}
+
+	bool bScheduled[2];
+	CRadiosityGrid::ScheduleUpdates( iUpdateType, flUpdateTime, iUpdateCost, 2,
+		deferred_radiosity_pass_budget.GetInt(), bScheduled );
+
+	for ( int iCascade = 0; iCascade < 2; iCascade++ )
+	{
+		// grids that wait keep their old origin, it still matches their cells
+		m_iRadiosityUpdate[iCascade] = bScheduled[iCascade] ? iUpdateType[iCascade] : CRadiosityGrid::UPDATE_NONE;
+
+		if ( m_iRadiosityUpdate[iCascade] == CRadiosityGrid::UPDATE_NONE )
+			continue;
+
+		const bool bFar = iCascade == 1;
+		const Vector gridSize( RADIOSITY_BUFFER_SAMPLES_XY, RADIOSITY_BUFFER_SAMPLES_XY,
+								RADIOSITY_BUFFER_SAMPLES_Z );
+		const Vector gridSizeHalf = gridSize / 2;
+		const float gridStepSize = bFar ? RADIOSITY_BUFFER_GRID_STEP_SIZE_FAR
+			: RADIOSITY_BUFFER_GRID_STEP_SIZE_CLOSE;
+
+		m_RadiosityGrid[iCascade].ApplyUpdate( m_iRadiosityUpdate[iCascade], iCell[iCascade], gpGlobals->curtime );
+
 		for ( int i = 0; i < 3; i++ )
-			m_vecRadiosityOrigin[iCascade][i] -= fmod( m_vecRadiosityOrigin[iCascade][i], gridStepSize );
+			m_vecRadiosityOrigin[iCascade][i] = iCell[iCascade][i] * gridStepSize;
 
 		m_vecRadiosityOrigin[iCascade] -= gridSizeHalf * gridStepSize;
 
+		if ( m_iRadiosityUpdate[iCascade] == CRadiosityGrid::UPDATE_SCROLL )
+		{
+			ScrollRadiosityBuffers( iCascade );
+			continue;
+		}
+
 		const int iSourceBuffer = GetSourceRadBufferIndex( iCascade );
-		static int iLastSourceBuffer[2] = { iSourceBuffer, GetSourceRadBufferIndex( 1 ) };
 
 		const int clearSizeY = RADIOSITY_BUFFER_RES_Y / 2;
 		const int clearOffset = (iCascade == 1) ? clearSizeY : 0;
@@ -1117,6 +1199,94 @@ void CDeferredViewRender::BeginRadiosity( const CViewSetup &view )
 	UpdateRadiosityPosition();
 }
 
+void CDeferredViewRender::ScrollRadiosityBuffers( const int iRadiosityCascade )
+{
+	const CRadiosityGrid &grid = m_RadiosityGrid[iRadiosityCascade];
+	const int iOffsetY = (iRadiosityCascade == 1) ? RADIOSITY_BUFFER_RES_Y/2 : 0;
+
+	radiosityRect_t viewport;
+	viewport.x0 = viewport.y0 = 0;
+	viewport.x1 = viewport.y1 = RADIOSITY_GRID_VIEWPORT_SIZE;
+
+	Rect_t rectViewport;
+	RadiosityRectToRect( viewport, iOffsetY, rectViewport );
+
+	CMatRenderContextPtr pRenderContext( materials );
+
+	// kept cells move through buffer 1, afterwards both buffers match so the
+	// steps can ping pong within the exposed rects
+	for ( int iTarget = 0; iTarget < 2; iTarget++ )
+	{
+		ITexture *pFinal = iTarget ? GetDefRT_RadiosityNormal( 0 ) : GetDefRT_RadiosityBuffer( 0 );
+		ITexture *pOther = iTarget ? GetDefRT_RadiosityNormal( 1 ) : GetDefRT_RadiosityBuffer( 1 );
+
+		pRenderContext->PushRenderTargetAndViewport( pFinal );
+
+		for ( int i = 0; i < grid.GetNumCopies(); i++ )
+		{
+			Rect_t rectSrc, rectDst;
+			RadiosityRectToRect( grid.GetCopySrc( i ), iOffsetY, rectSrc );
+			RadiosityRectToRect( grid.GetCopyDst( i ), iOffsetY, rectDst );
+
+			pRenderContext->CopyRenderTargetToTextureEx( pOther, 0, &rectSrc, &rectDst );
+		}
+
+		pRenderContext->PopRenderTargetAndViewport();
+
+		pRenderContext->PushRenderTargetAndViewport( pOther );
+		pRenderContext->CopyRenderTargetToTextureEx( pFinal, 0, &rectViewport, &rectViewport );
+		pRenderContext->PopRenderTargetAndViewport();
+	}
+
+	// new cells start out empty like a full update, in case nothing gets injected
+	const int iSourceBuffer = GetSourceRadBufferIndex( iRadiosityCascade );
+
+	for ( int i = 0; i < grid.GetNumExposedRects(); i++ )
+	{
+		Rect_t rect;
+		RadiosityRectToRect( grid.GetExposedRect( i ), iOffsetY, rect );
+
+		pRenderContext->PushRenderTargetAndViewport( GetDefRT_RadiosityBuffer( iSourceBuffer ), NULL,
+			rect.x, rect.y, rect.width, rect.height );
+		pRenderContext->ClearColor3ub( 0, 0, 0 );
+		pRenderContext->ClearBuffers( true, false );
+		pRenderContext->PopRenderTargetAndViewport();
+
+		pRenderContext->PushRenderTargetAndViewport( GetDefRT_RadiosityNormal( iSourceBuffer ), NULL,
+			rect.x, rect.y, rect.width, rect.height );
+		pRenderContext->ClearColor3ub( 127, 127, 127 );
+		pRenderContext->ClearBuffers( true, false );
+		pRenderContext->PopRenderTargetAndViewport();
+	}
+}
+
+void CDeferredViewRender::DrawRadiosityGrid( const int iRadiosityCascade )
+{
+	IMesh *pGrid = GetRadiosityScreenGrid( iRadiosityCascade );
+
+	if ( m_iRadiosityUpdate[iRadiosityCascade] != CRadiosityGrid::UPDATE_SCROLL )
+	{
+		pGrid->Draw();
+		return;
+	}
+
+	// scrolled grids only draw the cells that came into view
+	const CRadiosityGrid &grid = m_RadiosityGrid[iRadiosityCascade];
+	const int iOffsetY = (iRadiosityCascade == 1) ? RADIOSITY_BUFFER_RES_Y/2 : 0;
+
+	CMatRenderContextPtr pRenderContext( materials );
+
+	for ( int i = 0; i < grid.GetNumExposedRects(); i++ )
+	{
+		const radiosityRect_t &rect = grid.GetExposedRect( i );
+
+		pRenderContext->SetScissorRect( rect.x0, rect.y0 + iOffsetY, rect.x1, rect.y1 + iOffsetY, true );
+		pGrid->Draw();
+	}
+
+	pRenderContext->SetScissorRect( 0, 0, 0, 0, false );
+}
+
 void CDeferredViewRender::UpdateRadiosityPosition()
 {
 	struct defData_setupRadiosity
@@ -1139,6 +1309,9 @@ void CDeferredViewRender::UpdateRadiosityPosition()
 
 void CDeferredViewRender::PerformRadiosityGlobal( const int iRadiosityCascade, const CViewSetup &view )
 {
+	if ( m_iRadiosityUpdate[iRadiosityCascade] == CRadiosityGrid::UPDATE_NONE )
+		return;
+
 	const int iSourceBuffer = GetSourceRadBufferIndex( iRadiosityCascade );
 	const int iOffsetY = (iRadiosityCascade == 1) ? RADIOSITY_BUFFER_RES_Y/2 : 0;
 
@@ -1150,7 +1323,7 @@ void CDeferredViewRender::PerformRadiosityGlobal( const int iRadiosityCascade, c
 	pRenderContext->SetRenderTargetEx( 1, GetDefRT_RadiosityNormal( iSourceBuffer ) );
 
 	pRenderContext->Bind( GetDeferredManager()->GetDeferredMaterial( DEF_MAT_LIGHT_RADIOSITY_GLOBAL ) );
-	GetRadiosityScreenGrid( iRadiosityCascade )->Draw();
+	DrawRadiosityGrid( iRadiosityCascade );
 
 	pRenderContext->PopRenderTargetAndViewport();
 }
@@ -1172,8 +1345,13 @@ void CDeferredViewRender::EndRadiosity( const CViewSetup &view )
 		GetDeferredManager()->GetDeferredMaterial( DEF_MAT_LIGHT_RADIOSITY_BLUR_1 ),
 	};
 
+	GetDeferredProfiler()->BeginPass( DEFPROF_RADIOSITY_PROPAGATE );
+
 	for ( int iCascade = 0; iCascade < 2; iCascade++ )
 	{
+		if ( m_iRadiosityUpdate[iCascade] == CRadiosityGrid::UPDATE_NONE )
+			continue;
+
 		bool bSecondDestBuffer = GetSourceRadBufferIndex( iCascade ) == 0;
 		const int iOffsetY = (iCascade==1) ? RADIOSITY_BUFFER_RES_Y / 2 : 0;
 
@@ -1187,7 +1365,7 @@ void CDeferredViewRender::EndRadiosity( const CViewSetup &view )
 
 			pRenderContext->Bind( pPropagateMat[ 1 - index ] );
 
-			GetRadiosityScreenGrid( iCascade )->Draw();
+			DrawRadiosityGrid( iCascade );
 
 			pRenderContext->PopRenderTargetAndViewport();
 			bSecondDestBuffer = !bSecondDestBuffer;
@@ -1203,14 +1381,18 @@ void CDeferredViewRender::EndRadiosity( const CViewSetup &view )
 
 			pRenderContext->Bind( pBlurMat[ 1 - index ] );
 
-			GetRadiosityScreenGrid( iCascade )->Draw();
+			DrawRadiosityGrid( iCascade );
 
 			pRenderContext->PopRenderTargetAndViewport();
 			bSecondDestBuffer = !bSecondDestBuffer;
 		}
 	}
 
+	GetDeferredProfiler()->EndPass( DEFPROF_RADIOSITY_PROPAGATE );
+
 #if ( DEFCFG_DEFERRED_SHADING == 0 )
+	DEFPROF_SCOPE( DEFPROF_RADIOSITY_END );
+
 	DrawLightPassFullscreen( GetDeferredManager()->GetDeferredMaterial( DEF_MAT_LIGHT_RADIOSITY_BLEND ),
 		view.width, view.height );
 #endif
@@ -1362,16 +1544,32 @@ void CDeferredViewRender::DebugRadiosity( const CViewSetup &view )
 	}
 }
 
+void CDeferredViewRender::BeginShadowFrame( const CViewSetup &view )
+{
+	const lightData_Global_t state = GetActiveGlobalLightState();
+	bool bShadowedGlobal = GetGlobalLight() != NULL && state.bEnabled && state.bShadow;
+
+	if ( !GetLightingEditor()->IsEditorLightingActive() &&
+		deferred_override_globalLight_enable.GetBool() )
+		bShadowedGlobal = GetGlobalLight() != NULL && deferred_override_globalLight_shadow_enable.GetBool();
+
+	// cascades reserve their views before the local lights are scheduled
+	GetLightingManager()->GetShadowScheduler().BeginFrame( view, state.vecLight.AsVector3D(), bShadowedGlobal );
+}
+
 void CDeferredViewRender::RenderCascadedShadows( const CViewSetup &view, const bool bEnableRadiosity )
 {
-	for ( int i = 0; i < SHADOW_NUM_CASCADES; i++ )
+	DEFPROF_SCOPE( DEFPROF_CASCADES );
+
+	CShadowScheduler &shadowScheduler = GetLightingManager()->GetShadowScheduler();
+
+	for ( int i = 0; i < GetCascadeConfig()->GetNumCascades(); i++ )
 	{
 		const cascade_t &cascade = GetCascadeInfo(i);
 		const bool bDoRadiosity = bEnableRadiosity && cascade.bOutputRadiosityData;
 		const int iRadTarget = cascade.iRadiosityCascadeTarget;
 
-		float delta = m_flRenderDelay[i] - gpGlobals->curtime;
-		if ( delta > 0.0f && delta < 1.0f )
+		if ( !shadowScheduler.ShouldUpdateCascade( i ) )
 		{
 			if ( bDoRadiosity )
 				PerformRadiosityGlobal( iRadTarget, view );
@@ -1379,7 +1577,7 @@ void CDeferredViewRender::RenderCascadedShadows( const CViewSetup &view, const b
 			continue;
 		}
 
-		m_flRenderDelay[i] = gpGlobals->curtime + cascade.flUpdateDelay;
+		shadowScheduler.OnCascadeUpdated( i );
 
 #if CSM_USE_COMPOSITED_TARGET == 0
 		int textureIndex = i;
@@ -1402,8 +1600,48 @@ void CDeferredViewRender::RenderCascadedShadows( const CViewSetup &view, const b
 	}
 }
 
+#if DEFCFG_SHADOW_CACHE
+static void CopyShadowTarget( ITexture *pSrc, ITexture *pDst )
+{
+	CMatRenderContextPtr pRenderContext( materials );
+	pRenderContext->PushRenderTargetAndViewport( pSrc );
+	pRenderContext->CopyRenderTargetToTextureEx( pDst, 0, NULL, NULL );
+	pRenderContext->PopRenderTargetAndViewport();
+}
+#endif
+
 void CDeferredViewRender::DrawLightShadowView( const CViewSetup &view, int iDesiredShadowmap, def_light_t *l )
 {
+	DEFPROF_SCOPE( DEFPROF_SHADOWVIEWS );
+
+#if DEFCFG_SHADOW_CACHE
+	CShadowCache &shadowCache = GetLightingManager()->GetShadowCache();
+	const bool bCacheable = shadowCache.IsCacheable( l );
+	const int iShadowRes = l->IsPoint() ? GetShadowResolution_Point() : GetShadowResolution_Spot();
+
+	if ( bCacheable )
+	{
+		int iEntry = shadowCache.FindValidEntry( l, iShadowRes );
+
+		// out of shadow views, an old map beats none
+		if ( iEntry < 0 && l->IsShadowStale() )
+			iEntry = shadowCache.FindStaleEntry( l, iShadowRes );
+
+		if ( iEntry >= 0 )
+		{
+			if ( l->IsPoint() )
+				CopyShadowTarget( GetShadowCacheRT_DP( iEntry ), GetShadowColorRT_DP( iDesiredShadowmap ) );
+			else
+			{
+				CopyShadowTarget( GetShadowCacheRT_Proj( iEntry ), GetShadowColorRT_Proj( iDesiredShadowmap ) );
+				CSpotLightShadowView::QueueShadowData( iDesiredShadowmap, l->pos, l->ang );
+			}
+
+			return;
+		}
+	}
+#endif
+
 	CViewSetup setup;
 	setup.origin = l->pos;
 	setup.angles = l->ang;
@@ -1421,12 +1659,15 @@ void CDeferredViewRender::DrawLightShadowView( const CViewSetup &view, int iDesi
 		break;
 	case DEFLIGHTTYPE_POINT:
 		{
+			ITexture *pDepth = GetShadowDepthRT_DP( iDesiredShadowmap );
+			ITexture *pColor = GetShadowColorRT_DP( iDesiredShadowmap );
+
 			CRefPtr<CDualParaboloidShadowView> pDPView0 = new CDualParaboloidShadowView( this, l, false );
-			pDPView0->Setup( setup, GetShadowDepthRT_DP( iDesiredShadowmap ), GetShadowColorRT_DP( iDesiredShadowmap ) );
+			pDPView0->Setup( setup, pDepth, pColor );
 			AddViewToScene( pDPView0 );
 
 			CRefPtr<CDualParaboloidShadowView> pDPView1 = new CDualParaboloidShadowView( this, l, true );
-			pDPView1->Setup( setup, GetShadowDepthRT_DP( iDesiredShadowmap ), GetShadowColorRT_DP( iDesiredShadowmap ) );
+			pDPView1->Setup( setup, pDepth, pColor );
 			AddViewToScene( pDPView1 );
 		}
 		break;
@@ -1439,6 +1680,21 @@ void CDeferredViewRender::DrawLightShadowView( const CViewSetup &view, int iDesi
 		}
 		break;
 	}
+
+#if DEFCFG_SHADOW_CACHE
+	if ( bCacheable )
+	{
+		const int iEntry = shadowCache.AcquireEntry( l, iShadowRes );
+
+		if ( iEntry >= 0 )
+		{
+			if ( l->IsPoint() )
+				CopyShadowTarget( GetShadowColorRT_DP( iDesiredShadowmap ), GetShadowCacheRT_DP( iEntry ) );
+			else
+				CopyShadowTarget( GetShadowColorRT_Proj( iDesiredShadowmap ), GetShadowCacheRT_Proj( iEntry ) );
+		}
+	}
+#endif
 }
 
 void CDeferredViewRender::DrawViewModels( const CViewSetup &view, bool drawViewmodel, bool bGBuffer )
@@ -1621,6 +1877,7 @@ void CDeferredViewRender::RenderView( const CViewSetup &view, const CViewSetup &
 		g_pClientShadowMgr->UpdateSplitscreenLocalPlayerShadowSkip();
 
 		ProcessDeferredGlobals( worldView );
+		BeginShadowFrame( worldView );
 		GetLightingManager()->LightSetup( worldView );
 
 		PreViewDrawScene( worldView );
@@ -3566,7 +3823,8 @@ void CBaseShadowView::SetRadiosityOutputEnabled( bool bEnabled )
 
 void COrthoShadowView::CalcShadowView()
 {
-	const cascade_t &m_data = GetCascadeInfo( iCascadeIndex );
+	const CCascadeConfig *pConfig = GetCascadeConfig();
+	const cascade_t &m_data = pConfig->GetCascade( iCascadeIndex );
 	Vector mainFwd;
 	AngleVectors( angles, &mainFwd );
 
@@ -3577,12 +3835,35 @@ void COrthoShadowView::CalcShadowView()
 	Vector viewFwd, viewRight, viewUp;
 	AngleVectors( lightAng, &viewFwd, &viewRight, &viewUp );
 
-	const float halfOrthoSize = m_data.flProjectionSize * 0.5f;
+	float flProjectionSize = m_data.flProjectionSize;
+	float flFarZ = m_data.flFarZ;
+	const bool bFitToSlice = pConfig->GetSplitScheme() != CSM_SPLIT_FIXED;
 
-	origin += -viewFwd * m_data.flOriginOffset +
-		viewUp * halfOrthoSize -
-		viewRight * halfOrthoSize +
-		mainFwd * halfOrthoSize;
+	if ( bFitToSlice )
+	{
+		float flSplits[ CSM_MAX_CASCADES + 1 ];
+		pConfig->CalcSplits( zNear, flSplits );
+
+		const float flAspectRatio = ( m_flAspectRatio > 0.0f ) ? m_flAspectRatio : width / (float)MAX( 1, height );
+
+		cascadeFit_t fit;
+		CCascadeConfig::CalcFit( m_data, origin, angles, fov, flAspectRatio,
+			flSplits[ iCascadeIndex ], flSplits[ iCascadeIndex + 1 ], lightAng, fit );
+
+		// already snapped to texels
+		origin = fit.vecOrigin;
+		flProjectionSize = fit.flProjectionSize;
+		flFarZ = fit.flFarZ;
+	}
+	else
+	{
+		const float halfOrthoSize = flProjectionSize * 0.5f;
+
+		origin += -viewFwd * m_data.flOriginOffset +
+			viewUp * halfOrthoSize -
+			viewRight * halfOrthoSize +
+			mainFwd * halfOrthoSize;
+	}
 
 	angles = lightAng;
 
@@ -3593,17 +3874,20 @@ void COrthoShadowView::CalcShadowView()
 
 	m_bOrtho = true;
 	m_OrthoLeft = 0;
-	m_OrthoTop = -m_data.flProjectionSize;
-	m_OrthoRight = m_data.flProjectionSize;
+	m_OrthoTop = -flProjectionSize;
+	m_OrthoRight = flProjectionSize;
 	m_OrthoBottom = 0;
 
 	zNear = zNearViewmodel = 0;
-	zFar = zFarViewmodel = m_data.flFarZ;
+	zFar = zFarViewmodel = flFarZ;
 	m_flAspectRatio = 0;
 
-	float mapping_world = m_data.flProjectionSize / m_data.iResolution;
-	origin -= fmod( DotProduct( viewRight, origin ), mapping_world ) * viewRight;
-	origin -= fmod( DotProduct( viewUp, origin ), mapping_world ) * viewUp;
+	if ( !bFitToSlice )
+	{
+		float mapping_world = flProjectionSize / m_data.iResolution;
+		origin -= fmod( DotProduct( viewRight, origin ), mapping_world ) * viewRight;
+		origin -= fmod( DotProduct( viewUp, origin ), mapping_world ) * viewUp;
+	}
 
 	origin -= fmod( DotProduct( viewFwd, origin ), GetDepthMapDepthResolution( zFar - zNear ) ) * viewFwd;
 
@@ -3739,6 +4023,14 @@ void CSpotLightShadowView::CalcShadowView()
 }
 
 void CSpotLightShadowView::CommitData()
+{
+	QueueShadowData( m_iIndex, origin, angles );
+
+	CMatRenderContextPtr pRenderContext( materials );
+	pRenderContext->SetIntRenderingParameter( INT_RENDERPARM_DEFERRED_SHADOW_INDEX, m_iIndex );
+}
+
+void CSpotLightShadowView::QueueShadowData( int index, const Vector &origin, const QAngle &angles )
 {
 	struct sendShadowDataProj
 	{
@@ -3755,7 +4047,7 @@ void CSpotLightShadowView::CommitData()
 	AngleVectors( angles, &fwd );
 
 	sendShadowDataProj data;
-	data.index = m_iIndex;
+	data.index = index;
 	data.data.vecForward.Init( fwd );
 	data.data.vecOrigin.Init( origin );
 	// slope min, slope max, normal max, depth
@@ -3763,8 +4055,5 @@ void CSpotLightShadowView::CommitData()
 	data.data.vecSlopeSettings.Init( 0.001f, 0.005f, 3, 0 );
 
 	QUEUE_FIRE( sendShadowDataProj, Fire, data );
-
-	CMatRenderContextPtr pRenderContext( materials );
-	pRenderContext->SetIntRenderingParameter( INT_RENDERPARM_DEFERRED_SHADOW_INDEX, m_iIndex );
 }
 
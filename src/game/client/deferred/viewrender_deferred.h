@@ -24,7 +24,7 @@ public:
 	void			LevelInit( void );
 	void			LevelShutdown( void );
 
-	void			ResetCascadeDelay();
+	void			InvalidateCascades();
 
 	void			ViewDrawSceneDeferred( const CViewSetup &view, int nClearFlags, view_id_t viewID,
 		bool bDrawViewModel );
@@ -55,18 +55,21 @@ private:
 
 	void BeginRadiosity( const CViewSetup &view );
 	void UpdateRadiosityPosition();
+	void ScrollRadiosityBuffers( const int iRadiosityCascade );
+	void DrawRadiosityGrid( const int iRadiosityCascade );
 	void PerformRadiosityGlobal( const int iRadiosityCascade, const CViewSetup &view );
 	void EndRadiosity( const CViewSetup &view );
 	void DebugRadiosity( const CViewSetup &view );
 
+	void BeginShadowFrame( const CViewSetup &view );
 	void RenderCascadedShadows( const CViewSetup &view, const bool bEnableRadiosity );
 
-	float m_flRenderDelay[SHADOW_NUM_CASCADES];
-
 	IMesh *GetRadiosityScreenGrid( const int iCascade );
 	IMesh *CreateRadiosityScreenGrid( const Vector2D &vecViewportBase, const float flWorldStepSize );
 
 	Vector m_vecRadiosityOrigin[2];
+	CRadiosityGrid m_RadiosityGrid[2];
+	int m_iRadiosityUpdate[2];
 	IMesh *m_pMesh_RadiosityScreenGrid[2];
 	CUtlVector< IMesh* > m_hRadiosityDebugMeshList[2];
 };
@@ -1380,6 +1380,8 @@ public:
 	//---------------------------------
 	
 	virtual bool		IsUnusableNode(int iNodeID, CAI_Hint *pHint); // Override for special NPC behavior
+	virtual bool		UsesSharedRoutes()			{ return false; } // Node routes come from g_AI_PathRequestManager
+	virtual bool		FindRouteParents( int startID, int goalID, int **ppParents ) { return false; } // Node routes the NPC looks up without a search
 	virtual bool		ValidateNavGoal();
 	virtual bool		IsCurTaskContinuousMove();
 	virtual bool		IsValidMoveAwayDest( const Vector &vecDest )	{ return true; }
@@ -0,0 +1,586 @@
+//=============================================================================//
+//
+// Purpose: Flow fields over a snapshot of the node graph
+//
+//=============================================================================//
+
+#include "cbase.h"
+
+#include "ai_flowfield.h"
+
+#include "ai_basenpc.h"
+#include "ai_pathfinder.h"
+#include "ai_network.h"
+#include "ai_node.h"
+#include "ai_link.h"
+#include "filesystem.h"
+#include "tier0/fasttimer.h"
+#include "tier1/utlbuffer.h"
+#include "vstdlib/random.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+//-----------------------------------------------------------------------------
+
+CAI_FlowGraph::CAI_FlowGraph()
+ :	m_nBuiltNodes( 0 )
+{
+}
+
+//-----------------------------------------------------------------------------
+
+void CAI_FlowGraph::Purge()
+{
+	m_nBuiltNodes = 0;
+	m_Positions.Purge();
+	m_FirstEdge.Purge();
+	m_EdgeFrom.Purge();
+	m_EdgeCost.Purge();
+}
+
+//-----------------------------------------------------------------------------
+
+// routes can't pass through nodes the NPC can't use, so nothing links into them
+float CAI_FlowGraph::GetLinkCost( CAI_Node *pNode, int nodeID, int link, CAI_Pathfinder *pPathfinder ) const
+{
+	if ( pPathfinder->GetOuter()->IsUnusableNode( nodeID, pNode->GetHint() ) )
+		return FLT_MAX;
+
+	CAI_Link *pLink = pNode->GetLinkByIndex( link );
+	return pPathfinder->GetLinkCost( pLink, pLink->DestNodeID( nodeID ) );
+}
+
+//-----------------------------------------------------------------------------
+
+void CAI_FlowGraph::Build( CAI_Network *pNetwork, CAI_Pathfinder *pPathfinder )
+{
+	BeginBuild( pNetwork, pPathfinder );
+	BuildNodes( pNetwork, pPathfinder, INT_MAX );
+}
+
+//-----------------------------------------------------------------------------
+
+void CAI_FlowGraph::BeginBuild( CAI_Network *pNetwork, CAI_Pathfinder *pPathfinder )
+{
+	Purge();
+
+	int nNodes = pNetwork->NumNodes();
+	CAI_Node **pAInode = pNetwork->AccessNodes();
+	Hull_t hull = pPathfinder->GetHullType();
+
+	m_Positions.SetCount( nNodes );
+	m_FirstEdge.SetCount( nNodes + 1 );
+
+	for ( int nodeID = 0; nodeID < nNodes; nodeID++ )
+		m_Positions[nodeID] = pAInode[nodeID]->GetPosition( hull );
+
+	m_FirstEdge[0] = 0;
+}
+
+//-----------------------------------------------------------------------------
+
+bool CAI_FlowGraph::BuildNodes( CAI_Network *pNetwork, CAI_Pathfinder *pPathfinder, int nNodes )
+{
+	Assert( pNetwork->NumNodes() == NumNodes() );
+
+	CAI_Node **pAInode = pNetwork->AccessNodes();
+	int iLastNode = ( nNodes >= NumNodes() - m_nBuiltNodes ) ? NumNodes() : m_nBuiltNodes + nNodes;
+
+	for ( int nodeID = m_nBuiltNodes; nodeID < iLastNode; nodeID++ )
+	{
+		CAI_Node *pNode = pAInode[nodeID];
+
+		for ( int link = 0; link < pNode->NumLinks(); link++ )
+		{
+			m_EdgeFrom.AddToTail( pNode->GetLinkByIndex( link )->DestNodeID( nodeID ) );
+			m_EdgeCost.AddToTail( GetLinkCost( pNode, nodeID, link, pPathfinder ) );
+		}
+
+		m_FirstEdge[nodeID + 1] = m_EdgeFrom.Count();
+	}
+
+	m_nBuiltNodes = iLastNode;
+	return IsBuilt();
+}
+
+//-----------------------------------------------------------------------------
+
+bool CAI_FlowGraph::Refresh( CAI_Network *pNetwork, CAI_Pathfinder *pPathfinder, int iFirstNode, int nNodes )
+{
+	Assert( pNetwork->NumNodes() == NumNodes() && IsBuilt() );
+
+	CAI_Node **pAInode = pNetwork->AccessNodes();
+	int iLastNode = MIN( iFirstNode + nNodes, NumNodes() );
+	bool bChanged = false;
+
+	for ( int nodeID = iFirstNode; nodeID < iLastNode; nodeID++ )
+	{
+		CAI_Node *pNode = pAInode[nodeID];
+		int iEdge = FirstEdge( nodeID );
+
+		Assert( pNode->NumLinks() == LastEdge( nodeID ) - iEdge );
+
+		for ( int link = 0; link < pNode->NumLinks(); link++, iEdge++ )
+		{
+			float cost = GetLinkCost( pNode, nodeID, link, pPathfinder );
+
+			if ( cost != m_EdgeCost[iEdge] )
+			{
+				m_EdgeCost[iEdge] = cost;
+				bChanged = true;
+			}
+		}
+	}
+
+	return bChanged;
+}
+
+//-----------------------------------------------------------------------------
+
+void CAI_FlowGraph::BuildGrid( int nSide, float flSpacing, int iSeed )
+{
+	Purge();
+
+	CUniformRandomStream rnd;
+	rnd.SetSeed( iSeed );
+
+	int nNodes = nSide * nSide;
+
+	m_Positions.SetCount( nNodes );
+	m_FirstEdge.SetCount( nNodes + 1 );
+
+	for ( int nodeID = 0; nodeID < nNodes; nodeID++ )
+		m_Positions[nodeID].Init( ( nodeID % nSide ) * flSpacing, ( nodeID / nSide ) * flSpacing, 0 );
+
+	static const int s_Offsets[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+
+	for ( int nodeID = 0; nodeID < nNodes; nodeID++ )
+	{
+		int x = nodeID % nSide;
+		int y = nodeID / nSide;
+
+		m_FirstEdge[nodeID] = m_EdgeFrom.Count();
+
+		for ( int i = 0; i < 4; i++ )
+		{
+			int fromX = x + s_Offsets[i][0];
+			int fromY = y + s_Offsets[i][1];
+
+			if ( fromX < 0 || fromX >= nSide || fromY < 0 || fromY >= nSide )
+				continue;
+
+			// never cheaper than the distance, so the bench's A* heuristic holds
+			m_EdgeFrom.AddToTail( fromY * nSide + fromX );
+			m_EdgeCost.AddToTail( ( rnd.RandomFloat() < 0.15f ) ? FLT_MAX : flSpacing * rnd.RandomFloat( 1.0f, 1.5f ) );
+		}
+	}
+
+	m_FirstEdge[nNodes] = m_EdgeFrom.Count();
+	m_nBuiltNodes = nNodes;
+}
+
+//-----------------------------------------------------------------------------
+
+void CAI_FlowGraph::Write( CUtlBuffer &buf ) const
+{
+	buf.PutInt( AI_FLOWGRAPH_VERSION );
+	buf.PutInt( NumNodes() );
+	buf.PutInt( NumEdges() );
+
+	for ( int i = 0; i < NumNodes(); i++ )
+	{
+		buf.PutFloat( m_Positions[i].x );
+		buf.PutFloat( m_Positions[i].y );
+		buf.PutFloat( m_Positions[i].z );
+		buf.PutInt( m_FirstEdge[i] );
+	}
+
+	for ( int i = 0; i < NumEdges(); i++ )
+	{
+		buf.PutInt( m_EdgeFrom[i] );
+		buf.PutFloat( m_EdgeCost[i] );
+	}
+}
+
+//-----------------------------------------------------------------------------
+
+bool CAI_FlowGraph::Read( CUtlBuffer &buf )
+{
+	Purge();
+
+	if ( buf.GetInt() != AI_FLOWGRAPH_VERSION )
+		return false;
+
+	int nNodes = buf.GetInt();
+	int nEdges = buf.GetInt();
+
+	if ( !buf.IsValid() || nNodes < 0 || nEdges < 0 )
+		return false;
+
+	m_Positions.EnsureCapacity( nNodes );
+	m_FirstEdge.EnsureCapacity( nNodes + 1 );
+
+	for ( int i = 0; i < nNodes && buf.IsValid(); i++ )
+	{
+		Vector &vecPos = m_Positions[m_Positions.AddToTail()];
+
+		vecPos.x = buf.GetFloat();
+		vecPos.y = buf.GetFloat();
+		vecPos.z = buf.GetFloat();
+
+		int iFirstEdge = buf.GetInt();
+
+		if ( iFirstEdge < ( i ? m_FirstEdge[i - 1] : 0 ) || iFirstEdge > nEdges )
+		{
+			Purge();
+			return false;
+		}
+
+		m_FirstEdge.AddToTail( iFirstEdge );
+	}
+
+	m_FirstEdge.AddToTail( nEdges );
+
+	m_EdgeFrom.EnsureCapacity( nEdges );
+	m_EdgeCost.EnsureCapacity( nEdges );
+
+	for ( int i = 0; i < nEdges && buf.IsValid(); i++ )
+	{
+		int fromID = buf.GetInt();
+		float cost = buf.GetFloat();
+
+		if ( fromID < 0 || fromID >= nNodes || !( cost >= 0 ) )
+		{
+			Purge();
+			return false;
+		}
+
+		m_EdgeFrom.AddToTail( fromID );
+		m_EdgeCost.AddToTail( cost );
+	}
+
+	if ( !buf.IsValid() )
+	{
+		Purge();
+		return false;
+	}
+
+	m_nBuiltNodes = nNodes;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+bool CAI_FlowGraph::Save( const char *pszFileName ) const
+{
+	CUtlBuffer buf;
+	Write( buf );
+
+	return g_pFullFileSystem->WriteFile( pszFileName, "MOD", buf );
+}
+
+//-----------------------------------------------------------------------------
+
+bool CAI_FlowGraph::Load( const char *pszFileName )
+{
+	Purge();
+
+	CUtlBuffer buf;
+
+	if ( !g_pFullFileSystem->ReadFile( pszFileName, "MOD", buf ) )
+		return false;
+
+	return Read( buf );
+}
+
+//-----------------------------------------------------------------------------
+
+CAI_FlowField::CAI_FlowField()
+ :	m_goalID( NO_NODE ),
+	m_nNodes( 0 ),
+	m_bDone( false )
+{
+}
+
+//-----------------------------------------------------------------------------
+
+void CAI_FlowField::Begin( const CAI_FlowGraph &graph, int goalID )
+{
+	m_goalID = goalID;
+	m_nNodes = graph.NumNodes();
+	m_bDone = false;
+
+	m_Search.Begin( m_nNodes );
+
+	if ( goalID >= 0 && goalID < m_nNodes )
+		m_Search.Visit( goalID, NO_NODE, 0, 0 );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Dijkstra outward from the goal over the links into each node
+//-----------------------------------------------------------------------------
+
+bool CAI_FlowField::Grow( const CAI_FlowGraph &graph, int nMaxNodes )
+{
+	Assert( graph.NumNodes() == m_nNodes );
+
+	for ( int i = 0; i < nMaxNodes && !m_Search.IsEmpty(); i++ )
+	{
+		int nodeID = m_Search.PopSmallest();
+		float g = m_Search.GetCost( nodeID );
+
+		for ( int iEdge = graph.FirstEdge( nodeID ); iEdge < graph.LastEdge( nodeID ); iEdge++ )
+		{
+			float cost = graph.GetEdgeCost( iEdge );
+
+			if ( cost == FLT_MAX )
+				continue;
+
+			int fromID = graph.GetEdgeFrom( iEdge );
+			float new_g = g + cost;
+
+			if ( !m_Search.IsVisited( fromID ) || new_g < m_Search.GetCost( fromID ) )
+				m_Search.Visit( fromID, nodeID, new_g, new_g );
+		}
+	}
+
+	m_bDone = m_Search.IsEmpty();
+	return m_bDone;
+}
+
+//-----------------------------------------------------------------------------
+
+void CAI_FlowField::Purge()
+{
+	m_Search.Purge();
+	m_goalID = NO_NODE;
+	m_nNodes = 0;
+	m_bDone = false;
+}
+
+//-----------------------------------------------------------------------------
+
+bool CAI_FlowField::GetRouteParents( int startID, CUtlVector<int> &parents ) const
+{
+	if ( !IsReached( startID ) )
+		return false;
+
+	if ( parents.Count() < m_nNodes )
+		parents.SetCount( m_nNodes );
+
+	// the field leads toward the goal, turn the chain around to lead back to the start
+	const int *pTowardGoal = m_Search.GetParents();
+	int prevID = NO_NODE;
+
+	for ( int nodeID = startID; nodeID != NO_NODE; nodeID = pTowardGoal[nodeID] )
+	{
+		parents[nodeID] = prevID;
+		prevID = nodeID;
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: A* from the goal over the links into each node, as a per NPC search
+//			would cost the same route. Returns FLT_MAX if startID can't be reached
+//-----------------------------------------------------------------------------
+
+static float FlowGraphAStar( const CAI_FlowGraph &graph, CAI_OpenList &search, int startID, int goalID )
+{
+	const Vector &vecStart = graph.GetPosition( startID );
+
+	search.Begin( graph.NumNodes() );
+	search.Visit( goalID, NO_NODE, 0, graph.GetPosition( goalID ).DistTo( vecStart ) );
+
+	while ( !search.IsEmpty() )
+	{
+		int nodeID = search.PopSmallest();
+		float g = search.GetCost( nodeID );
+
+		if ( nodeID == startID )
+			return g;
+
+		for ( int iEdge = graph.FirstEdge( nodeID ); iEdge < graph.LastEdge( nodeID ); iEdge++ )
+		{
+			float cost = graph.GetEdgeCost( iEdge );
+
+			if ( cost == FLT_MAX )
+				continue;
+
+			int fromID = graph.GetEdgeFrom( iEdge );
+			float new_g = g + cost;
+
+			if ( !search.IsVisited( fromID ) || new_g < search.GetCost( fromID ) )
+				search.Visit( fromID, nodeID, new_g, new_g + graph.GetPosition( fromID ).DistTo( vecStart ) );
+		}
+	}
+
+	return FLT_MAX;
+}
+
+//-----------------------------------------------------------------------------
+
+CON_COMMAND_F( ai_flowfield_save_graph, "Saves the node graph as an NPC sees it, for ai_flowfield_bench. Arguments: <file> [npc name]", FCVAR_CHEAT )
+{
+	if ( args.ArgC() < 2 )
+	{
+		Msg( "Usage: ai_flowfield_save_graph <file> [npc name]\n" );
+		return;
+	}
+
+	if ( !g_pBigAINet || g_pBigAINet->NumNodes() < 2 )
+	{
+		Msg( "No node graph loaded\n" );
+		return;
+	}
+
+	// link usability and costs come from an NPC
+	CAI_BaseNPC *pNPC = NULL;
+
+	if ( args.ArgC() > 2 )
+	{
+		CBaseEntity *pEntity = gEntList.FindEntityByName( NULL, args[2] );
+		pNPC = pEntity ? pEntity->MyNPCPointer() : NULL;
+	}
+	else if ( g_AI_Manager.NumAIs() > 0 )
+	{
+		pNPC = g_AI_Manager.AccessAIs()[0];
+	}
+
+	if ( !pNPC || !pNPC->GetPathfinder() )
+	{
+		Msg( "No NPC to path with\n" );
+		return;
+	}
+
+	CAI_FlowGraph graph;
+	graph.Build( g_pBigAINet, pNPC->GetPathfinder() );
+
+	if ( graph.Save( args[1] ) )
+		Msg( "Saved %d nodes and %d links as %s sees them to %s\n", graph.NumNodes(), graph.NumEdges(), pNPC->GetClassname(), args[1] );
+	else
+		Warning( "Couldn't write %s\n", args[1] );
+}
+
+//-----------------------------------------------------------------------------
+
+CON_COMMAND( ai_flowfield_bench, "Times flow fields against per NPC A* on a saved or synthetic graph. Arguments: [graph file | grid side] [goals] [npcs per goal]" )
+{
+	CAI_FlowGraph graph;
+
+	const char *pszGraph = ( args.ArgC() > 1 ) ? args[1] : "64";
+
+	if ( isdigit( pszGraph[0] ) )
+	{
+		int nSide = clamp( atoi( pszGraph ), 2, 1024 );
+		graph.BuildGrid( nSide, 128.0f, 1 );
+	}
+	else if ( !graph.Load( pszGraph ) )
+	{
+		Warning( "Couldn't read a graph from %s\n", pszGraph );
+		return;
+	}
+
+	int nNodes = graph.NumNodes();
+
+	if ( nNodes < 2 )
+	{
+		Msg( "Graph has no nodes\n" );
+		return;
+	}
+
+	int nGoals = ( args.ArgC() > 2 ) ? MAX( 1, atoi( args[2] ) ) : 4;
+	int nNPCs = ( args.ArgC() > 3 ) ? MAX( 1, atoi( args[3] ) ) : 100;
+
+	CUniformRandomStream rnd;
+	rnd.SetSeed( 1 );
+
+	CAI_FlowField field;
+	CAI_OpenList search;
+	CUtlVector<int> parents;
+
+	CCycleCount fieldTime;
+	CCycleCount readTime;
+	CCycleCount searchTime;
+	int nReached = 0;
+	int nMismatches = 0;
+	int nLonger = 0;
+
+	for ( int i = 0; i < nGoals; i++ )
+	{
+		int goalID = rnd.RandomInt( 0, nNodes - 1 );
+
+		CFastTimer timer;
+
+		timer.Start();
+		field.Begin( graph, goalID );
+		field.Grow( graph, INT_MAX );
+		timer.End();
+		fieldTime += timer.GetDuration();
+
+		for ( int j = 0; j < nNPCs; j++ )
+		{
+			int startID = rnd.RandomInt( 0, nNodes - 1 );
+
+			timer.Start();
+			bool bReached = field.GetRouteParents( startID, parents );
+			timer.End();
+			readTime += timer.GetDuration();
+
+			timer.Start();
+			float cost = FlowGraphAStar( graph, search, startID, goalID );
+			timer.End();
+			searchTime += timer.GetDuration();
+
+			if ( bReached != ( cost != FLT_MAX ) )
+			{
+				nMismatches++;
+				continue;
+			}
+
+			if ( !bReached )
+				continue;
+
+			nReached++;
+
+			// parents have to lead from the goal back to the start
+			int nodeID = goalID;
+			int nSteps = 0;
+
+			while ( parents[nodeID] != NO_NODE && nSteps < nNodes )
+			{
+				nodeID = parents[nodeID];
+				nSteps++;
+			}
+
+			float tolerance = 0.001f * MAX( 1.0f, cost );
+
+			if ( nodeID != startID || field.GetCost( startID ) > cost + tolerance )
+				nMismatches++;
+			else if ( field.GetCost( startID ) < cost - tolerance )
+				nLonger++;	// saved graphs can cost links under their length, A* isn't optimal there
+		}
+	}
+
+	int nQueries = nGoals * nNPCs;
+
+	Msg( "%d goals x %d npcs on %d nodes and %d links, %d routes found\n", nGoals, nNPCs, nNodes, graph.NumEdges(), nReached );
+	Msg( "  field build: %.4f ms per goal\n", fieldTime.GetMillisecondsF() / nGoals );
+	Msg( "  field route: %.4f ms per npc\n", readTime.GetMillisecondsF() / nQueries );
+	Msg( "  A*:          %.4f ms per npc\n", searchTime.GetMillisecondsF() / nQueries );
+
+	double flSaved = ( searchTime.GetMillisecondsF() - readTime.GetMillisecondsF() ) / nQueries;
+
+	if ( flSaved > 0 )
+		Msg( "  a field pays off from %.1f npcs per goal\n", fieldTime.GetMillisecondsF() / nGoals / flSaved );
+
+	if ( nLonger )
+		Msg( "  %d A* routes cost more than the field's\n", nLonger );
+
+	if ( nMismatches == 0 )
+		Msg( "  routes match\n" );
+	else
+		Warning( "  %d routes differ\n", nMismatches );
+}
@@ -0,0 +1,115 @@
+//=============================================================================//
+//
+// Purpose: Flow fields over a snapshot of the node graph
+//
+//=============================================================================//
+
+#ifndef AI_FLOWFIELD_H
+#define AI_FLOWFIELD_H
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "utlvector.h"
+#include "ai_openlist.h"
+
+class CAI_Network;
+class CAI_Node;
+class CAI_Pathfinder;
+class CUtlBuffer;
+
+#define AI_FLOWGRAPH_VERSION 1
+
+//-----------------------------------------------------------------------------
+// Purpose: Node graph as one NPC sees it. Every node keeps the links leading
+//			into it along with the cost the NPC's pathfinder gave them, so
+//			fields can be grown without touching entities. Links into nodes
+//			the NPC can't use are never taken. Graphs are built and their
+//			costs re-read a few nodes at a time as doors and dangers change.
+//			Graphs can be saved, ai_flowfield_bench runs on saved or
+//			synthetic ones.
+//-----------------------------------------------------------------------------
+
+class CAI_FlowGraph
+{
+public:
+	CAI_FlowGraph();
+
+	void	Purge();
+
+	void	Build( CAI_Network *pNetwork, CAI_Pathfinder *pPathfinder );
+	// starts over with the network's nodes, BuildNodes then reads their links
+	void	BeginBuild( CAI_Network *pNetwork, CAI_Pathfinder *pPathfinder );
+	// reads the links into the next nNodes nodes, true once every node has them
+	bool	BuildNodes( CAI_Network *pNetwork, CAI_Pathfinder *pPathfinder, int nNodes );
+	bool	IsBuilt() const							{ return m_nBuiltNodes == NumNodes(); }
+	// re-reads the costs of the links into nNodes nodes from iFirstNode, true if any changed
+	bool	Refresh( CAI_Network *pNetwork, CAI_Pathfinder *pPathfinder, int iFirstNode, int nNodes );
+	// nSide x nSide nodes with random costs and walls, for benchmarks
+	void	BuildGrid( int nSide, float flSpacing, int iSeed );
+
+	int		NumNodes() const						{ return m_Positions.Count(); }
+	int		NumEdges() const						{ return m_EdgeFrom.Count(); }
+	const Vector &GetPosition( int iNode ) const	{ return m_Positions[iNode]; }
+
+	// edges leading into iNode are [FirstEdge, LastEdge)
+	int		FirstEdge( int iNode ) const			{ return m_FirstEdge[iNode]; }
+	int		LastEdge( int iNode ) const				{ return m_FirstEdge[iNode + 1]; }
+	int		GetEdgeFrom( int iEdge ) const			{ return m_EdgeFrom[iEdge]; }
+	// FLT_MAX if the link can't be taken
+	float	GetEdgeCost( int iEdge ) const			{ return m_EdgeCost[iEdge]; }
+
+	void	Write( CUtlBuffer &buf ) const;
+	// false and empty if the data is malformed
+	bool	Read( CUtlBuffer &buf );
+
+	bool	Save( const char *pszFileName ) const;
+	bool	Load( const char *pszFileName );
+
+private:
+	float	GetLinkCost( CAI_Node *pNode, int nodeID, int link, CAI_Pathfinder *pPathfinder ) const;
+
+	int					m_nBuiltNodes;
+	CUtlVector<Vector>	m_Positions;
+	CUtlVector<int>		m_FirstEdge;	// one more than there are nodes
+	CUtlVector<int>		m_EdgeFrom;
+	CUtlVector<float>	m_EdgeCost;
+};
+
+//-----------------------------------------------------------------------------
+// Purpose: Cheapest way from every node of a graph to one goal node, grown
+//			outward from the goal in steps so it can be spread over frames.
+//			Once done, the next node toward the goal is a single lookup.
+//-----------------------------------------------------------------------------
+
+class CAI_FlowField
+{
+public:
+	CAI_FlowField();
+
+	void	Begin( const CAI_FlowGraph &graph, int goalID );
+	// expands up to nMaxNodes nodes, true once every reachable node is in the field
+	bool	Grow( const CAI_FlowGraph &graph, int nMaxNodes );
+	void	Purge();
+
+	int		GetGoal() const							{ return m_goalID; }
+	bool	IsDone() const							{ return m_bDone; }
+	bool	IsReached( int iNode ) const			{ return m_bDone && iNode >= 0 && iNode < m_nNodes && m_Search.IsVisited( iNode ); }
+
+	// NO_NODE at the goal, only valid for reached nodes
+	int		GetNextNode( int iNode ) const			{ Assert( IsReached( iNode ) ); return m_Search.GetParents()[iNode]; }
+	float	GetCost( int iNode ) const				{ Assert( IsReached( iNode ) ); return m_Search.GetCost( iNode ); }
+
+	// parents leading from the goal back to startID, as MakeRouteFromParents wants them.
+	// false if startID wasn't reached
+	bool	GetRouteParents( int startID, CUtlVector<int> &parents ) const;
+
+private:
+	CAI_OpenList	m_Search;
+	int				m_goalID;
+	int				m_nNodes;
+	bool			m_bDone;
+};
+
+#endif // AI_FLOWFIELD_H
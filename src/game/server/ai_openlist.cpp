@@ -0,0 +1,178 @@
+//=============================================================================//
+//
+// Purpose: Open list and per node scratch state of the node graph A*
+//
+//=============================================================================//
+
+#include "cbase.h"
+
+#include "ai_openlist.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+//-----------------------------------------------------------------------------
+
+CAI_OpenList::CAI_OpenList()
+ :	m_iGeneration( 0 )
+{
+}
+
+//-----------------------------------------------------------------------------
+
+void CAI_OpenList::Begin( int nNodes )
+{
+	m_Heap.RemoveAll();
+
+	m_iGeneration++;
+
+	// stamps wrapped around, old ones could look current
+	if ( m_iGeneration == 0 )
+	{
+		for ( int i = 0; i < m_Nodes.Count(); i++ )
+			m_Nodes[i].generation = 0;
+		m_iGeneration = 1;
+	}
+
+	if ( m_Nodes.Count() < nNodes )
+	{
+		int nOld = m_Nodes.Count();
+
+		m_Nodes.SetCount( nNodes );
+		m_Parents.SetCount( nNodes );
+
+		for ( int i = nOld; i < nNodes; i++ )
+			m_Nodes[i].generation = 0;
+	}
+}
+
+//-----------------------------------------------------------------------------
+
+void CAI_OpenList::Purge()
+{
+	m_Nodes.Purge();
+	m_Parents.Purge();
+	m_Heap.Purge();
+	m_iGeneration = 0;
+}
+
+//-----------------------------------------------------------------------------
+
+bool CAI_OpenList::IsLess( int iNodeA, int iNodeB ) const
+{
+	const NodeState_t &a = m_Nodes[iNodeA];
+	const NodeState_t &b = m_Nodes[iNodeB];
+
+	if ( a.f != b.f )
+		return a.f < b.f;
+
+	return iNodeA < iNodeB;
+}
+
+//-----------------------------------------------------------------------------
+
+void CAI_OpenList::Place( int iHeapIndex, int iNode )
+{
+	m_Heap[iHeapIndex] = iNode;
+	m_Nodes[iNode].heapIndex = iHeapIndex;
+}
+
+//-----------------------------------------------------------------------------
+
+void CAI_OpenList::SiftUp( int iHeapIndex )
+{
+	int iNode = m_Heap[iHeapIndex];
+
+	while ( iHeapIndex > 0 )
+	{
+		int iParent = ( iHeapIndex - 1 ) / 2;
+
+		if ( !IsLess( iNode, m_Heap[iParent] ) )
+			break;
+
+		Place( iHeapIndex, m_Heap[iParent] );
+		iHeapIndex = iParent;
+	}
+
+	Place( iHeapIndex, iNode );
+}
+
+//-----------------------------------------------------------------------------
+
+void CAI_OpenList::SiftDown( int iHeapIndex )
+{
+	int iNode = m_Heap[iHeapIndex];
+	int nCount = m_Heap.Count();
+
+	for ( ;; )
+	{
+		int iChild = iHeapIndex * 2 + 1;
+
+		if ( iChild >= nCount )
+			break;
+
+		if ( iChild + 1 < nCount && IsLess( m_Heap[iChild + 1], m_Heap[iChild] ) )
+			iChild++;
+
+		if ( !IsLess( m_Heap[iChild], iNode ) )
+			break;
+
+		Place( iHeapIndex, m_Heap[iChild] );
+		iHeapIndex = iChild;
+	}
+
+	Place( iHeapIndex, iNode );
+}
+
+//-----------------------------------------------------------------------------
+
+void CAI_OpenList::Visit( int iNode, int iParent, float g, float f )
+{
+	NodeState_t &node = m_Nodes[iNode];
+
+	bool bOpen = IsOpen( iNode );
+	float flOldF = node.f;
+
+	node.generation = m_iGeneration;
+	node.g = g;
+	node.f = f;
+	m_Parents[iNode] = iParent;
+
+	if ( !bOpen )
+	{
+		node.heapIndex = m_Heap.AddToTail( iNode );
+		SiftUp( node.heapIndex );
+	}
+	else if ( f < flOldF )
+	{
+		SiftUp( node.heapIndex );
+	}
+	else if ( f > flOldF )
+	{
+		SiftDown( node.heapIndex );
+	}
+}
+
+//-----------------------------------------------------------------------------
+
+int CAI_OpenList::PopSmallest()
+{
+	Assert( !IsEmpty() );
+
+	int iSmallest = m_Heap[0];
+	int iLast = m_Heap.Count() - 1;
+
+	if ( iLast > 0 )
+	{
+		Place( 0, m_Heap[iLast] );
+		m_Heap.RemoveMultipleFromTail( 1 );
+		SiftDown( 0 );
+	}
+	else
+	{
+		m_Heap.RemoveAll();
+	}
+
+	m_Nodes[iSmallest].heapIndex = -1;
+	return iSmallest;
+}
@@ -0,0 +1,67 @@
+//=============================================================================//
+//
+// Purpose: Open list and per node scratch state of the node graph A*
+//
+//=============================================================================//
+
+#ifndef AI_OPENLIST_H
+#define AI_OPENLIST_H
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "utlvector.h"
+
+//-----------------------------------------------------------------------------
+// Purpose: Binary heap of node ids ordered by f, then by id, so nodes come out
+//			in the same order as the linear scan of CAI_Network::FindBSSmallest.
+//			Nodes remember their heap slot for decrease-key. Node state is
+//			stamped with the search generation, so starting a search doesn't
+//			have to clear it.
+//-----------------------------------------------------------------------------
+
+class CAI_OpenList
+{
+public:
+	CAI_OpenList();
+
+	// starts a new search over nNodes nodes
+	void	Begin( int nNodes );
+	void	Purge();
+
+	bool	IsVisited( int iNode ) const	{ return m_Nodes[iNode].generation == m_iGeneration; }
+	bool	IsOpen( int iNode ) const		{ return IsVisited( iNode ) && m_Nodes[iNode].heapIndex != -1; }
+	bool	IsEmpty() const					{ return m_Heap.Count() == 0; }
+
+	float	GetCost( int iNode ) const		{ Assert( IsVisited( iNode ) ); return m_Nodes[iNode].g; }
+
+	// reaches a node with cost g and total f, (re)opens it or moves it in the heap
+	void	Visit( int iNode, int iParent, float g, float f );
+	int		PopSmallest();
+
+	// indexed by node, only valid for the nodes visited in this search
+	int *	GetParents()					{ return m_Parents.Base(); }
+	const int *GetParents() const			{ return m_Parents.Base(); }
+
+private:
+	struct NodeState_t
+	{
+		unsigned	generation;
+		int			heapIndex;
+		float		g;
+		float		f;
+	};
+
+	bool	IsLess( int iNodeA, int iNodeB ) const;
+	void	Place( int iHeapIndex, int iNode );
+	void	SiftUp( int iHeapIndex );
+	void	SiftDown( int iHeapIndex );
+
+	CUtlVector<NodeState_t>	m_Nodes;
+	CUtlVector<int>			m_Parents;
+	CUtlVector<int>			m_Heap;
+	unsigned				m_iGeneration;
+};
+
+#endif // AI_OPENLIST_H
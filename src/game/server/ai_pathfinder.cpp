@@ -21,7 +21,11 @@
 #include "ai_dynamiclink.h"
 #include "ai_localnavigator.h"
 #include "ai_hint.h"
+#include "ai_openlist.h"
+#include "ai_pathrequest.h"
 #include "bitstring.h"
+#include "tier0/fasttimer.h"
+#include "vstdlib/random.h"
 
 //@todo: bad dependency!
 #include "ai_navigator.h"
@@ -343,6 +347,9 @@ int CAI_Pathfinder::NearestNodeToPoint( const Vector &vecOrigin )
 // Purpose: Build a path between two nodes
 //-----------------------------------------------------------------------------
 static float s_pDangerDistFactor[3] = { 2048.0f, 4096.0f, 8192.0f };
+
+// scratch of the searches, NPCs think one at a time
+static CAI_OpenList s_OpenList;
 					    
 AI_Waypoint_t *CAI_Pathfinder::FindBestPath(int startID, int endID) 
 {
@@ -358,6 +365,68 @@ AI_Waypoint_t *CAI_Pathfinder::FindBestPath(int startID, int endID)
 	int nNodes = GetNetwork()->NumNodes();
 	CAI_Node **pAInode = GetNetwork()->AccessNodes();
 
+	// ------------- INITIALIZE ------------------------
+	CAI_OpenList &openList = s_OpenList;
+	openList.Begin( nNodes );
+
+	float startH = 0.1*(pAInode[startID]->GetPosition(GetHullType())-pAInode[endID]->GetPosition(GetHullType())).Length(); // Don't want to over estimate
+	openList.Visit( startID, NO_NODE, 0, 0 + startH );
+
+	// --------------- FIND BEST PATH ------------------
+	while (!openList.IsEmpty()) 
+	{
+		int smallestID = openList.PopSmallest();
+
+		CAI_Node *pSmallestNode = pAInode[smallestID];
+		
+		if (GetOuter()->IsUnusableNode(smallestID, pSmallestNode->GetHint()))
+			continue;
+
+		if (smallestID == endID) 
+		{
+			AI_Waypoint_t* route = MakeRouteFromParents(openList.GetParents(), endID);
+			return route;
+		}
+
+		float smallestG = openList.GetCost(smallestID);
+
+		// Check this if the node is immediately in the path after the startNode 
+		// that it isn't blocked
+		for (int link=0; link < pSmallestNode->NumLinks();link++) 
+		{
+			CAI_Link *nodeLink = pSmallestNode->GetLinkByIndex(link);
+			int testID	 = nodeLink->DestNodeID(smallestID);
+
+			float dist   = GetLinkCost( nodeLink, smallestID );
+
+			if ( dist == FLT_MAX )
+				continue;
+
+			float new_g  = smallestG + dist;
+
+			if ( !openList.IsVisited(testID) || (new_g < openList.GetCost(testID)) ) 
+			{
+				float h = (pAInode[testID]->GetPosition(GetHullType())-pAInode[endID]->GetPosition(GetHullType())).Length();
+				openList.Visit( testID, smallestID, new_g, new_g + h );
+			}
+		}
+	}
+
+	return NULL;   
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: FindBestPath with the old linear scan of the open set, the reference
+//			of ai_pathfind_bench
+//-----------------------------------------------------------------------------
+AI_Waypoint_t *CAI_Pathfinder::FindBestPathLinear(int startID, int endID) 
+{
+	if ( !GetNetwork()->NumNodes() )
+		return NULL;
+
+	int nNodes = GetNetwork()->NumNodes();
+	CAI_Node **pAInode = GetNetwork()->AccessNodes();
+
 	CVarBitVec	openBS(nNodes);
 	CVarBitVec	closeBS(nNodes);
 
@@ -668,6 +737,41 @@ AI_Waypoint_t* CAI_Pathfinder::FindShortRandomPath(int startID, float minPathLen
 	return MakeRouteFromParents(&nodeParent[0], neighborID);
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Cost of taking a link from startID, FLT_MAX if it can't be taken
+//-----------------------------------------------------------------------------
+float CAI_Pathfinder::GetLinkCost(CAI_Link *pLink, int startID)
+{
+	if (!IsLinkUsable(pLink,startID))
+		return FLT_MAX;
+
+	// FIXME: the cost function should take into account Node costs (danger, flanking, etc).
+	int moveType = pLink->m_iAcceptedMoveTypes[GetHullType()] & CapabilitiesGet();
+	int endID	 = pLink->DestNodeID(startID);
+
+	Vector r1 = GetNetwork()->GetNode(startID)->GetPosition(GetHullType());
+	Vector r2 = GetNetwork()->GetNode(endID)->GetPosition(GetHullType());
+
+	float dist   = GetOuter()->GetNavigator()->MovementCost( moveType, r1, r2 ); // MovementCost takes ref parameters!!
+
+	if ( dist == FLT_MAX )
+		return FLT_MAX;
+
+	if ( pLink->m_LinkInfo & bits_PREFER_AVOID )
+	{
+		dist += 512.0f;
+	}
+
+	if ( pLink->m_nDangerCount > 0 )
+	{
+		if ( pLink->m_nDangerCount > 3 )
+			return FLT_MAX;
+		dist += s_pDangerDistFactor[ pLink->m_nDangerCount - 1 ];
+	}
+
+	return dist;
+}
+
 //------------------------------------------------------------------------------
 // Purpose : Returns true is link us usable by the given NPC from the
 //			 startID node.
@@ -1935,7 +2039,23 @@ AI_Waypoint_t *CAI_Pathfinder::BuildNodeRoute(const Vector &vStart, const Vector
 	if (!GetNetwork()->IsConnected(srcID, destID))
 		return NULL;
 
-	AI_Waypoint_t *path = FindBestPath(srcID, destID);
+	AI_Waypoint_t *path = NULL;
+	int *pSharedParents = NULL;
+
+	// NPCs chasing the same goal share one search from it, some keep fields to their goals themselves
+	if ( GetOuter()->FindRouteParents( srcID, destID, &pSharedParents ) ||
+		 ( GetOuter()->UsesSharedRoutes() && g_AI_PathRequestManager.FindSharedRoute( GetOuter(), srcID, destID, &pSharedParents ) ) )
+	{
+		if ( pSharedParents )
+			path = MakeRouteFromParents( pSharedParents, destID );
+	}
+	else
+	{
+		if ( GetOuter()->UsesSharedRoutes() )
+			g_AI_PathRequestManager.RequestRoutes( GetOuter(), destID );
+
+		path = FindBestPath(srcID, destID);
+	}
 
 	if (!path)
 	{
@@ -2264,3 +2384,100 @@ void CAI_Pathfinder::CTriDebugOverlay::AddTriOverlayLine(const Vector &origin, c
 }
 
 //-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// Purpose: Times FindBestPath against the linear reference on random node
+//			pairs of the loaded graph and checks both find the same routes
+//-----------------------------------------------------------------------------
+static bool RoutesMatch( const AI_Waypoint_t *pA, const AI_Waypoint_t *pB )
+{
+	while ( pA && pB )
+	{
+		if ( pA->iNodeID != pB->iNodeID || pA->GetPos() != pB->GetPos() )
+			return false;
+
+		pA = pA->GetNext();
+		pB = pB->GetNext();
+	}
+
+	return pA == pB;
+}
+
+CON_COMMAND_F( ai_pathfind_bench, "Times node graph pathfinding on random node pairs. Arguments: [pairs] [npc name]", FCVAR_CHEAT )
+{
+	CAI_Network *pNetwork = g_pBigAINet;
+
+	if ( !pNetwork || pNetwork->NumNodes() < 2 )
+	{
+		Msg( "No node graph loaded\n" );
+		return;
+	}
+
+	int nPairs = ( args.ArgC() > 1 ) ? MAX( 1, atoi( args[1] ) ) : 1000;
+
+	// link usability and costs come from an NPC
+	CAI_BaseNPC *pNPC = NULL;
+
+	if ( args.ArgC() > 2 )
+	{
+		CBaseEntity *pEntity = gEntList.FindEntityByName( NULL, args[2] );
+		pNPC = pEntity ? pEntity->MyNPCPointer() : NULL;
+	}
+	else if ( g_AI_Manager.NumAIs() > 0 )
+	{
+		pNPC = g_AI_Manager.AccessAIs()[0];
+	}
+
+	if ( !pNPC || !pNPC->GetPathfinder() )
+	{
+		Msg( "No NPC to path with\n" );
+		return;
+	}
+
+	CAI_Pathfinder *pPathfinder = pNPC->GetPathfinder();
+	int nNodes = pNetwork->NumNodes();
+
+	CUniformRandomStream rnd;
+	rnd.SetSeed( 1 );
+
+	CCycleCount heapTime;
+	CCycleCount linearTime;
+	int nFound = 0;
+	int nMismatches = 0;
+
+	for ( int i = 0; i < nPairs; i++ )
+	{
+		int startID = rnd.RandomInt( 0, nNodes - 1 );
+		int endID = rnd.RandomInt( 0, nNodes - 1 );
+
+		CFastTimer timer;
+
+		timer.Start();
+		AI_Waypoint_t *pHeapRoute = pPathfinder->FindBestPath( startID, endID );
+		timer.End();
+		heapTime += timer.GetDuration();
+
+		timer.Start();
+		AI_Waypoint_t *pLinearRoute = pPathfinder->FindBestPathLinear( startID, endID );
+		timer.End();
+		linearTime += timer.GetDuration();
+
+		if ( pHeapRoute )
+			nFound++;
+
+		if ( !RoutesMatch( pHeapRoute, pLinearRoute ) )
+			nMismatches++;
+
+		DeleteAll( pHeapRoute );
+		DeleteAll( pLinearRoute );
+	}
+
+	Msg( "%d pairs on %d nodes with %s, %d routes found\n", nPairs, nNodes, pNPC->GetClassname(), nFound );
+	Msg( "  heap:   %.4f ms per path\n", heapTime.GetMillisecondsF() / nPairs );
+	Msg( "  linear: %.4f ms per path\n", linearTime.GetMillisecondsF() / nPairs );
+
+	if ( nMismatches == 0 )
+		Msg( "  routes match\n" );
+	else
+		Warning( "  %d routes differ\n", nMismatches );
+}
@@ -67,11 +67,13 @@ public:
 	int				NearestNodeToPoint( const Vector &vecOrigin );
 
 	virtual AI_Waypoint_t*	FindBestPath		(int startID, int endID);
+	AI_Waypoint_t*	FindBestPathLinear	(int startID, int endID);
 	AI_Waypoint_t*	FindShortRandomPath	(int startID, float minPathLength, const Vector &vDirection = vec3_origin);
 
 	// --------------------------------
 
 	bool			IsLinkUsable(CAI_Link *pLink, int startID);
+	float			GetLinkCost(CAI_Link *pLink, int startID);	// FLT_MAX if the link can't be taken from startID
 
 	// --------------------------------
 	
@@ -0,0 +1,301 @@
+//=============================================================================//
+//
+// Purpose: Node routes shared by NPCs heading for the same goal
+//
+//=============================================================================//
+
+#include "cbase.h"
+
+#include "ai_pathrequest.h"
+
+#include "ai_basenpc.h"
+#include "ai_pathfinder.h"
+#include "ai_network.h"
+#include "ai_node.h"
+#include "ai_link.h"
+#include "tier0/fasttimer.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+ConVar ai_path_requests( "ai_path_requests", "1", FCVAR_CHEAT, "Share node routes between NPCs heading for the same node" );
+ConVar ai_path_request_budget( "ai_path_request_budget", "0.5", FCVAR_CHEAT, "Milliseconds per frame spent growing shared routes" );
+ConVar ai_path_request_lifetime( "ai_path_request_lifetime", "2.0", FCVAR_CHEAT, "Seconds shared routes are used before they are searched again" );
+ConVar ai_path_request_max( "ai_path_request_max", "16", FCVAR_CHEAT, "Maximum number of goals with shared routes" );
+
+// nodes expanded between budget checks
+#define PATHREQUEST_GROW_STEP 32
+
+CAI_PathRequestManager g_AI_PathRequestManager( "CAI_PathRequestManager" );
+
+//-----------------------------------------------------------------------------
+
+void CAI_PathRequestManager::LevelShutdownPreEntity()
+{
+	Purge();
+}
+
+//-----------------------------------------------------------------------------
+
+void CAI_PathRequestManager::Purge()
+{
+	while ( m_Fields.Count() )
+		RemoveField( m_Fields.Count() - 1 );
+
+	m_Fields.Purge();
+	m_RouteParents.Purge();
+
+	m_nFieldsBuilt = 0;
+	m_nRoutesMissed = 0;
+	m_nRoutesShared = 0;
+}
+
+//-----------------------------------------------------------------------------
+
+void CAI_PathRequestManager::RemoveField( int iField )
+{
+	delete m_Fields[iField];
+	m_Fields.Remove( iField );
+}
+
+//-----------------------------------------------------------------------------
+
+int CAI_PathRequestManager::FindField( CAI_BaseNPC *pNPC, int goalID )
+{
+	for ( int i = 0; i < m_Fields.Count(); i++ )
+	{
+		PathField_t *pField = m_Fields[i];
+
+		if ( pField->goalID == goalID &&
+			 pField->iszClassname == pNPC->m_iClassname &&
+			 pField->hull == pNPC->GetHullType() &&
+			 pField->capabilities == pNPC->CapabilitiesGet() )
+		{
+			// network was rebuilt
+			if ( !g_pBigAINet || pField->nNodes != g_pBigAINet->NumNodes() )
+			{
+				RemoveField( i );
+				return -1;
+			}
+
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+//-----------------------------------------------------------------------------
+
+void CAI_PathRequestManager::RequestRoutes( CAI_BaseNPC *pNPC, int goalID )
+{
+	if ( !ai_path_requests.GetBool() || !g_pBigAINet || goalID < 0 || goalID >= g_pBigAINet->NumNodes() )
+		return;
+
+	if ( FindField( pNPC, goalID ) != -1 )
+		return;
+
+	// make room by dropping the oldest finished field
+	if ( m_Fields.Count() >= ai_path_request_max.GetInt() )
+	{
+		int iOldest = -1;
+
+		for ( int i = 0; i < m_Fields.Count(); i++ )
+		{
+			if ( m_Fields[i]->flDoneTime >= 0 && ( iOldest == -1 || m_Fields[i]->flDoneTime < m_Fields[iOldest]->flDoneTime ) )
+				iOldest = i;
+		}
+
+		if ( iOldest == -1 )
+			return;
+
+		RemoveField( iOldest );
+	}
+
+	PathField_t *pField = new PathField_t;
+
+	pField->goalID = goalID;
+	pField->iszClassname = pNPC->m_iClassname;
+	pField->hull = pNPC->GetHullType();
+	pField->capabilities = pNPC->CapabilitiesGet();
+	pField->nNodes = g_pBigAINet->NumNodes();
+	pField->hNPC = pNPC;
+	pField->flDoneTime = -1;
+
+	pField->search.Begin( pField->nNodes );
+	pField->search.Visit( goalID, NO_NODE, 0, 0 );
+
+	m_Fields.AddToTail( pField );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Searches outward from the goal, costs are those of moving toward it.
+//			Returns true once every reachable node is in the field
+//-----------------------------------------------------------------------------
+
+bool CAI_PathRequestManager::GrowField( PathField_t *pField, CAI_BaseNPC *pNPC, int nMaxNodes )
+{
+	CAI_Pathfinder *pPathfinder = pNPC->GetPathfinder();
+	CAI_Node **pAInode = g_pBigAINet->AccessNodes();
+	CAI_OpenList &search = pField->search;
+
+	for ( int i = 0; i < nMaxNodes && !search.IsEmpty(); i++ )
+	{
+		int nodeID = search.PopSmallest();
+		CAI_Node *pNode = pAInode[nodeID];
+
+		// routes can't pass through unusable nodes, links into them are refused too
+		if ( pNPC->IsUnusableNode( nodeID, pNode->GetHint() ) )
+			continue;
+
+		float g = search.GetCost( nodeID );
+
+		for ( int link = 0; link < pNode->NumLinks(); link++ )
+		{
+			CAI_Link *pLink = pNode->GetLinkByIndex( link );
+			int fromID = pLink->DestNodeID( nodeID );
+
+			float dist = pPathfinder->GetLinkCost( pLink, fromID );
+
+			if ( dist == FLT_MAX )
+				continue;
+
+			float new_g = g + dist;
+
+			if ( !search.IsVisited( fromID ) || new_g < search.GetCost( fromID ) )
+				search.Visit( fromID, nodeID, new_g, new_g );
+		}
+	}
+
+	if ( !search.IsEmpty() )
+		return false;
+
+	pField->flDoneTime = gpGlobals->curtime;
+	m_nFieldsBuilt++;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+bool CAI_PathRequestManager::FindSharedRoute( CAI_BaseNPC *pNPC, int startID, int goalID, int **ppParents )
+{
+	*ppParents = NULL;
+
+	if ( !ai_path_requests.GetBool() )
+		return false;
+
+	int iField = FindField( pNPC, goalID );
+
+	if ( iField == -1 )
+		return false;
+
+	PathField_t *pField = m_Fields[iField];
+	const CAI_OpenList &search = pField->search;
+
+	// routes of closed nodes are final, anything else is searched by the NPC while
+	// the field keeps growing in the frame budget
+	if ( pField->flDoneTime < 0 &&
+		 ( startID < 0 || startID >= pField->nNodes || !search.IsVisited( startID ) || search.IsOpen( startID ) ) )
+	{
+		// the asking NPC is of the same kind, it stands in if the requester is gone
+		if ( pField->hNPC.Get() == NULL )
+			pField->hNPC = pNPC;
+
+		m_nRoutesMissed++;
+		return false;
+	}
+
+	m_nRoutesShared++;
+
+	if ( startID < 0 || startID >= pField->nNodes || !search.IsVisited( startID ) ||
+		 pNPC->IsUnusableNode( startID, g_pBigAINet->GetNode( startID )->GetHint() ) )
+		return true;
+
+	// parents lead to the goal, turn the chain around to lead back to the start
+	const int *pTowardGoal = pField->search.GetParents();
+
+	if ( m_RouteParents.Count() < pField->nNodes )
+		m_RouteParents.SetCount( pField->nNodes );
+
+	int prevID = NO_NODE;
+
+	for ( int nodeID = startID; nodeID != NO_NODE; nodeID = pTowardGoal[nodeID] )
+	{
+		m_RouteParents[nodeID] = prevID;
+		prevID = nodeID;
+	}
+
+	*ppParents = m_RouteParents.Base();
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+void CAI_PathRequestManager::FrameUpdatePreEntityThink()
+{
+	if ( !m_Fields.Count() )
+		return;
+
+	if ( !ai_path_requests.GetBool() || !g_pBigAINet )
+	{
+		Purge();
+		return;
+	}
+
+	// routes go stale as links, dangers and doors change
+	for ( int i = m_Fields.Count() - 1; i >= 0; i-- )
+	{
+		PathField_t *pField = m_Fields[i];
+
+		if ( pField->flDoneTime >= 0 && gpGlobals->curtime - pField->flDoneTime > ai_path_request_lifetime.GetFloat() )
+			RemoveField( i );
+		else if ( pField->flDoneTime < 0 && ( pField->hNPC.Get() == NULL || pField->nNodes != g_pBigAINet->NumNodes() ) )
+			RemoveField( i );
+	}
+
+	CFastTimer timer;
+	timer.Start();
+
+	for ( int i = 0; i < m_Fields.Count(); i++ )
+	{
+		PathField_t *pField = m_Fields[i];
+
+		if ( pField->flDoneTime >= 0 )
+			continue;
+
+		CBaseEntity *pEntity = pField->hNPC;
+		CAI_BaseNPC *pNPC = pEntity ? pEntity->MyNPCPointer() : NULL;
+
+		if ( !pNPC )
+			continue;
+
+		while ( !GrowField( pField, pNPC, PATHREQUEST_GROW_STEP ) )
+		{
+			timer.End();
+
+			if ( timer.GetDuration().GetMillisecondsF() >= ai_path_request_budget.GetFloat() )
+				return;
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+
+void CAI_PathRequestManager::Report()
+{
+	int nGrowing = 0;
+
+	for ( int i = 0; i < m_Fields.Count(); i++ )
+	{
+		if ( m_Fields[i]->flDoneTime < 0 )
+			nGrowing++;
+	}
+
+	Msg( "%d shared route fields, %d growing\n", m_Fields.Count(), nGrowing );
+	Msg( "  %d built, %d routes shared, %d searched while growing\n", m_nFieldsBuilt, m_nRoutesShared, m_nRoutesMissed );
+}
+
+CON_COMMAND( ai_path_request_report, "Prints the state of the shared node routes" )
+{
+	g_AI_PathRequestManager.Report();
+}
@@ -0,0 +1,79 @@
+//=============================================================================//
+//
+// Purpose: Node routes shared by NPCs heading for the same goal
+//
+//=============================================================================//
+
+#ifndef AI_PATHREQUEST_H
+#define AI_PATHREQUEST_H
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "igamesystem.h"
+#include "ai_openlist.h"
+
+class CAI_BaseNPC;
+
+//-----------------------------------------------------------------------------
+// Purpose: NPCs that path to the same node, like a horde chasing a marine,
+//			share one search outward from that node. Requests queue a field
+//			whose parents lead every reached node to the goal; fields grow
+//			under ai_path_request_budget ms per frame and routes are then read
+//			out of them instead of searching per NPC. Link costs come from an
+//			NPC, so fields are kept per goal, class, hull and capabilities.
+//-----------------------------------------------------------------------------
+
+class CAI_PathRequestManager : public CAutoGameSystemPerFrame
+{
+public:
+	CAI_PathRequestManager( char const *name ) : CAutoGameSystemPerFrame( name ),
+		m_nFieldsBuilt( 0 ),
+		m_nRoutesMissed( 0 ),
+		m_nRoutesShared( 0 )
+	{
+	}
+
+	virtual void LevelShutdownPreEntity();
+	virtual void FrameUpdatePreEntityThink();
+
+	// queues a field toward goalID, built with pNPC's link costs
+	void	RequestRoutes( CAI_BaseNPC *pNPC, int goalID );
+
+	// true if a field toward goalID answered, a field still growing only answers for
+	// nodes it already closed. *ppParents is then the route from startID for
+	// MakeRouteFromParents, or NULL if there is none
+	bool	FindSharedRoute( CAI_BaseNPC *pNPC, int startID, int goalID, int **ppParents );
+
+	void	Purge();
+	void	Report();
+
+private:
+	struct PathField_t
+	{
+		int				goalID;
+		string_t		iszClassname;
+		int				hull;
+		int				capabilities;
+		int				nNodes;
+		EHANDLE			hNPC;			// NPC the link costs come from
+		float			flDoneTime;		// -1 while growing
+		CAI_OpenList	search;
+	};
+
+	int		FindField( CAI_BaseNPC *pNPC, int goalID );
+	bool	GrowField( PathField_t *pField, CAI_BaseNPC *pNPC, int nMaxNodes );
+	void	RemoveField( int iField );
+
+	CUtlVector<PathField_t *>	m_Fields;
+	CUtlVector<int>				m_RouteParents;
+
+	int		m_nFieldsBuilt;
+	int		m_nRoutesMissed;
+	int		m_nRoutesShared;
+};
+
+extern CAI_PathRequestManager g_AI_PathRequestManager;
+
+#endif // AI_PATHREQUEST_H
@@ -41,7 +41,16 @@ void CDeferredManagerServer::AddWorldLight( CDeferredLight *l )
 	CDeferredLightContainer *pC = FindAvailableContainer();
 
 	if ( !pC )
+	{
+		// chunks of the world light table belong to a single container
+		if ( GetNumLightContainers() > 0 )
+		{
+			Warning( "Too many world lights, only %i are supported.\n", DEFLIGHTCONTAINER_MAXLIGHTS );
+			return;
+		}
+
 		pC = assert_cast< CDeferredLightContainer* >( CreateEntityByName( "deferred_light_container" ) );
+	}
 
 	pC->AddWorldLight( l );
 }
\ No newline at end of file
@@ -1505,6 +1505,7 @@ void CServerGameDLL::CreateNetworkStringTables( void )
 
 // @Deferred - Biohazard
 	g_pStringTable_LightCookies = networkstringtable->CreateStringTable( COOKIE_STRINGTBL_NAME, MAX_COOKIE_TEXTURES, 0, 0, NSF_DICTIONARY_ENABLED );
+	g_pStringTable_WorldLights = networkstringtable->CreateStringTable( WORLDLIGHTS_STRINGTBL_NAME, DEFLIGHTCONTAINER_MAXCHUNKS );
 
 	Assert( g_pStringTableParticleEffectNames &&
 			g_pStringTableEffectDispatch &&
@@ -1514,7 +1515,8 @@ void CServerGameDLL::CreateNetworkStringTables( void )
 			g_pStringTableClientSideChoreoScenes &&
 			g_pStringTableExtraParticleFiles &&
 // @Deferred - Biohazard
-			g_pStringTable_LightCookies );
+			g_pStringTable_LightCookies &&
+			g_pStringTable_WorldLights );
 
 	// Need this so we have the error material always handy
 	PrecacheMaterial( "debug/debugempty" );
@@ -0,0 +1,411 @@
+//=============================================================================//
+//
+// Purpose: A* search state for the navigation mesh
+//
+//=============================================================================//
+// nav_pathfind.cpp
+
+#include "cbase.h"
+#include "tier0/fasttimer.h"
+#include "vstdlib/jobthread.h"
+#include "vstdlib/random.h"
+
+#include "nav_mesh.h"
+#include "nav_pathfind.h"
+
+// NOTE: This has to be the last file included!
+#include "tier0/memdbgon.h"
+
+
+CNavPathSearch TheNavPathSearch( true );
+
+
+//--------------------------------------------------------------------------------------------------------------
+CNavPathSearch::CNavPathSearch( bool writeToAreas )
+{
+	m_marker = 0;
+	m_order = 0;
+	m_writeToAreas = writeToAreas;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavPathSearch::Purge( void )
+{
+	m_areas.Purge();
+	m_openList.Purge();
+	m_marker = 0;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Start a new search, old area states become stale
+ */
+void CNavPathSearch::Begin( void )
+{
+	m_openList.RemoveAll();
+	m_order = 0;
+
+	++m_marker;
+	if ( m_marker == 0 )
+	{
+		// markers wrapped around, old states could look current
+		for( int i=0; i<m_areas.Count(); ++i )
+		{
+			m_areas[i].marker = 0;
+		}
+
+		m_marker = 1;
+	}
+
+	// sized once per search, so states can be held by reference while searching
+	int oldCount = m_areas.Count();
+	int count = CNavArea::GetNextID();
+	if ( count > oldCount )
+	{
+		m_areas.SetCount( count );
+
+		for( int i=oldCount; i<count; ++i )
+		{
+			m_areas[i].marker = 0;
+		}
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+CNavPathSearch::AreaState &CNavPathSearch::GetState( const CNavArea *area )
+{
+	Assert( area->GetID() < (unsigned int)m_areas.Count() );
+
+	AreaState &state = m_areas[ area->GetID() ];
+
+	if ( state.marker != m_marker )
+	{
+		state.marker = m_marker;
+		state.heapIndex = -1;
+		state.order = 0;
+		state.isOpen = false;
+		state.isClosed = false;
+		state.parent = NULL;
+		state.parentHow = NUM_TRAVERSE_TYPES;
+		state.costSoFar = 0.0f;
+		state.totalCost = 0.0f;
+		state.pathLengthSoFar = 0.0f;
+	}
+
+	return state;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+const CNavPathSearch::AreaState *CNavPathSearch::FindState( const CNavArea *area ) const
+{
+	if ( area == NULL || area->GetID() >= (unsigned int)m_areas.Count() )
+		return NULL;
+
+	const AreaState &state = m_areas[ area->GetID() ];
+	return ( state.marker == m_marker ) ? &state : NULL;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavPathSearch::WriteToArea( CNavArea *area, const AreaState &state ) const
+{
+	if ( !m_writeToAreas )
+		return;
+
+	area->SetParent( state.parent, state.parentHow );
+	area->SetCostSoFar( state.costSoFar );
+	area->SetTotalCost( state.totalCost );
+	area->SetPathLengthSoFar( state.pathLengthSoFar );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+CNavArea *CNavPathSearch::GetParent( const CNavArea *area ) const
+{
+	const AreaState *state = FindState( area );
+	return state ? state->parent : NULL;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+NavTraverseType CNavPathSearch::GetParentHow( const CNavArea *area ) const
+{
+	const AreaState *state = FindState( area );
+	return state ? state->parentHow : NUM_TRAVERSE_TYPES;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+float CNavPathSearch::GetCostSoFar( const CNavArea *area ) const
+{
+	const AreaState *state = FindState( area );
+	return state ? state->costSoFar : 0.0f;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+float CNavPathSearch::GetTotalCost( const CNavArea *area ) const
+{
+	const AreaState *state = FindState( area );
+	return state ? state->totalCost : 0.0f;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+float CNavPathSearch::GetPathLengthSoFar( const CNavArea *area ) const
+{
+	const AreaState *state = FindState( area );
+	return state ? state->pathLengthSoFar : 0.0f;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Order of the open list, by total cost and then by when the cost was set
+ */
+bool CNavPathSearch::IsLess( const CNavArea *area, const CNavArea *other ) const
+{
+	const AreaState &state = m_areas[ area->GetID() ];
+	const AreaState &otherState = m_areas[ other->GetID() ];
+
+	if ( state.totalCost != otherState.totalCost )
+		return state.totalCost < otherState.totalCost;
+
+	return state.order < otherState.order;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavPathSearch::PlaceInHeap( int index, CNavArea *area )
+{
+	m_openList[ index ] = area;
+	m_areas[ area->GetID() ].heapIndex = index;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavPathSearch::SiftUp( int index )
+{
+	CNavArea *area = m_openList[ index ];
+
+	while( index > 0 )
+	{
+		int parent = ( index - 1 ) / 2;
+
+		if ( !IsLess( area, m_openList[ parent ] ) )
+			break;
+
+		PlaceInHeap( index, m_openList[ parent ] );
+		index = parent;
+	}
+
+	PlaceInHeap( index, area );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavPathSearch::SiftDown( int index )
+{
+	CNavArea *area = m_openList[ index ];
+	int count = m_openList.Count();
+
+	while( true )
+	{
+		int child = index * 2 + 1;
+
+		if ( child >= count )
+			break;
+
+		if ( child + 1 < count && IsLess( m_openList[ child + 1 ], m_openList[ child ] ) )
+			++child;
+
+		if ( !IsLess( m_openList[ child ], area ) )
+			break;
+
+		PlaceInHeap( index, m_openList[ child ] );
+		index = child;
+	}
+
+	PlaceInHeap( index, area );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavPathSearch::AddToOpenList( CNavArea *area )
+{
+	AreaState &state = GetState( area );
+
+	if ( state.isOpen )
+		return;
+
+	state.isOpen = true;
+	state.order = m_order++;
+
+	SiftUp( m_openList.AddToTail( area ) );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavPathSearch::UpdateOnOpenList( CNavArea *area )
+{
+	AreaState &state = GetState( area );
+	Assert( state.isOpen );
+
+	// a lower cost goes behind areas that already had it, like a new entry
+	state.order = m_order++;
+
+	SiftUp( state.heapIndex );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+CNavArea *CNavPathSearch::PopOpenList( void )
+{
+	CNavArea *area = m_openList[0];
+
+	int last = m_openList.Count() - 1;
+	if ( last > 0 )
+	{
+		PlaceInHeap( 0, m_openList[ last ] );
+		m_openList.RemoveMultipleFromTail( 1 );
+		SiftDown( 0 );
+	}
+	else
+	{
+		m_openList.RemoveAll();
+	}
+
+	AreaState &state = GetState( area );
+	state.isOpen = false;
+	state.heapIndex = -1;
+
+	return area;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * A slice of the queries of nav_pathfind_bench, searched with its own context
+ */
+struct NavPathBenchJob
+{
+	CNavArea **startAreas;
+	CNavArea **goalAreas;
+	float *costs;												// cost of the path, -1 if none was found
+	int count;
+
+	CNavPathSearch search;
+};
+
+static void RunNavPathBenchJob( NavPathBenchJob &job )
+{
+	ShortestPathCost costFunc( &job.search );
+
+	for( int i=0; i<job.count; ++i )
+	{
+		if ( job.search.BuildPath( job.startAreas[i], job.goalAreas[i], NULL, costFunc ) )
+		{
+			job.costs[i] = job.search.GetCostSoFar( job.goalAreas[i] );
+		}
+		else
+		{
+			job.costs[i] = -1.0f;
+		}
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+CON_COMMAND_F( nav_pathfind_bench, "Times random area to area paths on one and on all threads. Arguments: [queries]", FCVAR_GAMEDLL | FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	int areaCount = TheNavAreas.Count();
+	if ( areaCount < 2 )
+	{
+		Msg( "No navigation mesh loaded\n" );
+		return;
+	}
+
+	int queryCount = ( args.ArgC() > 1 ) ? MAX( 1, atoi( args[1] ) ) : 5000;
+
+	CUtlVector< CNavArea * > startAreas;
+	CUtlVector< CNavArea * > goalAreas;
+	CUtlVector< float > singleCosts;
+	CUtlVector< float > threadedCosts;
+
+	startAreas.SetCount( queryCount );
+	goalAreas.SetCount( queryCount );
+	singleCosts.SetCount( queryCount );
+	threadedCosts.SetCount( queryCount );
+
+	CUniformRandomStream random;
+	random.SetSeed( 1 );
+
+	for( int i=0; i<queryCount; ++i )
+	{
+		startAreas[i] = TheNavAreas[ random.RandomInt( 0, areaCount-1 ) ];
+		goalAreas[i] = TheNavAreas[ random.RandomInt( 0, areaCount-1 ) ];
+	}
+
+	const int maxJobs = 32;
+	NavPathBenchJob jobs[ maxJobs ];
+
+	int jobCount = ( g_pThreadPool != NULL ) ? g_pThreadPool->NumThreads() + 1 : 1;
+	jobCount = clamp( jobCount, 1, MIN( maxJobs, queryCount ) );
+
+	// every query on this thread
+	NavPathBenchJob &single = jobs[0];
+	single.startAreas = startAreas.Base();
+	single.goalAreas = goalAreas.Base();
+	single.costs = singleCosts.Base();
+	single.count = queryCount;
+
+	CFastTimer timer;
+	timer.Start();
+	RunNavPathBenchJob( single );
+	timer.End();
+	double singleTime = timer.GetDuration().GetMillisecondsF();
+
+	// queries split between threads, each job searching with its own context
+	for( int i=0; i<jobCount; ++i )
+	{
+		int first = queryCount * i / jobCount;
+		int last = queryCount * ( i + 1 ) / jobCount;
+
+		jobs[i].startAreas = startAreas.Base() + first;
+		jobs[i].goalAreas = goalAreas.Base() + first;
+		jobs[i].costs = threadedCosts.Base() + first;
+		jobs[i].count = last - first;
+	}
+
+	timer.Start();
+	ParallelProcess( jobs, jobCount, &RunNavPathBenchJob );
+	timer.End();
+	double threadedTime = timer.GetDuration().GetMillisecondsF();
+
+	int foundCount = 0;
+	int mismatchCount = 0;
+	for( int i=0; i<queryCount; ++i )
+	{
+		if ( singleCosts[i] >= 0.0f )
+			++foundCount;
+
+		if ( singleCosts[i] != threadedCosts[i] )
+			++mismatchCount;
+	}
+
+	Msg( "%d queries on %d areas, %d paths found\n", queryCount, areaCount, foundCount );
+	Msg( "  1 thread:   %.2f ms, %.0f queries/s\n", singleTime, queryCount * 1000.0 / MAX( singleTime, 0.001 ) );
+	Msg( "  %d threads: %.2f ms, %.0f queries/s\n", jobCount, threadedTime, queryCount * 1000.0 / MAX( threadedTime, 0.001 ) );
+
+	if ( mismatchCount > 0 )
+	{
+		Warning( "  %d threaded results differ from the single thread\n", mismatchCount );
+	}
+}
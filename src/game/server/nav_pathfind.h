@@ -32,6 +32,78 @@ enum RouteType
 };
 
 
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * State of one A* search through the nav mesh. The open list is a binary heap and the
+ * per-area costs and parents live in arrays indexed by area ID, stamped with a search
+ * marker so a new search doesn't have to clear them.
+ * Searches only read the mesh, so each thread can run its own context. Cost functors
+ * used that way must read costs so far from the context, see ShortestPathCost.
+ * Searches toward a goal position without a goal area test containment through the
+ * nav mesh grid and are main thread only.
+ */
+class CNavPathSearch
+{
+public:
+	CNavPathSearch( bool writeToAreas = false );
+
+	/**
+	 * Same as NavAreaBuildPath(), the path is defined by following GetParent() back from
+	 * the goal area. If 'writeToAreas' was given, costs and parents are also stored on the areas.
+	 */
+	template< typename CostFunctor >
+	bool BuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *goalPos, CostFunctor &costFunc, CNavArea **closestArea = NULL, float maxPathLength = 0.0f, int teamID = TEAM_ANY, bool ignoreNavBlockers = false );
+
+	// results of the last search, only valid for areas it reached
+	CNavArea *GetParent( const CNavArea *area ) const;
+	NavTraverseType GetParentHow( const CNavArea *area ) const;
+	float GetCostSoFar( const CNavArea *area ) const;
+	float GetTotalCost( const CNavArea *area ) const;
+	float GetPathLengthSoFar( const CNavArea *area ) const;
+
+	void Purge( void );
+
+private:
+	struct AreaState
+	{
+		unsigned int marker;									// state is from an old search unless this is the current marker
+		int heapIndex;
+		unsigned int order;										// breaks cost ties first come, first served
+		bool isOpen;
+		bool isClosed;
+
+		CNavArea *parent;
+		NavTraverseType parentHow;
+		float costSoFar;
+		float totalCost;
+		float pathLengthSoFar;
+	};
+
+	void Begin( void );
+	AreaState &GetState( const CNavArea *area );
+	const AreaState *FindState( const CNavArea *area ) const;
+	void WriteToArea( CNavArea *area, const AreaState &state ) const;
+
+	bool IsOpenListEmpty( void ) const	{ return m_openList.Count() == 0; }
+	void AddToOpenList( CNavArea *area );
+	void UpdateOnOpenList( CNavArea *area );					// cost decreased
+	CNavArea *PopOpenList( void );
+
+	bool IsLess( const CNavArea *area, const CNavArea *other ) const;
+	void PlaceInHeap( int index, CNavArea *area );
+	void SiftUp( int index );
+	void SiftDown( int index );
+
+	CUtlVector< AreaState > m_areas;
+	CUtlVector< CNavArea * > m_openList;
+	unsigned int m_marker;
+	unsigned int m_order;
+	bool m_writeToAreas;
+};
+
+extern CNavPathSearch TheNavPathSearch;							// used by NavAreaBuildPath(), main thread only
+
+
 //--------------------------------------------------------------------------------------------------------------
 /**
  * Functor used with NavAreaBuildPath()
@@ -39,6 +111,9 @@ enum RouteType
 class ShortestPathCost
 {
 public:
+	// with a search context, costs so far are read from it instead of the areas
+	ShortestPathCost( const CNavPathSearch *search = NULL ) : m_search( search ) { }
+
 	float operator() ( CNavArea *area, CNavArea *fromArea, const CNavLadder *ladder, const CFuncElevator *elevator, float length )
 	{
 		if ( fromArea == NULL )
@@ -64,7 +139,7 @@ public:
 				dist = ( area->GetCenter() - fromArea->GetCenter() ).Length();
 			}
 
-			float cost = dist + fromArea->GetCostSoFar();
+			float cost = dist + ( m_search ? m_search->GetCostSoFar( fromArea ) : fromArea->GetCostSoFar() );
 
 			// if this is a "crouch" area, add penalty
 			if ( area->GetAttributes() & NAV_MESH_CROUCH )
@@ -83,23 +158,17 @@ public:
 			return cost;
 		}
 	}
+
+private:
+	const CNavPathSearch *m_search;
 };
 
 //--------------------------------------------------------------------------------------------------------------
 /**
- * Find path from startArea to goalArea via an A* search, using supplied cost heuristic.
- * If cost functor returns -1 for an area, that area is considered a dead end.
- * This doesn't actually build a path, but the path is defined by following parent
- * pointers back from goalArea to startArea.
- * If 'closestArea' is non-NULL, the closest area to the goal is returned (useful if the path fails).
- * If 'goalArea' is NULL, will compute a path as close as possible to 'goalPos'.
- * If 'goalPos' is NULL, will use the center of 'goalArea' as the goal position.
- * If 'maxPathLength' is nonzero, path building will stop when this length is reached.
- * Returns true if a path exists.
+ * A* search of CNavPathSearch, see NavAreaBuildPath()
  */
-#define IGNORE_NAV_BLOCKERS true
 template< typename CostFunctor >
-bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *goalPos, CostFunctor &costFunc, CNavArea **closestArea = NULL, float maxPathLength = 0.0f, int teamID = TEAM_ANY, bool ignoreNavBlockers = false )
+bool CNavPathSearch::BuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *goalPos, CostFunctor &costFunc, CNavArea **closestArea, float maxPathLength, int teamID, bool ignoreNavBlockers )
 {
 	VPROF_BUDGET( "NavAreaBuildPath", "NextBotSpiky" );
 
@@ -108,7 +177,8 @@ bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *go
 		*closestArea = startArea;
 	}
 
-	bool isDebug = ( g_DebugPathfindCounter-- > 0 );
+	// only the main thread search draws
+	bool isDebug = m_writeToAreas && ( g_DebugPathfindCounter-- > 0 );
 
 	if (startArea == NULL)
 		return false;
@@ -119,43 +189,51 @@ bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *go
 	if (goalArea == NULL && goalPos == NULL)
 		return false;
 
-	startArea->SetParent( NULL );
+	// area containment goes through the nav mesh grid
+	Assert( goalArea || ThreadInMainThread() );
+
+	// start search
+	Begin();
+
+	AreaState &startState = GetState( startArea );
+	startState.parent = NULL;
+	startState.parentHow = NUM_TRAVERSE_TYPES;
+	startState.costSoFar = 0.0f;
+	startState.totalCost = 0.0f;
+	startState.pathLengthSoFar = 0.0f;
 
 	// if we are already in the goal area, build trivial path
 	if (startArea == goalArea)
 	{
-		goalArea->SetParent( NULL );
+		WriteToArea( startArea, startState );
 		return true;
 	}
 
 	// determine actual goal position
 	Vector actualGoalPos = (goalPos) ? *goalPos : goalArea->GetCenter();
 
-	// start search
-	CNavArea::ClearSearchLists();
-
 	// compute estimate of path length
 	/// @todo Cost might work as "manhattan distance"
-	startArea->SetTotalCost( (startArea->GetCenter() - actualGoalPos).Length() );
+	startState.totalCost = (startArea->GetCenter() - actualGoalPos).Length();
 
 	float initCost = costFunc( startArea, NULL, NULL, NULL, -1.0f );	
 	if (initCost < 0.0f)
 		return false;
-	startArea->SetCostSoFar( initCost );
-	startArea->SetPathLengthSoFar( 0.0 );
+	startState.costSoFar = initCost;
 
-	startArea->AddToOpenList();
+	WriteToArea( startArea, startState );
+	AddToOpenList( startArea );
 
 	// keep track of the area we visit that is closest to the goal
 	if (closestArea)
 		*closestArea = startArea;
-	float closestAreaDist = startArea->GetTotalCost();
+	float closestAreaDist = startState.totalCost;
 
 	// do A* search
-	while( !CNavArea::IsOpenListEmpty() )
+	while( !IsOpenListEmpty() )
 	{
 		// get next area to check
-		CNavArea *area = CNavArea::PopOpenList();
+		CNavArea *area = PopOpenList();
 
 		if ( isDebug )
 		{
@@ -345,18 +423,19 @@ bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *go
 				continue;
 				
 			// stop if path length limit reached
+			float newLengthSoFar = 0.0f;
 			if ( bHaveMaxPathLength )
 			{
 				// keep track of path length so far
 				float deltaLength = ( newArea->GetCenter() - area->GetCenter() ).Length();
-				float newLengthSoFar = area->GetPathLengthSoFar() + deltaLength;
+				newLengthSoFar = GetPathLengthSoFar( area ) + deltaLength;
 				if ( newLengthSoFar > maxPathLength )
 					continue;
-				
-				newArea->SetPathLengthSoFar( newLengthSoFar );
 			}
 
-			if ( ( newArea->IsOpen() || newArea->IsClosed() ) && newArea->GetCostSoFar() <= newCostSoFar )
+			AreaState &newState = GetState( newArea );
+
+			if ( ( newState.isOpen || newState.isClosed ) && newState.costSoFar <= newCostSoFar )
 			{
 				// this is a worse path - skip it
 				continue;
@@ -374,36 +453,57 @@ bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *go
 					closestAreaDist = newCostRemaining;
 				}
 				
-				newArea->SetCostSoFar( newCostSoFar );
-				newArea->SetTotalCost( newCostSoFar + newCostRemaining );
-
-				if ( newArea->IsClosed() )
-				{
-					newArea->RemoveFromClosedList();
-				}
-
-				if ( newArea->IsOpen() )
+				newState.costSoFar = newCostSoFar;
+				newState.totalCost = newCostSoFar + newCostRemaining;
+				newState.pathLengthSoFar = newLengthSoFar;
+				newState.parent = area;
+				newState.parentHow = how;
+				newState.isClosed = false;
+
+				if ( newState.isOpen )
 				{
-					// area already on open list, update the list order to keep costs sorted
-					newArea->UpdateOnOpenList();
+					// area already on open list, update the heap to keep costs sorted
+					UpdateOnOpenList( newArea );
 				}
 				else
 				{
-					newArea->AddToOpenList();
+					AddToOpenList( newArea );
 				}
 
-				newArea->SetParent( area, how );
+				WriteToArea( newArea, newState );
 			}
 		}
 
 		// we have searched this area
-		area->AddToClosedList();
+		GetState( area ).isClosed = true;
 	}
 
 	return false;
 }
 
 
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Find path from startArea to goalArea via an A* search, using supplied cost heuristic.
+ * If cost functor returns -1 for an area, that area is considered a dead end.
+ * This doesn't actually build a path, but the path is defined by following parent
+ * pointers back from goalArea to startArea.
+ * If 'closestArea' is non-NULL, the closest area to the goal is returned (useful if the path fails).
+ * If 'goalArea' is NULL, will compute a path as close as possible to 'goalPos'.
+ * If 'goalPos' is NULL, will use the center of 'goalArea' as the goal position.
+ * If 'maxPathLength' is nonzero, path building will stop when this length is reached.
+ * Returns true if a path exists.
+ * Costs and parents are stored on the areas, so this is main thread only. Use a
+ * CNavPathSearch of your own to search from other threads.
+ */
+#define IGNORE_NAV_BLOCKERS true
+template< typename CostFunctor >
+bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *goalPos, CostFunctor &costFunc, CNavArea **closestArea = NULL, float maxPathLength = 0.0f, int teamID = TEAM_ANY, bool ignoreNavBlockers = false )
+{
+	return TheNavPathSearch.BuildPath( startArea, goalArea, goalPos, costFunc, closestArea, maxPathLength, teamID, ignoreNavBlockers );
+}
+
+
 //--------------------------------------------------------------------------------------------------------------
 /**
  * Compute distance between two areas. Return -1 if can't reach 'endArea' from 'startArea'.
@@ -30,6 +30,7 @@
 #include "asw_tesla_trap.h"
 #include "sendprop_priorities.h"
 #include "asw_spawn_manager.h"
+#include "asw_flow_field_manager.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -1237,6 +1238,12 @@ bool CASW_Alien::IsCurTaskContinuousMove()
 	return BaseClass::IsCurTaskContinuousMove();
 }
 
+// routes to the marines come out of their flow fields
+bool CASW_Alien::FindRouteParents( int startID, int goalID, int **ppParents )
+{
+	return ASWFlowFieldManager()->FindRouteParents( this, startID, goalID, ppParents );
+}
+
 void CASW_Alien::RunTask(const Task_t *pTask)
 {
 	switch (pTask->iTask)
@@ -110,6 +110,8 @@ public:
 	virtual void StartTask(const Task_t *pTask);
 	virtual void RunTask(const Task_t *pTask);
 	virtual bool IsCurTaskContinuousMove();
+	virtual bool UsesSharedRoutes() { return true; }	// hordes chase the same marines, also where the flow fields miss
+	virtual bool FindRouteParents( int startID, int goalID, int **ppParents );
 	int TranslateSchedule( int scheduleType );
 	virtual void BuildScheduleTestBits();
 	virtual void HandleAnimEvent( animevent_t *pEvent );
@@ -0,0 +1,396 @@
+#include "cbase.h"
+#include "asw_flow_field_manager.h"
+#include "asw_marine.h"
+#include "asw_marine_resource.h"
+#include "asw_game_resource.h"
+#include "ai_basenpc.h"
+#include "ai_pathfinder.h"
+#include "ai_network.h"
+#include "ai_node.h"
+#include "tier0/fasttimer.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+ConVar asw_flow_fields( "asw_flow_fields", "1", FCVAR_CHEAT, "Aliens read routes to the marines out of flow fields instead of searching the node graph" );
+ConVar asw_flow_field_budget( "asw_flow_field_budget", "0.5", FCVAR_CHEAT, "Milliseconds per frame spent growing flow fields" );
+ConVar asw_flow_field_goal_interval( "asw_flow_field_goal_interval", "0.2", FCVAR_CHEAT, "Seconds between checks of which node each marine is nearest" );
+ConVar asw_flow_field_refresh_nodes( "asw_flow_field_refresh_nodes", "64", FCVAR_CHEAT, "Nodes per frame whose link costs are re-read for the flow fields" );
+ConVar asw_flow_field_idle_time( "asw_flow_field_idle_time", "10", FCVAR_CHEAT, "Seconds a kind of alien keeps its flow fields after it last asked for a route" );
+ConVar asw_flow_field_max_layers( "asw_flow_field_max_layers", "4", FCVAR_CHEAT, "Maximum number of alien kinds with flow fields" );
+
+// nodes expanded between budget checks
+#define ASW_FLOW_FIELD_GROW_STEP 128
+// nodes whose links are read between budget checks
+#define ASW_FLOW_GRAPH_BUILD_STEP 32
+
+CASW_Flow_Field_Manager g_ASWFlowFieldManager;
+CASW_Flow_Field_Manager* ASWFlowFieldManager() { return &g_ASWFlowFieldManager; }
+
+CASW_Flow_Field_Manager::CASW_Flow_Field_Manager() : CAutoGameSystemPerFrame( "CASW_Flow_Field_Manager" )
+{
+	m_iNextField = 0;
+	m_iFieldsGrown = 0;
+	m_iRoutesRead = 0;
+	m_iRoutesMissed = 0;
+}
+
+void CASW_Flow_Field_Manager::LevelShutdownPreEntity()
+{
+	Purge();
+}
+
+void CASW_Flow_Field_Manager::Purge()
+{
+	m_Layers.PurgeAndDeleteElements();
+	m_RouteParents.Purge();
+
+	m_iNextField = 0;
+	m_iFieldsGrown = 0;
+	m_iRoutesRead = 0;
+	m_iRoutesMissed = 0;
+}
+
+int CASW_Flow_Field_Manager::FindLayer( CAI_BaseNPC *pNPC )
+{
+	for ( int i=0;i<m_Layers.Count();i++ )
+	{
+		FlowLayer_t *pLayer = m_Layers[i];
+		if ( pLayer->m_iszClassname == pNPC->m_iClassname &&
+			pLayer->m_iHull == pNPC->GetHullType() &&
+			pLayer->m_iCapabilities == pNPC->CapabilitiesGet() )
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+void CASW_Flow_Field_Manager::RemoveLayer( int iLayer )
+{
+	delete m_Layers[iLayer];
+	m_Layers.Remove( iLayer );
+}
+
+bool CASW_Flow_Field_Manager::IsEnabled() const
+{
+	return asw_flow_fields.GetBool() && g_pBigAINet != NULL;
+}
+
+bool CASW_Flow_Field_Manager::AddLayer( CAI_BaseNPC *pNPC )
+{
+	if ( !IsEnabled() || !pNPC || !pNPC->GetPathfinder() )
+		return false;
+
+	int iLayer = FindLayer( pNPC );
+	if ( iLayer != -1 )
+	{
+		m_Layers[iLayer]->m_flLastUsed = gpGlobals->curtime;
+		return true;
+	}
+
+	if ( m_Layers.Count() >= asw_flow_field_max_layers.GetInt() )
+		return false;
+
+	// the graph is built over the next frame updates
+	FlowLayer_t *pLayer = new FlowLayer_t;
+	pLayer->m_iszClassname = pNPC->m_iClassname;
+	pLayer->m_iHull = pNPC->GetHullType();
+	pLayer->m_iCapabilities = pNPC->CapabilitiesGet();
+	pLayer->m_hNPC = pNPC;
+	pLayer->m_flLastUsed = gpGlobals->curtime;
+	pLayer->m_iRefreshNode = 0;
+	ResetLayer( pLayer );
+
+	m_Layers.AddToTail( pLayer );
+	return true;
+}
+
+void CASW_Flow_Field_Manager::ResetLayer( FlowLayer_t *pLayer )
+{
+	for ( int i=0;i<ASW_MAX_MARINE_RESOURCES;i++ )
+	{
+		MarineField_t &marine = pLayer->m_Marines[i];
+		marine.m_hMarine = NULL;
+		marine.m_Fields[0].Purge();
+		marine.m_Fields[1].Purge();
+		marine.m_iCurrent = 0;
+		marine.m_bGrowing = false;
+		marine.m_iNextGoal = NO_NODE;
+		marine.m_flNextGoalCheck = 0;
+	}
+}
+
+// starts growing the field aliens don't read, they keep reading the old one until it's done.
+//  a field that's still growing isn't started over, it grows toward the new goal once it's done
+void CASW_Flow_Field_Manager::RegrowField( FlowLayer_t *pLayer, MarineField_t &marine, int iGoalNode )
+{
+	if ( marine.m_bGrowing )
+	{
+		marine.m_iNextGoal = iGoalNode;
+		return;
+	}
+
+	marine.m_Fields[!marine.m_iCurrent].Begin( pLayer->m_Graph, iGoalNode );
+	marine.m_bGrowing = true;
+	marine.m_iNextGoal = NO_NODE;
+}
+
+void CASW_Flow_Field_Manager::UpdateLayer( FlowLayer_t *pLayer, CAI_BaseNPC *pNPC )
+{
+	CAI_Pathfinder *pPathfinder = pNPC->GetPathfinder();
+
+	if ( pLayer->m_Graph.NumNodes() != g_pBigAINet->NumNodes() )
+	{
+		// new layer or the network was rebuilt, the links are read in the frame budget
+		pLayer->m_Graph.BeginBuild( g_pBigAINet, pPathfinder );
+		pLayer->m_iRefreshNode = 0;
+		ResetLayer( pLayer );
+		return;
+	}
+
+	if ( !pLayer->m_Graph.IsBuilt() )
+		return;
+
+	// doors, dangers and stale links change what the links cost
+	int iNodes = asw_flow_field_refresh_nodes.GetInt();
+	bool bCostsChanged = pLayer->m_Graph.Refresh( g_pBigAINet, pPathfinder, pLayer->m_iRefreshNode, iNodes );
+	pLayer->m_iRefreshNode += iNodes;
+	if ( pLayer->m_iRefreshNode >= pLayer->m_Graph.NumNodes() )
+		pLayer->m_iRefreshNode = 0;
+
+	CASW_Game_Resource *pGameResource = ASWGameResource();
+
+	for ( int i=0;i<ASW_MAX_MARINE_RESOURCES;i++ )
+	{
+		MarineField_t &marine = pLayer->m_Marines[i];
+
+		CASW_Marine_Resource *pMR = pGameResource ? pGameResource->GetMarineResource(i) : NULL;
+		CASW_Marine *pMarine = pMR ? pMR->GetMarineEntity() : NULL;
+		if ( !pMarine || pMarine->GetHealth() <= 0 )
+		{
+			if ( marine.m_hMarine.Get() )
+			{
+				marine.m_hMarine = NULL;
+				marine.m_Fields[0].Purge();
+				marine.m_Fields[1].Purge();
+				marine.m_bGrowing = false;
+				marine.m_iNextGoal = NO_NODE;
+			}
+			continue;
+		}
+
+		if ( marine.m_hMarine.Get() != pMarine )
+		{
+			marine.m_hMarine = pMarine;
+			marine.m_Fields[0].Purge();
+			marine.m_Fields[1].Purge();
+			marine.m_bGrowing = false;
+			marine.m_iNextGoal = NO_NODE;
+			marine.m_flNextGoalCheck = 0;
+		}
+
+		// the goal last asked for
+		int iGoalNode = marine.m_iNextGoal;
+		if ( iGoalNode == NO_NODE )
+			iGoalNode = marine.m_Fields[ marine.m_bGrowing ? !marine.m_iCurrent : marine.m_iCurrent ].GetGoal();
+
+		if ( gpGlobals->curtime >= marine.m_flNextGoalCheck )
+		{
+			marine.m_flNextGoalCheck = gpGlobals->curtime + asw_flow_field_goal_interval.GetFloat();
+
+			int iNearestNode = pPathfinder->NearestNodeToPoint( pMarine->GetAbsOrigin() );
+			if ( iNearestNode != NO_NODE && iNearestNode != iGoalNode )
+			{
+				RegrowField( pLayer, marine, iNearestNode );
+				continue;
+			}
+		}
+
+		if ( bCostsChanged && iGoalNode != NO_NODE )
+		{
+			RegrowField( pLayer, marine, iGoalNode );
+		}
+	}
+}
+
+void CASW_Flow_Field_Manager::FrameUpdatePreEntityThink()
+{
+	if ( !m_Layers.Count() )
+		return;
+
+	if ( !IsEnabled() )
+	{
+		Purge();
+		return;
+	}
+
+	for ( int i=m_Layers.Count()-1;i>=0;i-- )
+	{
+		FlowLayer_t *pLayer = m_Layers[i];
+		if ( gpGlobals->curtime - pLayer->m_flLastUsed > asw_flow_field_idle_time.GetFloat() )
+		{
+			RemoveLayer( i );
+			continue;
+		}
+
+		// links are costed by one alien of the kind, the next one to ask stands in when it dies
+		CBaseEntity *pEntity = pLayer->m_hNPC;
+		CAI_BaseNPC *pNPC = pEntity ? pEntity->MyNPCPointer() : NULL;
+		if ( pNPC && pNPC->GetPathfinder() )
+		{
+			UpdateLayer( pLayer, pNPC );
+		}
+	}
+
+	CFastTimer timer;
+	timer.Start();
+
+	// no field grows before its graph is built
+	if ( BuildGraphs( timer ) )
+	{
+		GrowFields( timer );
+	}
+}
+
+// reads the links of unbuilt graphs, false if the budget ran out
+bool CASW_Flow_Field_Manager::BuildGraphs( CFastTimer &timer )
+{
+	for ( int i=0;i<m_Layers.Count();i++ )
+	{
+		FlowLayer_t *pLayer = m_Layers[i];
+		if ( pLayer->m_Graph.IsBuilt() )
+			continue;
+
+		CBaseEntity *pEntity = pLayer->m_hNPC;
+		CAI_BaseNPC *pNPC = pEntity ? pEntity->MyNPCPointer() : NULL;
+		if ( !pNPC || !pNPC->GetPathfinder() )
+			continue;
+
+		while ( !pLayer->m_Graph.BuildNodes( g_pBigAINet, pNPC->GetPathfinder(), ASW_FLOW_GRAPH_BUILD_STEP ) )
+		{
+			timer.End();
+			if ( timer.GetDuration().GetMillisecondsF() >= asw_flow_field_budget.GetFloat() )
+				return false;
+		}
+	}
+
+	return true;
+}
+
+// grows every growing field a step in turn, starting where the last frame's budget ran out
+void CASW_Flow_Field_Manager::GrowFields( CFastTimer &timer )
+{
+	int iNumFields = m_Layers.Count() * ASW_MAX_MARINE_RESOURCES;
+	if ( !iNumFields )
+		return;
+
+	int iIdle = 0;
+
+	for ( int i = m_iNextField % iNumFields; iIdle < iNumFields; i = ( i + 1 ) % iNumFields )
+	{
+		FlowLayer_t *pLayer = m_Layers[ i / ASW_MAX_MARINE_RESOURCES ];
+		MarineField_t &marine = pLayer->m_Marines[ i % ASW_MAX_MARINE_RESOURCES ];
+		if ( !marine.m_bGrowing || !pLayer->m_Graph.IsBuilt() )
+		{
+			iIdle++;
+			continue;
+		}
+
+		iIdle = 0;
+
+		if ( marine.m_Fields[!marine.m_iCurrent].Grow( pLayer->m_Graph, ASW_FLOW_FIELD_GROW_STEP ) )
+		{
+			marine.m_iCurrent = !marine.m_iCurrent;
+			marine.m_bGrowing = false;
+			m_iFieldsGrown++;
+
+			if ( marine.m_iNextGoal != NO_NODE )
+			{
+				RegrowField( pLayer, marine, marine.m_iNextGoal );
+			}
+		}
+
+		timer.End();
+		if ( timer.GetDuration().GetMillisecondsF() >= asw_flow_field_budget.GetFloat() )
+		{
+			m_iNextField = i + 1;
+			return;
+		}
+	}
+}
+
+bool CASW_Flow_Field_Manager::FindRouteParents( CAI_BaseNPC *pNPC, int startID, int goalID, int **ppParents )
+{
+	*ppParents = NULL;
+
+	if ( !IsEnabled() )
+		return false;
+
+	int iLayer = FindLayer( pNPC );
+	if ( iLayer == -1 )
+	{
+		// fields are there for the next route this kind asks for
+		AddLayer( pNPC );
+		return false;
+	}
+
+	FlowLayer_t *pLayer = m_Layers[iLayer];
+	pLayer->m_flLastUsed = gpGlobals->curtime;
+	if ( !pLayer->m_hNPC.Get() )
+	{
+		pLayer->m_hNPC = pNPC;
+	}
+
+	if ( pLayer->m_Graph.NumNodes() != g_pBigAINet->NumNodes() || !pLayer->m_Graph.IsBuilt() )
+		return false;
+
+	// the fields lead out of nodes aliens can't use, a search decides what to do there
+	if ( startID < 0 || startID >= g_pBigAINet->NumNodes() || pNPC->IsUnusableNode( startID, g_pBigAINet->GetNode( startID )->GetHint() ) )
+		return false;
+
+	for ( int i=0;i<ASW_MAX_MARINE_RESOURCES;i++ )
+	{
+		const MarineField_t &marine = pLayer->m_Marines[i];
+		const CAI_FlowField &field = marine.m_Fields[marine.m_iCurrent];
+
+		// no route in the field, or a goal the regrowing field doesn't reach yet, leaves it to the
+		//  shared routes, the field's costs may be a moment old
+		if ( field.IsDone() && field.GetGoal() == goalID && field.GetRouteParents( startID, m_RouteParents ) )
+		{
+			*ppParents = m_RouteParents.Base();
+			m_iRoutesRead++;
+			return true;
+		}
+	}
+
+	m_iRoutesMissed++;
+	return false;
+}
+
+void CASW_Flow_Field_Manager::Report()
+{
+	Msg( "%d flow field layers\n", m_Layers.Count() );
+
+	for ( int i=0;i<m_Layers.Count();i++ )
+	{
+		FlowLayer_t *pLayer = m_Layers[i];
+		Msg( "  %s hull %d: %d nodes, %d links\n", STRING( pLayer->m_iszClassname ), pLayer->m_iHull, pLayer->m_Graph.NumNodes(), pLayer->m_Graph.NumEdges() );
+
+		for ( int j=0;j<ASW_MAX_MARINE_RESOURCES;j++ )
+		{
+			MarineField_t &marine = pLayer->m_Marines[j];
+			if ( !marine.m_hMarine.Get() )
+				continue;
+
+			Msg( "    marine %d: field to node %d%s\n", j, marine.m_Fields[marine.m_iCurrent].GetGoal(), marine.m_bGrowing ? ", regrowing" : "" );
+		}
+	}
+
+	Msg( "  %d fields grown, %d routes read, %d routes missed\n", m_iFieldsGrown, m_iRoutesRead, m_iRoutesMissed );
+}
+
+CON_COMMAND_F( asw_flow_field_report, "Prints the state of the aliens' flow fields to the marines", FCVAR_CHEAT )
+{
+	ASWFlowFieldManager()->Report();
+}
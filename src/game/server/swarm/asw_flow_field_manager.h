@@ -0,0 +1,84 @@
+#ifndef _INCLUDED_ASW_FLOW_FIELD_MANAGER_H
+#define _INCLUDED_ASW_FLOW_FIELD_MANAGER_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "igamesystem.h"
+#include "ai_flowfield.h"
+#include "asw_shareddefs.h"
+
+class CAI_BaseNPC;
+class CFastTimer;
+
+// Keeps a flow field toward every marine for each kind of alien chasing them, so an alien
+//  reads its route out of the field instead of searching the node graph.  Fields follow the
+//  marines' nearest nodes and are regrown while the previous one is still read.  Graphs are
+//  built and fields grown in turns under asw_flow_field_budget ms per frame.  Link costs are
+//  re-read a few nodes per frame, a change regrows the fields too.
+
+class CASW_Flow_Field_Manager : public CAutoGameSystemPerFrame
+{
+public:
+	CASW_Flow_Field_Manager();
+
+	virtual void LevelShutdownPreEntity();
+	virtual void FrameUpdatePreEntityThink();
+
+	// aliens look up their routes to the marines here first, g_AI_PathRequestManager shares the ones the fields miss
+	bool IsEnabled() const;
+
+	// starts keeping fields for aliens like pNPC, false if flow fields are off
+	bool AddLayer( CAI_BaseNPC *pNPC );
+
+	// true if goalID is where a marine's field leads and it reached startID, *ppParents is then
+	//  the route for MakeRouteFromParents
+	bool FindRouteParents( CAI_BaseNPC *pNPC, int startID, int goalID, int **ppParents );
+
+	void Purge();
+	void Report();
+
+private:
+	struct MarineField_t
+	{
+		EHANDLE m_hMarine;
+		CAI_FlowField m_Fields[2];
+		int m_iCurrent;				// the finished field aliens read, the other one grows
+		bool m_bGrowing;
+		int m_iNextGoal;			// regrow asked for while growing, started when it's done
+		float m_flNextGoalCheck;
+	};
+
+	// fields of one kind of alien, costs come from one of them
+	struct FlowLayer_t
+	{
+		string_t m_iszClassname;
+		int m_iHull;
+		int m_iCapabilities;
+		EHANDLE m_hNPC;
+		float m_flLastUsed;
+		CAI_FlowGraph m_Graph;
+		int m_iRefreshNode;
+		MarineField_t m_Marines[ASW_MAX_MARINE_RESOURCES];
+	};
+
+	int FindLayer( CAI_BaseNPC *pNPC );
+	void RemoveLayer( int iLayer );
+	void ResetLayer( FlowLayer_t *pLayer );
+	void UpdateLayer( FlowLayer_t *pLayer, CAI_BaseNPC *pNPC );
+	void RegrowField( FlowLayer_t *pLayer, MarineField_t &marine, int iGoalNode );
+	bool BuildGraphs( CFastTimer &timer );
+	void GrowFields( CFastTimer &timer );
+
+	CUtlVector<FlowLayer_t *> m_Layers;
+	CUtlVector<int> m_RouteParents;
+	int m_iNextField;			// layer * ASW_MAX_MARINE_RESOURCES + marine to grow first next frame
+
+	int m_iFieldsGrown;
+	int m_iRoutesRead;
+	int m_iRoutesMissed;
+};
+
+CASW_Flow_Field_Manager* ASWFlowFieldManager();
+
+#endif // _INCLUDED_ASW_FLOW_FIELD_MANAGER_H
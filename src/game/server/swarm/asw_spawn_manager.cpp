@@ -16,6 +16,10 @@
 #include "triggers.h"
 #include "datacache/imdlcache.h"
 #include "ai_link.h"
+#include "ai_pathfinder.h"
+#include "ai_pathrequest.h"
+#include "asw_flow_field_manager.h"
+#include "tier0/fasttimer.h"
 #include "asw_alien.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
@@ -26,6 +30,7 @@ CASW_Spawn_Manager* ASWSpawnManager() { return &g_Spawn_Manager; }
 
 #define CANDIDATE_ALIEN_HULL 11		// TODO: have this use the hull of the alien type we're spawning a horde of?
 #define MARINE_NEAR_DISTANCE 740.0f
+#define CANDIDATE_GRID_CELL_SIZE 512.0f
 
 extern ConVar asw_director_debug;
 ConVar asw_horde_min_distance("asw_horde_min_distance", "800", FCVAR_CHEAT, "Minimum distance away from the marines the horde can spawn" );
@@ -39,6 +44,11 @@ CASW_Spawn_Manager::CASW_Spawn_Manager()
 {
 	m_nAwakeAliens = 0;
 	m_nAwakeDrones = 0;
+	m_iCandidateGridStamp = 0;
+	m_iCandidateGridWidth = 0;
+	m_iCandidateGridHeight = 0;
+	m_iCandidateGridNetworkNodes = 0;
+	m_iMarineCacheTick = -1;
 }
 
 CASW_Spawn_Manager::~CASW_Spawn_Manager()
@@ -107,8 +117,10 @@ void CASW_Spawn_Manager::LevelInitPostEntity()
 
 	m_northCandidateNodes.Purge();
 	m_southCandidateNodes.Purge();
+	m_iMarineCacheTick = -1;
 
 	FindEscapeTriggers();
+	BuildCandidateGrid();
 }
 
 void CASW_Spawn_Manager::OnAlienWokeUp( CASW_Alien *pAlien )
@@ -201,6 +213,10 @@ void CASW_Spawn_Manager::Update()
 		{
 			int iToSpawn = MIN( m_iHordeToSpawn, asw_max_alien_batch.GetInt() );
 			int iSpawned = SpawnAlienBatch( asw_horde_class.GetString(), iToSpawn, m_vecHordePosition, m_angHordeAngle, 0 );
+			if ( iSpawned > 0 )
+			{
+				RequestHordeRoutes( asw_horde_class.GetString() );
+			}
 			m_iHordeToSpawn -= iSpawned;
 			if ( m_iHordeToSpawn <= 0 )
 			{
@@ -284,7 +300,7 @@ bool CASW_Spawn_Manager::SpawnAlientAtRandomNode()
 			continue;
 
 		float flDistance = 0;
-		CASW_Marine *pMarine = dynamic_cast<CASW_Marine*>(UTIL_ASW_NearestMarine( pNode->GetPosition( CANDIDATE_ALIEN_HULL ), flDistance ));
+		CASW_Marine *pMarine = NearestCachedMarine( pNode->GetPosition( CANDIDATE_ALIEN_HULL ), flDistance );
 		if ( !pMarine )
 			return false;
 
@@ -364,6 +380,40 @@ bool CASW_Spawn_Manager::AddHorde( int iHordeSize )
 	return true;
 }
 
+// start flow fields or queue shared routes from the horde to each marine, so the aliens don't all search the node graph when they start chasing
+void CASW_Spawn_Manager::RequestHordeRoutes( const char *szAlienClass )
+{
+	CBaseEntity *pEntity = gEntList.FindEntityByClassnameNearest( szAlienClass, m_vecHordePosition, 512.0f );
+	CAI_BaseNPC *pAlien = pEntity ? pEntity->MyNPCPointer() : NULL;
+	if ( !pAlien || !pAlien->UsesSharedRoutes() || !pAlien->GetPathfinder() )
+		return;
+
+	// the marines' flow fields already lead the horde to them, routes they miss are shared on demand
+	if ( ASWFlowFieldManager()->AddLayer( pAlien ) )
+		return;
+
+	CASW_Game_Resource *pGameResource = ASWGameResource();
+	if ( !pGameResource )
+		return;
+
+	for ( int i=0;i<pGameResource->GetMaxMarineResources();i++ )
+	{
+		CASW_Marine_Resource *pMR = pGameResource->GetMarineResource(i);
+		if ( !pMR )
+			continue;
+
+		CASW_Marine *pMarine = pMR->GetMarineEntity();
+		if ( !pMarine || pMarine->GetHealth() <= 0 )
+			continue;
+
+		int iGoalNode = pAlien->GetPathfinder()->NearestNodeToPoint( pMarine->GetAbsOrigin() );
+		if ( iGoalNode != NO_NODE )
+		{
+			g_AI_PathRequestManager.RequestRoutes( pAlien, iGoalNode );
+		}
+	}
+}
+
 CAI_Network* CASW_Spawn_Manager::GetNetwork()
 {
 	return g_pBigAINet;
@@ -384,37 +434,110 @@ void CASW_Spawn_Manager::UpdateCandidateNodes()
 		return;
 	}
 
-	CASW_Game_Resource *pGameResource = ASWGameResource();
-	if ( !pGameResource )
+	UpdateMarinePositions();
+	if ( !m_CachedMarinePositions.Count() )		// no live marines
 		return;
 
-	Vector vecSouthMarine = vec3_origin;
-	Vector vecNorthMarine = vec3_origin;
-	for ( int i=0;i<pGameResource->GetMaxMarineResources();i++ )
-	{
-		CASW_Marine_Resource *pMR = pGameResource->GetMarineResource(i);
-		if ( !pMR )
-			continue;
+	FindCandidateNodes( m_northCandidateNodes, m_southCandidateNodes );
 
-		CASW_Marine *pMarine = pMR->GetMarineEntity();
-		if ( !pMarine || pMarine->GetHealth() <= 0 )
-			continue;
-
-		if ( vecSouthMarine == vec3_origin || vecSouthMarine.y > pMarine->GetAbsOrigin().y )
+	if ( asw_director_debug.GetInt() == 3 )
+	{
+		for ( int i=0;i<m_northCandidateNodes.Count();i++ )
 		{
-			vecSouthMarine = pMarine->GetAbsOrigin();
+			Vector vecPos = GetNetwork()->GetNode( m_northCandidateNodes[i] )->GetPosition( CANDIDATE_ALIEN_HULL );
+			NDebugOverlay::Box( vecPos, -Vector( 5, 5, 5 ), Vector( 5, 5, 5 ), 32, 32, 128, 10, 60.0f );
 		}
-		if ( vecNorthMarine == vec3_origin || vecNorthMarine.y < pMarine->GetAbsOrigin().y )
+		for ( int i=0;i<m_southCandidateNodes.Count();i++ )
 		{
-			vecNorthMarine = pMarine->GetAbsOrigin();
+			Vector vecPos = GetNetwork()->GetNode( m_southCandidateNodes[i] )->GetPosition( CANDIDATE_ALIEN_HULL );
+			NDebugOverlay::Box( vecPos, -Vector( 5, 5, 5 ), Vector( 5, 5, 5 ), 128, 32, 32, 10, 60.0f );
 		}
 	}
-	if ( vecSouthMarine == vec3_origin || vecNorthMarine == vec3_origin )		// no live marines
+}
+
+static int __cdecl CandidateNodeSort( const int *pLeft, const int *pRight )
+{
+	return *pLeft - *pRight;
+}
+
+// finds ground nodes between asw_horde_min_distance and asw_horde_max_distance from the nearest marine,
+//  only searching the grid cells within range of a marine
+void CASW_Spawn_Manager::FindCandidateNodes( CUtlVector<int> &northNodes, CUtlVector<int> &southNodes )
+{
+	northNodes.RemoveAll();
+	southNodes.RemoveAll();
+
+	if ( m_iCandidateGridNetworkNodes != GetNetwork()->NumNodes() )		// network was loaded or rebuilt after level init
+	{
+		BuildCandidateGrid();
+	}
+
+	UpdateMarinePositions();
+	if ( !m_iCandidateGridWidth || !m_CachedMarinePositions.Count() )
 		return;
-	
+
+	float flMinDistance = asw_horde_min_distance.GetFloat();
+	float flMaxDistance = asw_horde_max_distance.GetFloat();
+
+	m_iCandidateGridStamp++;
+
+	for ( int m=0;m<m_CachedMarinePositions.Count();m++ )
+	{
+		const Vector &vecMarine = m_CachedMarinePositions[m];
+		int iMinX = GetCandidateGridCell( vecMarine.x - flMaxDistance, m_vecCandidateGridOrigin.x, m_iCandidateGridWidth );
+		int iMaxX = GetCandidateGridCell( vecMarine.x + flMaxDistance, m_vecCandidateGridOrigin.x, m_iCandidateGridWidth );
+		int iMinY = GetCandidateGridCell( vecMarine.y - flMaxDistance, m_vecCandidateGridOrigin.y, m_iCandidateGridHeight );
+		int iMaxY = GetCandidateGridCell( vecMarine.y + flMaxDistance, m_vecCandidateGridOrigin.y, m_iCandidateGridHeight );
+
+		for ( int y=iMinY;y<=iMaxY;y++ )
+		{
+			for ( int x=iMinX;x<=iMaxX;x++ )
+			{
+				// cells near several marines are only searched once
+				int iCell = y * m_iCandidateGridWidth + x;
+				if ( m_CandidateGridStamps[iCell] == m_iCandidateGridStamp )
+					continue;
+
+				m_CandidateGridStamps[iCell] = m_iCandidateGridStamp;
+
+				for ( int k=m_CandidateGridCells[iCell];k<m_CandidateGridCells[iCell+1];k++ )
+				{
+					const Vector &vecPos = m_CandidateGridPositions[k];
+
+					float flDistance = 0;
+					NearestCachedMarine( vecPos, flDistance );
+					if ( flDistance > flMaxDistance || flDistance < flMinDistance )
+						continue;
+
+					if ( vecPos.y >= m_vecSouthMarine.y )
+					{
+						northNodes.AddToTail( m_CandidateGridNodes[k] );
+					}
+					if ( vecPos.y <= m_vecNorthMarine.y )
+					{
+						southNodes.AddToTail( m_CandidateGridNodes[k] );
+					}
+				}
+			}
+		}
+	}
+
+	// same order as a scan of the whole network
+	northNodes.Sort( CandidateNodeSort );
+	southNodes.Sort( CandidateNodeSort );
+}
+
+// the scan of every node the grid replaced, kept to check the grid against
+void CASW_Spawn_Manager::FindCandidateNodesLinear( CUtlVector<int> &northNodes, CUtlVector<int> &southNodes )
+{
+	northNodes.RemoveAll();
+	southNodes.RemoveAll();
+
+	UpdateMarinePositions();
+	if ( !m_CachedMarinePositions.Count() )
+		return;
+
 	int iNumNodes = GetNetwork()->NumNodes();
-	m_northCandidateNodes.Purge();
-	m_southCandidateNodes.Purge();
 	for ( int i=0 ; i<iNumNodes; i++ )
 	{
 		CAI_Node *pNode = GetNetwork()->GetNode( i );
@@ -436,7 +559,7 @@ void CASW_Spawn_Manager::UpdateCandidateNodes()
 		bool bInsideEscapeArea = false;
 		for ( int d=0; d<m_EscapeTriggers.Count(); d++ )
 		{
-			if ( m_EscapeTriggers[d]->CollisionProp()->IsPointInBounds( vecPos ) )
+			if ( m_EscapeTriggers[d].Get() && m_EscapeTriggers[d]->CollisionProp()->IsPointInBounds( vecPos ) )
 			{
 				bInsideEscapeArea = true;
 				break;
@@ -445,23 +568,241 @@ void CASW_Spawn_Manager::UpdateCandidateNodes()
 		if ( bInsideEscapeArea )
 			continue;
 
-		if ( vecPos.y >= vecSouthMarine.y )
+		if ( vecPos.y >= m_vecSouthMarine.y )
 		{
-			if ( asw_director_debug.GetInt() == 3 )
-			{
-				NDebugOverlay::Box( vecPos, -Vector( 5, 5, 5 ), Vector( 5, 5, 5 ), 32, 32, 128, 10, 60.0f );
-			}
-			m_northCandidateNodes.AddToTail( i );
+			northNodes.AddToTail( i );
 		}
-		if ( vecPos.y <= vecNorthMarine.y )
+		if ( vecPos.y <= m_vecNorthMarine.y )
+		{
+			southNodes.AddToTail( i );
+		}
+	}
+}
+
+int CASW_Spawn_Manager::GetCandidateGridCell( float flPos, float flOrigin, int iCells )
+{
+	int iCell = (int) floor( ( flPos - flOrigin ) / CANDIDATE_GRID_CELL_SIZE );
+	return clamp( iCell, 0, iCells - 1 );
+}
+
+// buckets the ground nodes by position, leaving out those inside escape triggers since spawns never come from there
+void CASW_Spawn_Manager::BuildCandidateGrid()
+{
+	m_CandidateGridCells.Purge();
+	m_CandidateGridNodes.Purge();
+	m_CandidateGridPositions.Purge();
+	m_CandidateGridStamps.Purge();
+	m_iCandidateGridStamp = 0;
+	m_iCandidateGridWidth = 0;
+	m_iCandidateGridHeight = 0;
+	m_iCandidateGridNetworkNodes = GetNetwork() ? GetNetwork()->NumNodes() : 0;
+
+	CUtlVector<int> nodes;
+	CUtlVector<Vector> positions;
+	Vector2D vecMins( FLT_MAX, FLT_MAX );
+	Vector2D vecMaxs( -FLT_MAX, -FLT_MAX );
+
+	for ( int i=0;i<m_iCandidateGridNetworkNodes;i++ )
+	{
+		CAI_Node *pNode = GetNetwork()->GetNode( i );
+		if ( !pNode || pNode->GetType() != NODE_GROUND )
+			continue;
+
+		Vector vecPos = pNode->GetPosition( CANDIDATE_ALIEN_HULL );
+
+		bool bInsideEscapeArea = false;
+		for ( int d=0; d<m_EscapeTriggers.Count(); d++ )
 		{
-			m_southCandidateNodes.AddToTail( i );
-			if ( asw_director_debug.GetInt() == 3 )
+			if ( m_EscapeTriggers[d].Get() && m_EscapeTriggers[d]->CollisionProp()->IsPointInBounds( vecPos ) )
 			{
-				NDebugOverlay::Box( vecPos, -Vector( 5, 5, 5 ), Vector( 5, 5, 5 ), 128, 32, 32, 10, 60.0f );
+				bInsideEscapeArea = true;
+				break;
 			}
 		}
+		if ( bInsideEscapeArea )
+			continue;
+
+		nodes.AddToTail( i );
+		positions.AddToTail( vecPos );
+		vecMins.x = MIN( vecMins.x, vecPos.x );
+		vecMins.y = MIN( vecMins.y, vecPos.y );
+		vecMaxs.x = MAX( vecMaxs.x, vecPos.x );
+		vecMaxs.y = MAX( vecMaxs.y, vecPos.y );
+	}
+
+	if ( !nodes.Count() )
+		return;
+
+	m_vecCandidateGridOrigin = vecMins;
+	m_iCandidateGridWidth = (int) ( ( vecMaxs.x - vecMins.x ) / CANDIDATE_GRID_CELL_SIZE ) + 1;
+	m_iCandidateGridHeight = (int) ( ( vecMaxs.y - vecMins.y ) / CANDIDATE_GRID_CELL_SIZE ) + 1;
+	int iNumCells = m_iCandidateGridWidth * m_iCandidateGridHeight;
+
+	// count the nodes in each cell, then place them so each cell's nodes are contiguous and in node order
+	CUtlVector<int> nodeCells;
+	nodeCells.SetCount( nodes.Count() );
+	m_CandidateGridCells.SetCount( iNumCells + 1 );
+	for ( int i=0;i<=iNumCells;i++ )
+	{
+		m_CandidateGridCells[i] = 0;
+	}
+	for ( int i=0;i<nodes.Count();i++ )
+	{
+		nodeCells[i] = GetCandidateGridCell( positions[i].y, vecMins.y, m_iCandidateGridHeight ) * m_iCandidateGridWidth +
+			GetCandidateGridCell( positions[i].x, vecMins.x, m_iCandidateGridWidth );
+		m_CandidateGridCells[ nodeCells[i] + 1 ]++;
+	}
+	for ( int i=0;i<iNumCells;i++ )
+	{
+		m_CandidateGridCells[i+1] += m_CandidateGridCells[i];
+	}
+
+	CUtlVector<int> cellFill;
+	cellFill.SetCount( iNumCells );
+	for ( int i=0;i<iNumCells;i++ )
+	{
+		cellFill[i] = m_CandidateGridCells[i];
 	}
+
+	m_CandidateGridNodes.SetCount( nodes.Count() );
+	m_CandidateGridPositions.SetCount( nodes.Count() );
+	for ( int i=0;i<nodes.Count();i++ )
+	{
+		int k = cellFill[ nodeCells[i] ]++;
+		m_CandidateGridNodes[k] = nodes[i];
+		m_CandidateGridPositions[k] = positions[i];
+	}
+
+	m_CandidateGridStamps.SetCount( iNumCells );
+	for ( int i=0;i<iNumCells;i++ )
+	{
+		m_CandidateGridStamps[i] = 0;
+	}
+}
+
+// caches where the live marines are, node queries in the same tick don't walk the marine resources again
+void CASW_Spawn_Manager::UpdateMarinePositions()
+{
+	if ( m_iMarineCacheTick == gpGlobals->tickcount )
+		return;
+
+	m_iMarineCacheTick = gpGlobals->tickcount;
+	m_CachedMarines.RemoveAll();
+	m_CachedMarinePositions.RemoveAll();
+	m_vecSouthMarine = vec3_origin;
+	m_vecNorthMarine = vec3_origin;
+
+	CASW_Game_Resource *pGameResource = ASWGameResource();
+	if ( !pGameResource )
+		return;
+
+	for ( int i=0;i<pGameResource->GetMaxMarineResources();i++ )
+	{
+		CASW_Marine_Resource *pMR = pGameResource->GetMarineResource(i);
+		if ( !pMR )
+			continue;
+
+		CASW_Marine *pMarine = pMR->GetMarineEntity();
+		if ( !pMarine || pMarine->GetHealth() <= 0 )
+			continue;
+
+		m_CachedMarines.AddToTail( pMarine );
+		m_CachedMarinePositions.AddToTail( pMarine->GetAbsOrigin() );
+
+		if ( m_vecSouthMarine == vec3_origin || m_vecSouthMarine.y > pMarine->GetAbsOrigin().y )
+		{
+			m_vecSouthMarine = pMarine->GetAbsOrigin();
+		}
+		if ( m_vecNorthMarine == vec3_origin || m_vecNorthMarine.y < pMarine->GetAbsOrigin().y )
+		{
+			m_vecNorthMarine = pMarine->GetAbsOrigin();
+		}
+	}
+}
+
+// as UTIL_ASW_NearestMarine, over the cached marines
+CASW_Marine* CASW_Spawn_Manager::NearestCachedMarine( const Vector &vecPos, float &flDistance )
+{
+	UpdateMarinePositions();
+
+	flDistance = -1.0f;
+	int iNearest = -1;
+	for ( int i=0;i<m_CachedMarinePositions.Count();i++ )
+	{
+		float flMarineDistance = m_CachedMarinePositions[i].DistTo( vecPos );
+		if ( flDistance == -1.0f || flMarineDistance < flDistance )
+		{
+			flDistance = flMarineDistance;
+			iNearest = i;
+		}
+	}
+	return iNearest != -1 ? m_CachedMarines[iNearest].Get() : NULL;
+}
+
+void CASW_Spawn_Manager::BenchCandidateNodes( int iIterations )
+{
+	if ( !GetNetwork() || !GetNetwork()->NumNodes() )
+	{
+		Msg( "No node network\n" );
+		return;
+	}
+
+	UpdateMarinePositions();
+	if ( !m_CachedMarinePositions.Count() )
+	{
+		Msg( "No live marines\n" );
+		return;
+	}
+
+	CUtlVector<int> northNodes, southNodes, linearNorthNodes, linearSouthNodes;
+
+	CFastTimer timer;
+	timer.Start();
+	BuildCandidateGrid();
+	timer.End();
+	float flBuildTime = timer.GetDuration().GetMillisecondsF();
+
+	timer.Start();
+	for ( int i=0;i<iIterations;i++ )
+	{
+		FindCandidateNodes( northNodes, southNodes );
+	}
+	timer.End();
+	float flGridTime = timer.GetDuration().GetMillisecondsF();
+
+	timer.Start();
+	for ( int i=0;i<iIterations;i++ )
+	{
+		FindCandidateNodesLinear( linearNorthNodes, linearSouthNodes );
+	}
+	timer.End();
+	float flLinearTime = timer.GetDuration().GetMillisecondsF();
+
+	Msg( "%d nodes, %d in the candidate grid of %d x %d cells, %d marines, %d escape triggers\n", GetNetwork()->NumNodes(), m_CandidateGridNodes.Count(),
+		m_iCandidateGridWidth, m_iCandidateGridHeight, m_CachedMarinePositions.Count(), m_EscapeTriggers.Count() );
+	Msg( "  grid build: %.4f ms\n", flBuildTime );
+	Msg( "  grid:       %.4f ms per update\n", flGridTime / iIterations );
+	Msg( "  linear:     %.4f ms per update\n", flLinearTime / iIterations );
+
+	bool bMatch = northNodes.Count() == linearNorthNodes.Count() && southNodes.Count() == linearSouthNodes.Count();
+	for ( int i=0;bMatch && i<northNodes.Count();i++ )
+	{
+		bMatch = northNodes[i] == linearNorthNodes[i];
+	}
+	for ( int i=0;bMatch && i<southNodes.Count();i++ )
+	{
+		bMatch = southNodes[i] == linearSouthNodes[i];
+	}
+
+	if ( bMatch )
+		Msg( "  %d north and %d south candidates match\n", northNodes.Count(), southNodes.Count() );
+	else
+		Warning( "  candidates differ: grid %d north %d south, linear %d north %d south\n", northNodes.Count(), southNodes.Count(), linearNorthNodes.Count(), linearSouthNodes.Count() );
+}
+
+CON_COMMAND_F( asw_spawn_candidate_bench, "Times finding horde candidate nodes with the node grid and with a full network scan. Arguments: [iterations]", FCVAR_CHEAT )
+{
+	ASWSpawnManager()->BenchCandidateNodes( args.ArgC() > 1 ? MAX( 1, atoi( args[1] ) ) : 100 );
 }
 
 bool CASW_Spawn_Manager::FindHordePosition()
@@ -504,7 +845,7 @@ bool CASW_Spawn_Manager::FindHordePosition()
 			continue;
 
 		float flDistance = 0;
-		CASW_Marine *pMarine = dynamic_cast<CASW_Marine*>(UTIL_ASW_NearestMarine( pNode->GetPosition( CANDIDATE_ALIEN_HULL ), flDistance ));
+		CASW_Marine *pMarine = NearestCachedMarine( pNode->GetPosition( CANDIDATE_ALIEN_HULL ), flDistance );
 		if ( !pMarine )
 		{
 			if ( asw_director_debug.GetBool() )
@@ -9,6 +9,7 @@ class CTriggerMultiple;
 struct AI_Waypoint_t;
 class CAI_Node;
 class CASW_Alien;
+class CASW_Marine;
 
 // The spawn manager can spawn aliens and groups of aliens
 
@@ -74,9 +75,19 @@ public:
 	bool SpawnRandomShieldbug();
 	bool SpawnRandomParasitePack( int nParasites );
 
+	// times the candidate node grid against a scan of the whole network and checks they agree
+	void BenchCandidateNodes( int iIterations );
+
 private:
 	void UpdateCandidateNodes();
+	void FindCandidateNodes( CUtlVector<int> &northNodes, CUtlVector<int> &southNodes );
+	void FindCandidateNodesLinear( CUtlVector<int> &northNodes, CUtlVector<int> &southNodes );
+	void BuildCandidateGrid();
+	int GetCandidateGridCell( float flPos, float flOrigin, int iCells );
+	void UpdateMarinePositions();
+	CASW_Marine* NearestCachedMarine( const Vector &vecPos, float &flDistance );
 	bool FindHordePosition();
+	void RequestHordeRoutes( const char *szAlienClass );
 	CAI_Network* GetNetwork();
 	bool SpawnAlientAtRandomNode();
 	void FindEscapeTriggers();
@@ -99,6 +110,24 @@ private:
 	CUtlVector<int> m_southCandidateNodes;
 	CountdownTimer m_CandidateUpdateTimer;
 
+	// ground nodes outside the escape areas, bucketed on a 2D grid so candidates are found around the marines
+	CUtlVector<int> m_CandidateGridCells;			// first entry of each cell, one more than there are cells
+	CUtlVector<int> m_CandidateGridNodes;
+	CUtlVector<Vector> m_CandidateGridPositions;
+	CUtlVector<int> m_CandidateGridStamps;			// cells already searched by this update
+	int m_iCandidateGridStamp;
+	Vector2D m_vecCandidateGridOrigin;
+	int m_iCandidateGridWidth;
+	int m_iCandidateGridHeight;
+	int m_iCandidateGridNetworkNodes;
+
+	// live marines, refreshed at most once per tick
+	CUtlVector< CHandle<CASW_Marine> > m_CachedMarines;
+	CUtlVector<Vector> m_CachedMarinePositions;
+	Vector m_vecSouthMarine;
+	Vector m_vecNorthMarine;
+	int m_iMarineCacheTick;
+
 	typedef CHandle<CTriggerMultiple> TriggerMultiple_t;
 	CUtlVector<TriggerMultiple_t> m_EscapeTriggers;
 };
@@ -0,0 +1,524 @@
+#include "cbase.h"
+#include "deferred/deferred_shared_common.h"
+
+#ifdef CLIENT_DLL
+#include "vstdlib/random.h"
+#endif
+
+#define LIGHTCODEC_POS_BITS 18
+#define LIGHTCODEC_POS_SCALE 8.0f
+#define LIGHTCODEC_ANGLE_BITS 12
+#define LIGHTCODEC_COLOR_BITS 8
+#define LIGHTCODEC_COLOR_SCALE 255.0f
+#define LIGHTCODEC_RADIUS_BITS 18
+#define LIGHTCODEC_RADIUS_SCALE 4.0f
+#define LIGHTCODEC_POWER_BITS 10
+#define LIGHTCODEC_POWER_SCALE 64.0f
+#define LIGHTCODEC_CONE_BITS 12
+#define LIGHTCODEC_CONE_SCALE 16.0f
+#define LIGHTCODEC_RANGE_BITS 16
+
+// amount, speed, smooth, random
+static const int g_iStyleBits[ 4 ] = { 10, 14, 8, 8 };
+static const float g_flStyleScale[ 4 ] = { 256.0f, 16.0f, 255.0f, 255.0f };
+
+void defLightNetData_t::Init()
+{
+	pos.Init();
+	ang.Init();
+
+	col_diffuse.Init( 1, 1, 1 );
+	col_ambient.Init();
+
+	flRadius = 256.0f;
+	flFalloffPower = 2.0f;
+	flSpotCone_Inner = 35.0f;
+	flSpotCone_Outer = 45.0f;
+
+	iVisible_Dist = 2048;
+	iVisible_Range = 512;
+	iShadow_Dist = 1536;
+	iShadow_Range = 512;
+
+	flStyle_Amount = 0;
+	flStyle_Speed = 0;
+	flStyle_Smooth = 0;
+	flStyle_Random = 0;
+	iStyleSeed = 0;
+
+	iLighttype = DEFLIGHTTYPE_POINT;
+	iFlags = DEFLIGHT_ENABLED;
+	iCookieIndex = 0;
+}
+
+static uint QuantizeUnsigned( float flValue, float flScale, int iBits )
+{
+	const float flMax = ( 1 << iBits ) - 1;
+	return (uint)clamp( flValue * flScale + 0.5f, 0.0f, flMax );
+}
+
+static uint QuantizeAngle( float flAngle )
+{
+	return (uint)( anglemod( flAngle ) * ( 1 << LIGHTCODEC_ANGLE_BITS ) / 360.0f + 0.5f ) &
+		( ( 1 << LIGHTCODEC_ANGLE_BITS ) - 1 );
+}
+
+static void QuantizeColor( const Vector &col, uint *pOut, float &flScale )
+{
+	flScale = MAX( 0.0f, MAX( col.x, MAX( col.y, col.z ) ) );
+
+	for ( int i = 0; i < 3; i++ )
+		pOut[ i ] = ( flScale > 0.0f ) ? QuantizeUnsigned( col[ i ] / flScale, LIGHTCODEC_COLOR_SCALE, LIGHTCODEC_COLOR_BITS ) : 0;
+}
+
+static void DequantizeColor( const uint *pColor, float flScale, Vector &col )
+{
+	for ( int i = 0; i < 3; i++ )
+		col[ i ] = pColor[ i ] / LIGHTCODEC_COLOR_SCALE * flScale;
+}
+
+void CDeferredLightCodec::Quantize( const defLightNetData_t &l, quantized_t &q )
+{
+	for ( int i = 0; i < 3; i++ )
+	{
+		q.pos[ i ] = QuantizeUnsigned( l.pos[ i ] + MAX_COORD_INTEGER, LIGHTCODEC_POS_SCALE, LIGHTCODEC_POS_BITS );
+		q.ang[ i ] = QuantizeAngle( l.ang[ i ] );
+	}
+
+	QuantizeColor( l.col_diffuse, q.diffuse, q.flDiffuseScale );
+	QuantizeColor( l.col_ambient, q.ambient, q.flAmbientScale );
+
+	q.radius = QuantizeUnsigned( l.flRadius, LIGHTCODEC_RADIUS_SCALE, LIGHTCODEC_RADIUS_BITS );
+	q.power = QuantizeUnsigned( l.flFalloffPower, LIGHTCODEC_POWER_SCALE, LIGHTCODEC_POWER_BITS );
+	q.cone[ 0 ] = QuantizeUnsigned( l.flSpotCone_Inner, LIGHTCODEC_CONE_SCALE, LIGHTCODEC_CONE_BITS );
+	q.cone[ 1 ] = QuantizeUnsigned( l.flSpotCone_Outer, LIGHTCODEC_CONE_SCALE, LIGHTCODEC_CONE_BITS );
+
+	q.ranges[ 0 ] = clamp( l.iVisible_Dist, 0, ( 1 << LIGHTCODEC_RANGE_BITS ) - 1 );
+	q.ranges[ 1 ] = clamp( l.iVisible_Range, 0, ( 1 << LIGHTCODEC_RANGE_BITS ) - 1 );
+	q.ranges[ 2 ] = clamp( l.iShadow_Dist, 0, ( 1 << LIGHTCODEC_RANGE_BITS ) - 1 );
+	q.ranges[ 3 ] = clamp( l.iShadow_Range, 0, ( 1 << LIGHTCODEC_RANGE_BITS ) - 1 );
+
+	const float flStyle[ 4 ] = { l.flStyle_Amount, l.flStyle_Speed, l.flStyle_Smooth, l.flStyle_Random };
+	for ( int i = 0; i < 4; i++ )
+		q.style[ i ] = QuantizeUnsigned( flStyle[ i ], g_flStyleScale[ i ], g_iStyleBits[ i ] );
+	q.seed = l.iStyleSeed & DEFLIGHT_SEED_MAX;
+
+	q.type = l.iLighttype & ( ( 1 << MAX_DEFLIGHTTYPE_BITS ) - 1 );
+	q.flags = l.iFlags & ( ( 1 << DEFLIGHT_FLAGS_MAX_SHARED_BITS ) - 1 );
+	q.cookie = l.iCookieIndex & ( MAX_COOKIE_TEXTURES - 1 );
+}
+
+void CDeferredLightCodec::Dequantize( const quantized_t &q, defLightNetData_t &l )
+{
+	for ( int i = 0; i < 3; i++ )
+	{
+		l.pos[ i ] = q.pos[ i ] / LIGHTCODEC_POS_SCALE - MAX_COORD_INTEGER;
+		l.ang[ i ] = AngleNormalize( q.ang[ i ] * 360.0f / ( 1 << LIGHTCODEC_ANGLE_BITS ) );
+	}
+
+	DequantizeColor( q.diffuse, q.flDiffuseScale, l.col_diffuse );
+	DequantizeColor( q.ambient, q.flAmbientScale, l.col_ambient );
+
+	l.flRadius = q.radius / LIGHTCODEC_RADIUS_SCALE;
+	l.flFalloffPower = q.power / LIGHTCODEC_POWER_SCALE;
+	l.flSpotCone_Inner = q.cone[ 0 ] / LIGHTCODEC_CONE_SCALE;
+	l.flSpotCone_Outer = q.cone[ 1 ] / LIGHTCODEC_CONE_SCALE;
+
+	l.iVisible_Dist = q.ranges[ 0 ];
+	l.iVisible_Range = q.ranges[ 1 ];
+	l.iShadow_Dist = q.ranges[ 2 ];
+	l.iShadow_Range = q.ranges[ 3 ];
+
+	l.flStyle_Amount = q.style[ 0 ] / g_flStyleScale[ 0 ];
+	l.flStyle_Speed = q.style[ 1 ] / g_flStyleScale[ 1 ];
+	l.flStyle_Smooth = q.style[ 2 ] / g_flStyleScale[ 2 ];
+	l.flStyle_Random = q.style[ 3 ] / g_flStyleScale[ 3 ];
+	l.iStyleSeed = q.seed;
+
+	l.iLighttype = q.type;
+	l.iFlags = q.flags;
+	l.iCookieIndex = q.cookie;
+}
+
+int CDeferredLightCodec::GetChangeMask( const quantized_t &a, const quantized_t &b )
+{
+	int iMask = 0;
+
+	if ( Q_memcmp( a.pos, b.pos, sizeof( a.pos ) ) )
+		iMask |= ( 1 << DEFLIGHTCODEC_ORIGIN );
+
+	if ( Q_memcmp( a.ang, b.ang, sizeof( a.ang ) ) )
+		iMask |= ( 1 << DEFLIGHTCODEC_ANGLES );
+
+	if ( Q_memcmp( a.diffuse, b.diffuse, sizeof( a.diffuse ) ) || a.flDiffuseScale != b.flDiffuseScale )
+		iMask |= ( 1 << DEFLIGHTCODEC_DIFFUSE );
+
+	if ( Q_memcmp( a.ambient, b.ambient, sizeof( a.ambient ) ) || a.flAmbientScale != b.flAmbientScale )
+		iMask |= ( 1 << DEFLIGHTCODEC_AMBIENT );
+
+	if ( a.radius != b.radius || a.power != b.power || Q_memcmp( a.cone, b.cone, sizeof( a.cone ) ) )
+		iMask |= ( 1 << DEFLIGHTCODEC_SHAPE );
+
+	if ( Q_memcmp( a.ranges, b.ranges, sizeof( a.ranges ) ) )
+		iMask |= ( 1 << DEFLIGHTCODEC_RANGES );
+
+	if ( Q_memcmp( a.style, b.style, sizeof( a.style ) ) || a.seed != b.seed )
+		iMask |= ( 1 << DEFLIGHTCODEC_STYLE );
+
+	if ( a.type != b.type || a.flags != b.flags || a.cookie != b.cookie )
+		iMask |= ( 1 << DEFLIGHTCODEC_CONFIG );
+
+	return iMask;
+}
+
+void CDeferredLightCodec::WriteGroup( int iGroup, const quantized_t &q, bf_write &buf )
+{
+	switch ( iGroup )
+	{
+	case DEFLIGHTCODEC_ORIGIN:
+		for ( int i = 0; i < 3; i++ )
+			buf.WriteUBitLong( q.pos[ i ], LIGHTCODEC_POS_BITS );
+		break;
+	case DEFLIGHTCODEC_ANGLES:
+		for ( int i = 0; i < 3; i++ )
+			buf.WriteUBitLong( q.ang[ i ], LIGHTCODEC_ANGLE_BITS );
+		break;
+	case DEFLIGHTCODEC_DIFFUSE:
+		for ( int i = 0; i < 3; i++ )
+			buf.WriteUBitLong( q.diffuse[ i ], LIGHTCODEC_COLOR_BITS );
+		buf.WriteFloat( q.flDiffuseScale );
+		break;
+	case DEFLIGHTCODEC_AMBIENT:
+		for ( int i = 0; i < 3; i++ )
+			buf.WriteUBitLong( q.ambient[ i ], LIGHTCODEC_COLOR_BITS );
+		buf.WriteFloat( q.flAmbientScale );
+		break;
+	case DEFLIGHTCODEC_SHAPE:
+		buf.WriteUBitLong( q.radius, LIGHTCODEC_RADIUS_BITS );
+		buf.WriteUBitLong( q.power, LIGHTCODEC_POWER_BITS );
+		buf.WriteUBitLong( q.cone[ 0 ], LIGHTCODEC_CONE_BITS );
+		buf.WriteUBitLong( q.cone[ 1 ], LIGHTCODEC_CONE_BITS );
+		break;
+	case DEFLIGHTCODEC_RANGES:
+		for ( int i = 0; i < 4; i++ )
+			buf.WriteUBitLong( q.ranges[ i ], LIGHTCODEC_RANGE_BITS );
+		break;
+	case DEFLIGHTCODEC_STYLE:
+		for ( int i = 0; i < 4; i++ )
+			buf.WriteUBitLong( q.style[ i ], g_iStyleBits[ i ] );
+		buf.WriteUBitLong( q.seed, DEFLIGHT_SEED_MAX_BITS );
+		break;
+	case DEFLIGHTCODEC_CONFIG:
+		buf.WriteUBitLong( q.type, MAX_DEFLIGHTTYPE_BITS );
+		buf.WriteUBitLong( q.flags, DEFLIGHT_FLAGS_MAX_SHARED_BITS );
+		buf.WriteUBitLong( q.cookie, MAX_COOKIE_TEXTURES_BITS );
+		break;
+	default:
+		Assert( 0 );
+	}
+}
+
+void CDeferredLightCodec::ReadGroup( int iGroup, quantized_t &q, bf_read &buf )
+{
+	switch ( iGroup )
+	{
+	case DEFLIGHTCODEC_ORIGIN:
+		for ( int i = 0; i < 3; i++ )
+			q.pos[ i ] = buf.ReadUBitLong( LIGHTCODEC_POS_BITS );
+		break;
+	case DEFLIGHTCODEC_ANGLES:
+		for ( int i = 0; i < 3; i++ )
+			q.ang[ i ] = buf.ReadUBitLong( LIGHTCODEC_ANGLE_BITS );
+		break;
+	case DEFLIGHTCODEC_DIFFUSE:
+		for ( int i = 0; i < 3; i++ )
+			q.diffuse[ i ] = buf.ReadUBitLong( LIGHTCODEC_COLOR_BITS );
+		q.flDiffuseScale = buf.ReadFloat();
+		break;
+	case DEFLIGHTCODEC_AMBIENT:
+		for ( int i = 0; i < 3; i++ )
+			q.ambient[ i ] = buf.ReadUBitLong( LIGHTCODEC_COLOR_BITS );
+		q.flAmbientScale = buf.ReadFloat();
+		break;
+	case DEFLIGHTCODEC_SHAPE:
+		q.radius = buf.ReadUBitLong( LIGHTCODEC_RADIUS_BITS );
+		q.power = buf.ReadUBitLong( LIGHTCODEC_POWER_BITS );
+		q.cone[ 0 ] = buf.ReadUBitLong( LIGHTCODEC_CONE_BITS );
+		q.cone[ 1 ] = buf.ReadUBitLong( LIGHTCODEC_CONE_BITS );
+		break;
+	case DEFLIGHTCODEC_RANGES:
+		for ( int i = 0; i < 4; i++ )
+			q.ranges[ i ] = buf.ReadUBitLong( LIGHTCODEC_RANGE_BITS );
+		break;
+	case DEFLIGHTCODEC_STYLE:
+		for ( int i = 0; i < 4; i++ )
+			q.style[ i ] = buf.ReadUBitLong( g_iStyleBits[ i ] );
+		q.seed = buf.ReadUBitLong( DEFLIGHT_SEED_MAX_BITS );
+		break;
+	case DEFLIGHTCODEC_CONFIG:
+		q.type = buf.ReadUBitLong( MAX_DEFLIGHTTYPE_BITS );
+		q.flags = buf.ReadUBitLong( DEFLIGHT_FLAGS_MAX_SHARED_BITS );
+		q.cookie = buf.ReadUBitLong( MAX_COOKIE_TEXTURES_BITS );
+		break;
+	default:
+		Assert( 0 );
+	}
+}
+
+bool CDeferredLightCodec::EncodeChunk( const defLightNetData_t *pLights, int iNumLights, bf_write &buf )
+{
+	Assert( iNumLights >= 0 && iNumLights <= DEFLIGHTCONTAINER_CHUNK_LIGHTS );
+
+	buf.WriteUBitLong( iNumLights, DEFLIGHTCONTAINER_CHUNK_BITS + 1 );
+
+	defLightNetData_t base;
+	base.Init();
+
+	quantized_t prev, cur;
+	Quantize( base, prev );
+
+	for ( int i = 0; i < iNumLights; i++ )
+	{
+		Quantize( pLights[ i ], cur );
+
+		const int iMask = GetChangeMask( cur, prev );
+		buf.WriteUBitLong( iMask, DEFLIGHTCODEC_GROUP_COUNT );
+
+		for ( int iGroup = 0; iGroup < DEFLIGHTCODEC_GROUP_COUNT; iGroup++ )
+		{
+			if ( iMask & ( 1 << iGroup ) )
+				WriteGroup( iGroup, cur, buf );
+		}
+
+		prev = cur;
+	}
+
+	return !buf.IsOverflowed();
+}
+
+int CDeferredLightCodec::DecodeChunk( bf_read &buf, defLightNetData_t *pLightsOut, int iMaxLights )
+{
+	const int iNumLights = buf.ReadUBitLong( DEFLIGHTCONTAINER_CHUNK_BITS + 1 );
+
+	if ( iNumLights > iMaxLights || iNumLights > DEFLIGHTCONTAINER_CHUNK_LIGHTS )
+		return -1;
+
+	defLightNetData_t base;
+	base.Init();
+
+	quantized_t q;
+	Quantize( base, q );
+
+	for ( int i = 0; i < iNumLights; i++ )
+	{
+		const int iMask = buf.ReadUBitLong( DEFLIGHTCODEC_GROUP_COUNT );
+
+		for ( int iGroup = 0; iGroup < DEFLIGHTCODEC_GROUP_COUNT; iGroup++ )
+		{
+			if ( iMask & ( 1 << iGroup ) )
+				ReadGroup( iGroup, q, buf );
+		}
+
+		Dequantize( q, pLightsOut[ i ] );
+	}
+
+	return buf.IsOverflowed() ? -1 : iNumLights;
+}
+
+void CDeferredLightCodec::GetChunkName( int iChunk, char *pszOut, int iMaxLen )
+{
+	Q_snprintf( pszOut, iMaxLen, "%i", iChunk );
+}
+
+#ifdef CLIENT_DLL
+// the old container arrays per light: eight float vectors, the packed int and
+// a prop index per array element
+#define LIGHTCODEC_LEGACY_LIGHT_BITS ( 8 * 96 + 28 + 9 * 7 )
+// light count plus its prop index
+#define LIGHTCODEC_LEGACY_CONTAINER_BITS ( 7 + 7 )
+#define LIGHTCODEC_LEGACY_CONTAINER_LIGHTS 113
+
+static void MakeTestLight( CUniformRandomStream &rnd, defLightNetData_t &l )
+{
+	static const Vector colors[ 4 ] = { Vector( 1, 0.9f, 0.7f ), Vector( 0.6f, 0.8f, 1 ),
+		Vector( 1, 0.3f, 0.1f ), Vector( 1, 1, 1 ) };
+	static const float radii[ 5 ] = { 128, 192, 256, 384, 512 };
+
+	l.Init();
+
+	l.pos.Init( rnd.RandomFloat( -8000, 8000 ), rnd.RandomFloat( -8000, 8000 ), rnd.RandomFloat( -1000, 1000 ) );
+	l.col_diffuse = colors[ rnd.RandomInt( 0, 3 ) ] * ( rnd.RandomInt( 1, 4 ) * 0.5f );
+	l.flRadius = radii[ rnd.RandomInt( 0, 4 ) ];
+
+	if ( rnd.RandomInt( 0, 9 ) < 3 )
+	{
+		l.iLighttype = DEFLIGHTTYPE_SPOT;
+		l.ang.Init( rnd.RandomFloat( -89, 89 ), rnd.RandomFloat( -180, 180 ), 0 );
+		l.flSpotCone_Inner = rnd.RandomInt( 10, 60 );
+		l.flSpotCone_Outer = l.flSpotCone_Inner + rnd.RandomInt( 5, 20 );
+	}
+
+	if ( rnd.RandomInt( 0, 9 ) == 0 )
+		l.col_ambient = l.col_diffuse * rnd.RandomFloat( 0, 0.2f );
+
+	if ( rnd.RandomInt( 0, 4 ) == 0 )
+	{
+		l.iVisible_Dist = rnd.RandomInt( 512, 4096 );
+		l.iShadow_Dist = rnd.RandomInt( 256, l.iVisible_Dist );
+	}
+
+	if ( rnd.RandomInt( 0, 4 ) == 0 )
+		l.iFlags |= DEFLIGHT_SHADOW_ENABLED;
+
+	if ( rnd.RandomInt( 0, 19 ) == 0 )
+	{
+		l.iFlags |= DEFLIGHT_COOKIE_ENABLED;
+		l.iCookieIndex = rnd.RandomInt( 1, MAX_COOKIE_TEXTURES - 1 );
+	}
+
+	if ( rnd.RandomInt( 0, 9 ) == 0 )
+	{
+		l.iFlags |= DEFLIGHT_LIGHTSTYLE_ENABLED;
+		l.flStyle_Amount = rnd.RandomFloat( 0, 1 );
+		l.flStyle_Speed = rnd.RandomFloat( 0, 20 );
+		l.flStyle_Smooth = rnd.RandomFloat( 0, 1 );
+		l.flStyle_Random = rnd.RandomFloat( 0, 1 );
+		l.iStyleSeed = rnd.RandomInt( 0, DEFLIGHT_SEED_MAX );
+	}
+}
+
+static bool IsColorWithinQuantization( const Vector &a, const Vector &b )
+{
+	const float flTolerance = MAX( a.x, MAX( a.y, a.z ) ) * 0.5f / LIGHTCODEC_COLOR_SCALE + 0.0001f;
+
+	for ( int i = 0; i < 3; i++ )
+	{
+		if ( fabs( a[ i ] - b[ i ] ) > flTolerance )
+			return false;
+	}
+
+	return true;
+}
+
+static bool IsWithinQuantization( const defLightNetData_t &a, const defLightNetData_t &b )
+{
+	for ( int i = 0; i < 3; i++ )
+	{
+		if ( fabs( a.pos[ i ] - b.pos[ i ] ) > 0.5f / LIGHTCODEC_POS_SCALE + 0.001f ||
+			fabs( AngleDiff( a.ang[ i ], b.ang[ i ] ) ) > 180.0f / ( 1 << LIGHTCODEC_ANGLE_BITS ) + 0.001f )
+			return false;
+	}
+
+	if ( !IsColorWithinQuantization( a.col_diffuse, b.col_diffuse ) ||
+		!IsColorWithinQuantization( a.col_ambient, b.col_ambient ) )
+		return false;
+
+	if ( fabs( a.flRadius - b.flRadius ) > 0.5f / LIGHTCODEC_RADIUS_SCALE + 0.001f ||
+		fabs( a.flFalloffPower - b.flFalloffPower ) > 0.5f / LIGHTCODEC_POWER_SCALE + 0.001f ||
+		fabs( a.flSpotCone_Inner - b.flSpotCone_Inner ) > 0.5f / LIGHTCODEC_CONE_SCALE + 0.001f ||
+		fabs( a.flSpotCone_Outer - b.flSpotCone_Outer ) > 0.5f / LIGHTCODEC_CONE_SCALE + 0.001f )
+		return false;
+
+	const float flStyleA[ 4 ] = { a.flStyle_Amount, a.flStyle_Speed, a.flStyle_Smooth, a.flStyle_Random };
+	const float flStyleB[ 4 ] = { b.flStyle_Amount, b.flStyle_Speed, b.flStyle_Smooth, b.flStyle_Random };
+
+	for ( int i = 0; i < 4; i++ )
+	{
+		if ( fabs( flStyleA[ i ] - flStyleB[ i ] ) > 0.5f / g_flStyleScale[ i ] + 0.001f )
+			return false;
+	}
+
+	return a.iVisible_Dist == b.iVisible_Dist && a.iVisible_Range == b.iVisible_Range &&
+		a.iShadow_Dist == b.iShadow_Dist && a.iShadow_Range == b.iShadow_Range &&
+		a.iStyleSeed == b.iStyleSeed && a.iLighttype == b.iLighttype &&
+		a.iFlags == b.iFlags && a.iCookieIndex == b.iCookieIndex;
+}
+
+CON_COMMAND( deferred_light_codec_bench, "Compares the bytes replicated for synthetic world lights by the light codec and by the old container arrays. Args: [lights]" )
+{
+	const int iNumLights = ( args.ArgC() > 1 ) ? clamp( atoi( args[ 1 ] ), 1, DEFLIGHTCONTAINER_MAXLIGHTS ) : 1000;
+
+	int iNumMismatched = 0;
+
+	CUniformRandomStream rnd;
+	rnd.SetSeed( 1 );
+
+	CUtlVector< defLightNetData_t > lights;
+	lights.SetCount( iNumLights );
+
+	for ( int i = 0; i < iNumLights; i++ )
+		MakeTestLight( rnd, lights[ i ] );
+
+	unsigned char data[ DEFLIGHTCONTAINER_CHUNK_MAX_BYTES ];
+	defLightNetData_t decoded[ DEFLIGHTCONTAINER_CHUNK_LIGHTS ];
+
+	int iBytes = 0;
+	int iMaxChunkBytes = 0;
+	int iNumChunks = 0;
+
+	for ( int iFirst = 0; iFirst < iNumLights; iFirst += DEFLIGHTCONTAINER_CHUNK_LIGHTS, iNumChunks++ )
+	{
+		const int iChunkLights = MIN( DEFLIGHTCONTAINER_CHUNK_LIGHTS, iNumLights - iFirst );
+
+		bf_write write( data, sizeof( data ) );
+		if ( !CDeferredLightCodec::EncodeChunk( lights.Base() + iFirst, iChunkLights, write ) )
+		{
+			Warning( "chunk %i doesn't fit %i bytes\n", iNumChunks, DEFLIGHTCONTAINER_CHUNK_MAX_BYTES );
+			continue;
+		}
+
+		// the table entry also sends its name and the userdata length
+		char szName[ 16 ];
+		CDeferredLightCodec::GetChunkName( iNumChunks, szName, sizeof( szName ) );
+
+		iBytes += write.GetNumBytesWritten() + Q_strlen( szName ) + 1 + 2;
+		iMaxChunkBytes = MAX( iMaxChunkBytes, write.GetNumBytesWritten() );
+
+		bf_read read( data, write.GetNumBytesWritten() );
+		if ( CDeferredLightCodec::DecodeChunk( read, decoded, DEFLIGHTCONTAINER_CHUNK_LIGHTS ) != iChunkLights )
+		{
+			Warning( "chunk %i doesn't decode\n", iNumChunks );
+			continue;
+		}
+
+		for ( int i = 0; i < iChunkLights; i++ )
+		{
+			if ( !IsWithinQuantization( lights[ iFirst + i ], decoded[ i ] ) )
+				iNumMismatched++;
+		}
+	}
+
+	// repeated lights only send their change mask
+	bf_write single( data, sizeof( data ) );
+	CDeferredLightCodec::EncodeChunk( lights.Base(), 1, single );
+
+	defLightNetData_t repeated[ DEFLIGHTCONTAINER_CHUNK_LIGHTS ];
+	for ( int i = 0; i < DEFLIGHTCONTAINER_CHUNK_LIGHTS; i++ )
+		repeated[ i ] = lights[ 0 ];
+
+	bf_write repeat( data, sizeof( data ) );
+	CDeferredLightCodec::EncodeChunk( repeated, DEFLIGHTCONTAINER_CHUNK_LIGHTS, repeat );
+
+	if ( repeat.GetNumBitsWritten() != single.GetNumBitsWritten() + ( DEFLIGHTCONTAINER_CHUNK_LIGHTS - 1 ) * DEFLIGHTCODEC_GROUP_COUNT )
+		Warning( "repeated lights send more than their change mask\n" );
+
+	// chunks that don't fit the output are rejected
+	bf_write write( data, sizeof( data ) );
+	CDeferredLightCodec::EncodeChunk( repeated, 2, write );
+
+	bf_read read( data, write.GetNumBytesWritten() );
+	if ( CDeferredLightCodec::DecodeChunk( read, decoded, 1 ) != -1 )
+		Warning( "a chunk larger than the output was decoded\n" );
+
+	const int iNumContainers = ( iNumLights + LIGHTCODEC_LEGACY_CONTAINER_LIGHTS - 1 ) / LIGHTCODEC_LEGACY_CONTAINER_LIGHTS;
+	const int iLegacyBytes = ( iNumLights * LIGHTCODEC_LEGACY_LIGHT_BITS + iNumContainers * LIGHTCODEC_LEGACY_CONTAINER_BITS + 7 ) / 8;
+
+	Msg( "%i lights: %i bytes in %i containers before, %i bytes in %i chunks now\n",
+		iNumLights, iLegacyBytes, iNumContainers, iBytes, iNumChunks );
+	Msg( "one changed light: %i bytes before, up to %i bytes now\n",
+		( LIGHTCODEC_LEGACY_LIGHT_BITS + 7 ) / 8, iMaxChunkBytes );
+
+	if ( iNumMismatched > 0 )
+		Warning( "%i lights changed beyond quantization\n", iNumMismatched );
+}
+#endif
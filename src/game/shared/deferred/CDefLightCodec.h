@@ -0,0 +1,108 @@
+#ifndef CDEF_LIGHT_CODEC_H
+#define CDEF_LIGHT_CODEC_H
+
+#include "cbase.h"
+
+#include "tier1/bitbuf.h"
+
+// groups of the change mask
+enum
+{
+	DEFLIGHTCODEC_ORIGIN = 0,
+	DEFLIGHTCODEC_ANGLES,
+	DEFLIGHTCODEC_DIFFUSE,
+	DEFLIGHTCODEC_AMBIENT,
+	DEFLIGHTCODEC_SHAPE,
+	DEFLIGHTCODEC_RANGES,
+	DEFLIGHTCODEC_STYLE,
+	DEFLIGHTCODEC_CONFIG,
+
+	DEFLIGHTCODEC_GROUP_COUNT,
+};
+
+// world light as it's replicated, cones are in degrees
+struct defLightNetData_t
+{
+	// same defaults as def_light_t
+	void Init();
+
+	Vector pos;
+	QAngle ang;
+
+	Vector col_diffuse;
+	Vector col_ambient;
+
+	float flRadius;
+	float flFalloffPower;
+	float flSpotCone_Inner;
+	float flSpotCone_Outer;
+
+	int iVisible_Dist;
+	int iVisible_Range;
+	int iShadow_Dist;
+	int iShadow_Range;
+
+	float flStyle_Amount;
+	float flStyle_Speed;
+	float flStyle_Smooth;
+	float flStyle_Random;
+	int iStyleSeed;
+
+	int iLighttype;
+	int iFlags;
+	int iCookieIndex;
+};
+
+/*
+ * Encodes chunks of world lights for the world light string table. Values
+ * are quantized, positions to an eighth of a unit and colors to 8 bits per
+ * channel times a scale, and every light starts with a change mask against
+ * the previous light of its chunk so runs of similar lights only send what
+ * differs.
+ */
+class CDeferredLightCodec
+{
+public:
+
+	// false if the buffer overflowed
+	static bool EncodeChunk( const defLightNetData_t *pLights, int iNumLights, bf_write &buf );
+	// returns the number of lights read, -1 if the chunk is malformed
+	static int DecodeChunk( bf_read &buf, defLightNetData_t *pLightsOut, int iMaxLights );
+
+	static void GetChunkName( int iChunk, char *pszOut, int iMaxLen );
+
+private:
+
+	struct quantized_t
+	{
+		uint pos[ 3 ];
+		uint ang[ 3 ];
+		uint diffuse[ 3 ];
+		float flDiffuseScale;
+		uint ambient[ 3 ];
+		float flAmbientScale;
+
+		uint radius;
+		uint power;
+		uint cone[ 2 ];
+
+		uint ranges[ 4 ];
+
+		uint style[ 4 ];
+		uint seed;
+
+		uint type;
+		uint flags;
+		uint cookie;
+	};
+
+	static void Quantize( const defLightNetData_t &l, quantized_t &q );
+	static void Dequantize( const quantized_t &q, defLightNetData_t &l );
+
+	static int GetChangeMask( const quantized_t &a, const quantized_t &b );
+
+	static void WriteGroup( int iGroup, const quantized_t &q, bf_write &buf );
+	static void ReadGroup( int iGroup, quantized_t &q, bf_read &buf );
+};
+
+#endif
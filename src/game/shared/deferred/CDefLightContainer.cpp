@@ -27,36 +27,8 @@ IMPLEMENT_NETWORKCLASS_DT( CDeferredLightContainer, CDeferredLightContainer_DT )
 
 #ifdef GAME_DLL
 	SendPropInt( SENDINFO( m_iLightCount ), DEFLIGHTCONTAINER_MAXLIGHT_BITS, SPROP_UNSIGNED ),
-
-	SendPropArray3( SENDINFO_ARRAY3( m_pos ), SendPropVector( SENDINFO_ARRAY( m_pos ) ) ),
-	SendPropArray3( SENDINFO_ARRAY3( m_ang ), SendPropQAngles( SENDINFO_ARRAY( m_ang ) ) ),
-
-	SendPropArray3( SENDINFO_ARRAY3( m_col_diff ), SendPropVector( SENDINFO_ARRAY( m_col_diff ) ) ),
-	SendPropArray3( SENDINFO_ARRAY3( m_col_amb ), SendPropVector( SENDINFO_ARRAY( m_col_amb ) ) ),
-
-	SendPropArray3( SENDINFO_ARRAY3( m_style_amt_speed_smooth ), SendPropVector( SENDINFO_ARRAY( m_style_amt_speed_smooth ) ) ),
-	SendPropArray3( SENDINFO_ARRAY3( m_ranges_vdist_vrange_sdist ), SendPropVector( SENDINFO_ARRAY( m_ranges_vdist_vrange_sdist ) ) ),
-	SendPropArray3( SENDINFO_ARRAY3( m_style_ran_radius_power ), SendPropVector( SENDINFO_ARRAY( m_style_ran_radius_power ) ) ),
-	SendPropArray3( SENDINFO_ARRAY3( m_ranges_srange_cinner_couter ), SendPropVector( SENDINFO_ARRAY( m_ranges_srange_cinner_couter ) ) ),
-
-	SendPropArray3( SENDINFO_ARRAY3( m_type_flags_cookieindex_seed ),
-	SendPropInt( SENDINFO_ARRAY( m_type_flags_cookieindex_seed ),
-		(DEFLIGHT_SEED_MAX_BITS + MAX_COOKIE_TEXTURES_BITS + DEFLIGHT_FLAGS_MAX_SHARED_BITS + MAX_DEFLIGHTTYPE_BITS), SPROP_UNSIGNED ) ),
 #else
 	RecvPropInt( RECVINFO( m_iLightCount ) ),
-
-	RecvPropArray3( RECVINFO_ARRAY( m_pos ), RecvPropVector( RECVINFO( m_pos[0] ))),
-	RecvPropArray3( RECVINFO_ARRAY( m_ang ), RecvPropQAngles( RECVINFO( m_ang[0] ))),
-
-	RecvPropArray3( RECVINFO_ARRAY( m_col_diff ), RecvPropVector( RECVINFO( m_col_diff[0] ))),
-	RecvPropArray3( RECVINFO_ARRAY( m_col_amb ), RecvPropVector( RECVINFO( m_col_amb[0] ))),
-
-	RecvPropArray3( RECVINFO_ARRAY( m_style_amt_speed_smooth ), RecvPropVector( RECVINFO( m_style_amt_speed_smooth[0] ))),
-	RecvPropArray3( RECVINFO_ARRAY( m_ranges_vdist_vrange_sdist ), RecvPropVector( RECVINFO( m_ranges_vdist_vrange_sdist[0] ))),
-	RecvPropArray3( RECVINFO_ARRAY( m_style_ran_radius_power ), RecvPropVector( RECVINFO( m_style_ran_radius_power[0] ))),
-	RecvPropArray3( RECVINFO_ARRAY( m_ranges_srange_cinner_couter ), RecvPropVector( RECVINFO( m_ranges_srange_cinner_couter[0] ))),
-
-	RecvPropArray3( RECVINFO_ARRAY( m_type_flags_cookieindex_seed ), RecvPropInt( RECVINFO( m_type_flags_cookieindex_seed[0] ))),
 #endif
 
 END_NETWORK_TABLE();
@@ -69,6 +41,7 @@ CDeferredLightContainer::CDeferredLightContainer()
 #ifdef CLIENT_DLL
 	m_iSanityCounter = 0;
 	m_hLights.SetGrowSize( 10 );
+	Q_memset( m_iChunkCRCs, 0, sizeof( m_iChunkCRCs ) );
 #endif
 }
 
@@ -104,53 +77,70 @@ void CDeferredLightContainer::AddWorldLight( CDeferredLight *l )
 
 	Assert( targetIndex < DEFLIGHTCONTAINER_MAXLIGHTS );
 
-	float spotConeInnerDot = SPOT_DEGREE_TO_RAD( l->GetSpotCone_Inner());
-	float spotConeOuterDot = SPOT_DEGREE_TO_RAD(l->GetSpotCone_Outer());
-
 	int styleSeed = l->GetStyle_Seed();
 
 	if ( styleSeed < 0 )
 		styleSeed = RandomInt( 0, DEFLIGHT_SEED_MAX );
 
-	m_pos.Set( targetIndex, l->GetAbsOrigin() );
-	m_ang.Set( targetIndex, l->GetAbsAngles() );
+	defLightNetData_t &data = m_Lights[ m_Lights.AddToTail() ];
 
-	m_col_diff.Set( targetIndex, l->GetColor_Diffuse() );
-	m_col_amb.Set( targetIndex, l->GetColor_Ambient() );
+	data.pos = l->GetAbsOrigin();
+	data.ang = l->GetAbsAngles();
 
-	m_style_amt_speed_smooth.Set( targetIndex,
-		Vector( l->GetStyle_Amount(), l->GetStyle_Speed(), l->GetStyle_Smooth() ) );
-	m_ranges_vdist_vrange_sdist.Set( targetIndex,
-		Vector( l->GetVisible_Distance(), l->GetVisible_FadeRange(), l->GetShadow_Distance() ) );
-	m_style_ran_radius_power.Set( targetIndex,
-		Vector( l->GetStyle_Random(), l->GetRadius(), l->GetFalloffPower() ) );
-	m_ranges_srange_cinner_couter.Set( targetIndex,
-		Vector( l->GetShadow_FadeRange(), spotConeInnerDot, spotConeOuterDot ) );
+	data.col_diffuse = l->GetColor_Diffuse();
+	data.col_ambient = l->GetColor_Ambient();
 
-	SetEncodedDataInt( targetIndex,
-		styleSeed, l->GetCookieIndex(),
-		l->GetLight_Flags(), l->GetLight_Type() );
+	data.flRadius = l->GetRadius();
+	data.flFalloffPower = l->GetFalloffPower();
+	data.flSpotCone_Inner = l->GetSpotCone_Inner();
+	data.flSpotCone_Outer = l->GetSpotCone_Outer();
+
+	data.iVisible_Dist = l->GetVisible_Distance();
+	data.iVisible_Range = l->GetVisible_FadeRange();
+	data.iShadow_Dist = l->GetShadow_Distance();
+	data.iShadow_Range = l->GetShadow_FadeRange();
+
+	data.flStyle_Amount = l->GetStyle_Amount();
+	data.flStyle_Speed = l->GetStyle_Speed();
+	data.flStyle_Smooth = l->GetStyle_Smooth();
+	data.flStyle_Random = l->GetStyle_Random();
+	data.iStyleSeed = styleSeed;
+
+	data.iLighttype = l->GetLight_Type();
+	data.iFlags = l->GetLight_Flags();
+	data.iCookieIndex = l->GetCookieIndex();
 
 	m_iLightCount = targetIndex + 1;
+
+	WriteChunk( targetIndex / DEFLIGHTCONTAINER_CHUNK_LIGHTS );
 }
 
-void CDeferredLightContainer::SetEncodedDataInt( const int index,
-		int seed, int cookie, int flags, int lighttype )
+void CDeferredLightContainer::WriteChunk( int iChunk )
 {
-	Assert( index >= 0 && index < DEFLIGHTCONTAINER_MAXLIGHTS );
+	Assert( g_pStringTable_WorldLights != NULL );
+	Assert( iChunk >= 0 && iChunk < DEFLIGHTCONTAINER_MAXCHUNKS );
 
-	int val = seed;
-	val <<= MAX_COOKIE_TEXTURES_BITS;
+	const int iFirst = iChunk * DEFLIGHTCONTAINER_CHUNK_LIGHTS;
+	const int iNumLights = MIN( DEFLIGHTCONTAINER_CHUNK_LIGHTS, m_Lights.Count() - iFirst );
 
-	val |= cookie;
-	val <<= DEFLIGHT_FLAGS_MAX_SHARED_BITS;
+	unsigned char data[ DEFLIGHTCONTAINER_CHUNK_MAX_BYTES ];
+	bf_write buf( data, sizeof( data ) );
 
-	val |= flags;
-	val <<= MAX_DEFLIGHTTYPE_BITS;
+	if ( !CDeferredLightCodec::EncodeChunk( m_Lights.Base() + iFirst, iNumLights, buf ) )
+	{
+		Warning( "World light chunk %i overflowed.\n", iChunk );
+		return;
+	}
 
-	val |= lighttype;
+	char szName[ 16 ];
+	CDeferredLightCodec::GetChunkName( iChunk, szName, sizeof( szName ) );
 
-	m_type_flags_cookieindex_seed.Set( index, val );
+	const int iString = g_pStringTable_WorldLights->FindStringIndex( szName );
+
+	if ( iString == INVALID_STRING_INDEX )
+		g_pStringTable_WorldLights->AddString( true, szName, buf.GetNumBytesWritten(), data );
+	else
+		g_pStringTable_WorldLights->SetStringUserData( iString, buf.GetNumBytesWritten(), data );
 }
 
 #else
@@ -163,19 +153,9 @@ void CDeferredLightContainer::PostDataUpdate( DataUpdateType_t type )
 	{
 		Assert( m_iSanityCounter == 0 );
 		m_iSanityCounter++;
-
-		for ( int i = 0; i < GetLightsAmount(); i++ )
-		{
-			def_light_t *l = new def_light_t( true );
-			m_hLights.AddToTail( l );
-
-			ReadWorldLight( i, *l );
-
-			l->MakeDirtyAll();
-
-			GetLightingManager()->AddLight( l );
-		}
 	}
+
+	ReadWorldLights();
 }
 
 void CDeferredLightContainer::UpdateOnRemove()
@@ -186,67 +166,127 @@ void CDeferredLightContainer::UpdateOnRemove()
 	m_iSanityCounter--;
 
 	for ( int i = 0; i < m_hLights.Count(); i++ )
-		GetLightingManager()->RemoveLight( m_hLights[i] );
+	{
+		if ( m_hLights[i] != NULL )
+			GetLightingManager()->RemoveLight( m_hLights[i] );
+	}
 
 	m_hLights.PurgeAndDeleteElements();
 }
 
-void CDeferredLightContainer::ReadWorldLight( int index, def_light_t &l )
+void CDeferredLightContainer::ReadWorldLights()
 {
-	Assert( index >= 0 && index < GetLightsAmount() );
-	Vector tmp;
-
-	l.pos = m_pos.Get( index );
-	l.ang = m_ang.Get( index );
-
-	l.col_diffuse = m_col_diff.Get( index );
-	l.col_ambient = m_col_amb.Get( index );
-
-	tmp = m_style_amt_speed_smooth.Get( index );
-	l.flStyle_Amount = tmp.x;
-	l.flStyle_Speed = tmp.y;
-	l.flStyle_Smooth = tmp.z;
-
-	tmp = m_ranges_vdist_vrange_sdist.Get( index );
-	l.iVisible_Dist = tmp.x;
-	l.iVisible_Range = tmp.y;
-	l.iShadow_Dist = tmp.z;
-
-	tmp = m_style_ran_radius_power.Get( index );
-	l.flStyle_Random = tmp.x;
-	l.flRadius = tmp.y;
-	l.flFalloffPower = tmp.z;
-	
-	tmp = m_ranges_srange_cinner_couter.Get( index );
-	l.iShadow_Range = tmp.x;
-	l.flSpotCone_Inner = tmp.y;
-	l.flSpotCone_Outer = tmp.z;
-
-	ReadEncodedDataInt( index, l.iStyleSeed, l.iCookieIndex, l.iFlags, l.iLighttype );
-}
+	const int iNumLights = GetLightsAmount();
+	const int iOldNumLights = m_hLights.Count();
 
-#endif
+	for ( int i = iNumLights; i < iOldNumLights; i++ )
+	{
+		if ( m_hLights[i] == NULL )
+			continue;
 
-int CDeferredLightContainer::GetLightsAmount()
-{
-	return m_iLightCount;
-}
+		GetLightingManager()->RemoveLight( m_hLights[i] );
+		delete m_hLights[i];
+	}
 
-void CDeferredLightContainer::ReadEncodedDataInt( const int index,
-		ushort &seed, uint8 &cookie, uint8 &flags, uint8 &lighttype )
-{
-	Assert( index >= 0 && index < GetLightsAmount() );
+	m_hLights.SetCountNonDestructively( iNumLights );
+
+	for ( int i = iOldNumLights; i < iNumLights; i++ )
+		m_hLights[i] = NULL;
+
+	// the count and the table arrive separately, lights past either wait for the other
+	if ( g_pStringTable_WorldLights == NULL )
+		return;
+
+	defLightNetData_t data[ DEFLIGHTCONTAINER_CHUNK_LIGHTS ];
+
+	for ( int iString = 0; iString < g_pStringTable_WorldLights->GetNumStrings(); iString++ )
+	{
+		const int iChunk = atoi( g_pStringTable_WorldLights->GetString( iString ) );
+		const int iFirst = iChunk * DEFLIGHTCONTAINER_CHUNK_LIGHTS;
+
+		if ( iChunk < 0 || iChunk >= DEFLIGHTCONTAINER_MAXCHUNKS || iFirst >= iNumLights )
+			continue;
+
+		int iLength = 0;
+		const void *pData = g_pStringTable_WorldLights->GetStringUserData( iString, &iLength );
+
+		if ( pData == NULL || iLength <= 0 )
+			continue;
+
+		const int iChunkLights = MIN( DEFLIGHTCONTAINER_CHUNK_LIGHTS, iNumLights - iFirst );
+		const CRC32_t iCRC = CRC32_ProcessSingleBuffer( pData, iLength );
+
+		bool bMissingLights = false;
+		for ( int i = 0; i < iChunkLights; i++ )
+			bMissingLights = bMissingLights || m_hLights[ iFirst + i ] == NULL;
+
+		if ( !bMissingLights && m_iChunkCRCs[ iChunk ] == iCRC )
+			continue;
+
+		bf_read buf( pData, iLength );
+		const int iDecoded = CDeferredLightCodec::DecodeChunk( buf, data, DEFLIGHTCONTAINER_CHUNK_LIGHTS );
+
+		if ( iDecoded < 0 )
+		{
+			Warning( "Malformed world light chunk %i.\n", iChunk );
+			continue;
+		}
 
-	int val = m_type_flags_cookieindex_seed.Get( index );
+		m_iChunkCRCs[ iChunk ] = iCRC;
 
-	lighttype = val & NETWORK_MASK_LIGHTTYPE;
-	val >>= MAX_DEFLIGHTTYPE_BITS;
+		for ( int i = 0; i < MIN( iDecoded, iChunkLights ); i++ )
+		{
+			def_light_t *l = m_hLights[ iFirst + i ];
+			const bool bCreated = l == NULL;
 
-	flags = val & NETWORK_MASK_FLAGS;
-	val >>= DEFLIGHT_FLAGS_MAX_SHARED_BITS;
+			if ( bCreated )
+			{
+				l = new def_light_t( true );
+				m_hLights[ iFirst + i ] = l;
+			}
 
-	cookie = val & NETWORK_MASK_COOKIE;
-	val >>= MAX_COOKIE_TEXTURES_BITS;
+			ReadWorldLight( data[ i ], *l );
 
-	seed = val & NETWORK_MASK_SEED;
-}
\ No newline at end of file
+			l->MakeDirtyAll();
+
+			if ( bCreated )
+				GetLightingManager()->AddLight( l );
+		}
+	}
+}
+
+void CDeferredLightContainer::ReadWorldLight( const defLightNetData_t &data, def_light_t &l )
+{
+	l.pos = data.pos;
+	l.ang = data.ang;
+
+	l.col_diffuse = data.col_diffuse;
+	l.col_ambient = data.col_ambient;
+
+	l.flRadius = data.flRadius;
+	l.flFalloffPower = data.flFalloffPower;
+	l.flSpotCone_Inner = SPOT_DEGREE_TO_RAD( data.flSpotCone_Inner );
+	l.flSpotCone_Outer = SPOT_DEGREE_TO_RAD( data.flSpotCone_Outer );
+
+	l.iVisible_Dist = data.iVisible_Dist;
+	l.iVisible_Range = data.iVisible_Range;
+	l.iShadow_Dist = data.iShadow_Dist;
+	l.iShadow_Range = data.iShadow_Range;
+
+	l.flStyle_Amount = data.flStyle_Amount;
+	l.flStyle_Speed = data.flStyle_Speed;
+	l.flStyle_Smooth = data.flStyle_Smooth;
+	l.flStyle_Random = data.flStyle_Random;
+	l.iStyleSeed = data.iStyleSeed;
+
+	l.iLighttype = data.iLighttype;
+	l.iFlags = data.iFlags;
+	l.iCookieIndex = data.iCookieIndex;
+}
+
+#endif
+
+int CDeferredLightContainer::GetLightsAmount()
+{
+	return m_iLightCount;
+}
@@ -4,6 +4,7 @@
 
 
 INetworkStringTable *g_pStringTable_LightCookies = NULL;
+INetworkStringTable *g_pStringTable_WorldLights = NULL;
 
 
 static const char *g_pszLightParamNames[ LPARAM_COUNT ] =
@@ -89,13 +89,14 @@ inline void normalizeAngles( QAngle &ang )
 
 void UTIL_StringToIntArray( int *pVector, int count, const char *pString );
 
-#define DEFLIGHTCONTAINER_MAXLIGHT_BITS 7
-#define DEFLIGHTCONTAINER_MAXLIGHTS 113
-
-#define NETWORK_MASK_LIGHTTYPE	0x0001
-#define NETWORK_MASK_FLAGS		0x001F
-#define NETWORK_MASK_COOKIE		0x007F
-#define NETWORK_MASK_SEED		0xFFFF
+#define WORLDLIGHTS_STRINGTBL_NAME "DeferredWorldLights"
+#define DEFLIGHTCONTAINER_CHUNK_BITS 5
+#define DEFLIGHTCONTAINER_CHUNK_LIGHTS (( 1 << DEFLIGHTCONTAINER_CHUNK_BITS ))
+#define DEFLIGHTCONTAINER_CHUNK_MAX_BYTES 2048
+#define DEFLIGHTCONTAINER_MAXCHUNKS_BITS 8
+#define DEFLIGHTCONTAINER_MAXCHUNKS (( 1 << DEFLIGHTCONTAINER_MAXCHUNKS_BITS ))
+#define DEFLIGHTCONTAINER_MAXLIGHT_BITS ( DEFLIGHTCONTAINER_CHUNK_BITS + DEFLIGHTCONTAINER_MAXCHUNKS_BITS + 1 )
+#define DEFLIGHTCONTAINER_MAXLIGHTS ( DEFLIGHTCONTAINER_CHUNK_LIGHTS * DEFLIGHTCONTAINER_MAXCHUNKS )
 
 #include "../../materialsystem/swarmshaders/deferred_global_common.h"
 
@@ -145,6 +146,7 @@ const char *GetLightParamName( LIGHT_PARAM_ID id );
 #include "networkstringtabledefs.h"
 
 #include "deferred/CDefLight.h"
+#include "deferred/CDefLightCodec.h"
 #include "deferred/CDefLightContainer.h"
 #include "deferred/CDefLightGlobal.h"
 #include "deferred/ssemath_ext.h"
@@ -157,5 +159,6 @@ const char *GetLightParamName( LIGHT_PARAM_ID id );
 
 
 extern INetworkStringTable *g_pStringTable_LightCookies;
+extern INetworkStringTable *g_pStringTable_WorldLights;
 
 #endif
\ No newline at end of file
@@ -99,6 +99,8 @@
 #	define DEFRTNAME_SHADOWCOLOR_PROJ_LOD2 "_rt_ShadowColor_proj_lod2_"	// + %02i	
 #endif
 #define DEFRTNAME_SHADOWCOLOR_DP "_rt_ShadowColor_dp_"			// + %02i
+#define DEFRTNAME_SHADOWCACHE_PROJ "_rt_ShadowCache_proj_"		// + %02i
+#define DEFRTNAME_SHADOWCACHE_DP "_rt_ShadowCache_dp_"			// + %02i
 #define DEFRTNAME_SHADOWRAD_ALBEDO_ORTHO "_rt_ShadowRad_Albedo_ortho_"	// + %02i
 #define DEFRTNAME_SHADOWRAD_NORMAL_ORTHO "_rt_ShadowRad_Normal_ortho_"	// + %02i
 
@@ -202,6 +204,20 @@
 #	define SHADOWMAPPING_USE_COLOR 1
 #endif
 
+/* Keep shadow maps of world lights between frames
+ * Cached maps are copied back, which depth targets don't support
+ */
+#if defined( SHADOWMAPPING_USE_COLOR )
+#	define DEFCFG_SHADOW_CACHE 1
+#else
+#	define DEFCFG_SHADOW_CACHE 0
+#endif
+
+#if DEFCFG_SHADOW_CACHE
+#	define SHADOWCACHE_MAX_PROJ 8
+#	define SHADOWCACHE_MAX_DP 4
+#endif
+
 
 /* Vendor defs for specific hardware filters
  * or goddamn stupid code because some amd cards are damn stupid and broken!!!